@@ -0,0 +1,187 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#define _GNU_SOURCE
+
+#include "align.h"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define ALIGN_EMA  0.3f
+#define ALIGN_HOLD ( 3 * G_USEC_PER_SEC )
+
+#define TONE_RATE  8000
+#define TONE_CHUNK ( TONE_RATE / 50 ) // 20 ms: the pitch follows at the sampling rate
+#define TONE_LOW   300  // Hz at 0 %
+#define TONE_HIGH  1500 // Hz at 100 %
+#define TONE_AHEAD ( G_USEC_PER_SEC / 10 ) // 100 ms: audio queued past the player, the pitch lag
+
+void align_filter_reset ( AlignFilter *af )
+{
+	memset ( af, 0, sizeof ( AlignFilter ) );
+}
+
+static float align_median ( const float *win, uint8_t n )
+{
+	float s[ALIGN_MEDIAN];
+	memcpy ( s, win, n * sizeof ( float ) );
+
+	// insertion sort: n <= ALIGN_MEDIAN
+	uint8_t i = 0; for ( i = 1; i < n; i++ )
+	{
+		float v = s[i];
+		uint8_t j = i;
+
+		while ( j > 0 && s[j - 1] > v ) { s[j] = s[j - 1]; j--; }
+
+		s[j] = v;
+	}
+
+	return s[n / 2];
+}
+
+/* raw - AL_ALL values in %; the median drops single-sample spikes, the EMA the jitter left */
+void align_filter_add ( AlignFilter *af, const float *raw, gint64 now, AlignOut *out )
+{
+	uint8_t v = 0; for ( v = 0; v < AL_ALL; v++ ) af->win[v][af->pos] = raw[v];
+
+	af->pos = ( af->pos + 1 ) % ALIGN_MEDIAN;
+	if ( af->n < ALIGN_MEDIAN ) af->n++;
+
+	for ( v = 0; v < AL_ALL; v++ )
+	{
+		float med = align_median ( af->win[v], af->n );
+
+		af->ema[v] = ( af->n == 1 ) ? med : af->ema[v] + ALIGN_EMA * ( med - af->ema[v] );
+
+		// a new peak or an old one past the hold time
+		if ( af->ema[v] >= af->peak[v] || now - af->peak_time[v] > ALIGN_HOLD ) { af->peak[v] = af->ema[v]; af->peak_time[v] = now; }
+
+		out->val[v]  = af->ema[v];
+		out->peak[v] = af->peak[v];
+	}
+}
+
+struct _AlignTone
+{
+	GPid pid;
+	int fd; // aplay stdin
+
+	GThread *thread;
+	gint stop, pitch; // pitch - 0.1 %
+};
+
+/* Parabolic sine, x - one period in 0 ... 1: a beep needs no libm */
+static float align_tone_sin ( double x )
+{
+	float p = (float)( ( x < 0.5 ) ? x * 2 : x * 2 - 2 ); // -1 ... 1 half periods
+
+	return 4 * p * ( 1 - ( ( p < 0 ) ? -p : p ) );
+}
+
+static gpointer align_tone_thread ( AlignTone *tone )
+{
+	int16_t buf[TONE_CHUNK];
+	double phase = 0;
+
+	gint64 t0 = g_get_monotonic_time ();
+	uint64_t samples = 0;
+
+	while ( !g_atomic_int_get ( &tone->stop ) )
+	{
+		double freq = TONE_LOW + ( TONE_HIGH - TONE_LOW ) * g_atomic_int_get ( &tone->pitch ) / 1000.0;
+
+		// phase carried over: no clicks on a pitch change
+		uint16_t i = 0; for ( i = 0; i < TONE_CHUNK; i++ )
+		{
+			buf[i] = (int16_t)( 8000 * align_tone_sin ( phase ) );
+
+			phase += freq / TONE_RATE;
+			if ( phase >= 1 ) phase -= 1;
+		}
+
+		// the clock paces the loop: a full pipe and the player's buffer would hold seconds of an old pitch
+		gint64 ahead = (gint64)( samples * G_USEC_PER_SEC / TONE_RATE ) - ( g_get_monotonic_time () - t0 );
+
+		if ( ahead > TONE_AHEAD ) g_usleep ( (gulong)( ahead - TONE_AHEAD ) );
+
+		// the player fell behind ( underrun, slow start ): count from now
+		if ( ahead < 0 ) { t0 = g_get_monotonic_time (); samples = 0; }
+
+		if ( write ( tone->fd, buf, sizeof ( buf ) ) == -1 && errno != EINTR ) break;
+
+		samples += TONE_CHUNK;
+	}
+
+	return NULL;
+}
+
+/* Raw PCM to aplay; NULL - no player */
+AlignTone * align_tone_start ( void )
+{
+	char *argv[] = { "aplay", "-q", "-t", "raw", "-f", "S16_LE", "-r", G_STRINGIFY ( TONE_RATE ), "-c", "1", "-B", "100000", NULL };
+
+	GPid pid = 0;
+	int fd = -1;
+	GError *error = NULL;
+
+	if ( !g_spawn_async_with_pipes ( NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+		NULL, NULL, &pid, &fd, NULL, NULL, &error ) )
+	{
+		g_warning ( "%s:: %s ", __func__, error->message );
+		g_error_free ( error );
+
+		return NULL;
+	}
+
+#ifdef F_SETPIPE_SZ
+	// 100 ms of audio, the kernel rounds it up to a page
+	fcntl ( fd, F_SETPIPE_SZ, TONE_RATE * 2 / 10 );
+#endif
+
+	// a player that quits must not take the program with it
+	signal ( SIGPIPE, SIG_IGN );
+
+	AlignTone *tone = g_new0 ( AlignTone, 1 );
+
+	tone->pid = pid;
+	tone->fd  = fd;
+	tone->thread = g_thread_new ( "align-tone", (GThreadFunc)align_tone_thread, tone );
+
+	return tone;
+}
+
+/* value - 0 ... 100 % */
+void align_tone_set ( AlignTone *tone, float value )
+{
+	if ( tone ) g_atomic_int_set ( &tone->pitch, (gint)( CLAMP ( value, 0, 100 ) * 10 ) );
+}
+
+void align_tone_stop ( AlignTone *tone )
+{
+	if ( !tone ) return;
+
+	g_atomic_int_set ( &tone->stop, 1 );
+
+	// a write blocked on a full pipe returns once the player is gone
+	kill ( tone->pid, SIGTERM );
+
+	g_thread_join ( tone->thread );
+
+	close ( tone->fd );
+	waitpid ( tone->pid, NULL, 0 );
+	g_spawn_close_pid ( tone->pid );
+
+	free ( tone );
+}
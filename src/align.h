@@ -0,0 +1,50 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <glib.h>
+
+#define ALIGN_MS     20 // sampling: 50 Hz, slower drivers just take longer per ioctl
+#define ALIGN_FPS    25 // readout
+#define ALIGN_MEDIAN 5
+
+enum align_value { AL_SGL, AL_SNR, AL_ALL };
+
+typedef struct _AlignOut AlignOut;
+
+struct _AlignOut
+{
+	float val[AL_ALL];  // %, median + exponential smoothing
+	float peak[AL_ALL]; // %, held for ALIGN_HOLD
+};
+
+typedef struct _AlignFilter AlignFilter;
+
+struct _AlignFilter
+{
+	float win[AL_ALL][ALIGN_MEDIAN];
+	uint8_t n, pos;
+
+	float ema[AL_ALL], peak[AL_ALL];
+	gint64 peak_time[AL_ALL];
+};
+
+void align_filter_reset ( AlignFilter * );
+
+void align_filter_add ( AlignFilter *, const float *, gint64, AlignOut * );
+
+typedef struct _AlignTone AlignTone;
+
+AlignTone * align_tone_start ( void );
+
+void align_tone_set ( AlignTone *, float );
+
+void align_tone_stop ( AlignTone * );
@@ -0,0 +1,454 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "chbin.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHBIN_MAGIC "DVB5CHDB"
+#define CHBIN_VERSION 1
+
+typedef struct _ChBinHeader ChBinHeader;
+
+struct _ChBinHeader
+{
+	char magic[8];
+	uint32_t version, n_rec;
+
+	uint32_t rec_off, pool_off, str_off, name_off, case_off; // byte offsets from the file start
+	uint32_t pool_len, str_len, hash_len; // u32 count, bytes, buckets ( power of 2 )
+};
+
+struct _ChBin
+{
+	void *map;
+	size_t size;
+
+	const ChBinHeader *hdr;
+	const ChBinRec *rec;
+	const uint32_t *pool;
+	const char *str;
+	const uint32_t *name, *casefd; // bucket -> record + 1, 0 - empty
+};
+
+static uint32_t chbin_hash ( const char *str, gboolean casefd )
+{
+	uint32_t h = 2166136261u; // FNV-1a
+
+	for ( ; *str; str++ )
+	{
+		h ^= (uint8_t)( ( casefd ) ? g_ascii_tolower ( *str ) : *str );
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+gboolean chbin_is_bin ( const char *file )
+{
+	char magic[8] = { 0 };
+
+	int fd = open ( file, O_RDONLY | O_CLOEXEC );
+
+	if ( fd == -1 ) return FALSE;
+
+	ssize_t r = read ( fd, magic, sizeof ( magic ) );
+	close ( fd );
+
+	return ( r == sizeof ( magic ) && memcmp ( magic, CHBIN_MAGIC, sizeof ( magic ) ) == 0 );
+}
+
+static gboolean chbin_check ( ChBin *bin )
+{
+	const ChBinHeader *h = bin->hdr;
+
+	if ( bin->size < sizeof ( ChBinHeader ) || memcmp ( h->magic, CHBIN_MAGIC, 8 ) || h->version != CHBIN_VERSION ) return FALSE;
+
+	if ( (uint64_t)h->rec_off  + (uint64_t)h->n_rec * sizeof ( ChBinRec ) > bin->size ) return FALSE;
+	if ( (uint64_t)h->pool_off + (uint64_t)h->pool_len * 4 > bin->size ) return FALSE;
+	if ( (uint64_t)h->str_off  + h->str_len > bin->size || h->str_len == 0 ) return FALSE;
+	if ( (uint64_t)h->name_off + (uint64_t)h->hash_len * 4 > bin->size ) return FALSE;
+	if ( (uint64_t)h->case_off + (uint64_t)h->hash_len * 4 > bin->size ) return FALSE;
+	if ( h->hash_len == 0 || ( h->hash_len & ( h->hash_len - 1 ) ) ) return FALSE;
+	if ( bin->str[h->str_len - 1] != '\0' ) return FALSE;
+
+	uint32_t i = 0; for ( i = 0; i < h->n_rec; i++ )
+	{
+		const ChBinRec *r = &bin->rec[i];
+
+		if ( r->channel >= h->str_len || r->vchannel >= h->str_len || r->location >= h->str_len || r->lnb >= h->str_len ) return FALSE;
+		if ( (uint64_t)r->props + 2u * r->n_props > h->pool_len || r->n_props > DTV_MAX_COMMAND ) return FALSE;
+		if ( (uint64_t)r->pids + r->n_video + r->n_audio + r->n_other > h->pool_len ) return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Read-only shared mapping: several processes can use the same page cache copy */
+ChBin * chbin_open ( const char *file )
+{
+	int fd = open ( file, O_RDONLY | O_CLOEXEC );
+
+	if ( fd == -1 ) { g_warning ( "%s:: %s: %m", __func__, file ); return NULL; }
+
+	struct stat st;
+
+	if ( fstat ( fd, &st ) == -1 || st.st_size < (off_t)sizeof ( ChBinHeader ) ) { close ( fd ); return NULL; }
+
+	void *map = mmap ( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close ( fd );
+
+	if ( map == MAP_FAILED ) { g_warning ( "%s:: mmap %s: %m", __func__, file ); return NULL; }
+
+	ChBin *bin = g_new0 ( ChBin, 1 );
+
+	bin->map  = map;
+	bin->size = (size_t)st.st_size;
+	bin->hdr  = map;
+	bin->rec  = (const ChBinRec *)( (const char *)map + bin->hdr->rec_off  );
+	bin->pool = (const uint32_t *)( (const char *)map + bin->hdr->pool_off );
+	bin->str  = (const char *)map + bin->hdr->str_off;
+	bin->name   = (const uint32_t *)( (const char *)map + bin->hdr->name_off );
+	bin->casefd = (const uint32_t *)( (const char *)map + bin->hdr->case_off );
+
+	if ( !chbin_check ( bin ) )
+	{
+		g_warning ( "%s:: %s: invalid channel database.", __func__, file );
+		chbin_close ( bin );
+		return NULL;
+	}
+
+	return bin;
+}
+
+void chbin_close ( ChBin *bin )
+{
+	if ( !bin ) return;
+
+	munmap ( bin->map, bin->size );
+	free ( bin );
+}
+
+uint32_t chbin_count ( ChBin *bin )
+{
+	return bin->hdr->n_rec;
+}
+
+const ChBinRec * chbin_rec ( ChBin *bin, uint32_t i )
+{
+	return &bin->rec[i];
+}
+
+const char * chbin_str ( ChBin *bin, uint32_t off )
+{
+	return ( off ) ? bin->str + off : NULL;
+}
+
+/* 0 - first video pid, 1 - first audio pid */
+uint16_t chbin_pid ( ChBin *bin, const ChBinRec *r, uint8_t num )
+{
+	if ( num == 0 && r->n_video ) return (uint16_t)bin->pool[r->pids];
+	if ( num == 1 && r->n_audio ) return (uint16_t)bin->pool[r->pids + r->n_video];
+
+	return 0;
+}
+
+/* Returns the record index of channel / vchannel ( exact or case-insensitive ), -1 not found */
+int64_t chbin_lookup ( ChBin *bin, const char *name, gboolean casefd )
+{
+	const uint32_t *table = ( casefd ) ? bin->casefd : bin->name;
+	uint32_t mask = bin->hdr->hash_len - 1, b = chbin_hash ( name, casefd ) & mask;
+
+	uint32_t n = 0; for ( n = 0; n <= mask && table[b]; n++, b = ( b + 1 ) & mask )
+	{
+		uint32_t i = table[b] - 1;
+
+		if ( i >= bin->hdr->n_rec ) break;
+
+		const ChBinRec *r = &bin->rec[i];
+		const char *ch = chbin_str ( bin, r->channel ), *vch = chbin_str ( bin, r->vchannel );
+
+		if ( casefd )
+		{
+			if ( ch && g_ascii_strcasecmp ( ch, name ) == 0 ) return i;
+		}
+		else
+		{
+			if ( ( ch && g_str_equal ( ch, name ) ) || ( vch && g_str_equal ( vch, name ) ) ) return i;
+		}
+	}
+
+	return -1;
+}
+
+static char * chbin_strdup ( ChBin *bin, uint32_t off )
+{
+	return ( off ) ? strdup ( bin->str + off ) : NULL;
+}
+
+/* Allocated like libdvbv5 does: link into a struct dvb_file and release with dvb_file_free */
+struct dvb_entry * chbin_entry_new ( ChBin *bin, uint32_t i )
+{
+	const ChBinRec *r = &bin->rec[i];
+	const uint32_t *pool = bin->pool;
+
+	struct dvb_entry *entry = calloc ( 1, sizeof ( struct dvb_entry ) );
+
+	if ( !entry ) return NULL;
+
+	uint16_t k = 0; for ( k = 0; k < r->n_props; k++ )
+	{
+		entry->props[k].cmd    = pool[r->props + 2u * k];
+		entry->props[k].u.data = pool[r->props + 2u * k + 1];
+	}
+
+	entry->n_props = r->n_props;
+
+	const uint32_t *pids = pool + r->pids;
+
+	if ( r->n_video )
+	{
+		entry->video_pid = calloc ( r->n_video, sizeof ( uint16_t ) );
+		for ( k = 0; entry->video_pid && k < r->n_video; k++ ) entry->video_pid[k] = (uint16_t)pids[k];
+		entry->video_pid_len = ( entry->video_pid ) ? r->n_video : 0;
+	}
+
+	pids += r->n_video;
+
+	if ( r->n_audio )
+	{
+		entry->audio_pid = calloc ( r->n_audio, sizeof ( uint16_t ) );
+		for ( k = 0; entry->audio_pid && k < r->n_audio; k++ ) entry->audio_pid[k] = (uint16_t)pids[k];
+		entry->audio_pid_len = ( entry->audio_pid ) ? r->n_audio : 0;
+	}
+
+	pids += r->n_audio;
+
+	if ( r->n_other )
+	{
+		entry->other_el_pid = calloc ( r->n_other, sizeof ( struct dvb_elementary_pid ) );
+
+		for ( k = 0; entry->other_el_pid && k < r->n_other; k++ )
+		{
+			entry->other_el_pid[k].type = (uint8_t)( pids[k] >> 16 );
+			entry->other_el_pid[k].pid  = (uint16_t)( pids[k] & 0xffff );
+		}
+
+		entry->other_el_pid_len = ( entry->other_el_pid ) ? r->n_other : 0;
+	}
+
+	entry->channel  = chbin_strdup ( bin, r->channel  );
+	entry->vchannel = chbin_strdup ( bin, r->vchannel );
+	entry->location = chbin_strdup ( bin, r->location );
+	entry->lnb      = chbin_strdup ( bin, r->lnb      );
+
+	entry->service_id   = r->service_id;
+	entry->network_id   = r->network_id;
+	entry->transport_id = r->transport_id;
+	entry->sat_number   = r->sat_number;
+	entry->freq_bpf     = r->freq_bpf;
+	entry->diseqc_wait  = r->diseqc_wait;
+
+	return entry;
+}
+
+static uint32_t chbin_intern ( GString *str, GHashTable *strings, const char *s )
+{
+	if ( !s ) return 0;
+
+	gpointer off = g_hash_table_lookup ( strings, s );
+
+	if ( off ) return GPOINTER_TO_UINT ( off );
+
+	uint32_t o = (uint32_t)str->len;
+
+	g_string_append_len ( str, s, (gssize)strlen ( s ) + 1 );
+	g_hash_table_insert ( strings, (gpointer)s, GUINT_TO_POINTER ( o ) );
+
+	return o;
+}
+
+static void chbin_hash_insert ( uint32_t *table, uint32_t mask, const char *name, gboolean casefd, uint32_t i, GHashTable *seen )
+{
+	g_autofree char *key = ( casefd ) ? g_ascii_strdown ( name, -1 ) : g_strdup ( name );
+
+	if ( g_hash_table_contains ( seen, key ) ) return; // the first entry wins
+
+	uint32_t b = chbin_hash ( name, casefd ) & mask;
+
+	while ( table[b] ) b = ( b + 1 ) & mask;
+
+	table[b] = i + 1;
+	g_hash_table_add ( seen, g_steal_pointer ( &key ) );
+}
+
+static void chbin_pad4 ( GByteArray *data )
+{
+	const uint8_t zero[4] = { 0 };
+
+	if ( data->len % 4 ) g_byte_array_append ( data, zero, 4 - data->len % 4 );
+}
+
+/* Compiles a parsed channel file into the binary form ( written atomically ) */
+gboolean chbin_write ( const char *file, struct dvb_file *dvb_file )
+{
+	GArray *recs = g_array_new ( FALSE, TRUE, sizeof ( ChBinRec ) );
+	GArray *pool = g_array_new ( FALSE, TRUE, sizeof ( uint32_t ) );
+	GString *str = g_string_new_len ( "", 1 ); // offset 0 - NULL
+	GHashTable *strings = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	uint32_t n_names = 0;
+	struct dvb_entry *entry;
+
+	for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
+	{
+		ChBinRec r = { 0 };
+		uint32_t k = 0;
+
+		r.channel  = chbin_intern ( str, strings, entry->channel  );
+		r.vchannel = chbin_intern ( str, strings, entry->vchannel );
+		r.location = chbin_intern ( str, strings, entry->location );
+		r.lnb      = chbin_intern ( str, strings, entry->lnb      );
+
+		r.props = pool->len;
+		r.n_props = (uint16_t)MIN ( entry->n_props, DTV_MAX_COMMAND );
+
+		for ( k = 0; k < r.n_props; k++ )
+		{
+			g_array_append_val ( pool, entry->props[k].cmd );
+			g_array_append_val ( pool, entry->props[k].u.data );
+
+			if ( entry->props[k].cmd == DTV_FREQUENCY ) r.freq = entry->props[k].u.data;
+		}
+
+		r.pids = pool->len;
+		r.n_video = (uint16_t)entry->video_pid_len;
+		r.n_audio = (uint16_t)entry->audio_pid_len;
+		r.n_other = (uint16_t)entry->other_el_pid_len;
+
+		for ( k = 0; k < r.n_video; k++ ) { uint32_t v = entry->video_pid[k]; g_array_append_val ( pool, v ); }
+		for ( k = 0; k < r.n_audio; k++ ) { uint32_t v = entry->audio_pid[k]; g_array_append_val ( pool, v ); }
+		for ( k = 0; k < r.n_other; k++ ) { uint32_t v = (uint32_t)entry->other_el_pid[k].type << 16 | entry->other_el_pid[k].pid; g_array_append_val ( pool, v ); }
+
+		r.service_id   = entry->service_id;
+		r.network_id   = entry->network_id;
+		r.transport_id = entry->transport_id;
+		r.sat_number   = entry->sat_number;
+		r.freq_bpf     = entry->freq_bpf;
+		r.diseqc_wait  = entry->diseqc_wait;
+
+		if ( entry->channel  ) n_names++;
+		if ( entry->vchannel ) n_names++;
+
+		g_array_append_val ( recs, r );
+	}
+
+	uint32_t hash_len = 16; while ( hash_len < n_names * 2 ) hash_len <<= 1;
+
+	uint32_t *name   = g_new0 ( uint32_t, hash_len );
+	uint32_t *casefd = g_new0 ( uint32_t, hash_len );
+
+	GHashTable *seen_n = g_hash_table_new_full ( g_str_hash, g_str_equal, g_free, NULL );
+	GHashTable *seen_c = g_hash_table_new_full ( g_str_hash, g_str_equal, g_free, NULL );
+
+	uint32_t i = 0;
+	for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next, i++ )
+	{
+		if ( entry->channel  ) chbin_hash_insert ( name,   hash_len - 1, entry->channel,  FALSE, i, seen_n );
+		if ( entry->vchannel ) chbin_hash_insert ( name,   hash_len - 1, entry->vchannel, FALSE, i, seen_n );
+		if ( entry->channel  ) chbin_hash_insert ( casefd, hash_len - 1, entry->channel,  TRUE,  i, seen_c );
+	}
+
+	ChBinHeader h = { .version = CHBIN_VERSION, .n_rec = recs->len, .pool_len = pool->len, .str_len = (uint32_t)str->len, .hash_len = hash_len };
+	memcpy ( h.magic, CHBIN_MAGIC, 8 );
+
+	GByteArray *data = g_byte_array_new ();
+	g_byte_array_append ( data, (const uint8_t *)&h, sizeof ( h ) );
+
+	chbin_pad4 ( data ); h.rec_off  = data->len; g_byte_array_append ( data, (const uint8_t *)recs->data, recs->len * (uint32_t)sizeof ( ChBinRec ) );
+	chbin_pad4 ( data ); h.pool_off = data->len; g_byte_array_append ( data, (const uint8_t *)pool->data, pool->len * 4 );
+	chbin_pad4 ( data ); h.name_off = data->len; g_byte_array_append ( data, (const uint8_t *)name,   hash_len * 4 );
+	chbin_pad4 ( data ); h.case_off = data->len; g_byte_array_append ( data, (const uint8_t *)casefd, hash_len * 4 );
+	chbin_pad4 ( data ); h.str_off  = data->len; g_byte_array_append ( data, (const uint8_t *)str->str, (uint32_t)str->len );
+
+	memcpy ( data->data, &h, sizeof ( h ) );
+
+	GError *error = NULL;
+	gboolean ret = g_file_set_contents ( file, (const char *)data->data, (gssize)data->len, &error );
+
+	if ( error ) { g_warning ( "%s:: %s ", __func__, error->message ); g_error_free ( error ); }
+
+	g_byte_array_free ( data, TRUE );
+	g_hash_table_unref ( seen_n );
+	g_hash_table_unref ( seen_c );
+	g_hash_table_unref ( strings );
+	g_string_free ( str, TRUE );
+	g_array_free ( pool, TRUE );
+	g_array_free ( recs, TRUE );
+	free ( name );
+	free ( casefd );
+
+	return ret;
+}
+
+/* DVBV5 | VDR | CHANNEL | ZAP -> binary */
+gboolean chbin_import ( const char *file, enum dvb_file_formats format, uint32_t delsys, const char *file_bin )
+{
+	struct dvb_file *dvb_file = dvb_read_file_format ( file, delsys, format );
+
+	if ( !dvb_file ) { g_critical ( "%s:: Read file format failed.", __func__ ); return FALSE; }
+
+	gboolean ret = chbin_write ( file_bin, dvb_file );
+
+	dvb_file_free ( dvb_file );
+
+	return ret;
+}
+
+/* binary -> DVBV5 | VDR | CHANNEL | ZAP */
+gboolean chbin_export ( const char *file_bin, const char *file, enum dvb_file_formats format )
+{
+	ChBin *bin = chbin_open ( file_bin );
+
+	if ( !bin ) return FALSE;
+
+	struct dvb_file *dvb_file = calloc ( 1, sizeof ( struct dvb_file ) );
+
+	if ( !dvb_file ) { chbin_close ( bin ); return FALSE; }
+
+	struct dvb_entry **last = &dvb_file->first_entry;
+
+	uint32_t delsys = SYS_UNDEFINED;
+
+	uint32_t i = 0; for ( i = 0; i < chbin_count ( bin ); i++ )
+	{
+		struct dvb_entry *entry = chbin_entry_new ( bin, i );
+
+		if ( !entry ) break;
+
+		if ( delsys == SYS_UNDEFINED ) dvb_retrieve_entry_prop ( entry, DTV_DELIVERY_SYSTEM, &delsys );
+
+		*last = entry;
+		last = &entry->next;
+		dvb_file->n_entries++;
+	}
+
+	chbin_close ( bin );
+
+	int rc = dvb_write_file_format ( file, dvb_file, delsys, format );
+
+	dvb_file_free ( dvb_file );
+
+	return ( rc == 0 );
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-file.h>
+
+#include <glib.h>
+
+#define CHBIN_EXT ".chdb"
+
+typedef struct _ChBin ChBin;
+
+typedef struct _ChBinRec ChBinRec;
+
+/* Fixed-width record: strings are offsets into the string table ( 0 - NULL ), arrays are offsets into the u32 pool */
+struct _ChBinRec
+{
+	uint32_t channel, vchannel, location, lnb;
+	uint32_t props, pids; // props: cmd, data pairs; pids: video, audio, other ( type << 16 | pid )
+	uint16_t n_props, n_video, n_audio, n_other;
+	uint16_t service_id, network_id, transport_id, pad;
+	int32_t sat_number;
+	uint32_t freq_bpf, diseqc_wait, freq;
+};
+
+gboolean chbin_is_bin ( const char * );
+
+ChBin * chbin_open ( const char * );
+
+void chbin_close ( ChBin * );
+
+uint32_t chbin_count ( ChBin * );
+
+const ChBinRec * chbin_rec ( ChBin *, uint32_t );
+
+const char * chbin_str ( ChBin *, uint32_t );
+
+uint16_t chbin_pid ( ChBin *, const ChBinRec *, uint8_t );
+
+int64_t chbin_lookup ( ChBin *, const char *, gboolean );
+
+struct dvb_entry * chbin_entry_new ( ChBin *, uint32_t );
+
+gboolean chbin_write ( const char *, struct dvb_file * );
+
+gboolean chbin_import ( const char *, enum dvb_file_formats, uint32_t, const char * );
+
+gboolean chbin_export ( const char *, const char *, enum dvb_file_formats );
@@ -0,0 +1,368 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "chdb.h"
+#include "chbin.h"
+#include "chtable.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+struct _ChDb
+{
+	gint ref;
+
+	char *file;
+	enum dvb_file_formats format;
+	uint32_t delsys; // for the formats that need it ( ZAP ), as in dvb_read_file_format
+
+	struct timespec mtime;
+	goffset size;
+
+	// text file: parsed entries; binary file: mmap + entries materialized on demand
+	struct dvb_file *dvb_file;
+	GPtrArray *rows;
+
+	ChBin *bin;
+	GMutex mat_mutex;
+	struct dvb_entry **mat;
+
+	uint32_t count;
+
+	// values are row + 1
+	GHashTable *name;   // channel & vchannel -> row ( text only, binary has its own )
+	GHashTable *casefd; // lower-case channel   -> row ( text only )
+	GHashTable *sid;    // service_id -> row
+	GHashTable *freq;   // frequency  -> row
+
+	GMutex tab_mutex;
+	ChTable *table; // zap list + search index, built on first use
+};
+
+static GMutex chdb_mutex;
+static GHashTable *chdb_cache = NULL; // file -> ChDb
+
+static void chdb_insert ( GHashTable *table, gpointer key, uint32_t row )
+{
+	// the first entry wins, as the linear search did
+	if ( !g_hash_table_contains ( table, key ) ) g_hash_table_insert ( table, key, GUINT_TO_POINTER ( row + 1 ) );
+}
+
+static gboolean chdb_load_text ( ChDb *db )
+{
+	db->dvb_file = dvb_read_file_format ( db->file, db->delsys, db->format );
+
+	if ( !db->dvb_file ) return FALSE;
+
+	db->rows   = g_ptr_array_new ();
+	db->name   = g_hash_table_new ( g_str_hash, g_str_equal );
+	db->casefd = g_hash_table_new_full ( g_str_hash, g_str_equal, g_free, NULL );
+
+	struct dvb_entry *entry;
+
+	for ( entry = db->dvb_file->first_entry; entry != NULL; entry = entry->next )
+	{
+		uint32_t row = db->rows->len;
+		g_ptr_array_add ( db->rows, entry );
+
+		if ( entry->channel  ) chdb_insert ( db->name, entry->channel,  row );
+		if ( entry->vchannel ) chdb_insert ( db->name, entry->vchannel, row );
+
+		if ( entry->channel )
+		{
+			char *key = g_ascii_strdown ( entry->channel, -1 );
+
+			if ( g_hash_table_contains ( db->casefd, key ) ) g_free ( key ); else g_hash_table_insert ( db->casefd, key, GUINT_TO_POINTER ( row + 1 ) );
+		}
+
+		if ( entry->service_id ) chdb_insert ( db->sid, GUINT_TO_POINTER ( entry->service_id ), row );
+
+		uint32_t f = 0;
+		if ( !dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &f ) && f ) chdb_insert ( db->freq, GUINT_TO_POINTER ( f ), row );
+	}
+
+	db->count = db->rows->len;
+
+	return TRUE;
+}
+
+static gboolean chdb_load_bin ( ChDb *db )
+{
+	db->bin = chbin_open ( db->file );
+
+	if ( !db->bin ) return FALSE;
+
+	db->count = chbin_count ( db->bin );
+	db->mat = g_new0 ( struct dvb_entry *, db->count + 1 );
+
+	uint32_t row = 0; for ( row = 0; row < db->count; row++ )
+	{
+		const ChBinRec *r = chbin_rec ( db->bin, row );
+
+		if ( r->service_id ) chdb_insert ( db->sid, GUINT_TO_POINTER ( r->service_id ), row );
+		if ( r->freq ) chdb_insert ( db->freq, GUINT_TO_POINTER ( r->freq ), row );
+	}
+
+	return TRUE;
+}
+
+static void chdb_free ( ChDb *db )
+{
+	if ( db->name   ) g_hash_table_unref ( db->name   );
+	if ( db->casefd ) g_hash_table_unref ( db->casefd );
+
+	g_hash_table_unref ( db->sid  );
+	g_hash_table_unref ( db->freq );
+
+	if ( db->rows ) g_ptr_array_free ( db->rows, TRUE );
+	if ( db->dvb_file ) dvb_file_free ( db->dvb_file );
+
+	if ( db->mat )
+	{
+		// materialized entries are released the libdvbv5 way
+		struct dvb_file *dvb_file = calloc ( 1, sizeof ( struct dvb_file ) );
+		struct dvb_entry **last = &dvb_file->first_entry;
+
+		uint32_t row = 0; for ( row = 0; row < db->count; row++ )
+		{
+			if ( !db->mat[row] ) continue;
+
+			*last = db->mat[row];
+			last = &db->mat[row]->next;
+		}
+
+		dvb_file_free ( dvb_file );
+		free ( db->mat );
+	}
+
+	chtable_unref ( db->table );
+	g_mutex_clear ( &db->tab_mutex );
+
+	chbin_close ( db->bin );
+	g_mutex_clear ( &db->mat_mutex );
+
+	free ( db->file );
+	free ( db );
+}
+
+static ChDb * chdb_load ( const char *file, enum dvb_file_formats format, uint32_t delsys, GStatBuf *st )
+{
+	ChDb *db = g_new0 ( ChDb, 1 );
+
+	db->ref = 1;
+	db->file = g_strdup ( file );
+	db->format = format;
+	db->delsys = delsys;
+	db->mtime = st->st_mtim;
+	db->size = st->st_size;
+
+	g_mutex_init ( &db->mat_mutex );
+	g_mutex_init ( &db->tab_mutex );
+
+	db->sid  = g_hash_table_new ( g_direct_hash, g_direct_equal );
+	db->freq = g_hash_table_new ( g_direct_hash, g_direct_equal );
+
+	gboolean ret = ( chbin_is_bin ( file ) ) ? chdb_load_bin ( db ) : chdb_load_text ( db );
+
+	if ( !ret ) { g_critical ( "%s:: Read file format failed.", __func__ ); chdb_free ( db ); return NULL; }
+
+	return db;
+}
+
+ChDb * chdb_ref ( ChDb *db )
+{
+	g_atomic_int_inc ( &db->ref );
+
+	return db;
+}
+
+void chdb_unref ( ChDb *db )
+{
+	if ( db && g_atomic_int_dec_and_test ( &db->ref ) ) chdb_free ( db );
+}
+
+/*
+* Returns the parsed and indexed channel file ( text or compiled CHBIN_EXT ), loaded once and shared:
+* it is re-read only when the file's mtime or size changes. Release with chdb_unref.
+* delsys - the frontend's, for the text formats that need it ( ZAP ).
+*/
+ChDb * chdb_open ( const char *file, enum dvb_file_formats format, uint32_t delsys )
+{
+	GStatBuf st;
+
+	// DVBV5 carries its own: one cached copy whatever the frontend
+	if ( format == FILE_DVBV5 ) delsys = SYS_UNDEFINED;
+
+	if ( !file || g_stat ( file, &st ) == -1 ) return NULL;
+
+	g_mutex_lock ( &chdb_mutex );
+
+	if ( !chdb_cache ) chdb_cache = g_hash_table_new_full ( g_str_hash, g_str_equal, NULL, (GDestroyNotify)chdb_unref );
+
+	ChDb *db = g_hash_table_lookup ( chdb_cache, file );
+
+	if ( db && ( db->format != format || db->delsys != delsys || db->size != st.st_size
+		|| db->mtime.tv_sec != st.st_mtim.tv_sec || db->mtime.tv_nsec != st.st_mtim.tv_nsec ) )
+	{
+		g_hash_table_remove ( chdb_cache, file );
+		db = NULL;
+	}
+
+	if ( db ) { chdb_ref ( db ); g_mutex_unlock ( &chdb_mutex ); return db; }
+
+	g_mutex_unlock ( &chdb_mutex );
+
+	// parsed outside the lock: lookups of other files go on meanwhile
+	ChDb *db_new = chdb_load ( file, format, delsys, &st );
+
+	if ( !db_new ) return NULL;
+
+	g_mutex_lock ( &chdb_mutex );
+
+	// a parallel load of the same file got there first
+	db = g_hash_table_lookup ( chdb_cache, file );
+
+	if ( db && db->format == format && db->delsys == delsys && db->size == db_new->size
+		&& db->mtime.tv_sec == db_new->mtime.tv_sec && db->mtime.tv_nsec == db_new->mtime.tv_nsec )
+		chdb_free ( db_new );
+	else
+		{ db = db_new; g_hash_table_replace ( chdb_cache, db->file, db ); }
+
+	chdb_ref ( db );
+
+	g_mutex_unlock ( &chdb_mutex );
+
+	return db;
+}
+
+void chdb_cache_clear ( void )
+{
+	g_mutex_lock ( &chdb_mutex );
+
+	if ( chdb_cache ) g_hash_table_remove_all ( chdb_cache );
+
+	g_mutex_unlock ( &chdb_mutex );
+}
+
+uint32_t chdb_count ( ChDb *db )
+{
+	return db->count;
+}
+
+struct dvb_entry * chdb_entry ( ChDb *db, uint32_t row )
+{
+	if ( row >= db->count ) return NULL;
+
+	if ( db->rows ) return g_ptr_array_index ( db->rows, row );
+
+	g_mutex_lock ( &db->mat_mutex );
+
+	if ( !db->mat[row] ) db->mat[row] = chbin_entry_new ( db->bin, row );
+
+	struct dvb_entry *entry = db->mat[row];
+
+	g_mutex_unlock ( &db->mat_mutex );
+
+	return entry;
+}
+
+/* The list columns of a row, without materializing binary entries */
+void chdb_info ( ChDb *db, uint32_t row, ChDbInfo *info )
+{
+	memset ( info, 0, sizeof ( ChDbInfo ) );
+
+	if ( row >= db->count ) return;
+
+	if ( db->bin )
+	{
+		const ChBinRec *r = chbin_rec ( db->bin, row );
+
+		info->channel  = chbin_str ( db->bin, r->channel  );
+		info->vchannel = chbin_str ( db->bin, r->vchannel );
+		info->sid  = r->service_id;
+		info->vpid = chbin_pid ( db->bin, r, 0 );
+		info->apid = chbin_pid ( db->bin, r, 1 );
+		info->freq = r->freq;
+
+		return;
+	}
+
+	struct dvb_entry *entry = g_ptr_array_index ( db->rows, row );
+
+	info->channel  = entry->channel;
+	info->vchannel = entry->vchannel;
+	info->sid  = entry->service_id;
+	info->vpid = ( entry->video_pid ) ? entry->video_pid[0] : 0;
+	info->apid = ( entry->audio_pid ) ? entry->audio_pid[0] : 0;
+
+	dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &info->freq );
+}
+
+static struct dvb_entry * chdb_lookup_table ( ChDb *db, GHashTable *table, gconstpointer key )
+{
+	uint32_t row = GPOINTER_TO_UINT ( g_hash_table_lookup ( table, key ) );
+
+	return ( row ) ? chdb_entry ( db, row - 1 ) : NULL;
+}
+
+/* The zap list table with its search index, shared by every user of this file; release with chtable_unref */
+ChTable * chdb_table ( ChDb *db )
+{
+	g_mutex_lock ( &db->tab_mutex );
+
+	if ( !db->table ) db->table = chtable_new ( db );
+
+	ChTable *table = chtable_ref ( db->table );
+
+	g_mutex_unlock ( &db->tab_mutex );
+
+	return table;
+}
+
+/* Channel or vchannel, then case-insensitive channel, then frequency; no fuzzy match: a zap never tunes another channel */
+struct dvb_entry * chdb_lookup ( ChDb *db, const char *channel )
+{
+	struct dvb_entry *entry = NULL;
+
+	if ( db->bin )
+	{
+		int64_t row = chbin_lookup ( db->bin, channel, FALSE );
+
+		if ( row < 0 ) row = chbin_lookup ( db->bin, channel, TRUE );
+
+		if ( row >= 0 ) entry = chdb_entry ( db, (uint32_t)row );
+	}
+	else
+	{
+		entry = chdb_lookup_table ( db, db->name, channel );
+
+		if ( !entry )
+		{
+			g_autofree char *key = g_ascii_strdown ( channel, -1 );
+
+			entry = chdb_lookup_table ( db, db->casefd, key );
+		}
+	}
+
+	if ( !entry )
+	{
+		uint32_t freq = (uint32_t)atoi ( channel );
+
+		if ( freq ) entry = chdb_lookup_table ( db, db->freq, GUINT_TO_POINTER ( freq ) );
+	}
+
+	return entry;
+}
+
+struct dvb_entry * chdb_lookup_sid ( ChDb *db, uint16_t sid )
+{
+	return chdb_lookup_table ( db, db->sid, GUINT_TO_POINTER ( sid ) );
+}
@@ -0,0 +1,47 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-file.h>
+
+#include <glib.h>
+
+typedef struct _ChDb ChDb;
+
+typedef struct _ChDbInfo ChDbInfo;
+
+typedef struct _ChTable ChTable;
+
+struct _ChDbInfo
+{
+	const char *channel, *vchannel;
+	uint16_t sid, vpid, apid;
+	uint32_t freq;
+};
+
+ChDb * chdb_open ( const char *, enum dvb_file_formats, uint32_t );
+
+ChDb * chdb_ref ( ChDb * );
+
+void chdb_unref ( ChDb * );
+
+uint32_t chdb_count ( ChDb * );
+
+struct dvb_entry * chdb_entry ( ChDb *, uint32_t );
+
+void chdb_info ( ChDb *, uint32_t, ChDbInfo * );
+
+struct dvb_entry * chdb_lookup ( ChDb *, const char * );
+
+struct dvb_entry * chdb_lookup_sid ( ChDb *, uint16_t );
+
+ChTable * chdb_table ( ChDb * );
+
+void chdb_cache_clear ( void );
@@ -0,0 +1,163 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "chindex.h"
+#include "chtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Substring search over the zap list: each row's text is "name \x1f sid \x1f frequency", case-folded.
+* Trigrams are hashed into CHINDEX_BUCKETS posting lists ( rows ascending ); a query takes the
+* shortest list of its trigrams and verifies each candidate, so collisions cost time, not results.
+* Queries shorter than a trigram scan the texts.
+*/
+
+#define CHINDEX_BITS    18
+#define CHINDEX_BUCKETS ( 1u << CHINDEX_BITS )
+
+struct _ChIndex
+{
+	uint32_t count;
+
+	char *text;    // folded texts, NUL-terminated
+	uint32_t *off; // count + 1 offsets into text
+
+	uint32_t *first; // CHINDEX_BUCKETS + 1 offsets into post
+	uint32_t *post;
+	uint32_t n_post;
+};
+
+static inline uint32_t chindex_key ( const char *s )
+{
+	uint32_t h = (uint8_t)s[0] * 0x9E3779B1u ^ (uint8_t)s[1] * 0x85EBCA6Bu ^ (uint8_t)s[2] * 0xC2B2AE35u;
+
+	return h >> ( 32 - CHINDEX_BITS );
+}
+
+static char * chindex_fold ( const char *str )
+{
+	return ( g_utf8_validate ( str, -1, NULL ) ) ? g_utf8_casefold ( str, -1 ) : g_ascii_strdown ( str, -1 );
+}
+
+static inline const char * chindex_text ( const ChIndex *index, uint32_t row )
+{
+	return index->text + index->off[row];
+}
+
+/* Counts ( fill: stores ) the row in the bucket of each of its trigrams, once per bucket */
+static void chindex_post ( ChIndex *index, uint32_t row, uint32_t *last, gboolean fill )
+{
+	const char *s = chindex_text ( index, row );
+	size_t len = strlen ( s );
+
+	size_t i = 0; for ( i = 0; i + 3 <= len; i++ )
+	{
+		uint32_t k = chindex_key ( s + i );
+
+		if ( last[k] == row + 1 ) continue;
+
+		last[k] = row + 1;
+
+		if ( fill ) index->post[index->first[k]++] = row; else index->first[k + 1]++;
+	}
+}
+
+ChIndex * chindex_new ( const ChTable *table )
+{
+	ChIndex *index = g_new0 ( ChIndex, 1 );
+
+	index->count = table->count;
+	index->off = g_new0 ( uint32_t, table->count + 1 );
+
+	GString *text = g_string_sized_new ( table->size );
+
+	uint32_t row = 0; for ( row = 0; row < table->count; row++ )
+	{
+		g_autofree char *fold = chindex_fold ( chtable_name ( table, row ) );
+
+		index->off[row] = (uint32_t)text->len;
+		g_string_append_printf ( text, "%s\x1f%u\x1f%u", fold, table->sid[row], table->freq[row] );
+		g_string_append_c ( text, '\0' );
+	}
+
+	index->off[table->count] = (uint32_t)text->len;
+	index->text = g_string_free ( text, FALSE );
+
+	// counting pass, prefix sums, filling pass: posting lists come out sorted without a sort
+	uint32_t *last = g_new0 ( uint32_t, CHINDEX_BUCKETS );
+	index->first = g_new0 ( uint32_t, CHINDEX_BUCKETS + 1 );
+
+	for ( row = 0; row < table->count; row++ ) chindex_post ( index, row, last, FALSE );
+
+	uint32_t k = 0; for ( k = 0; k < CHINDEX_BUCKETS; k++ ) index->first[k + 1] += index->first[k];
+
+	index->n_post = index->first[CHINDEX_BUCKETS];
+	index->post = g_new ( uint32_t, index->n_post + 1 );
+
+	memset ( last, 0, CHINDEX_BUCKETS * sizeof ( uint32_t ) );
+
+	for ( row = 0; row < table->count; row++ ) chindex_post ( index, row, last, TRUE );
+
+	// the filling pass moved each first[k] to the end of its list
+	for ( k = CHINDEX_BUCKETS; k > 0; k-- ) index->first[k] = index->first[k - 1];
+	index->first[0] = 0;
+
+	free ( last );
+
+	return index;
+}
+
+void chindex_free ( ChIndex *index )
+{
+	if ( !index ) return;
+
+	free ( index->text );
+	free ( index->off );
+	free ( index->first );
+	free ( index->post );
+	free ( index );
+}
+
+size_t chindex_size ( const ChIndex *index )
+{
+	return index->off[index->count] + ( index->count + 1 + CHINDEX_BUCKETS + 1 + index->n_post ) * sizeof ( uint32_t );
+}
+
+/* Rows ( ascending ) whose name, sid or frequency contains the query, case-insensitive; free rows */
+uint32_t chindex_search ( const ChIndex *index, const char *query, uint32_t **rows )
+{
+	g_autofree char *q = chindex_fold ( query );
+
+	size_t len = strlen ( q );
+
+	const uint32_t *cand = NULL;
+	uint32_t n_cand = index->count;
+
+	size_t i = 0; for ( i = 0; i + 3 <= len; i++ )
+	{
+		uint32_t k = chindex_key ( q + i ), n = index->first[k + 1] - index->first[k];
+
+		if ( !cand || n < n_cand ) { cand = index->post + index->first[k]; n_cand = n; }
+	}
+
+	uint32_t n = 0;
+	*rows = g_new ( uint32_t, n_cand + 1 );
+
+	uint32_t c = 0; for ( c = 0; c < n_cand; c++ )
+	{
+		uint32_t row = ( cand ) ? cand[c] : c;
+
+		if ( strstr ( chindex_text ( index, row ), q ) ) ( *rows )[n++] = row;
+	}
+
+	return n;
+}
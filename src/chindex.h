@@ -0,0 +1,25 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <glib.h>
+
+typedef struct _ChTable ChTable;
+
+typedef struct _ChIndex ChIndex;
+
+ChIndex * chindex_new ( const ChTable * );
+
+void chindex_free ( ChIndex * );
+
+uint32_t chindex_search ( const ChIndex *, const char *, uint32_t ** );
+
+size_t chindex_size ( const ChIndex * );
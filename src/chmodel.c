@@ -0,0 +1,199 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "chmodel.h"
+
+/*
+* Read-only GtkTreeModel over a ChTable: no per-cell GValues are stored,
+* a row exists only while the view asks for it. Iter user_data - the row of the model;
+* a filtered model maps its rows to table rows.
+*/
+
+struct _ChModel
+{
+	GObject parent_instance;
+
+	ChTable *table;
+	gint stamp;
+
+	uint32_t *rows; // NULL - all table rows
+	uint32_t n_rows;
+};
+
+static void chmodel_tree_model_init ( GtkTreeModelIface * );
+
+G_DEFINE_TYPE_WITH_CODE ( ChModel, chmodel, G_TYPE_OBJECT, G_IMPLEMENT_INTERFACE ( GTK_TYPE_TREE_MODEL, chmodel_tree_model_init ) )
+
+static const GType chmodel_types[NUM_COLS] = { G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING };
+
+static gboolean chmodel_iter_set ( ChModel *model, GtkTreeIter *iter, int64_t row )
+{
+	if ( row < 0 || row >= model->n_rows ) { iter->stamp = 0; return FALSE; }
+
+	iter->stamp = model->stamp;
+	iter->user_data = GUINT_TO_POINTER ( (uint32_t)row );
+
+	return TRUE;
+}
+
+static uint32_t chmodel_iter_row ( GtkTreeIter *iter )
+{
+	return GPOINTER_TO_UINT ( iter->user_data );
+}
+
+static GtkTreeModelFlags chmodel_get_flags ( G_GNUC_UNUSED GtkTreeModel *tm )
+{
+	return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static int chmodel_get_n_columns ( G_GNUC_UNUSED GtkTreeModel *tm )
+{
+	return NUM_COLS;
+}
+
+static GType chmodel_get_column_type ( G_GNUC_UNUSED GtkTreeModel *tm, int col )
+{
+	return ( col >= 0 && col < NUM_COLS ) ? chmodel_types[col] : G_TYPE_INVALID;
+}
+
+static gboolean chmodel_get_iter ( GtkTreeModel *tm, GtkTreeIter *iter, GtkTreePath *path )
+{
+	if ( gtk_tree_path_get_depth ( path ) != 1 ) return FALSE;
+
+	return chmodel_iter_set ( CHMODEL_LIST ( tm ), iter, gtk_tree_path_get_indices ( path )[0] );
+}
+
+static GtkTreePath * chmodel_get_path ( G_GNUC_UNUSED GtkTreeModel *tm, GtkTreeIter *iter )
+{
+	return gtk_tree_path_new_from_indices ( (int)chmodel_iter_row ( iter ), -1 );
+}
+
+static void chmodel_get_value ( GtkTreeModel *tm, GtkTreeIter *iter, int col, GValue *value )
+{
+	ChModel *model = CHMODEL_LIST ( tm );
+	ChTable *table = model->table;
+
+	uint32_t row = chmodel_iter_row ( iter );
+	if ( model->rows ) row = model->rows[row];
+
+	g_value_init ( value, chmodel_types[col] );
+
+	switch ( col )
+	{
+		case COL_NUM:  g_value_set_uint ( value, row + 1 ); break;
+		case COL_CHL:  g_value_set_static_string ( value, chtable_name ( table, row ) ); break;
+		case COL_VPID: g_value_set_uint ( value, table->vpid[row] ); break;
+		case COL_APID: g_value_set_uint ( value, table->apid[row] ); break;
+
+		default: break; // Rec, Size, File: not kept per channel
+	}
+}
+
+static gboolean chmodel_iter_next ( GtkTreeModel *tm, GtkTreeIter *iter )
+{
+	return chmodel_iter_set ( CHMODEL_LIST ( tm ), iter, (int64_t)chmodel_iter_row ( iter ) + 1 );
+}
+
+static gboolean chmodel_iter_previous ( GtkTreeModel *tm, GtkTreeIter *iter )
+{
+	return chmodel_iter_set ( CHMODEL_LIST ( tm ), iter, (int64_t)chmodel_iter_row ( iter ) - 1 );
+}
+
+static gboolean chmodel_iter_nth_child ( GtkTreeModel *tm, GtkTreeIter *iter, GtkTreeIter *parent, int n )
+{
+	if ( parent ) { iter->stamp = 0; return FALSE; }
+
+	return chmodel_iter_set ( CHMODEL_LIST ( tm ), iter, n );
+}
+
+static gboolean chmodel_iter_children ( GtkTreeModel *tm, GtkTreeIter *iter, GtkTreeIter *parent )
+{
+	return chmodel_iter_nth_child ( tm, iter, parent, 0 );
+}
+
+static gboolean chmodel_iter_has_child ( G_GNUC_UNUSED GtkTreeModel *tm, G_GNUC_UNUSED GtkTreeIter *iter )
+{
+	return FALSE;
+}
+
+static int chmodel_iter_n_children ( GtkTreeModel *tm, GtkTreeIter *iter )
+{
+	return ( iter ) ? 0 : (int)CHMODEL_LIST ( tm )->n_rows;
+}
+
+static gboolean chmodel_iter_parent ( G_GNUC_UNUSED GtkTreeModel *tm, GtkTreeIter *iter, G_GNUC_UNUSED GtkTreeIter *child )
+{
+	iter->stamp = 0;
+
+	return FALSE;
+}
+
+static void chmodel_tree_model_init ( GtkTreeModelIface *iface )
+{
+	iface->get_flags       = chmodel_get_flags;
+	iface->get_n_columns   = chmodel_get_n_columns;
+	iface->get_column_type = chmodel_get_column_type;
+	iface->get_iter        = chmodel_get_iter;
+	iface->get_path        = chmodel_get_path;
+	iface->get_value       = chmodel_get_value;
+	iface->iter_next       = chmodel_iter_next;
+	iface->iter_previous   = chmodel_iter_previous;
+	iface->iter_children   = chmodel_iter_children;
+	iface->iter_has_child  = chmodel_iter_has_child;
+	iface->iter_n_children = chmodel_iter_n_children;
+	iface->iter_nth_child  = chmodel_iter_nth_child;
+	iface->iter_parent     = chmodel_iter_parent;
+}
+
+ChTable * chmodel_table ( ChModel *model )
+{
+	return model->table;
+}
+
+static void chmodel_init ( ChModel *model )
+{
+	model->stamp = g_random_int ();
+}
+
+static void chmodel_finalize ( GObject *object )
+{
+	ChModel *model = CHMODEL_LIST ( object );
+
+	chtable_unref ( model->table );
+	free ( model->rows );
+
+	G_OBJECT_CLASS (chmodel_parent_class)->finalize (object);
+}
+
+static void chmodel_class_init ( ChModelClass *class )
+{
+	G_OBJECT_CLASS (class)->finalize = chmodel_finalize;
+}
+
+/* The model keeps a reference to the table; NULL - an empty list */
+ChModel * chmodel_new ( ChTable *table )
+{
+	ChModel *model = g_object_new ( CHMODEL_TYPE_LIST, NULL );
+
+	model->table = ( table ) ? chtable_ref ( table ) : chtable_new ( NULL );
+	model->n_rows = model->table->count;
+
+	return model;
+}
+
+/* Only the given table rows ( search results ); the model takes rows */
+ChModel * chmodel_new_filter ( ChTable *table, uint32_t *rows, uint32_t n_rows )
+{
+	ChModel *model = chmodel_new ( table );
+
+	model->rows = rows;
+	model->n_rows = n_rows;
+
+	return model;
+}
@@ -0,0 +1,36 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "chtable.h"
+
+#include <gtk/gtk.h>
+
+enum cols_n
+{
+	COL_NUM,
+	COL_REC,
+	COL_CHL,
+	COL_SIZE,
+	COL_VPID,
+	COL_APID,
+	COL_FILE,
+	NUM_COLS
+};
+
+#define CHMODEL_TYPE_LIST chmodel_get_type ()
+
+G_DECLARE_FINAL_TYPE ( ChModel, chmodel, CHMODEL, LIST, GObject )
+
+ChModel * chmodel_new ( ChTable * );
+
+ChModel * chmodel_new_filter ( ChTable *, uint32_t *, uint32_t );
+
+ChTable * chmodel_table ( ChModel * );
@@ -0,0 +1,101 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "chtable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Two passes over chdb: sizes, then one allocation for all arrays and the names */
+ChTable * chtable_new ( ChDb *db )
+{
+	ChDbInfo info;
+	uint32_t count = 0, n_db = ( db ) ? chdb_count ( db ) : 0;
+	size_t blob_len = 0;
+
+	uint32_t r = 0; for ( r = 0; r < n_db; r++ )
+	{
+		chdb_info ( db, r, &info );
+
+		if ( info.channel  ) { count++; blob_len += strlen ( info.channel  ) + 1; }
+		if ( info.vchannel ) { count++; blob_len += strlen ( info.vchannel ) + 1; }
+	}
+
+	// widest first: every array stays aligned
+	size_t arrays = (size_t)count * ( 3 * sizeof ( uint32_t ) + 3 * sizeof ( uint16_t ) );
+
+	ChTable *table = g_new0 ( ChTable, 1 );
+
+	table->ref   = 1;
+	table->count = count;
+	table->size  = arrays + blob_len;
+
+	char *arena = g_malloc ( table->size + 1 );
+
+	table->name = (uint32_t *)arena;
+	table->row  = table->name + count;
+	table->freq = table->row  + count;
+	table->sid  = (uint16_t *)( table->freq + count );
+	table->vpid = table->sid  + count;
+	table->apid = table->vpid + count;
+	table->blob = arena + arrays;
+
+	uint32_t i = 0, off = 0;
+
+	for ( r = 0; r < n_db; r++ )
+	{
+		chdb_info ( db, r, &info );
+
+		const char *names[2] = { info.channel, info.vchannel };
+
+		uint8_t c = 0; for ( c = 0; c < 2; c++ )
+		{
+			if ( !names[c] ) continue;
+
+			size_t len = strlen ( names[c] ) + 1;
+			memcpy ( table->blob + off, names[c], len );
+
+			table->name[i] = off;
+			table->row[i]  = r;
+			table->freq[i] = info.freq;
+			table->sid[i]  = info.sid;
+			table->vpid[i] = info.vpid;
+			table->apid[i] = info.apid;
+
+			off += (uint32_t)len;
+			i++;
+		}
+	}
+
+	table->index = chindex_new ( table );
+
+	return table;
+}
+
+ChTable * chtable_ref ( ChTable *table )
+{
+	g_atomic_int_inc ( &table->ref );
+
+	return table;
+}
+
+void chtable_unref ( ChTable *table )
+{
+	if ( !table || !g_atomic_int_dec_and_test ( &table->ref ) ) return;
+
+	chindex_free ( table->index );
+
+	free ( table->name ); // the arena
+	free ( table );
+}
+
+const char * chtable_name ( const ChTable *table, uint32_t i )
+{
+	return ( i < table->count ) ? table->blob + table->name[i] : NULL;
+}
@@ -0,0 +1,40 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "chdb.h"
+#include "chindex.h"
+
+typedef struct _ChTable ChTable;
+
+/* The zap list as a struct of arrays: one row per channel and per vchannel, names in one blob */
+struct _ChTable
+{
+	gint ref;
+	uint32_t count;
+
+	uint32_t *name; // offset into blob
+	uint32_t *row;  // chdb row
+	uint32_t *freq;
+	uint16_t *sid, *vpid, *apid;
+
+	char *blob;
+	size_t size; // bytes, arrays + blob
+
+	ChIndex *index; // search, built with the table
+};
+
+ChTable * chtable_new ( ChDb * );
+
+ChTable * chtable_ref ( ChTable * );
+
+void chtable_unref ( ChTable * );
+
+const char * chtable_name ( const ChTable *, uint32_t );
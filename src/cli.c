@@ -0,0 +1,386 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "cli.h"
+#include "ctl.h"
+#include "file.h"
+#include "ztrace.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <locale.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+
+/*
+* Batch jobs without GTK: one JSON object per line on stdout, the log on stderr.
+* Exit: 0 - done, 1 - usage or device error, 2 - no lock ( replay: a milestone not reached ).
+*/
+
+enum cli_cmd { CLI_SCAN, CLI_ZAP, CLI_RECORD, CLI_MONITOR, CLI_REPLAY, CLI_ALL };
+
+static const char *cli_cmds[CLI_ALL] = { "scan", "zap", "record", "monitor", "replay" };
+
+typedef struct _Cli Cli;
+
+struct _Cli
+{
+	Dvb *dvb;
+	GMainLoop *loop;
+
+	uint8_t cmd;
+	int status;
+	gboolean done; // a quit before the loop runs
+
+	char *call_error; // returned by dvb-zap or dvb-scan-set-data
+
+	gint64 t_main; // monotonic, at cli_run
+	gint64 t_start; // monotonic, at the lock: record and monitor run from there
+	uint32_t seconds;
+
+	char *out;
+	DwrRecMonitor dm;
+	GThread *rec;
+	uint8_t adapter;
+};
+
+gboolean cli_command ( const char *arg )
+{
+	uint8_t c = 0; for ( c = 0; c < CLI_ALL; c++ ) if ( g_str_equal ( arg, cli_cmds[c] ) ) return TRUE;
+
+	return FALSE;
+}
+
+/* ms from exec: the dynamic loader included; -1 - unknown */
+static int64_t cli_exec_ms ( void )
+{
+	g_autofree char *stat = NULL;
+
+	if ( !g_file_get_contents ( "/proc/self/stat", &stat, NULL, NULL ) ) return -1;
+
+	// comm may hold spaces: the fields start after the last ')'
+	const char *p = strrchr ( stat, ')' );
+
+	if ( !p ) return -1;
+
+	g_auto ( GStrv ) fields = g_strsplit ( p + 2, " ", 0 );
+
+	// starttime: field 22, 20th after comm
+	if ( g_strv_length ( fields ) < 20 ) return -1;
+
+	uint64_t start = g_ascii_strtoull ( fields[19], NULL, 10 );
+
+	struct timespec ts;
+	if ( clock_gettime ( CLOCK_BOOTTIME, &ts ) == -1 ) return -1;
+
+	long hz = sysconf ( _SC_CLK_TCK );
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - (int64_t)( start * 1000 / (uint64_t)( ( hz > 0 ) ? hz : 100 ) );
+}
+
+static void cli_print ( GString *s )
+{
+	g_string_append ( s, "}\n" );
+
+	fwrite ( s->str, 1, s->len, stdout );
+	fflush ( stdout );
+
+	g_string_free ( s, TRUE );
+}
+
+static void cli_quit ( Cli *cli, int status )
+{
+	if ( !cli->status ) cli->status = status;
+
+	cli->done = TRUE;
+	g_main_loop_quit ( cli->loop );
+}
+
+static gboolean cli_signal ( Cli *cli )
+{
+	cli_quit ( cli, 0 );
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean cli_timeout ( Cli *cli )
+{
+	cli_quit ( cli, 0 );
+
+	return G_SOURCE_REMOVE;
+}
+
+static void cli_info ( G_GNUC_UNUSED Dvb *dvb, const char *info, G_GNUC_UNUSED Cli *cli )
+{
+	GString *s = ctl_json_begin ( "event", "info" );
+	ctl_json_str ( s, "info", info );
+
+	cli_print ( s );
+}
+
+static void cli_scan_tp ( G_GNUC_UNUSED Dvb *dvb, uint32_t freq, uint32_t lock_ms, uint32_t dwell_ms, uint32_t services, G_GNUC_UNUSED Cli *cli )
+{
+	GString *s = ctl_json_begin ( "event", "scan-transponder" );
+
+	ctl_json_int ( s, "freq", freq );
+	ctl_json_int ( s, "lock_ms", lock_ms );
+	ctl_json_int ( s, "dwell_ms", dwell_ms );
+	ctl_json_int ( s, "services", services );
+
+	cli_print ( s );
+}
+
+static void cli_scan_done ( G_GNUC_UNUSED Dvb *dvb, uint32_t transponders, uint32_t programs, Cli *cli )
+{
+	GString *s = ctl_json_begin ( "event", "scan-done" );
+
+	ctl_json_int ( s, "transponders", transponders );
+	ctl_json_int ( s, "programs", programs );
+	ctl_json_int ( s, "ms", ( g_get_monotonic_time () - cli->t_main ) / 1000 );
+
+	cli_print ( s );
+
+	cli_quit ( cli, 0 );
+}
+
+static void cli_stats ( G_GNUC_UNUSED Dvb *dvb, uint32_t freq, uint8_t qual, const char *sgl, const char *snr, uint8_t sgl_p, uint8_t snr_p, gboolean fe_lock, Cli *cli )
+{
+	if ( cli->cmd != CLI_MONITOR && cli->cmd != CLI_RECORD ) return;
+
+	GString *s = ctl_json_begin ( "event", "stats" );
+
+	ctl_json_int  ( s, "freq", freq );
+	ctl_json_int  ( s, "quality", qual );
+	ctl_json_str  ( s, "signal", sgl );
+	ctl_json_str  ( s, "cn", snr );
+	ctl_json_int  ( s, "signal_p", sgl_p );
+	ctl_json_int  ( s, "cn_p", snr_p );
+	ctl_json_bool ( s, "lock", fe_lock );
+
+	if ( cli->rec ) ctl_json_int ( s, "bytes", (int64_t)cli->dm.total_rec );
+
+	cli_print ( s );
+}
+
+/* Record and monitor run for seconds from here; 0 - until a signal */
+static void cli_zap_lock ( G_GNUC_UNUSED Dvb *dvb, uint32_t ms, gboolean timeout, G_GNUC_UNUSED gboolean tuned, Cli *cli )
+{
+	GString *s = ctl_json_begin ( "event", "lock" );
+
+	ctl_json_bool ( s, "lock", !timeout );
+	ctl_json_int  ( s, "ms", ms );
+	ctl_json_int  ( s, "main_ms", ( g_get_monotonic_time () - cli->t_main ) / 1000 );
+	ctl_json_int  ( s, "exec_ms", cli_exec_ms () );
+
+	cli_print ( s );
+
+	if ( timeout && cli->cmd != CLI_MONITOR ) { cli_quit ( cli, 2 ); return; }
+
+	if ( cli->cmd == CLI_ZAP ) { cli_quit ( cli, 0 ); return; }
+
+	cli->t_start = g_get_monotonic_time ();
+
+	if ( cli->cmd == CLI_RECORD && !cli->rec )
+	{
+		cli->dm.stop_rec  = 0;
+		cli->dm.total_rec = 0;
+
+		const char *err = dvr_rec_start ( cli->adapter, cli->out, &cli->dm, &cli->rec );
+
+		if ( err ) { cli_info ( NULL, err, cli ); cli_quit ( cli, 1 ); return; }
+	}
+
+	if ( cli->seconds ) g_timeout_add_seconds ( cli->seconds, (GSourceFunc)cli_timeout, cli );
+}
+
+static void cli_zap_trace ( G_GNUC_UNUSED Dvb *dvb, const char *channel, const char *trace, G_GNUC_UNUSED Cli *cli )
+{
+	GString *s = ctl_json_begin ( "event", "zap-trace" );
+
+	ctl_json_str ( s, "channel", channel );
+	ctl_json_str ( s, "trace", trace );
+
+	cli_print ( s );
+}
+
+static void cli_zap_adapter ( G_GNUC_UNUSED Dvb *dvb, uint8_t a, G_GNUC_UNUSED uint8_t f, G_GNUC_UNUSED uint8_t d, Cli *cli )
+{
+	cli->adapter = a;
+}
+
+/* Zap-latency benchmark without a frontend: the stream milestones of a recorded TS; log - the zap CSV log, optional */
+static int cli_replay ( const char *file, uint16_t sid, uint16_t vpid, uint32_t bitrate, const char *log )
+{
+	const char *keys[ZT_ALL] = { NULL, NULL, NULL, "pat_us", "pmt_us", "video_us", "iframe_us" };
+
+	ZapTrace tr;
+
+	if ( !ztrace_replay ( file, sid, vpid, bitrate, &tr ) ) return 1;
+
+	gboolean done = ztrace_stream_done ( &tr );
+
+	GString *s = ctl_json_begin ( "event", "replay" );
+
+	ctl_json_str ( s, "file", file );
+	ctl_json_int ( s, "sid", sid );
+	ctl_json_int ( s, "vpid", vpid );
+	ctl_json_int ( s, "bitrate", bitrate );
+
+	// µs of stream time from the first byte; -1 - not reached
+	uint8_t m = 0; for ( m = ZT_PAT; m < ZT_ALL; m++ ) ctl_json_int ( s, keys[m], ( tr.mark[m] ) ? tr.mark[m] : -1 );
+
+	ctl_json_bool ( s, "complete", done );
+
+	cli_print ( s );
+
+	if ( log && !ztrace_log_append ( log, &tr ) ) return 1;
+
+	return ( done ) ? 0 : 2;
+}
+
+static void cli_usage ( GOptionContext *ctx )
+{
+	g_autofree char *help = g_option_context_get_help ( ctx, TRUE, NULL );
+
+	fprintf ( stderr, "%s", help );
+}
+
+/* argv[0] - the command */
+int cli_run ( int argc, char **argv )
+{
+	setlocale ( LC_NUMERIC, "C" );
+
+	Cli cli;
+	memset ( &cli, 0, sizeof ( Cli ) );
+
+	cli.t_main = g_get_monotonic_time ();
+
+	uint8_t c = 0; for ( c = 0; c < CLI_ALL && !g_str_equal ( argv[0], cli_cmds[c] ); c++ );
+
+	cli.cmd = c;
+
+	int a = 0, f = 0, d = 0, tm = 2, seconds = 0, dmx_out = DMX_OUT_TS_TAP, sid = 0, vpid = 0, bitrate = 0;
+	char *channel = NULL, *input = NULL, *output = NULL;
+
+	GOptionEntry entries[] =
+	{
+		{ "adapter",   'a', 0, G_OPTION_ARG_INT,      &a,        "Adapter", "N" },
+		{ "frontend",  'f', 0, G_OPTION_ARG_INT,      &f,        "Frontend", "N" },
+		{ "demux",     'd', 0, G_OPTION_ARG_INT,      &d,        "Demux", "N" },
+		{ "channel",   'c', 0, G_OPTION_ARG_STRING,   &channel,  "Channel ( zap, record, monitor )", "NAME" },
+		{ "input",     'i', 0, G_OPTION_ARG_FILENAME, &input,    "Initial file ( scan ), channel file or TS ( replay )", "FILE" },
+		{ "output",    'o', 0, G_OPTION_ARG_FILENAME, &output,   "Channel file ( scan ), recording or CSV log ( replay )", "FILE" },
+		{ "time-mult", 'T', 0, G_OPTION_ARG_INT,      &tm,       "Scan timeout multiplier", "N" },
+		{ "seconds",   't', 0, G_OPTION_ARG_INT,      &seconds,  "Record / monitor time after the lock; 0 - until a signal", "S" },
+		{ "dmx-out",   'x', 0, G_OPTION_ARG_INT,      &dmx_out,  "Zap output: 0 decoder, 1 tap, 2 TS tap, 3 TS demux tap", "N" },
+		{ "sid",       's', 0, G_OPTION_ARG_INT,      &sid,      "Service id ( replay )", "N" },
+		{ "vpid",      'v', 0, G_OPTION_ARG_INT,      &vpid,     "Video pid ( replay )", "N" },
+		{ "bitrate",   'b', 0, G_OPTION_ARG_INT,      &bitrate,  "Mux bitrate, bit/s: the replay clock", "N" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	g_autofree char *param = g_strdup_printf ( "%s - dvbv5-gtk batch job", argv[0] );
+
+	GOptionContext *ctx = g_option_context_new ( param );
+	g_option_context_add_main_entries ( ctx, entries, NULL );
+
+	GError *error = NULL;
+	gboolean ok = g_option_context_parse ( ctx, &argc, &argv, &error );
+
+	if ( error ) { fprintf ( stderr, "%s\n", error->message ); g_error_free ( error ); }
+
+	if ( ok )
+	{
+		if ( cli.cmd == CLI_SCAN ) ok = ( input && output );
+		else if ( cli.cmd == CLI_REPLAY ) ok = ( input && bitrate > 0 );
+		else ok = ( channel && input && ( cli.cmd != CLI_RECORD || ( output && seconds > 0 ) ) );
+	}
+
+	if ( !ok ) cli_usage ( ctx );
+
+	g_option_context_free ( ctx );
+
+	if ( !ok ) { free ( channel ); free ( input ); free ( output ); return 1; }
+
+	if ( cli.cmd == CLI_REPLAY )
+	{
+		int ret = cli_replay ( input, (uint16_t)sid, (uint16_t)vpid, (uint32_t)bitrate, output );
+
+		free ( channel ); free ( input ); free ( output );
+
+		return ret;
+	}
+
+	cli.out = output;
+	cli.seconds = (uint32_t)MAX ( seconds, 0 );
+	cli.adapter = (uint8_t)a;
+	cli.dm.stop_rec = 1;
+	cli.loop = g_main_loop_new ( NULL, FALSE );
+	cli.dvb = dvb_new ();
+
+	g_signal_connect ( cli.dvb, "dvb-scan-info",    G_CALLBACK ( cli_info        ), &cli );
+	g_signal_connect ( cli.dvb, "scan-transponder", G_CALLBACK ( cli_scan_tp     ), &cli );
+	g_signal_connect ( cli.dvb, "scan-done",        G_CALLBACK ( cli_scan_done   ), &cli );
+	g_signal_connect ( cli.dvb, "stats-update",     G_CALLBACK ( cli_stats       ), &cli );
+	g_signal_connect ( cli.dvb, "zap-lock",         G_CALLBACK ( cli_zap_lock    ), &cli );
+	g_signal_connect ( cli.dvb, "zap-trace",        G_CALLBACK ( cli_zap_trace   ), &cli );
+	g_signal_connect ( cli.dvb, "zap-adapter",      G_CALLBACK ( cli_zap_adapter ), &cli );
+
+	guint sig_int  = g_unix_signal_add ( SIGINT,  (GSourceFunc)cli_signal, &cli );
+	guint sig_term = g_unix_signal_add ( SIGTERM, (GSourceFunc)cli_signal, &cli );
+
+	if ( cli.cmd == CLI_SCAN )
+		g_signal_emit_by_name ( cli.dvb, "dvb-scan-set-data", (uint8_t)a, (uint8_t)f, (uint8_t)d, (uint8_t)tm, 0, 0, 0, 0, -1, 0,
+			"NONE", "Auto", input, output, "DVBV5", "DVBV5", &cli.call_error );
+	else
+		g_signal_emit_by_name ( cli.dvb, "dvb-zap", (uint8_t)a, (uint8_t)f, (uint8_t)d, (uint8_t)dmx_out, TRUE, channel, input, &cli.call_error );
+
+	GString *s = ctl_json_begin ( "event", ( cli.cmd == CLI_SCAN ) ? "scan" : "tune" );
+
+	ctl_json_str ( s, "error", cli.call_error );
+	ctl_json_int ( s, "main_ms", ( g_get_monotonic_time () - cli.t_main ) / 1000 );
+	ctl_json_int ( s, "exec_ms", cli_exec_ms () );
+
+	cli_print ( s );
+
+	if ( cli.call_error ) cli.status = 1; else if ( !cli.done ) g_main_loop_run ( cli.loop );
+
+	if ( cli.rec )
+	{
+		uint64_t total = cli.dm.total_rec;
+
+		cli.dm.stop_rec = 1;
+		g_thread_join ( cli.rec );
+
+		s = ctl_json_begin ( "event", "record" );
+
+		ctl_json_str ( s, "file", cli.out );
+		ctl_json_int ( s, "bytes", (int64_t)total );
+		ctl_json_int ( s, "ms", ( g_get_monotonic_time () - cli.t_start ) / 1000 );
+
+		cli_print ( s );
+	}
+
+	if ( cli.cmd == CLI_SCAN ) g_signal_emit_by_name ( cli.dvb, "dvb-scan-stop" ); else g_signal_emit_by_name ( cli.dvb, "dvb-zap-stop" );
+
+	g_source_remove ( sig_int );
+	g_source_remove ( sig_term );
+
+	g_object_unref ( cli.dvb );
+	g_main_loop_unref ( cli.loop );
+
+	free ( cli.call_error );
+	free ( channel );
+	free ( input );
+	free ( output );
+
+	return cli.status;
+}
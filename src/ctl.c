@@ -0,0 +1,756 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#define _GNU_SOURCE
+
+#include "ctl.h"
+#include "file.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define CTL_LINE_MAX ( 64 * 1024 )   // one request
+#define CTL_OUT_MAX  ( 1024 * 1024 ) // queued per client: events beyond are dropped, replies never
+
+/*
+* Control of a Dvb over a Unix socket, one JSON object per line ( varlink-like ):
+*   -> { "method": "zap", "adapter": 0, "channel": "...", "file": "..." }
+*   <- { "reply": "zap", "ok": true } or { "reply": "zap", "error": "..." }
+*   <- { "event": "stats", ... } - to the clients that called "subscribe"
+* Requests are flat objects: strings, numbers, booleans. Everything runs in the main loop;
+* the data path ( frontend monitor, recorder threads ) never waits for a client.
+*/
+
+typedef struct _CtlClient CtlClient;
+
+struct _CtlClient
+{
+	Ctl *ctl;
+	int fd;
+	guint src_in, src_out;
+
+	GString *in, *out;
+
+	gboolean subscribed, dead;
+	uint32_t dropped;
+};
+
+struct _Ctl
+{
+	Dvb *dvb; // not owned
+	int fd;
+	guint src;
+	char *path;
+
+	GPtrArray *clients; // CtlClient
+
+	char *call_error; // returned by the request's signal, freed after the reply
+
+	gboolean zap;
+	uint8_t adapter;
+
+	DwrRecMonitor dm;
+	GThread *rec;
+};
+
+typedef const char * ( *CtlMethod ) ( CtlClient *, GHashTable *, GString * );
+
+char * ctl_default_path ( void )
+{
+	return g_build_filename ( g_get_user_runtime_dir (), CTL_SOCK, NULL );
+}
+
+/* JSON: the replies and events here, the batch output of cli.c */
+
+static void ctl_json_escape ( GString *s, const char *str )
+{
+	g_string_append_c ( s, '"' );
+
+	const char *p = NULL; for ( p = str; p && *p; p++ )
+	{
+		if ( *p == '"' || *p == '\\' ) { g_string_append_c ( s, '\\' ); g_string_append_c ( s, *p ); }
+		else if ( (uint8_t)*p < 0x20 ) g_string_append_printf ( s, "\\u%04x", (uint8_t)*p );
+		else g_string_append_c ( s, *p );
+	}
+
+	g_string_append_c ( s, '"' );
+}
+
+GString * ctl_json_begin ( const char *kind, const char *name )
+{
+	GString *s = g_string_new ( "{" );
+
+	ctl_json_escape ( s, kind );
+	g_string_append_c ( s, ':' );
+	ctl_json_escape ( s, name );
+
+	return s;
+}
+
+void ctl_json_str ( GString *s, const char *key, const char *val )
+{
+	g_string_append_c ( s, ',' );
+	ctl_json_escape ( s, key );
+	g_string_append_c ( s, ':' );
+
+	if ( val ) ctl_json_escape ( s, val ); else g_string_append ( s, "null" );
+}
+
+void ctl_json_int ( GString *s, const char *key, int64_t val )
+{
+	g_string_append_c ( s, ',' );
+	ctl_json_escape ( s, key );
+	g_string_append_printf ( s, ":%" G_GINT64_FORMAT, val );
+}
+
+void ctl_json_bool ( GString *s, const char *key, gboolean val )
+{
+	g_string_append_c ( s, ',' );
+	ctl_json_escape ( s, key );
+	g_string_append ( s, ( val ) ? ":true" : ":false" );
+}
+
+static const char * ctl_json_ws ( const char *p )
+{
+	while ( *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' ) p++;
+
+	return p;
+}
+
+static const char * ctl_json_string ( const char *p, GString *s )
+{
+	if ( *p++ != '"' ) return NULL;
+
+	while ( *p && *p != '"' )
+	{
+		if ( *p != '\\' ) { g_string_append_c ( s, *p++ ); continue; }
+
+		p++;
+
+		switch ( *p )
+		{
+			case 'b': g_string_append_c ( s, '\b' ); break;
+			case 'f': g_string_append_c ( s, '\f' ); break;
+			case 'n': g_string_append_c ( s, '\n' ); break;
+			case 'r': g_string_append_c ( s, '\r' ); break;
+			case 't': g_string_append_c ( s, '\t' ); break;
+			case 'u':
+			{
+				char hex[5] = { 0 };
+				if ( strlen ( p + 1 ) < 4 ) return NULL;
+				memcpy ( hex, p + 1, 4 );
+
+				gunichar c = (gunichar)g_ascii_strtoull ( hex, NULL, 16 );
+
+				// a surrogate pair: two escapes
+				if ( c >= 0xd800 && c < 0xdc00 && g_str_has_prefix ( p + 5, "\\u" ) && strlen ( p + 7 ) >= 4 )
+				{
+					memcpy ( hex, p + 7, 4 );
+					gunichar lo = (gunichar)g_ascii_strtoull ( hex, NULL, 16 );
+
+					if ( lo >= 0xdc00 && lo < 0xe000 ) { c = 0x10000 + ( ( c - 0xd800 ) << 10 ) + ( lo - 0xdc00 ); p += 6; }
+				}
+
+				g_string_append_unichar ( s, c );
+				p += 4;
+				break;
+			}
+			case '\0': return NULL;
+			default: g_string_append_c ( s, *p ); break; // " \ /
+		}
+
+		p++;
+	}
+
+	return ( *p == '"' ) ? p + 1 : NULL;
+}
+
+/* A flat object: key -> value text ( numbers and booleans as written ); NULL - not one */
+static GHashTable * ctl_json_parse ( const char *line )
+{
+	GHashTable *obj = g_hash_table_new_full ( g_str_hash, g_str_equal, g_free, g_free );
+
+	const char *p = ctl_json_ws ( line );
+
+	if ( *p++ != '{' ) { g_hash_table_destroy ( obj ); return NULL; }
+
+	p = ctl_json_ws ( p );
+
+	while ( p && *p && *p != '}' )
+	{
+		GString *key = g_string_new ( NULL ), *val = g_string_new ( NULL );
+
+		p = ctl_json_string ( p, key );
+		p = ( p ) ? ctl_json_ws ( p ) : NULL;
+		p = ( p && *p == ':' ) ? ctl_json_ws ( p + 1 ) : NULL;
+
+		if ( p && *p == '"' )
+			p = ctl_json_string ( p, val );
+		else if ( p && *p && strchr ( "-0123456789tfn", *p ) )
+		{
+			size_t len = strspn ( p, "-+.0123456789eEtruefalsn" );
+			g_string_append_len ( val, p, (gssize)len );
+			p += len;
+		}
+		else
+			p = NULL; // nested objects and arrays are not part of the protocol
+
+		if ( p && !g_str_equal ( val->str, "null" ) ) g_hash_table_replace ( obj, g_string_free ( key, FALSE ), g_string_free ( val, FALSE ) );
+		else { g_string_free ( key, TRUE ); g_string_free ( val, TRUE ); }
+
+		p = ( p ) ? ctl_json_ws ( p ) : NULL;
+
+		if ( p && *p == ',' ) p = ctl_json_ws ( p + 1 ); else if ( p && *p != '}' ) p = NULL;
+	}
+
+	if ( !p || *p != '}' ) { g_hash_table_destroy ( obj ); return NULL; }
+
+	return obj;
+}
+
+static const char * ctl_str ( GHashTable *obj, const char *key, const char *def )
+{
+	const char *val = g_hash_table_lookup ( obj, key );
+
+	return ( val ) ? val : def;
+}
+
+static int64_t ctl_int ( GHashTable *obj, const char *key, int64_t def )
+{
+	const char *val = g_hash_table_lookup ( obj, key );
+
+	return ( val ) ? g_ascii_strtoll ( val, NULL, 10 ) : def;
+}
+
+static gboolean ctl_bool ( GHashTable *obj, const char *key, gboolean def )
+{
+	const char *val = g_hash_table_lookup ( obj, key );
+
+	return ( val ) ? ( g_str_equal ( val, "true" ) || g_str_equal ( val, "1" ) ) : def;
+}
+
+/* Clients */
+
+static gboolean ctl_client_write ( int fd, GIOCondition cond, CtlClient *client );
+
+static void ctl_client_flush ( CtlClient *client )
+{
+	while ( client->out->len )
+	{
+		ssize_t n = send ( client->fd, client->out->str, client->out->len, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+		if ( n > 0 ) { g_string_erase ( client->out, 0, n ); continue; }
+
+		if ( n == -1 && errno == EINTR ) continue;
+
+		if ( n == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+		{
+			if ( !client->src_out ) client->src_out = g_unix_fd_add ( client->fd, G_IO_OUT, (GUnixFDSourceFunc)ctl_client_write, client );
+
+			return;
+		}
+
+		// the read side sees the hang-up and closes
+		client->dead = TRUE;
+		g_string_truncate ( client->out, 0 );
+	}
+}
+
+static gboolean ctl_client_write ( G_GNUC_UNUSED int fd, G_GNUC_UNUSED GIOCondition cond, CtlClient *client )
+{
+	client->src_out = 0;
+
+	ctl_client_flush ( client );
+
+	return G_SOURCE_REMOVE;
+}
+
+/* line - without the newline, consumed */
+static void ctl_client_send ( CtlClient *client, GString *line, gboolean event )
+{
+	if ( client->dead || ( event && client->out->len > CTL_OUT_MAX ) )
+	{
+		if ( event ) client->dropped++;
+
+		return;
+	}
+
+	g_string_append_len ( client->out, line->str, (gssize)line->len );
+	g_string_append_c ( client->out, '\n' );
+
+	ctl_client_flush ( client );
+}
+
+static void ctl_client_free ( CtlClient *client )
+{
+	if ( client->src_in  ) g_source_remove ( client->src_in  );
+	if ( client->src_out ) g_source_remove ( client->src_out );
+
+	close ( client->fd );
+
+	if ( client->dropped ) g_message ( "%s:: events dropped: %u ", __func__, client->dropped );
+
+	g_string_free ( client->in,  TRUE );
+	g_string_free ( client->out, TRUE );
+
+	free ( client );
+}
+
+static void ctl_event ( Ctl *ctl, GString *line )
+{
+	g_string_append_c ( line, '}' );
+
+	uint32_t i = 0; for ( i = 0; i < ctl->clients->len; i++ )
+	{
+		CtlClient *client = g_ptr_array_index ( ctl->clients, i );
+
+		if ( client->subscribed ) ctl_client_send ( client, line, TRUE );
+	}
+
+	g_string_free ( line, TRUE );
+}
+
+/* Methods: NULL - ok, else the error; reply - extra fields */
+
+static const char * ctl_m_subscribe ( CtlClient *client, G_GNUC_UNUSED GHashTable *obj, G_GNUC_UNUSED GString *reply )
+{
+	client->subscribed = TRUE;
+
+	return NULL;
+}
+
+static const char * ctl_m_info ( CtlClient *client, GHashTable *obj, G_GNUC_UNUSED GString *reply )
+{
+	g_signal_emit_by_name ( client->ctl->dvb, "dvb-info", (uint8_t)ctl_int ( obj, "adapter", 0 ), (uint8_t)ctl_int ( obj, "frontend", 0 ) );
+
+	return NULL;
+}
+
+static const char * ctl_m_record_stop ( CtlClient *client, G_GNUC_UNUSED GHashTable *obj, GString *reply )
+{
+	Ctl *ctl = client->ctl;
+
+	if ( !ctl->rec ) return "Not recording.";
+
+	uint64_t total = ctl->dm.total_rec;
+
+	ctl->dm.stop_rec = 1;
+	g_thread_join ( ctl->rec );
+	ctl->rec = NULL;
+
+	ctl_json_int ( reply, "bytes", (int64_t)total );
+
+	return NULL;
+}
+
+static const char * ctl_m_zap ( CtlClient *client, GHashTable *obj, G_GNUC_UNUSED GString *reply )
+{
+	Ctl *ctl = client->ctl;
+
+	const char *channel = ctl_str ( obj, "channel", NULL ), *file = ctl_str ( obj, "file", NULL );
+
+	if ( !channel || !file ) return "channel and file required.";
+
+	uint8_t a = (uint8_t)ctl_int ( obj, "adapter", 0 );
+
+	g_signal_emit_by_name ( ctl->dvb, "dvb-zap", a, (uint8_t)ctl_int ( obj, "frontend", 0 ), (uint8_t)ctl_int ( obj, "demux", 0 ),
+		(uint8_t)ctl_int ( obj, "dmx_out", DMX_OUT_TS_TAP ), ctl_bool ( obj, "eit", TRUE ), channel, file, &ctl->call_error );
+
+	if ( !ctl->call_error ) { ctl->zap = TRUE; ctl->adapter = a; }
+
+	return ctl->call_error;
+}
+
+static const char * ctl_m_zap_stop ( CtlClient *client, GHashTable *obj, GString *reply )
+{
+	Ctl *ctl = client->ctl;
+
+	if ( ctl->rec ) ctl_m_record_stop ( client, obj, reply );
+
+	g_signal_emit_by_name ( ctl->dvb, "dvb-zap-stop" );
+
+	ctl->zap = FALSE;
+
+	return NULL;
+}
+
+/* The zap session's TS from the dvr device; dmx_out of the zap: DMX_OUT_TS_TAP */
+static const char * ctl_m_record ( CtlClient *client, GHashTable *obj, G_GNUC_UNUSED GString *reply )
+{
+	Ctl *ctl = client->ctl;
+
+	const char *file = ctl_str ( obj, "file", NULL );
+
+	if ( !file ) return "file required.";
+	if ( !ctl->zap ) return "Zap?";
+	if ( ctl->rec ) return "Recording already.";
+
+	ctl->dm.stop_rec  = 0;
+	ctl->dm.total_rec = 0;
+
+	return dvr_rec_start ( ctl->adapter, file, &ctl->dm, &ctl->rec );
+}
+
+static const char * ctl_m_scan ( CtlClient *client, GHashTable *obj, G_GNUC_UNUSED GString *reply )
+{
+	const char *fi = ctl_str ( obj, "input", NULL ), *fo = ctl_str ( obj, "output", NULL );
+
+	if ( !fi || !fo ) return "input and output required.";
+
+	g_signal_emit_by_name ( client->ctl->dvb, "dvb-scan-set-data",
+		(uint8_t)ctl_int ( obj, "adapter", 0 ), (uint8_t)ctl_int ( obj, "frontend", 0 ), (uint8_t)ctl_int ( obj, "demux", 0 ),
+		(uint8_t)ctl_int ( obj, "time_mult", 2 ), (uint8_t)ctl_bool ( obj, "new_freqs", FALSE ), (uint8_t)ctl_bool ( obj, "get_detect", FALSE ),
+		(uint8_t)ctl_bool ( obj, "get_nit", FALSE ), (uint8_t)ctl_bool ( obj, "other_nit", FALSE ),
+		(int)ctl_int ( obj, "sat_num", -1 ), (uint8_t)ctl_int ( obj, "diseqc_wait", 0 ),
+		ctl_str ( obj, "lnb", "NONE" ), ctl_str ( obj, "lna", "Auto" ), fi, fo,
+		ctl_str ( obj, "input_format", "DVBV5" ), ctl_str ( obj, "output_format", "DVBV5" ), &client->ctl->call_error );
+
+	return client->ctl->call_error;
+}
+
+static const char * ctl_m_scan_stop ( CtlClient *client, G_GNUC_UNUSED GHashTable *obj, G_GNUC_UNUSED GString *reply )
+{
+	g_signal_emit_by_name ( client->ctl->dvb, "dvb-scan-stop" );
+
+	return NULL;
+}
+
+static const char * ctl_m_schedule ( CtlClient *client, GHashTable *obj, GString *reply )
+{
+	const char *file = ctl_str ( obj, "file", NULL );
+
+	if ( !file ) return "file required.";
+
+	char *info = NULL;
+	g_signal_emit_by_name ( client->ctl->dvb, "dvb-sched-event", file, (uint16_t)ctl_int ( obj, "onid", 0 ), (uint16_t)ctl_int ( obj, "tsid", 0 ),
+		(uint16_t)ctl_int ( obj, "sid", 0 ), (uint16_t)ctl_int ( obj, "event_id", 0 ), &info );
+
+	ctl_json_str ( reply, "info", info );
+	free ( info );
+
+	return NULL;
+}
+
+/* A timed recording: start and stop in unix s, the scheduler adds its padding */
+static const char * ctl_m_record_at ( CtlClient *client, GHashTable *obj, GString *reply )
+{
+	const char *channel = ctl_str ( obj, "channel", NULL ), *file = ctl_str ( obj, "file", NULL );
+
+	if ( !channel || !file ) return "channel and file required.";
+
+	int64_t start = ctl_int ( obj, "start", 0 ), stop = ctl_int ( obj, "stop", 0 );
+
+	if ( !start || !stop ) return "start and stop required.";
+
+	char *info = NULL;
+	g_signal_emit_by_name ( client->ctl->dvb, "dvb-sched-add", file, channel, start, stop, &info );
+
+	ctl_json_str ( reply, "info", info );
+	free ( info );
+
+	return NULL;
+}
+
+static const char * ctl_m_status ( CtlClient *client, G_GNUC_UNUSED GHashTable *obj, GString *reply )
+{
+	Ctl *ctl = client->ctl;
+
+	ctl_json_bool ( reply, "zap", ctl->zap );
+	ctl_json_int  ( reply, "adapter", ctl->adapter );
+	ctl_json_bool ( reply, "record", ctl->rec != NULL );
+	ctl_json_int  ( reply, "bytes", (int64_t)ctl->dm.total_rec );
+	ctl_json_int  ( reply, "clients", ctl->clients->len );
+
+	return NULL;
+}
+
+static const struct { const char *name; CtlMethod func; } ctl_methods[] =
+{
+	{ "subscribe",   ctl_m_subscribe   },
+	{ "status",      ctl_m_status      },
+	{ "info",        ctl_m_info        },
+	{ "scan",        ctl_m_scan        },
+	{ "scan-stop",   ctl_m_scan_stop   },
+	{ "zap",         ctl_m_zap         },
+	{ "zap-stop",    ctl_m_zap_stop    },
+	{ "record",      ctl_m_record      },
+	{ "record-stop", ctl_m_record_stop },
+	{ "schedule",    ctl_m_schedule    },
+	{ "record-at",   ctl_m_record_at   }
+};
+
+static void ctl_call ( CtlClient *client, const char *line )
+{
+	Ctl *ctl = client->ctl;
+
+	GHashTable *obj = ctl_json_parse ( line );
+	const char *method = ( obj ) ? ctl_str ( obj, "method", "" ) : "";
+
+	GString *reply = ctl_json_begin ( "reply", method );
+
+	const char *error = ( obj ) ? "Unknown method." : "Parse error.";
+
+	uint8_t i = 0; for ( i = 0; obj && i < G_N_ELEMENTS ( ctl_methods ); i++ )
+	{
+		if ( !g_str_equal ( method, ctl_methods[i].name ) ) continue;
+
+		error = ctl_methods[i].func ( client, obj, reply );
+
+		break;
+	}
+
+	if ( error ) ctl_json_str ( reply, "error", error ); else ctl_json_bool ( reply, "ok", TRUE );
+
+	g_string_append_c ( reply, '}' );
+
+	ctl_client_send ( client, reply, FALSE );
+
+	g_string_free ( reply, TRUE );
+	free ( ctl->call_error );
+	ctl->call_error = NULL;
+
+	if ( obj ) g_hash_table_destroy ( obj );
+}
+
+static gboolean ctl_client_read ( int fd, G_GNUC_UNUSED GIOCondition cond, CtlClient *client )
+{
+	char buf[4096];
+
+	ssize_t n = read ( fd, buf, sizeof ( buf ) );
+
+	if ( n == -1 && ( errno == EAGAIN || errno == EINTR ) ) return G_SOURCE_CONTINUE;
+
+	if ( n <= 0 || client->in->len + (size_t)n > CTL_LINE_MAX )
+	{
+		client->src_in = 0;
+
+		g_ptr_array_remove ( client->ctl->clients, client );
+		ctl_client_free ( client );
+
+		return G_SOURCE_REMOVE;
+	}
+
+	g_string_append_len ( client->in, buf, n );
+
+	char *nl = NULL;
+
+	while ( ( nl = memchr ( client->in->str, '\n', client->in->len ) ) )
+	{
+		*nl = '\0';
+
+		if ( nl > client->in->str ) ctl_call ( client, client->in->str );
+
+		g_string_erase ( client->in, 0, nl - client->in->str + 1 );
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean ctl_accept ( int fd, G_GNUC_UNUSED GIOCondition cond, Ctl *ctl )
+{
+	int cfd = accept4 ( fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+	if ( cfd == -1 ) return G_SOURCE_CONTINUE;
+
+	CtlClient *client = g_new0 ( CtlClient, 1 );
+
+	client->ctl = ctl;
+	client->fd  = cfd;
+	client->in  = g_string_new ( NULL );
+	client->out = g_string_new ( NULL );
+	client->src_in = g_unix_fd_add ( cfd, G_IO_IN | G_IO_HUP | G_IO_ERR, (GUnixFDSourceFunc)ctl_client_read, client );
+
+	g_ptr_array_add ( ctl->clients, client );
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Events */
+
+static void ctl_ev_info ( G_GNUC_UNUSED Dvb *dvb, const char *info, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "info" );
+	ctl_json_str ( s, "info", info );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_name ( G_GNUC_UNUSED Dvb *dvb, const char *name, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "name" );
+	ctl_json_str ( s, "name", name );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_stats ( G_GNUC_UNUSED Dvb *dvb, uint32_t freq, uint8_t qual, const char *sgl, const char *snr, uint8_t sgl_p, uint8_t snr_p, gboolean fe_lock, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "stats" );
+
+	ctl_json_int  ( s, "freq", freq );
+	ctl_json_int  ( s, "quality", qual );
+	ctl_json_str  ( s, "signal", sgl );
+	ctl_json_str  ( s, "cn", snr );
+	ctl_json_int  ( s, "signal_p", sgl_p );
+	ctl_json_int  ( s, "cn_p", snr_p );
+	ctl_json_bool ( s, "lock", fe_lock );
+
+	if ( ctl->rec ) ctl_json_int ( s, "bytes", (int64_t)ctl->dm.total_rec );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_scan_tp ( G_GNUC_UNUSED Dvb *dvb, uint32_t freq, uint32_t lock_ms, uint32_t dwell_ms, uint32_t services, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "scan-transponder" );
+
+	ctl_json_int ( s, "freq", freq );
+	ctl_json_int ( s, "lock_ms", lock_ms );
+	ctl_json_int ( s, "dwell_ms", dwell_ms );
+	ctl_json_int ( s, "services", services );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_scan_done ( G_GNUC_UNUSED Dvb *dvb, uint32_t transponders, uint32_t programs, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "scan-done" );
+
+	ctl_json_int ( s, "transponders", transponders );
+	ctl_json_int ( s, "programs", programs );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_zap_lock ( G_GNUC_UNUSED Dvb *dvb, uint32_t ms, gboolean timeout, gboolean tuned, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "zap-lock" );
+
+	ctl_json_int  ( s, "ms", ms );
+	ctl_json_bool ( s, "timeout", timeout );
+	ctl_json_bool ( s, "tuned", tuned );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_zap_trace ( G_GNUC_UNUSED Dvb *dvb, const char *channel, const char *trace, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "zap-trace" );
+
+	ctl_json_str ( s, "channel", channel );
+	ctl_json_str ( s, "trace", trace );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_zap_psi ( G_GNUC_UNUSED Dvb *dvb, const char *change, Ctl *ctl )
+{
+	GString *s = ctl_json_begin ( "event", "zap-psi" );
+	ctl_json_str ( s, "change", change );
+
+	ctl_event ( ctl, s );
+}
+
+static void ctl_ev_zap_adapter ( G_GNUC_UNUSED Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, Ctl *ctl )
+{
+	ctl->adapter = a;
+
+	GString *s = ctl_json_begin ( "event", "zap-adapter" );
+
+	ctl_json_int ( s, "adapter", a );
+	ctl_json_int ( s, "frontend", f );
+	ctl_json_int ( s, "demux", d );
+
+	ctl_event ( ctl, s );
+}
+
+static int ctl_listen ( const char *path )
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+	if ( strlen ( path ) >= sizeof ( sun.sun_path ) ) { errno = ENAMETOOLONG; return -1; }
+
+	strcpy ( sun.sun_path, path );
+
+	int fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+	if ( fd == -1 ) return -1;
+
+	unlink ( path );
+
+	// the owner only: the socket tunes and records
+	mode_t mask = umask ( 0077 );
+	int ret = bind ( fd, (struct sockaddr *)&sun, sizeof ( sun ) );
+	umask ( mask );
+
+	if ( ret == -1 || listen ( fd, 8 ) == -1 ) { int e = errno; close ( fd ); errno = e; return -1; }
+
+	return fd;
+}
+
+/* path - NULL: ctl_default_path () */
+Ctl * ctl_new ( Dvb *dvb, const char *path )
+{
+	g_autofree char *def = ( path && path[0] ) ? NULL : ctl_default_path ();
+
+	if ( def ) path = def;
+
+	int fd = ctl_listen ( path );
+
+	if ( fd == -1 ) { g_warning ( "%s:: %s: %s ", __func__, path, g_strerror ( errno ) ); return NULL; }
+
+	Ctl *ctl = g_new0 ( Ctl, 1 );
+
+	ctl->dvb  = dvb;
+	ctl->fd   = fd;
+	ctl->path = g_strdup ( path );
+	ctl->dm.stop_rec = 1;
+	ctl->clients = g_ptr_array_new ();
+	ctl->src = g_unix_fd_add ( fd, G_IO_IN, (GUnixFDSourceFunc)ctl_accept, ctl );
+
+	g_signal_connect ( dvb, "dvb-scan-info",    G_CALLBACK ( ctl_ev_info        ), ctl );
+	g_signal_connect ( dvb, "dvb-name",         G_CALLBACK ( ctl_ev_name        ), ctl );
+	g_signal_connect ( dvb, "stats-update",     G_CALLBACK ( ctl_ev_stats       ), ctl );
+	g_signal_connect ( dvb, "scan-transponder", G_CALLBACK ( ctl_ev_scan_tp     ), ctl );
+	g_signal_connect ( dvb, "scan-done",        G_CALLBACK ( ctl_ev_scan_done   ), ctl );
+	g_signal_connect ( dvb, "zap-lock",         G_CALLBACK ( ctl_ev_zap_lock    ), ctl );
+	g_signal_connect ( dvb, "zap-trace",        G_CALLBACK ( ctl_ev_zap_trace   ), ctl );
+	g_signal_connect ( dvb, "zap-psi",          G_CALLBACK ( ctl_ev_zap_psi     ), ctl );
+	g_signal_connect ( dvb, "zap-adapter",      G_CALLBACK ( ctl_ev_zap_adapter ), ctl );
+
+	g_message ( "%s:: %s ", __func__, path );
+
+	return ctl;
+}
+
+void ctl_free ( Ctl *ctl )
+{
+	if ( !ctl ) return;
+
+	g_signal_handlers_disconnect_by_data ( ctl->dvb, ctl );
+
+	if ( ctl->rec ) { ctl->dm.stop_rec = 1; g_thread_join ( ctl->rec ); }
+
+	g_ptr_array_foreach ( ctl->clients, (GFunc)ctl_client_free, NULL );
+	g_ptr_array_free ( ctl->clients, TRUE );
+
+	g_source_remove ( ctl->src );
+	close ( ctl->fd );
+
+	unlink ( ctl->path );
+	free ( ctl->path );
+
+	free ( ctl->call_error );
+	free ( ctl );
+}
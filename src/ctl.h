@@ -0,0 +1,31 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "dvb.h"
+
+#define CTL_ENV  "DVB5_CTL"      // the UI serves its engine too: "1" - default path, or a path
+#define CTL_SOCK "dvb5-gtk.sock" // in g_get_user_runtime_dir ()
+
+typedef struct _Ctl Ctl;
+
+char * ctl_default_path ( void );
+
+Ctl * ctl_new ( Dvb *, const char * );
+
+void ctl_free ( Ctl * );
+
+GString * ctl_json_begin ( const char *, const char * );
+
+void ctl_json_str ( GString *, const char *, const char * );
+
+void ctl_json_int ( GString *, const char *, int64_t );
+
+void ctl_json_bool ( GString *, const char *, gboolean );
@@ -8,13 +8,54 @@
 */
 
 #include "dvb.h"
+#include "chdb.h"
+#include "report.h"
+#include "ztrace.h"
+#include "pretune.h"
+#include "svc.h"
+#include "femon.h"
+#include "sighist.h"
+#include "metrics.h"
+#include "eit.h"
+#include "scheddvb.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#define DVB_ZAP_LOCK_TIMEOUT ( 5 * G_USEC_PER_SEC )
+#define DVB_STATS_MS 250
+#define DVB_HIST_GRAPH 300
 
 struct _Dvb
 {
 	GObject parent_instance;
 
 	struct dvb_device *dvb_scan, *dvb_zap, *dvb_fe;
-	struct dvb_open_descriptor *video_fd, *audio_fd;
+	struct dvb_open_descriptor *video_fd, *audio_fd, *fe_fd;
+
+	gint64 zap_start;
+	guint zap_probe;
+	PsiTp zap_tp; // tuned transponder of the session
+
+	ZapTrace zap_trace;
+	ZtCapture *zap_cap;
+	GArray *zap_hist; // ZapTrace, the last ZTRACE_HIST
+	char *zap_log;
+
+	PreTune *pretune; // idle frontends on the neighbouring transponders
+
+	FeMon *femon; // statistics and lock events of the scan / zap frontend
+	uint32_t stats_ms;
+	guint stats_src;
+
+	GHashTable *sig_hist; // SigHist per adapter << 8 | frontend, kept for the whole run
+	uint8_t hist_level, hist_tick;
+
+	gboolean align; // dish alignment: fast sampling, readout at ALIGN_FPS
+	guint align_src;
+	AlignTone *align_tone;
 
 	char *demux_dev;
 	char *input_file, *output_file;
@@ -27,11 +68,29 @@ struct _Dvb
 	uint8_t descr_num;
 	uint16_t pids[3]; // 0 - sid, 1 - vpid, 2 - apid
 
+	gboolean eit;
+	SvcPids svc; // the full service: TS outputs
+	struct dvb_open_descriptor *svc_fd;
+	SvcMon *svc_mon;
+	GAsyncQueue *psi_changes; // char *, from the service monitor
+	char *psi_log;
+
+	EpgStore *epg; // EIT of every transponder tuned, kept across runs
+	EitMon *eit_mon;
+
+	Sched *sched; // timed and EPG recordings, on the first one
+	SchedDvb *sched_dvb;
+
 	GMutex mutex;
 	GThread *thread;
 
 	uint8_t thread_stop;
 	uint32_t freq_scan, progs_scan;
+	gboolean scan_run; // until scan-done
+
+	GMutex report_mutex;
+	GArray *report; // ScanRecord
+	uint32_t report_shown;
 
 	gboolean exit;
 };
@@ -39,6 +98,7 @@ struct _Dvb
 G_DEFINE_TYPE ( Dvb, dvb, G_TYPE_OBJECT )
 
 static void dvb_info_stats ( Dvb *dvb );
+static void dvb_femon_stop ( Dvb *dvb );
 
 static uint8_t _get_delsys ( struct dvb_v5_fe_parms *parms )
 {
@@ -70,18 +130,12 @@ static uint8_t _get_delsys ( struct dvb_v5_fe_parms *parms )
 	return sys;
 }
 
-static int _check_frontend ( G_GNUC_UNUSED void *__args, G_GNUC_UNUSED struct dvb_v5_fe_parms *parms )
-{
-	return 0;
-}
-
 static gpointer dvb_scan_thread ( Dvb *dvb_base )
 {
 	struct dvb_device *dvb = dvb_base->dvb_scan;
 	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
 	struct dvb_file *dvb_file = NULL, *dvb_file_new = NULL;
 	struct dvb_entry *entry;
-	struct dvb_open_descriptor *dmx_fd;
 
 	g_mutex_init ( &dvb_base->mutex );
 
@@ -102,20 +156,6 @@ static gpointer dvb_scan_thread ( Dvb *dvb_base )
 		return NULL;
 	}
 
-	dmx_fd = dvb_dev_open ( dvb, dvb_base->demux_dev, O_RDWR );
-
-	if ( !dmx_fd )
-	{
-		dvb_file_free ( dvb_file );
-		dvb_dev_free ( dvb );
-		dvb_base->dvb_scan  = NULL;
-		dvb_base->demux_dev = NULL;
-
-		g_mutex_clear ( &dvb_base->mutex );
-		perror ( "opening demux failed" );
-		return NULL;
-	}
-
 	for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
 	{
 		struct dvb_v5_descriptors *dvb_scan_handler = NULL;
@@ -136,7 +176,31 @@ static gpointer dvb_scan_thread ( Dvb *dvb_base )
 			dvb_base->freq_scan = freq;
 		g_mutex_unlock ( &dvb_base->mutex );
 
-		dvb_scan_handler = dvb_dev_scan ( dmx_fd, entry, &_check_frontend, NULL, dvb_base->other_nit, dvb_base->time_mult );
+		metrics_scan ( TRUE, freq, (uint32_t)count, dvb_base->progs_scan );
+
+		ScanRecord rec = { .freq = freq, .pol = pol, .stream_id = stream_id };
+
+		if ( psi_tune_entry ( parms, entry, dvb_base->time_mult, &rec.stats ) )
+		{
+			uint32_t sgl = 0, snr = 0;
+			dvb_fe_retrieve_stats ( parms, DTV_STAT_CNR, &snr );
+			dvb_fe_retrieve_stats ( parms, DTV_STAT_SIGNAL_STRENGTH, &sgl );
+
+			rec.locked = 1;
+			rec.sgl_p = (uint8_t)(sgl * 100 / 65535);
+			rec.snr_p = (uint8_t)(snr * 100 / 65535);
+
+			dvb_scan_handler = psi_scan_transponder ( dvb, dvb_base->demux_dev, dvb_base->other_nit, dvb_base->time_mult, &rec.stats );
+		}
+
+		if ( dvb_scan_handler ) rec.services = dvb_scan_handler->num_program;
+
+		if ( !parms->abort )
+		{
+			g_mutex_lock ( &dvb_base->report_mutex );
+				g_array_append_val ( dvb_base->report, rec );
+			g_mutex_unlock ( &dvb_base->report_mutex );
+		}
 
 		g_mutex_lock ( &dvb_base->mutex );
 			if ( dvb_scan_handler ) dvb_base->progs_scan += dvb_scan_handler->num_program;
@@ -161,15 +225,21 @@ static gpointer dvb_scan_thread ( Dvb *dvb_base )
 
 	if ( dvb_file_new ) dvb_write_file_format ( dvb_base->output_file, dvb_file_new, parms->current_sys, dvb_base->output_format );
 
+	g_autofree char *report_file = g_strdup_printf ( "%s.json", dvb_base->output_file );
+
+	g_mutex_lock ( &dvb_base->report_mutex );
+		report_scan_write ( report_file, dvb_base->report, dvb_base->input_file, dvb_base->output_file, dvb_base->time_mult );
+	g_mutex_unlock ( &dvb_base->report_mutex );
+
 	dvb_file_free ( dvb_file );
 	if ( dvb_file_new ) dvb_file_free ( dvb_file_new );
 
-	dvb_dev_close ( dmx_fd );
-
 	g_mutex_lock ( &dvb_base->mutex );
 		dvb_base->thread_stop = 1;
 	g_mutex_unlock ( &dvb_base->mutex );
 
+	metrics_scan ( FALSE, 0, (uint32_t)count, dvb_base->progs_scan );
+
 	g_mutex_clear ( &dvb_base->mutex );
 
 	dvb_dev_free ( dvb );
@@ -235,18 +305,27 @@ static const char * dvb_scan ( Dvb *dvb )
 	dvb->freq_scan  = 0;
 	dvb->progs_scan = 0;
 
+	g_mutex_lock ( &dvb->report_mutex );
+		g_array_set_size ( dvb->report, 0 );
+		dvb->report_shown = 0;
+	g_mutex_unlock ( &dvb->report_mutex );
+
 	dvb_info_stats ( dvb );
 
+	dvb->scan_run = TRUE;
+	sched_set_busy ( dvb->sched, dvb->adapter, TRUE );
+
 	dvb->thread = g_thread_new ( "scan-thread", (GThreadFunc)dvb_scan_thread, dvb );
 	g_thread_unref ( dvb->thread );
 
 	return NULL;
 }
 
-static void dvb_handler_scan ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_t t, uint8_t q, uint8_t c, uint8_t n, uint8_t o, 
+/* Returns the error, NULL - the scan runs */
+static char * dvb_handler_scan ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_t t, uint8_t q, uint8_t c, uint8_t n, uint8_t o, 
 	int8_t sn, uint8_t dq, const char *lnb_name, const char *lna, const char *fi, const char *fo, const char *fmi, const char *fmo )
 {
-	if ( dvb->dvb_scan || dvb->dvb_zap ) { g_signal_emit_by_name ( dvb, "dvb-scan-info", "It works ..." ); return; }
+	if ( dvb->dvb_scan || dvb->dvb_zap ) return g_strdup ( "It works ..." );
 
 	dvb->adapter   = a;
 	dvb->frontend  = f;
@@ -279,130 +358,47 @@ static void dvb_handler_scan ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_
 	dvb->input_file  = g_strdup ( fi );
 	dvb->output_file = g_strdup ( fo );
 
-	const char *ret_str = dvb_scan ( dvb );
-
-	if ( ret_str ) g_signal_emit_by_name ( dvb, "dvb-scan-info", ret_str );
+	return g_strdup ( dvb_scan ( dvb ) );
 }
 
+/* The adapter stays busy for the scheduler until the thread lets the frontend go ( scan-done ) */
 static void dvb_handler_scan_stop ( Dvb *dvb )
 {
 	if ( dvb->dvb_scan ) dvb->thread_stop = 1;
 }
 
-static uint8_t dvb_zap_parse ( const char *file, const char *channel, uint8_t frm, struct dvb_v5_fe_parms *parms, uint16_t pids[] )
+static uint8_t dvb_zap_parse ( const char *file, const char *channel, uint8_t frm, struct dvb_v5_fe_parms *parms, uint16_t pids[], SvcPids *svc, gboolean eit, PsiTp *tp )
 {
-	struct dvb_file *dvb_file;
 	struct dvb_entry *entry;
 
-	uint8_t i = 0;
-	uint32_t sys = _get_delsys ( parms );
-
-	dvb_file = dvb_read_file_format ( file, sys, frm );
+	ChDb *db = chdb_open ( file, frm, _get_delsys ( parms ) );
 
-	if ( !dvb_file )
+	if ( !db )
 	{
 		g_critical ( "%s:: Read file format failed.", __func__ );
 		return 0;
 	}
 
-	for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
-	{
-		if ( entry->channel && !strcmp ( entry->channel, channel ) ) break;
-		if ( entry->vchannel && !strcmp ( entry->vchannel, channel ) ) break;
-	}
-
-	if ( !entry )
-	{
-		for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
-		{
-			if ( entry->channel && !strcasecmp ( entry->channel, channel ) ) break;
-		}
-	}
-
-	if ( !entry )
-	{
-		uint32_t f, freq = (uint32_t)atoi ( channel );
-
-		if ( freq )
-		{
-			for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
-			{
-				dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &f );
-
-				if ( f == freq ) break;
-			}
-		}
-	}
+	entry = chdb_lookup ( db, channel );
 
 	if ( !entry )
 	{
 		g_critical ( "%s:: channel %s | file %s | Can't find channel.", __func__, channel, file );
 
-		dvb_file_free ( dvb_file );
+		chdb_unref ( db );
 		return 0;
 	}
 
-	if ( entry->lnb )
-	{
-		int lnb = dvb_sat_search_lnb ( entry->lnb );
-
-		if ( lnb == -1 )
-		{
-			g_warning ( "%s:: Unknown LNB %s", __func__, entry->lnb );
-			dvb_file_free ( dvb_file );
-			return 0;
-		}
-
-		parms->lnb = dvb_sat_get_lnb (lnb);
-	}
-
 	// pids[3];  0 - sid, 1 - vpid, 2 - apid
 	if ( entry->service_id ) pids[0] = entry->service_id;
 	if ( entry->video_pid  ) pids[1] = entry->video_pid[0];
 	if ( entry->audio_pid  ) pids[2] = entry->audio_pid[0];
-	if ( entry->sat_number >= 0 ) parms->sat_number = entry->sat_number;
 
-	dvb_retrieve_entry_prop (entry, DTV_DELIVERY_SYSTEM, &sys );
-	dvb_set_compat_delivery_system ( parms, sys );
+	svc_pids_from_entry ( entry, eit, svc );
 
-	/* Copy data into parms */
-	for ( i = 0; i < entry->n_props; i++ )
-	{
-		uint32_t data = entry->props[i].u.data;
-
-		/* Don't change the delivery system */
-		if ( entry->props[i].cmd == DTV_DELIVERY_SYSTEM ) continue;
+	if ( !psi_store_tp ( parms, entry, tp ) ) { chdb_unref ( db ); return 0; }
 
-		dvb_fe_store_parm ( parms, entry->props[i].cmd, data );
-
-		if ( parms->current_sys == SYS_ISDBT )
-		{
-			dvb_fe_store_parm ( parms, DTV_ISDBT_PARTIAL_RECEPTION,  0 );
-			dvb_fe_store_parm ( parms, DTV_ISDBT_SOUND_BROADCASTING, 0 );
-			dvb_fe_store_parm ( parms, DTV_ISDBT_LAYER_ENABLED,   0x07 );
-
-			if ( entry->props[i].cmd == DTV_CODE_RATE_HP )
-			{
-				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERA_FEC, data );
-				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERB_FEC, data );
-				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERC_FEC, data );
-			}
-			else if ( entry->props[i].cmd == DTV_MODULATION )
-			{
-				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERA_MODULATION, data );
-				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERB_MODULATION, data );
-				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERC_MODULATION, data );
-			}
-		}
-
-		if ( parms->current_sys == SYS_ATSC && entry->props[i].cmd == DTV_MODULATION )
-		{
-			if ( data != VSB_8 && data != VSB_16 )
-				dvb_fe_store_parm ( parms, DTV_DELIVERY_SYSTEM, SYS_DVBC_ANNEX_B );
-		}
-	}
-
-	dvb_file_free ( dvb_file );
+	chdb_unref ( db );
 
 	return 1;
 }
@@ -435,6 +431,19 @@ static void dvb_zap_set_dmx ( Dvb *dvb )
 
 	uint32_t bsz = ( dvb->descr_num == DMX_OUT_TS_TAP || dvb->descr_num == 4 ) ? 64 * 1024 : 0;
 
+	// EPG for as long as the transponder is tuned, whatever the output
+	dvb->eit_mon = eit_mon_start ( dvb->dvb_zap, dvb->demux_dev, dvb->epg );
+
+	// TS outputs: all pids of the service on one filter, completed from the PAT / PMT
+	if ( dvb->descr_num == DMX_OUT_TS_TAP || dvb->descr_num == DMX_OUT_TSDEMUX_TAP )
+	{
+		dvb->svc_fd = svc_filter_open ( dvb->dvb_zap, dvb->demux_dev, &dvb->svc, dvb->descr_num, 64 * 1024 );
+
+		dvb->svc_mon = svc_mon_start ( dvb->dvb_zap, dvb->demux_dev, dvb->svc_fd, dvb->pids[0], &dvb->svc, dvb->psi_changes );
+
+		if ( dvb->svc_fd ) return;
+	}
+
 	if ( dvb->pids[1] )
 	{
 		dvb->video_fd = dvb_dev_open ( dvb->dvb_zap, dvb->demux_dev, O_RDWR );
@@ -457,7 +466,76 @@ static void dvb_zap_set_dmx ( Dvb *dvb )
 }
 
 
-static const char * dvb_zap ( uint8_t a, uint8_t f, uint8_t d, uint8_t num, const char *channel, const char *file, Dvb *dvb )
+static void dvb_zap_close_dmx ( Dvb *dvb )
+{
+	eit_mon_stop ( dvb->eit_mon );
+	dvb->eit_mon = NULL;
+
+	svc_mon_stop ( dvb->svc_mon );
+	dvb->svc_mon = NULL;
+
+	if ( dvb->svc_fd ) dvb_dev_close ( dvb->svc_fd );
+	dvb->svc_fd = NULL;
+
+	if ( dvb->audio_fd ) dvb_dev_close ( dvb->audio_fd );
+	if ( dvb->video_fd ) dvb_dev_close ( dvb->video_fd );
+
+	dvb->audio_fd = NULL;
+	dvb->video_fd = NULL;
+
+	dvb->pids[0] = 0;
+	dvb->pids[1] = 0;
+	dvb->pids[2] = 0;
+}
+
+/* Latency milestones of the last zap: history, CSV log and the status bar */
+static void dvb_zap_trace_commit ( Dvb *dvb )
+{
+	if ( !dvb->zap_cap ) return;
+
+	ztrace_capture_stop ( dvb->zap_cap );
+	dvb->zap_cap = NULL;
+
+	if ( dvb->zap_hist->len >= ZTRACE_HIST ) g_array_remove_index ( dvb->zap_hist, 0 );
+	g_array_append_val ( dvb->zap_hist, dvb->zap_trace );
+
+	ztrace_log_append ( dvb->zap_log, &dvb->zap_trace );
+
+	g_autofree char *str = ztrace_to_str ( &dvb->zap_trace );
+
+	g_message ( "%s:: %s: %s ", __func__, dvb->zap_trace.channel, str );
+	g_signal_emit_by_name ( dvb, "zap-trace", dvb->zap_trace.channel, str );
+}
+
+static void dvb_zap_close ( Dvb *dvb )
+{
+	if ( !dvb->dvb_zap ) return;
+
+	dvb_zap_trace_commit ( dvb );
+
+	dvb_zap_close_dmx ( dvb );
+
+	// once per session, not per re-zap
+	epg_store_save ( dvb->epg );
+
+	// the monitor polls fe_fd
+	dvb_femon_stop ( dvb );
+
+	dvb_dev_free ( dvb->dvb_zap );
+	dvb->dvb_zap = NULL;
+	dvb->demux_dev = NULL;
+	dvb->fe_fd = NULL;
+
+	pretune_free ( dvb->pretune );
+	dvb->pretune = NULL;
+
+	memset ( &dvb->zap_tp, 0, sizeof ( PsiTp ) );
+
+	sched_set_busy ( dvb->sched, dvb->adapter, FALSE );
+}
+
+/* Device discovery and frontend open: once per zap session, not per channel */
+static const char * dvb_zap_open ( uint8_t a, uint8_t f, uint8_t d, Dvb *dvb )
 {
 	dvb->dvb_zap = dvb_dev_alloc ();
 
@@ -465,14 +543,12 @@ static const char * dvb_zap ( uint8_t a, uint8_t f, uint8_t d, uint8_t num, cons
 
 	dvb_dev_set_log ( dvb->dvb_zap, 0, NULL );
 	dvb_dev_find ( dvb->dvb_zap, NULL, NULL );
-	struct dvb_v5_fe_parms *parms = dvb->dvb_zap->fe_parms;
 
 	struct dvb_dev_list *dvb_dev = dvb_dev_seek_by_adapter ( dvb->dvb_zap, a, d, DVB_DEVICE_DEMUX );
 
 	if ( !dvb_dev )
 	{
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
+		dvb_zap_close ( dvb );
 
 		g_critical ( "%s: Couldn't find demux device node.", __func__ );
 		return "Couldn't find demux device.";
@@ -484,8 +560,7 @@ static const char * dvb_zap ( uint8_t a, uint8_t f, uint8_t d, uint8_t num, cons
 
 	if ( !dvb_dev )
 	{
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
+		dvb_zap_close ( dvb );
 
 		g_critical ( "%s: Couldn't find dvr device node.", __func__ );
 		return "Couldn't find dvr device.";
@@ -495,38 +570,198 @@ static const char * dvb_zap ( uint8_t a, uint8_t f, uint8_t d, uint8_t num, cons
 
 	if ( !dvb_dev )
 	{
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
+		dvb_zap_close ( dvb );
 
 		g_critical ( "%s: Couldn't find frontend device node.", __func__ );
 		return "Couldn't find frontend device.";
 	}
 
-	if ( !dvb_dev_open ( dvb->dvb_zap, dvb_dev->sysname, O_RDWR ) )
+	dvb->fe_fd = dvb_dev_open ( dvb->dvb_zap, dvb_dev->sysname, O_RDWR );
+
+	if ( !dvb->fe_fd )
 	{
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
+		dvb_zap_close ( dvb );
 
 		perror ( "Opening device failed" );
 		return "Opening device failed.";
 	}
 
+	struct dvb_v5_fe_parms *parms = dvb->dvb_zap->fe_parms;
+
 	parms->diseqc_wait = 0;
 	parms->freq_bpf = 0;
 	parms->lna = -1;
 
+	dvb->adapter  = a;
+	dvb->frontend = f;
+	dvb->demux    = d;
+
+	sched_set_busy ( dvb->sched, a, TRUE );
+
+	return NULL;
+}
+
+static gboolean dvb_zap_fe_lock ( Dvb *dvb )
+{
+	fe_status_t status = 0;
+
+	if ( !dvb->dvb_zap || !dvb->fe_fd ) return FALSE;
+
+	return ( ioctl ( dvb_dev_get_fd ( dvb->fe_fd ), FE_READ_STATUS, &status ) == 0 && ( status & FE_HAS_LOCK ) );
+}
+
+static gboolean dvb_zap_lock_probe ( Dvb *dvb )
+{
+	if ( dvb->exit ) return FALSE;
+
+	if ( !dvb->dvb_zap || !dvb->fe_fd ) { dvb->zap_probe = 0; return FALSE; }
+
+	gint64 elapsed = g_get_monotonic_time () - dvb->zap_start;
+
+	// the monitor takes the lock time from the frontend event, the ioctl is the fallback
+	FeSnap snap;
+	gint64 lock_time = 0;
+
+	if ( femon_snapshot ( dvb->femon, &snap ) )
+		lock_time = ( snap.fe_lock && snap.lock_since >= dvb->zap_start ) ? snap.lock_since : 0;
+	else if ( dvb_zap_fe_lock ( dvb ) )
+		lock_time = g_get_monotonic_time ();
+
+	if ( lock_time )
+	{
+		ztrace_mark ( &dvb->zap_trace, ZT_LOCK, lock_time );
+
+		elapsed = lock_time - dvb->zap_start;
+
+		dvb->zap_probe = 0;
+		g_signal_emit_by_name ( dvb, "zap-lock", (uint32_t)( elapsed / 1000 ), FALSE, TRUE );
+
+		return FALSE;
+	}
+
+	if ( elapsed > DVB_ZAP_LOCK_TIMEOUT )
+	{
+		dvb->zap_probe = 0;
+		g_signal_emit_by_name ( dvb, "zap-lock", (uint32_t)( elapsed / 1000 ), TRUE, TRUE );
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The pre-tuned frontend becomes the zap session, the session's frontend goes to the pool */
+static void dvb_zap_handoff ( Dvb *dvb, PreTuneSlot *slot )
+{
+	dvb_zap_trace_commit ( dvb );
+	dvb_zap_close_dmx ( dvb );
+
+	// the monitor polls the old fe_fd
+	dvb_femon_stop ( dvb );
+
+	PreTuneSlot old = { dvb->dvb_zap, dvb->fe_fd, dvb->demux_dev, dvb->adapter, dvb->frontend, dvb->demux, dvb->zap_tp };
+
+	pretune_give ( dvb->pretune, &old );
+
+	sched_set_busy ( dvb->sched, old.adapter, FALSE );
+	sched_set_busy ( dvb->sched, slot->adapter, TRUE );
+
+	dvb->dvb_zap   = slot->dev;
+	dvb->fe_fd     = slot->fe_fd;
+	dvb->demux_dev = slot->demux_dev;
+	dvb->zap_tp    = slot->tp;
+
+	dvb->adapter  = slot->adapter;
+	dvb->frontend = slot->frontend;
+	dvb->demux    = slot->demux;
+
+	// the statistics follow the new frontend
+	dvb_info_stats ( dvb );
+
+	g_message ( "%s:: adapter%u/frontend%u ", __func__, dvb->adapter, dvb->frontend );
+
+	g_signal_emit_by_name ( dvb, "zap-adapter", dvb->adapter, dvb->frontend, dvb->demux );
+}
+
+static const char * dvb_zap ( uint8_t a, uint8_t f, uint8_t d, uint8_t num, gboolean eit, const char *channel, const char *file, Dvb *dvb )
+{
+	PreTuneSlot slot;
+
+	if ( dvb->dvb_zap && dvb->pretune && pretune_take ( dvb->pretune, file, channel, &slot ) )
+	{
+		dvb_zap_handoff ( dvb, &slot );
+
+		a = dvb->adapter; f = dvb->frontend; d = dvb->demux;
+	}
+
+	if ( dvb->dvb_zap && ( dvb->adapter != a || dvb->frontend != f || dvb->demux != d ) ) dvb_zap_close ( dvb );
+
+	gboolean session = ( dvb->dvb_zap != NULL );
+
+	if ( !session )
+	{
+		const char *ret_str = dvb_zap_open ( a, f, d, dvb );
+
+		if ( ret_str ) return ret_str;
+	}
+
+	// re-zap: the frontend and demux device stay open, only the parameters and PES filters change
+	FeSnap snap;
+	gboolean fe_lock = ( session && ( femon_snapshot ( dvb->femon, &snap ) ? snap.fe_lock : dvb_zap_fe_lock ( dvb ) ) );
+
+	dvb_zap_trace_commit ( dvb );
+
+	dvb->zap_start = g_get_monotonic_time ();
+
+	ztrace_begin ( &dvb->zap_trace, channel, dvb->zap_start );
+
+	dvb_zap_close_dmx ( dvb );
+
+	struct dvb_v5_fe_parms *parms = dvb->dvb_zap->fe_parms;
+
 	dvb->descr_num = num;
+	dvb->eit = eit;
 
-	if ( !dvb_zap_parse ( file, channel, FILE_DVBV5, parms, dvb->pids ) )
+	PsiTp tp = { 0 };
+
+	if ( !dvb_zap_parse ( file, channel, FILE_DVBV5, parms, dvb->pids, &dvb->svc, dvb->eit, &tp ) )
 	{
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
+		dvb_zap_close ( dvb );
 
 		g_critical ( "%s:: Zap parse failed.", __func__ );
 		return "Zap parse failed.";
 	}
 
-	uint32_t freq = dvb_zap_setup_frontend ( parms );
+	ZapTrace *trace = &dvb->zap_trace;
+
+	ztrace_mark ( trace, ZT_PARSE, g_get_monotonic_time () );
+
+	trace->freq = tp.freq;
+	trace->sid  = dvb->pids[0];
+	trace->vpid = dvb->pids[1];
+
+	// same transponder already locked: keep the frontend untouched, swap the PES filters only
+	gboolean same_tp = ( fe_lock && tp.freq && memcmp ( &tp, &dvb->zap_tp, sizeof ( PsiTp ) ) == 0 );
+
+	uint32_t freq = ( same_tp ) ? tp.freq : dvb_zap_setup_frontend ( parms );
+
+	dvb->zap_tp = tp;
+
+	if ( !same_tp ) { trace->retune = TRUE; ztrace_mark ( trace, ZT_SET_PARMS, g_get_monotonic_time () ); }
+
+	if ( same_tp )
+	{
+		dvb->freq_scan = freq;
+
+		dvb_zap_set_dmx ( dvb );
+
+		dvb->zap_cap = ztrace_capture_start ( dvb->dvb_zap, dvb->demux_dev, trace );
+
+		g_message ( "%s:: Zap Ok ( same transponder ).", __func__ );
+		g_signal_emit_by_name ( dvb, "zap-lock", (uint32_t)( ( g_get_monotonic_time () - dvb->zap_start ) / 1000 ), FALSE, FALSE );
+
+		return NULL;
+	}
 
 	if ( freq )
 	{
@@ -534,125 +769,83 @@ static const char * dvb_zap ( uint8_t a, uint8_t f, uint8_t d, uint8_t num, cons
 
 		dvb_zap_set_dmx ( dvb );
 
+		dvb->zap_cap = ztrace_capture_start ( dvb->dvb_zap, dvb->demux_dev, trace );
+
 		g_message ( "%s:: Zap Ok.", __func__ );
 	}
 	else
 	{
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
+		dvb_zap_close ( dvb );
 
 		g_warning ( "%s:: Zap failed.", __func__ );
 		return "Zap failed.";
 	}
 
+	if ( !dvb->zap_probe ) dvb->zap_probe = g_timeout_add ( 10, (GSourceFunc)dvb_zap_lock_probe, dvb );
+
 	dvb_info_stats ( dvb );
 
 	return NULL;
 }
 
-static void dvb_handler_zap ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_t num, const char *channel, const char *file )
+/* Returns the error, NULL - tuned ( the lock comes with zap-lock ) */
+static char * dvb_handler_zap ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_t num, gboolean eit, const char *channel, const char *file )
 {
-	if ( dvb->dvb_scan || dvb->dvb_zap ) { g_signal_emit_by_name ( dvb, "dvb-scan-info", "It works ..." ); return; }
+	if ( dvb->dvb_scan ) return g_strdup ( "It works ..." );
 
 	dvb->freq_scan = 0;
 
-	const char *ret_str = dvb_zap ( a, f, d, num, channel, file, dvb );
-
-	if ( ret_str ) g_signal_emit_by_name ( dvb, "dvb-scan-info", ret_str );
+	return g_strdup ( dvb_zap ( a, f, d, num, eit, channel, file, dvb ) );
 }
 
 static void dvb_handler_zap_stop ( Dvb *dvb )
 {
-	if ( dvb->dvb_zap )
-	{
-		dvb->pids[0] = 0;
-		dvb->pids[1] = 0;
-		dvb->pids[2] = 0;
-
-		if ( dvb->audio_fd ) dvb_dev_close ( dvb->audio_fd );
-		if ( dvb->video_fd ) dvb_dev_close ( dvb->video_fd );
-
-		dvb->audio_fd = NULL;
-		dvb->video_fd = NULL;
-
-		dvb_dev_free ( dvb->dvb_zap );
-		dvb->dvb_zap = NULL;
-		dvb->demux_dev = NULL;
-	}
+	dvb_zap_close ( dvb );
 }
 
-static int _frontend_stats ( struct dvb_v5_fe_parms *parms, Dvb *dvb )
+static gboolean dvb_pretune_busy ( gpointer data, uint8_t adapter )
 {
-	char buf[512], *p;
-	int rc, i, len, show;
-
-	rc = dvb_fe_get_stats ( parms );
-	if ( rc ) return -1;
+	Dvb *dvb = data;
 
-	p = buf;
-	len = sizeof(buf);
-	// dvb_fe_snprintf_stat ( parms, DTV_STATUS, NULL, 0, &p, &len, &show );
+	return sched_adapter_used ( dvb->sched, adapter );
+}
 
-	for ( i = 0; i < MAX_DTV_STATS; i++ )
-	{
-		show = 1;
+/* channels: the likely next zaps, most likely first; NULL or empty - pre-tune off */
+static void dvb_handler_pretune ( Dvb *dvb, const char *file, char **channels )
+{
+	if ( !channels || !channels[0] ) { pretune_free ( dvb->pretune ); dvb->pretune = NULL; return; }
 
-		dvb_fe_snprintf_stat ( parms, DTV_QUALITY, "Quality ", i, &p, &len, &show );
-		dvb_fe_snprintf_stat ( parms, DTV_STAT_SIGNAL_STRENGTH, "  Signal ", i, &p, &len, &show );
-		dvb_fe_snprintf_stat ( parms, DTV_STAT_CNR, "  C/N ", i, &p, &len, &show );
-/*
-		dvb_fe_snprintf_stat ( parms, DTV_STAT_ERROR_BLOCK_COUNT, "UCB", i,  &p, &len, &show );
-		dvb_fe_snprintf_stat ( parms, DTV_BER, "postBER", i,  &p, &len, &show );
-		dvb_fe_snprintf_stat ( parms, DTV_PRE_BER, "preBER", i,  &p, &len, &show );
-		dvb_fe_snprintf_stat ( parms, DTV_PER, "PER", i,  &p, &len, &show );
-*/
-		if ( p != buf )
-		{
-			// g_message ( "%d: %s ", i, buf );
+	if ( dvb->dvb_scan || !dvb->dvb_zap ) return;
 
-			g_signal_emit_by_name ( dvb, "stats-org", i, buf );
+	// the pool opens the other adapters O_RDWR: none that a recording holds
+	if ( !dvb->pretune ) dvb->pretune = pretune_new ( dvb->adapter, dvb_pretune_busy, dvb );
 
-			p = buf;
-			len = sizeof(buf);
-		}
-	}
-
-	return 0;
+	pretune_update ( dvb->pretune, file, (const char * const *)channels, &dvb->zap_tp );
 }
 
+/* Main loop: the last snapshot of the monitor, no ioctl here */
 static void dvb_fe_stat_get ( Dvb *dvb )
 {
-	struct dvb_v5_fe_parms *parms = dvb->dvb_fe->fe_parms;
-
-	int rc = dvb_fe_get_stats ( parms );
-
-	if ( rc ) { g_warning ( "%s:: failed.", __func__ ); return; }
-
-	uint32_t freq = 0, qual = 0;
-	gboolean fe_lock = FALSE;
-
-	fe_status_t status;
-	dvb_fe_retrieve_stats ( parms, DTV_STATUS,  &status );
-	dvb_fe_retrieve_stats ( parms, DTV_QUALITY,   &qual );
-	dvb_fe_retrieve_parm  ( parms, DTV_FREQUENCY, &freq );
-
-	if ( status & FE_HAS_LOCK ) fe_lock = TRUE;
+	FeSnap snap;
 
-	uint32_t sgl = 0, snr = 0;
-	dvb_fe_retrieve_stats ( parms, DTV_STAT_CNR, &snr );
-	dvb_fe_retrieve_stats ( parms, DTV_STAT_SIGNAL_STRENGTH, &sgl );
-
-	uint8_t sgl_p = (uint8_t)(sgl * 100 / 65535), snr_p = (uint8_t)(snr * 100 / 65535);
+	if ( !femon_snapshot ( dvb->femon, &snap ) ) return;
 
 	char sgl_s[256];
-	sprintf ( sgl_s, "Signal:  %u%% ", sgl_p );
+	sprintf ( sgl_s, "Signal:  %u%% ", snap.sgl_p );
+
+	// errors of layer A next to C/N, every layer in stats-org
+	const FeErrors *err = &snap.err[0];
 
 	char snr_s[256];
-	sprintf ( snr_s, "C/N:  %u%% ", snr_p );
+	int len = sprintf ( snr_s, "C/N:  %u%% ", snap.snr_p );
 
-	g_signal_emit_by_name ( dvb, "stats-update", dvb->freq_scan, qual, sgl_s, snr_s, sgl_p, snr_p, fe_lock );
+	if ( err->ber >= 0 ) len += sprintf ( snr_s + len, " BER:  %.1e ", err->ber );
+	if ( err->ucb_s >= 0 ) len += sprintf ( snr_s + len, " UCB:  %.0f/s ", err->ucb_s );
 
-	_frontend_stats ( parms, dvb );
+	g_signal_emit_by_name ( dvb, "stats-update", dvb->freq_scan, snap.qual, sgl_s, snr_s, snap.sgl_p, snap.snr_p, (gboolean)snap.fe_lock );
+
+	int i = 0; for ( i = 0; i < FEMON_LAYERS; i++ )
+		if ( snap.layer[i][0] ) g_signal_emit_by_name ( dvb, "stats-org", i, snap.layer[i] );
 }
 
 static const char * dvb_info ( uint8_t adapter, uint8_t frontend, Dvb *dvb )
@@ -701,32 +894,366 @@ static void dvb_handler_dvb_info ( Dvb *dvb, uint8_t adapter, uint8_t frontend )
 	if ( dvb->dvb_fe ) { dvb_dev_free ( dvb->dvb_fe ); dvb->dvb_fe = NULL; }
 }
 
+static void dvb_scan_report_emit ( Dvb *dvb )
+{
+	ScanRecord rec;
+
+	while ( TRUE )
+	{
+		g_mutex_lock ( &dvb->report_mutex );
+
+		gboolean next = ( dvb->report_shown < dvb->report->len );
+		if ( next ) rec = g_array_index ( dvb->report, ScanRecord, dvb->report_shown++ );
+
+		g_mutex_unlock ( &dvb->report_mutex );
+
+		if ( !next ) break;
+
+		uint32_t lock_ms  = ( rec.stats.lock  > 0 ) ? (uint32_t)( rec.stats.lock  / 1000 ) : 0;
+		uint32_t dwell_ms = ( rec.stats.dwell > 0 ) ? (uint32_t)( rec.stats.dwell / 1000 ) : 0;
+
+		g_signal_emit_by_name ( dvb, "scan-transponder", rec.freq, lock_ms, dwell_ms, rec.services );
+	}
+}
+
+/* PAT / PMT changes of the zapped service: log file and the status bar */
+static void dvb_psi_changes_emit ( Dvb *dvb )
+{
+	char *str = NULL;
+
+	while ( ( str = g_async_queue_try_pop ( dvb->psi_changes ) ) )
+	{
+		g_message ( "%s:: %s ", __func__, str );
+
+		FILE *fp = fopen ( dvb->psi_log, "a" );
+
+		if ( fp ) { fprintf ( fp, "%s\n", str ); fclose ( fp ); }
+
+		g_signal_emit_by_name ( dvb, "zap-psi", str );
+
+		free ( str );
+	}
+}
+
+static SigHist * dvb_sighist ( Dvb *dvb, gboolean create )
+{
+	gpointer key = GUINT_TO_POINTER ( ( (uint)dvb->adapter << 8 ) | dvb->frontend );
+
+	SigHist *sh = g_hash_table_lookup ( dvb->sig_hist, key );
+
+	if ( !sh && create ) { sh = sighist_new (); g_hash_table_insert ( dvb->sig_hist, key, sh ); }
+
+	return sh;
+}
+
+/* The graph: the last DVB_HIST_GRAPH buckets of the current frontend at the selected resolution */
+static void dvb_sighist_emit ( Dvb *dvb )
+{
+	SigHist *sh = dvb_sighist ( dvb, FALSE );
+
+	if ( !sh ) return;
+
+	SigBucket *buf = g_new0 ( SigBucket, DVB_HIST_GRAPH );
+
+	uint32_t n = sighist_copy ( sh, dvb->hist_level, g_get_real_time (), DVB_HIST_GRAPH, buf );
+
+	GBytes *bytes = g_bytes_new_take ( buf, n * sizeof ( SigBucket ) );
+
+	g_signal_emit_by_name ( dvb, "stats-history", sighist_res[dvb->hist_level], bytes );
+
+	g_bytes_unref ( bytes );
+}
+
+static void dvb_handler_hist_level ( Dvb *dvb, uint8_t level )
+{
+	dvb->hist_level = ( level < SIGHIST_LEVELS ) ? level : 0;
+
+	dvb_sighist_emit ( dvb );
+}
+
+static char * dvb_handler_hist_export ( Dvb *dvb )
+{
+	SigHist *sh = dvb_sighist ( dvb, FALSE );
+
+	if ( !sh ) return NULL;
+
+	char *file = g_strdup_printf ( "%s/dvb_signal_adapter%u_frontend%u.csv", g_get_home_dir (), dvb->adapter, dvb->frontend );
+
+	if ( !sighist_export ( sh, file ) ) { free ( file ); return NULL; }
+
+	g_message ( "%s:: %s ", __func__, file );
+
+	return file;
+}
+
+/* One frame of the alignment readout: the latest snapshot, nothing queues up behind a slow frame */
+static gboolean dvb_align_frame ( Dvb *dvb )
+{
+	if ( dvb->exit ) return FALSE;
+
+	if ( !dvb->align )
+	{
+		dvb->align_src = 0;
+		g_signal_emit_by_name ( dvb, "stats-align", FALSE, 0.0, 0.0, 0.0, 0.0, FALSE );
+
+		return FALSE;
+	}
+
+	FeSnap snap;
+
+	if ( !femon_snapshot ( dvb->femon, &snap ) || !snap.aligning ) return TRUE;
+
+	const AlignOut *al = &snap.align;
+
+	// C/N is what counts once locked, the signal gets the dish there
+	align_tone_set ( dvb->align_tone, ( snap.fe_lock ) ? al->val[AL_SNR] : al->val[AL_SGL] );
+
+	g_signal_emit_by_name ( dvb, "stats-align", TRUE, (double)al->val[AL_SGL], (double)al->val[AL_SNR], (double)al->peak[AL_SGL], (double)al->peak[AL_SNR], (gboolean)snap.fe_lock );
+
+	return TRUE;
+}
+
+static EpgStore * dvb_handler_epg ( Dvb *dvb )
+{
+	return dvb->epg;
+}
+
+static int64_t dvb_sched_now ( gpointer data )
+{
+	Dvb *dvb = data;
+
+	return sched_dvb_now ( dvb->sched_dvb );
+}
+
+static gboolean dvb_sched_start ( gpointer data, const SchedTuner *t, const SchedRec *rec )
+{
+	Dvb *dvb = data;
+
+	// the idle pool holds every other frontend open
+	pretune_free ( dvb->pretune );
+	dvb->pretune = NULL;
+
+	return sched_dvb_start ( dvb->sched_dvb, t, rec );
+}
+
+static void dvb_sched_stop ( gpointer data, const SchedTuner *t, const SchedRec *rec )
+{
+	Dvb *dvb = data;
+
+	sched_dvb_stop ( dvb->sched_dvb, t, rec );
+}
+
+static Sched * dvb_sched ( Dvb *dvb )
+{
+	if ( dvb->sched ) return dvb->sched;
+
+	static const SchedOps ops = { dvb_sched_now, dvb_sched_start, dvb_sched_stop, NULL };
+
+	uint8_t n = 0;
+	g_autofree SchedTuner *tuners = sched_dvb_tuners ( &n );
+
+	dvb->sched_dvb = sched_dvb_new ();
+	dvb->sched = sched_new ( &ops, dvb, tuners, n, TRUE );
+
+	sched_set_epg ( dvb->sched, dvb->epg );
+
+	if ( dvb->dvb_zap || dvb->scan_run ) sched_set_busy ( dvb->sched, dvb->adapter, TRUE );
+
+	return dvb->sched;
+}
+
+/* Output ~/channel-date.ts, the transponder of the entry; returns the message for the user */
+static char * dvb_sched_put ( Sched *sched, struct dvb_entry *entry, const char *file, SchedRec *rec )
+{
+	time_t t = (time_t)rec->start;
+	struct tm tm;
+	localtime_r ( &t, &tm );
+
+	char date[32];
+	strftime ( date, sizeof ( date ), "%Y%m%d-%H%M", &tm );
+
+	g_autofree char *name = g_strdelimit ( g_strdup ( entry->channel ), "/", '_' );
+
+	rec->channel = entry->channel;
+	rec->file = (char *)file;
+	rec->out = g_strdup_printf ( "%s/%s-%s.ts", g_get_home_dir (), name, date );
+
+	psi_entry_tp ( entry, &rec->tp );
+
+	uint32_t id = sched_add ( sched, rec );
+
+	char *ret = NULL;
+
+	if ( !id ) ret = g_strdup ( "Not scheduled." );
+
+	uint32_t i = 0, n = 0;
+	const SchedRec *list = sched_list ( sched, &n );
+
+	for ( i = 0; !ret && i < n; i++ )
+	{
+		if ( list[i].id != id ) continue;
+
+		if ( list[i].tuner == -1 )
+			ret = g_strdup_printf ( "Conflict: %s %s\nNo free tuner at this time.", entry->channel, date );
+		else
+			ret = g_strdup_printf ( "Scheduled: %s %s\n%s", entry->channel, date, rec->out );
+	}
+
+	free ( rec->out );
+	rec->out = NULL;
+
+	return ret;
+}
+
+/* An EPG event of the channel file: scheduled with the default padding, or unscheduled if it already is */
+static char * dvb_handler_sched_event ( Dvb *dvb, const char *file, uint16_t onid, uint16_t tsid, uint16_t sid, uint16_t event_id )
+{
+	Sched *sched = dvb_sched ( dvb );
+
+	uint32_t i = 0, n = 0;
+	const SchedRec *list = sched_list ( sched, &n );
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( list[i].event_id != event_id || list[i].svc.sid != sid || list[i].svc.tsid != tsid || list[i].svc.onid != onid ) continue;
+
+		g_autofree char *channel = g_strdup ( list[i].channel );
+
+		sched_remove ( sched, list[i].id );
+
+		return g_strdup_printf ( "Unscheduled: %s", channel );
+	}
+
+	ChDb *db = chdb_open ( file, FILE_DVBV5, SYS_UNDEFINED );
+	struct dvb_entry *entry = ( db ) ? chdb_lookup_sid ( db, sid ) : NULL;
+
+	if ( !entry || !entry->channel || ( entry->transport_id && entry->transport_id != tsid ) ) { chdb_unref ( db ); return g_strdup ( "No such channel." ); }
+
+	SchedRec rec;
+	memset ( &rec, 0, sizeof ( SchedRec ) );
+
+	rec.svc.onid = onid;
+	rec.svc.tsid = tsid;
+	rec.svc.sid  = sid;
+	rec.event_id = event_id;
+	rec.pre  = SCHED_PRE;
+	rec.post = SCHED_POST;
+
+	epg_store_lock ( dvb->epg );
+
+	int64_t pos = epg_store_find ( dvb->epg, &rec.svc );
+	const EpgEvent *ev = ( pos >= 0 ) ? epg_store_events ( dvb->epg, (uint32_t)pos, NULL, &n ) : NULL;
+
+	for ( i = 0; ev && i < n; i++ ) if ( ev[i].event_id == event_id ) { rec.start = ev[i].start; rec.stop = (int64_t)ev[i].start + ev[i].duration; break; }
+
+	epg_store_unlock ( dvb->epg );
+
+	if ( !rec.stop ) { chdb_unref ( db ); return g_strdup ( "No such event." ); }
+
+	char *ret = dvb_sched_put ( sched, entry, file, &rec );
+
+	chdb_unref ( db );
+
+	return ret;
+}
+
+/* A timed recording: channel of the file, start and stop in unix s, without the padding */
+static char * dvb_handler_sched_add ( Dvb *dvb, const char *file, const char *channel, int64_t start, int64_t stop )
+{
+	if ( stop <= start ) return g_strdup ( "Stop before start." );
+
+	Sched *sched = dvb_sched ( dvb );
+
+	ChDb *db = chdb_open ( file, FILE_DVBV5, SYS_UNDEFINED );
+	struct dvb_entry *entry = ( db ) ? chdb_lookup ( db, channel ) : NULL;
+
+	if ( !entry || !entry->channel ) { chdb_unref ( db ); return g_strdup ( "No such channel." ); }
+
+	SchedRec rec;
+	memset ( &rec, 0, sizeof ( SchedRec ) );
+
+	rec.start = start;
+	rec.stop  = stop;
+	rec.pre   = SCHED_PRE;
+	rec.post  = SCHED_POST;
+
+	char *ret = dvb_sched_put ( sched, entry, file, &rec );
+
+	chdb_unref ( db );
+
+	return ret;
+}
+
+static void dvb_handler_align ( Dvb *dvb, gboolean on, gboolean tone )
+{
+	dvb->align = on;
+
+	femon_align ( dvb->femon, on );
+
+	if ( on && tone && !dvb->align_tone ) dvb->align_tone = align_tone_start ();
+
+	if ( ( !on || !tone ) && dvb->align_tone ) { align_tone_stop ( dvb->align_tone ); dvb->align_tone = NULL; }
+
+	if ( on && !dvb->align_src ) dvb->align_src = g_timeout_add ( 1000 / ALIGN_FPS, (GSourceFunc)dvb_align_frame, dvb );
+}
+
 static gboolean dvb_info_show_stats ( Dvb *dvb )
 {
 	if ( dvb->exit ) return FALSE;
 
+	dvb_scan_report_emit ( dvb );
+	dvb_psi_changes_emit ( dvb );
+
+	// the report is out: every transponder went before
+	if ( dvb->scan_run && dvb->dvb_scan == NULL )
+	{
+		dvb->scan_run = FALSE;
+		sched_set_busy ( dvb->sched, dvb->adapter, FALSE );
+
+		g_signal_emit_by_name ( dvb, "scan-done", dvb->report_shown, dvb->progs_scan );
+	}
+
+	if ( dvb->zap_cap && !dvb->zap_probe && ztrace_capture_finished ( dvb->zap_cap ) ) dvb_zap_trace_commit ( dvb );
+
 	if ( dvb->dvb_scan == NULL && dvb->dvb_zap == NULL )
 	{
-		if ( dvb->dvb_fe ) { dvb_dev_free ( dvb->dvb_fe ); dvb->dvb_fe = NULL; }
+		dvb_femon_stop ( dvb );
 
 		g_signal_emit_by_name ( dvb, "stats-update", 0, 0, "Signal", "C/N", 0, 0, FALSE );
 
+		dvb->stats_src = 0;
 		return FALSE;
 	}
 
 	dvb_fe_stat_get ( dvb );
 
+	if ( ++dvb->hist_tick >= 1000 / DVB_STATS_MS ) { dvb->hist_tick = 0; dvb_sighist_emit ( dvb ); }
+
 	return TRUE;
 }
 
+static void dvb_femon_stop ( Dvb *dvb )
+{
+	femon_stop ( dvb->femon );
+	dvb->femon = NULL;
+}
+
+/* The monitor of the current frontend and the UI timer: both once per session */
 static void dvb_info_stats ( Dvb *dvb )
 {
-	const char *error = dvb_info ( dvb->adapter, dvb->frontend, dvb );
+	if ( !dvb->femon )
+	{
+		// zap: lock events come on the session's frontend; scan: the thread owns it, statistics only
+		int event_fd = ( dvb->dvb_zap && dvb->fe_fd ) ? dvb_dev_get_fd ( dvb->fe_fd ) : -1;
 
-	if ( error )
-		g_signal_emit_by_name ( dvb, "dvb-scan-info", error );
-	else
-		g_timeout_add ( 250, (GSourceFunc)dvb_info_show_stats, dvb );
+		dvb->femon = femon_start ( dvb->adapter, dvb->frontend, event_fd, dvb->stats_ms, dvb_sighist ( dvb, TRUE ) );
+
+		if ( !dvb->femon ) g_signal_emit_by_name ( dvb, "dvb-scan-info", "Opening device failed." );
+
+		femon_align ( dvb->femon, dvb->align );
+	}
+
+	if ( !dvb->stats_src ) dvb->stats_src = g_timeout_add ( DVB_STATS_MS, (GSourceFunc)dvb_info_show_stats, dvb );
 }
 
 static void dvb_init ( Dvb *dvb )
@@ -758,19 +1285,72 @@ static void dvb_init ( Dvb *dvb )
 
 	dvb->audio_fd = NULL;
 	dvb->video_fd = NULL;
+	dvb->fe_fd = NULL;
+
+	dvb->eit = FALSE;
+	dvb->svc.n = 0;
+	dvb->svc_fd = NULL;
+	dvb->svc_mon = NULL;
+	dvb->psi_changes = g_async_queue_new_full ( g_free );
+	dvb->psi_log = g_strconcat ( g_get_home_dir (), "/dvb_zap_psi.log", NULL );
+
+	g_autofree char *epg_dir = g_build_filename ( g_get_user_cache_dir (), "dvb5-gtk", NULL );
+	g_autofree char *epg_file = g_build_filename ( epg_dir, EPG_FILE, NULL );
+
+	g_mkdir_with_parents ( epg_dir, 0755 );
+
+	dvb->epg = epg_store_open ( epg_file );
+	dvb->eit_mon = NULL;
+
+	dvb->sched = NULL;
+	dvb->sched_dvb = NULL;
+
+	dvb->femon = NULL;
+	dvb->stats_ms  = DVB_STATS_MS;
+	dvb->stats_src = 0;
+
+	dvb->sig_hist = g_hash_table_new_full ( g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)sighist_free );
+	dvb->hist_level = 0;
+	dvb->hist_tick  = 0;
+
+	dvb->align = FALSE;
+	dvb->align_src  = 0;
+	dvb->align_tone = NULL;
+
+	dvb->zap_start = 0;
+	dvb->zap_probe = 0;
+	memset ( &dvb->zap_tp, 0, sizeof ( PsiTp ) );
+
+	dvb->zap_cap  = NULL;
+	dvb->zap_hist = g_array_new ( FALSE, TRUE, sizeof ( ZapTrace ) );
+	dvb->zap_log  = g_strconcat ( g_get_home_dir (), "/dvb_zap_trace.csv", NULL );
+	dvb->pretune  = NULL;
+	memset ( &dvb->zap_trace, 0, sizeof ( ZapTrace ) );
 
 	dvb->descr_num = 0;
 	dvb->freq_scan = 0;
+	dvb->scan_run  = FALSE;
 
 	dvb->input_file  = NULL;
 	dvb->output_file = NULL;
 
+	g_mutex_init ( &dvb->report_mutex );
+	dvb->report = g_array_new ( FALSE, TRUE, sizeof ( ScanRecord ) );
+	dvb->report_shown = 0;
+
 	dvb->input_format  = FILE_DVBV5;
 	dvb->output_format = FILE_DVBV5;
 
 	g_signal_connect ( dvb, "dvb-info",      G_CALLBACK ( dvb_handler_dvb_info  ), NULL );
 	g_signal_connect ( dvb, "dvb-zap",       G_CALLBACK ( dvb_handler_zap       ), NULL );
 	g_signal_connect ( dvb, "dvb-zap-stop",  G_CALLBACK ( dvb_handler_zap_stop  ), NULL );
+	g_signal_connect ( dvb, "dvb-pretune",   G_CALLBACK ( dvb_handler_pretune   ), NULL );
+	g_signal_connect ( dvb, "dvb-hist-level",  G_CALLBACK ( dvb_handler_hist_level  ), NULL );
+	g_signal_connect ( dvb, "dvb-hist-export", G_CALLBACK ( dvb_handler_hist_export ), NULL );
+	g_signal_connect ( dvb, "dvb-align",       G_CALLBACK ( dvb_handler_align       ), NULL );
+	g_signal_connect ( dvb, "dvb-epg",         G_CALLBACK ( dvb_handler_epg         ), NULL );
+	g_signal_connect ( dvb, "dvb-sched-event", G_CALLBACK ( dvb_handler_sched_event ), NULL );
+	g_signal_connect ( dvb, "dvb-sched-add",   G_CALLBACK ( dvb_handler_sched_add   ), NULL );
 	g_signal_connect ( dvb, "dvb-scan-stop", G_CALLBACK ( dvb_handler_scan_stop ), NULL );
 	g_signal_connect ( dvb, "dvb-scan-set-data", G_CALLBACK ( dvb_handler_scan  ), NULL );
 }
@@ -781,6 +1361,40 @@ static void dvb_finalize ( GObject *object )
 
 	dvb->exit = TRUE;
 
+	if ( dvb->zap_probe ) g_source_remove ( dvb->zap_probe );
+	if ( dvb->stats_src ) g_source_remove ( dvb->stats_src );
+	if ( dvb->align_src ) g_source_remove ( dvb->align_src );
+
+	align_tone_stop ( dvb->align_tone );
+	dvb->align_tone = NULL;
+
+	ztrace_capture_stop ( dvb->zap_cap );
+	dvb->zap_cap = NULL;
+
+	pretune_free ( dvb->pretune );
+	dvb->pretune = NULL;
+
+	svc_mon_stop ( dvb->svc_mon );
+	dvb->svc_mon = NULL;
+
+	eit_mon_stop ( dvb->eit_mon );
+	dvb->eit_mon = NULL;
+
+	// the recordings stop before their frontends close
+	sched_free ( dvb->sched );
+	sched_dvb_free ( dvb->sched_dvb );
+
+	epg_store_save ( dvb->epg );
+	epg_store_free ( dvb->epg );
+
+	// the monitor feeds sig_hist
+	dvb_femon_stop ( dvb );
+
+	g_hash_table_destroy ( dvb->sig_hist );
+
+	g_async_queue_unref ( dvb->psi_changes );
+	free ( dvb->psi_log );
+
 	if ( dvb->input_file ) free ( dvb->input_file  );
 	if ( dvb->input_file ) free ( dvb->output_file );
 
@@ -792,6 +1406,14 @@ static void dvb_finalize ( GObject *object )
 	dvb->dvb_zap = NULL;
 	dvb->dvb_scan = NULL;
 
+	g_array_free ( dvb->zap_hist, TRUE );
+	free ( dvb->zap_log );
+
+	g_array_free ( dvb->report, TRUE );
+	g_mutex_clear ( &dvb->report_mutex );
+
+	chdb_cache_clear ();
+
 	G_OBJECT_CLASS (dvb_parent_class)->finalize (object);
 }
 
@@ -817,15 +1439,60 @@ static void dvb_class_init ( DvbClass *class )
 		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING );
 
 	g_signal_new ( "dvb-zap", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
-		0, NULL, NULL, NULL, G_TYPE_NONE, 6, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING );
+		0, NULL, NULL, NULL, G_TYPE_STRING, 7, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING );
+
+	g_signal_new ( "dvb-pretune", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_STRV );
+
+	g_signal_new ( "dvb-hist-level", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_UINT );
+
+	g_signal_new ( "dvb-hist-export", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_STRING, 0 );
+
+	g_signal_new ( "stats-history", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_BYTES );
+
+	g_signal_new ( "dvb-epg", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_POINTER, 0 );
+
+	g_signal_new ( "dvb-sched-event", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_STRING, 5, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT );
+
+	g_signal_new ( "dvb-sched-add", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_STRING, 4, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT64, G_TYPE_INT64 );
+
+	g_signal_new ( "dvb-align", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "stats-align", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 6, G_TYPE_BOOLEAN, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "zap-adapter", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT );
 
 	g_signal_new ( "dvb-zap-stop", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
 
 	g_signal_new ( "dvb-scan-set-data", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
-		0, NULL, NULL, NULL, G_TYPE_NONE, 16, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, 
+		0, NULL, NULL, NULL, G_TYPE_STRING, 16, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, 
 		G_TYPE_INT, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING );
 
+	g_signal_new ( "zap-lock", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "zap-psi", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING );
+
+	g_signal_new ( "zap-trace", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_STRING );
+
+	g_signal_new ( "scan-transponder", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 4, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT );
+
+	g_signal_new ( "scan-done", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_UINT );
+
 	g_signal_new ( "stats-update", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 7, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_BOOLEAN );
 }
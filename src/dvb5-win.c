@@ -13,6 +13,8 @@
 #include "scan.h"
 #include "file.h"
 #include "status.h"
+#include "epggrid.h"
+#include "ctl.h"
 
 #include <locale.h>
 
@@ -24,8 +26,10 @@ struct _Dvb5Win
 	Zap *zap;
 	Scan *scan;
 	Status *status;
+	EpgGrid *epg;
 
 	Dvb *dvb;
+	Ctl *ctl; // DVB5_CTL: the engine of this window on the control socket too
 	gboolean fe_lock;
 	uint8_t adapter, frontend, demux;
 };
@@ -94,13 +98,40 @@ static void dvb5_handler_scan_data ( G_GNUC_UNUSED Scan *scan, uint8_t a, uint8_
 		return;
 	}
 
+	char *error = NULL;
+
 	g_signal_emit_by_name ( win->dvb, "dvb-scan-set-data", adapter, frontend, demux, time_mult, new_freqs, get_detect, get_nit, other_nit, 
-		sn, dq, lnb, lna, fi, fo, fmi, fmo );
+		sn, dq, lnb, lna, fi, fo, fmi, fmo, &error );
+
+	if ( error ) dvb5_message_dialog ( "", error, GTK_MESSAGE_ERROR, GTK_WINDOW ( win ) );
+
+	free ( error );
+}
+
+static void dvb5_handler_zap_data ( G_GNUC_UNUSED Zap *zap, uint8_t dmx_out, gboolean eit, const char *channel, const char *file, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->epg, "epg-set-file", file );
+	char *error = NULL;
+
+	g_signal_emit_by_name ( win->dvb, "dvb-zap", win->adapter, win->frontend, win->demux, dmx_out, eit, channel, file, &error );
+
+	if ( error ) dvb5_message_dialog ( "", error, GTK_MESSAGE_ERROR, GTK_WINDOW ( win ) );
+
+	free ( error );
 }
 
-static void dvb5_handler_zap_data ( G_GNUC_UNUSED Zap *zap, uint8_t dmx_out, const char *channel, const char *file, Dvb5Win *win )
+static void dvb5_handler_zap_pretune ( G_GNUC_UNUSED Zap *zap, const char *file, char **channels, Dvb5Win *win )
 {
-	g_signal_emit_by_name ( win->dvb, "dvb-zap", win->adapter, win->frontend, win->demux, dmx_out, channel, file );
+	g_signal_emit_by_name ( win->dvb, "dvb-pretune", file, channels );
+}
+
+static void dvb5_handler_zap_adapter_set ( G_GNUC_UNUSED Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, Dvb5Win *win )
+{
+	win->adapter = a;
+	win->frontend = f;
+	win->demux = d;
+
+	g_signal_emit_by_name ( win->zap, "zap-set-adapter", a, d );
 }
 
 static gboolean dvb5_handler_zap_lock ( G_GNUC_UNUSED Zap *zap, Dvb5Win *win )
@@ -144,6 +175,69 @@ static void dvb5_handler_stats_org ( G_GNUC_UNUSED Dvb *dvb, int num, char *text
 	g_signal_emit_by_name ( win->status, "status-org", num, text );
 }
 
+static void dvb5_handler_zap_lock_ms ( G_GNUC_UNUSED Dvb *dvb, uint32_t lock_ms, gboolean timeout, gboolean retune, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->status, "status-zap-lock", lock_ms, timeout, retune );
+}
+
+static void dvb5_handler_zap_trace ( G_GNUC_UNUSED Dvb *dvb, const char *channel, const char *trace, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->status, "status-zap-trace", channel, trace );
+}
+
+static void dvb5_handler_zap_psi ( G_GNUC_UNUSED Dvb *dvb, const char *change, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->status, "status-zap-trace", "PSI", change );
+}
+
+static void dvb5_handler_stats_history ( G_GNUC_UNUSED Dvb *dvb, uint32_t res, GBytes *hist, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->status, "status-history", res, hist );
+}
+
+static void dvb5_handler_stats_align ( G_GNUC_UNUSED Dvb *dvb, gboolean on, double sgl, double snr, double sgl_peak, double snr_peak, gboolean fe_lock, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->status, "status-align", on, sgl, snr, sgl_peak, snr_peak, fe_lock );
+}
+
+static void dvb5_handler_align ( G_GNUC_UNUSED Status *status, gboolean on, gboolean tone, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->dvb, "dvb-align", on, tone );
+}
+
+static void dvb5_handler_hist_level ( G_GNUC_UNUSED Status *status, uint32_t level, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->dvb, "dvb-hist-level", level );
+}
+
+static void dvb5_handler_epg_record ( G_GNUC_UNUSED EpgGrid *grid, const char *file, uint16_t onid, uint16_t tsid, uint16_t sid, uint16_t event_id, Dvb5Win *win )
+{
+	char *info = NULL;
+	g_signal_emit_by_name ( win->dvb, "dvb-sched-event", file, onid, tsid, sid, event_id, &info );
+
+	if ( info ) dvb5_message_dialog ( "Schedule", info, GTK_MESSAGE_INFO, GTK_WINDOW ( win ) );
+
+	free ( info );
+}
+
+static void dvb5_handler_hist_export ( G_GNUC_UNUSED Status *status, Dvb5Win *win )
+{
+	char *file = NULL;
+	g_signal_emit_by_name ( win->dvb, "dvb-hist-export", &file );
+
+	if ( file )
+		dvb5_message_dialog ( "Signal history", file, GTK_MESSAGE_INFO, GTK_WINDOW ( win ) );
+	else
+		dvb5_message_dialog ( "Signal history", "No history of this frontend.", GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
+
+	free ( file );
+}
+
+static void dvb5_handler_scan_tp ( G_GNUC_UNUSED Dvb *dvb, uint32_t freq, uint32_t lock_ms, uint32_t dwell_ms, uint32_t services, Dvb5Win *win )
+{
+	g_signal_emit_by_name ( win->status, "status-scan-add", freq, lock_ms, dwell_ms, services );
+}
+
 static void dvb5_handler_scan_af ( G_GNUC_UNUSED Scan *scan, const char *name_a, uint8_t a, const char *name_f, uint8_t f, const char *name_d, uint8_t d, Dvb5Win *win )
 {
 	g_signal_emit_by_name ( win->dvb, "dvb-info", a, f );
@@ -180,6 +274,7 @@ static void dvb5_win_create ( Dvb5Win *win )
 
 	gtk_notebook_append_page ( win->notebook, GTK_WIDGET ( win->scan   ), gtk_label_new ( "Scan"   ) );
 	gtk_notebook_append_page ( win->notebook, GTK_WIDGET ( win->zap    ), gtk_label_new ( "Zap"    ) );
+	gtk_notebook_append_page ( win->notebook, GTK_WIDGET ( win->epg    ), gtk_label_new ( "EPG"    ) );
 	gtk_notebook_append_page ( win->notebook, GTK_WIDGET ( win->status ), gtk_label_new ( "Status" ) );
 
 	gtk_notebook_set_tab_pos ( win->notebook, GTK_POS_TOP );
@@ -200,20 +295,41 @@ static void dvb5_win_init ( Dvb5Win *win )
 	g_signal_connect ( win->dvb, "dvb-scan-info", G_CALLBACK ( dvb5_handler_scan_info ), win );
 	g_signal_connect ( win->dvb, "stats-update",  G_CALLBACK ( dvb5_handler_stats_upd ), win );
 	g_signal_connect ( win->dvb, "stats-org",     G_CALLBACK ( dvb5_handler_stats_org ), win );
+	g_signal_connect ( win->dvb, "stats-history", G_CALLBACK ( dvb5_handler_stats_history ), win );
+	g_signal_connect ( win->dvb, "stats-align",   G_CALLBACK ( dvb5_handler_stats_align ), win );
+	g_signal_connect ( win->dvb, "scan-transponder", G_CALLBACK ( dvb5_handler_scan_tp ), win );
+	g_signal_connect ( win->dvb, "zap-lock",      G_CALLBACK ( dvb5_handler_zap_lock_ms ), win );
+	g_signal_connect ( win->dvb, "zap-trace",     G_CALLBACK ( dvb5_handler_zap_trace ), win );
+	g_signal_connect ( win->dvb, "zap-psi",       G_CALLBACK ( dvb5_handler_zap_psi ), win );
+	g_signal_connect ( win->dvb, "zap-adapter",   G_CALLBACK ( dvb5_handler_zap_adapter_set ), win );
+
+	const char *ctl = g_getenv ( CTL_ENV );
+	win->ctl = ( ctl && ctl[0] ) ? ctl_new ( win->dvb, ( g_str_equal ( ctl, "1" ) ) ? NULL : ctl ) : NULL;
 
 	win->zap    = zap_new  ();
 	win->scan   = scan_new ();
 	win->status = status_new ();
+	win->epg    = epg_grid_new ();
+
+	gpointer epg = NULL;
+	g_signal_emit_by_name ( win->dvb, "dvb-epg", &epg );
+	g_signal_emit_by_name ( win->epg, "epg-set-store", epg );
+
+	g_signal_connect ( win->epg, "epg-record", G_CALLBACK ( dvb5_handler_epg_record ), win );
 
 	g_signal_connect ( win->zap,    "zap-set-data",    G_CALLBACK ( dvb5_handler_zap_data    ), win );
 	g_signal_connect ( win->zap,    "zap-get-felock",  G_CALLBACK ( dvb5_handler_zap_lock    ), win );
 	g_signal_connect ( win->zap,    "zap-get-adapter", G_CALLBACK ( dvb5_handler_zap_adapter ), win );
 	g_signal_connect ( win->zap,    "zap-get-demux",   G_CALLBACK ( dvb5_handler_zap_demux   ), win );
+	g_signal_connect ( win->zap,    "zap-pretune",     G_CALLBACK ( dvb5_handler_zap_pretune ), win );
 	g_signal_connect ( win->scan,   "scan-set-af",     G_CALLBACK ( dvb5_handler_scan_af     ), win );
 	g_signal_connect ( win->scan,   "scan-set-data",   G_CALLBACK ( dvb5_handler_scan_data   ), win );
 	g_signal_connect ( win->status, "scan-stop",       G_CALLBACK ( dvb5_handler_scan_stop   ), win );
 	g_signal_connect ( win->status, "scan-start",      G_CALLBACK ( dvb5_handler_scan_start  ), win );
 	g_signal_connect ( win->status, "win-info",        G_CALLBACK ( dvb5_handler_win_info    ), win );
+	g_signal_connect ( win->status, "hist-level",      G_CALLBACK ( dvb5_handler_hist_level  ), win );
+	g_signal_connect ( win->status, "hist-export",     G_CALLBACK ( dvb5_handler_hist_export ), win );
+	g_signal_connect ( win->status, "align",           G_CALLBACK ( dvb5_handler_align       ), win );
 	g_signal_connect ( win->status, "win-close",       G_CALLBACK ( dvb5_handler_win_close   ), win );
 
 	dvb5_win_create ( win );
@@ -225,6 +341,7 @@ static void dvb5_win_finalize ( GObject *object )
 {
 	Dvb5Win *win = DVB5_WIN ( object );
 
+	ctl_free ( win->ctl );
 	g_object_unref ( win->dvb );
 
 	G_OBJECT_CLASS ( dvb5_win_parent_class )->finalize ( object );
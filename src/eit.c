@@ -0,0 +1,274 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "eit.h"
+#include "svc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dvb/dmx.h>
+
+#define EIT_SECT_SIZE 4096
+#define EIT_BUF_SIZE  ( 1024 * 1024 ) // demux buffer: a full schedule burst between two reads
+
+#define EIT_TID_PF_ACTUAL 0x4e
+#define EIT_TID_LAST      0x6f
+
+typedef struct _EitSub EitSub;
+
+/* One sub-table: service + table_id; the sections of its current version already stored */
+struct _EitSub
+{
+	int64_t key; // onid << 40 | tsid << 24 | sid << 8 | tid
+	uint8_t ver;
+	uint8_t seen[32]; // section_number bits
+};
+
+struct _EitMon
+{
+	struct dvb_open_descriptor *fd;
+	EpgStore *store; // not owned
+
+	GHashTable *subs; // &key -> EitSub *
+	GThread *thread;
+
+	uint64_t sections, dups, events, overflows;
+
+	gint stop;
+};
+
+static uint8_t eit_bcd ( uint8_t b )
+{
+	return (uint8_t)( ( b >> 4 ) * 10 + ( b & 0x0f ) );
+}
+
+/* DVB text ( EN 300 468 annex A ): a leading byte below 0x20 names the table, the default is Latin ( ISO 6937 read as ISO-8859-1 ) */
+static char * eit_text ( const uint8_t *s, uint8_t len )
+{
+	if ( !len ) return NULL;
+
+	const char *charset = "ISO-8859-1";
+	char cs[16];
+	gboolean single = TRUE;
+
+	if ( s[0] >= 0x01 && s[0] <= 0x0b ) { sprintf ( cs, "ISO-8859-%u", s[0] + 4 ); charset = cs; s++; len--; }
+	else if ( s[0] == 0x10 && len >= 3 ) { sprintf ( cs, "ISO-8859-%u", s[2] ); charset = cs; s += 3; len -= 3; }
+	else if ( s[0] == 0x11 ) { charset = "UCS-2BE"; single = FALSE; s++; len--; }
+	else if ( s[0] == 0x13 ) { charset = "GB2312";  single = FALSE; s++; len--; }
+	else if ( s[0] == 0x14 ) { charset = "BIG5";    single = FALSE; s++; len--; }
+	else if ( s[0] == 0x15 ) { charset = "UTF-8";   single = FALSE; s++; len--; }
+	else if ( s[0] < 0x20 ) { s++; len--; }
+
+	char buf[256];
+	gsize n = 0;
+
+	// single-byte tables: 0x80 ... 0x9f are control codes, 0x8a - CR/LF
+	uint8_t i = 0; for ( i = 0; i < len; i++ )
+	{
+		if ( single && s[i] >= 0x80 && s[i] <= 0x9f ) { if ( s[i] == 0x8a ) buf[n++] = '\n'; continue; }
+
+		buf[n++] = (char)s[i];
+	}
+
+	if ( !n ) return NULL;
+
+	char *out = g_convert ( buf, (gssize)n, "UTF-8", charset, NULL, NULL, NULL );
+
+	if ( !out ) out = g_utf8_make_valid ( buf, (gssize)n );
+
+	return out;
+}
+
+/* Name and text of the first short_event_descriptor */
+static void eit_descriptors ( const uint8_t *p, const uint8_t *end, char **name, char **text )
+{
+	while ( p + 2 <= end )
+	{
+		uint8_t tag = p[0], dlen = p[1];
+		const uint8_t *d = p + 2;
+
+		if ( d + dlen > end ) break;
+
+		if ( tag == 0x4d && dlen >= 5 && !*name )
+		{
+			uint8_t nlen = d[3];
+
+			if ( 4 + nlen + 1 <= dlen )
+			{
+				uint8_t tlen = d[4 + nlen];
+
+				*name = eit_text ( d + 4, nlen );
+				if ( 5 + nlen + tlen <= dlen ) *text = eit_text ( d + 5 + nlen, tlen );
+			}
+		}
+
+		p = d + dlen;
+	}
+}
+
+static gboolean eit_sub_check ( EitMon *mon, const uint8_t *b )
+{
+	uint16_t sid  = (uint16_t)( b[3] << 8 | b[4] );
+	uint16_t tsid = (uint16_t)( b[8] << 8 | b[9] );
+	uint16_t onid = (uint16_t)( b[10] << 8 | b[11] );
+	uint8_t ver = ( b[5] >> 1 ) & 0x1f, sec = b[6];
+
+	int64_t key = (int64_t)onid << 40 | (int64_t)tsid << 24 | (int64_t)sid << 8 | b[0];
+
+	EitSub *sub = g_hash_table_lookup ( mon->subs, &key );
+
+	if ( !sub )
+	{
+		sub = g_new0 ( EitSub, 1 );
+		sub->key = key;
+		sub->ver = ver;
+
+		g_hash_table_insert ( mon->subs, &sub->key, sub );
+	}
+
+	// a new version starts over
+	if ( sub->ver != ver ) { sub->ver = ver; memset ( sub->seen, 0, sizeof ( sub->seen ) ); }
+
+	if ( sub->seen[sec / 8] & ( 1 << ( sec % 8 ) ) ) return FALSE;
+
+	sub->seen[sec / 8] |= (uint8_t)( 1 << ( sec % 8 ) );
+
+	return TRUE;
+}
+
+static void eit_section ( EitMon *mon, const uint8_t *b, ssize_t len )
+{
+	if ( len < 18 || b[0] < EIT_TID_PF_ACTUAL || b[0] > EIT_TID_LAST ) return;
+
+	ssize_t total = ( ( ( b[1] & 0x0f ) << 8 ) | b[2] ) + 3;
+
+	if ( total > len || total < 18 ) return;
+
+	mon->sections++;
+
+	// every repetition of the carousel after the first is dropped here, before any parsing
+	if ( !eit_sub_check ( mon, b ) ) { mon->dups++; return; }
+
+	EpgService id = { .onid = (uint16_t)( b[10] << 8 | b[11] ), .tsid = (uint16_t)( b[8] << 8 | b[9] ), .sid = (uint16_t)( b[3] << 8 | b[4] ) };
+
+	const uint8_t *p = b + 14, *end = b + total - 4; // CRC checked by the demux
+
+	while ( p + 12 <= end )
+	{
+		uint16_t mjd = (uint16_t)( p[2] << 8 | p[3] );
+		uint16_t dlen = (uint16_t)( ( p[10] & 0x0f ) << 8 | p[11] );
+
+		const uint8_t *d = p + 12;
+
+		if ( d + dlen > end ) break;
+
+		if ( mjd != 0xffff )
+		{
+			EpgEvent ev = { .event_id = (uint16_t)( p[0] << 8 | p[1] ), .running = p[10] >> 5, .tid = b[0] };
+
+			ev.start = (uint32_t)( ( mjd - 40587 ) * 86400 + eit_bcd ( p[4] ) * 3600 + eit_bcd ( p[5] ) * 60 + eit_bcd ( p[6] ) );
+			ev.duration = (uint32_t)( eit_bcd ( p[7] ) * 3600 + eit_bcd ( p[8] ) * 60 + eit_bcd ( p[9] ) );
+
+			char *name = NULL, *text = NULL;
+
+			eit_descriptors ( d, d + dlen, &name, &text );
+
+			epg_store_add ( mon->store, &id, &ev, name, text );
+
+			free ( name );
+			free ( text );
+
+			mon->events++;
+		}
+
+		p = d + dlen;
+	}
+}
+
+static gpointer eit_mon_thread ( EitMon *mon )
+{
+	uint8_t *buf = g_malloc ( EIT_SECT_SIZE );
+
+	int fd = dvb_dev_get_fd ( mon->fd );
+
+	while ( !g_atomic_int_get ( &mon->stop ) )
+	{
+		struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLPRI };
+
+		if ( poll ( &pfd, 1, 100 ) <= 0 ) continue;
+
+		// drain: one wake-up may carry many sections
+		while ( !g_atomic_int_get ( &mon->stop ) )
+		{
+			ssize_t len = read ( fd, buf, EIT_SECT_SIZE );
+
+			if ( len > 0 ) { eit_section ( mon, buf, len ); continue; }
+
+			// the kernel dropped its buffer: the sub-tables repeat, the seen bits make us pick them up again
+			if ( len == -1 && errno == EOVERFLOW ) { mon->overflows++; continue; }
+
+			break;
+		}
+	}
+
+	free ( buf );
+
+	return NULL;
+}
+
+/* All EIT tables on the tuned transponder ( p/f and schedule, actual and other ) into store */
+EitMon * eit_mon_start ( struct dvb_device *dvb, const char *demux_dev, EpgStore *store )
+{
+	if ( !store ) return NULL;
+
+	struct dvb_open_descriptor *fd = dvb_dev_open ( dvb, demux_dev, O_RDWR | O_NONBLOCK );
+
+	if ( !fd ) { g_warning ( "%s:: failed opening %s", __func__, demux_dev ); return NULL; }
+
+	if ( ioctl ( dvb_dev_get_fd ( fd ), DMX_SET_BUFFER_SIZE, EIT_BUF_SIZE ) < 0 ) g_warning ( "%s:: DMX_SET_BUFFER_SIZE: %m ", __func__ );
+
+	// table_id 0x40 ... 0x7f, the rest is sorted out per section
+	uint8_t filter[DMX_FILTER_SIZE] = { 0x40 }, mask[DMX_FILTER_SIZE] = { 0xc0 }, mode[DMX_FILTER_SIZE] = { 0 };
+
+	if ( dvb_dev_dmx_set_section_filter ( fd, SVC_PID_EIT, 1, filter, mask, mode, DMX_IMMEDIATE_START | DMX_CHECK_CRC ) < 0 )
+	{
+		g_warning ( "%s:: pid 0x%04x: set section filter failed.", __func__, SVC_PID_EIT );
+		dvb_dev_close ( fd );
+		return NULL;
+	}
+
+	EitMon *mon = g_new0 ( EitMon, 1 );
+
+	mon->fd = fd;
+	mon->store = store;
+	mon->subs = g_hash_table_new_full ( g_int64_hash, g_int64_equal, NULL, free );
+	mon->thread = g_thread_new ( "eit-monitor", (GThreadFunc)eit_mon_thread, mon );
+
+	return mon;
+}
+
+void eit_mon_stop ( EitMon *mon )
+{
+	if ( !mon ) return;
+
+	g_atomic_int_set ( &mon->stop, 1 );
+	g_thread_join ( mon->thread );
+
+	g_message ( "%s:: sections %" G_GUINT64_FORMAT ", repeated %" G_GUINT64_FORMAT ", events %" G_GUINT64_FORMAT ", overflows %" G_GUINT64_FORMAT " ",
+		__func__, mon->sections, mon->dups, mon->events, mon->overflows );
+
+	dvb_dev_close ( mon->fd );
+	g_hash_table_unref ( mon->subs );
+
+	free ( mon );
+}
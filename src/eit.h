@@ -0,0 +1,20 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "epg.h"
+
+#include <libdvbv5/dvb-dev.h>
+
+typedef struct _EitMon EitMon;
+
+EitMon * eit_mon_start ( struct dvb_device *, const char *, EpgStore * );
+
+void eit_mon_stop ( EitMon * );
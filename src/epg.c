@@ -0,0 +1,417 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "epg.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define EPG_MAGIC "DVB5EPG"
+#define EPG_VERSION 1
+
+typedef struct _EpgHeader EpgHeader;
+
+struct _EpgHeader
+{
+	char magic[8];
+	uint32_t version, n_svc, n_evt, str_len;
+	uint32_t svc_off, evt_off, str_off; // byte offsets from the file start
+};
+
+typedef struct _EpgSvcRec EpgSvcRec;
+
+struct _EpgSvcRec
+{
+	uint16_t onid, tsid, sid, pad;
+	uint32_t first, count; // events
+};
+
+typedef struct _EpgSvc EpgSvc;
+
+struct _EpgSvc
+{
+	int64_t key; // onid << 32 | tsid << 16 | sid
+	EpgService id;
+	uint32_t pos; // in svcs
+
+	// the saved events stay in the mapping until the service gets a new one
+	const EpgEvent *base;
+	uint32_t n_base;
+
+	GArray *events; // EpgEvent, sorted by start; NULL - base
+};
+
+/*
+* Events per service in start order, strings interned once: ids below base_len are offsets into
+* the mapped string table, the rest index strings added since the start ( GStringChunk, stable ).
+*/
+struct _EpgStore
+{
+	GMutex mutex;
+	char *file;
+
+	void *map;
+	size_t map_size;
+
+	const char *base_str;
+	uint32_t base_len;
+
+	GPtrArray *svcs;   // EpgSvc *
+	GHashTable *index; // &key -> EpgSvc *
+
+	GStringChunk *chunk;
+	GPtrArray *strs;    // const char *, id - base_len
+	GHashTable *intern; // const char * -> id
+};
+
+static int64_t epg_key ( const EpgService *id )
+{
+	return (int64_t)id->onid << 32 | (int64_t)id->tsid << 16 | id->sid;
+}
+
+static EpgSvc * epg_svc_get ( EpgStore *store, const EpgService *id )
+{
+	int64_t key = epg_key ( id );
+
+	EpgSvc *svc = g_hash_table_lookup ( store->index, &key );
+
+	if ( svc ) return svc;
+
+	svc = g_new0 ( EpgSvc, 1 );
+
+	svc->key = key;
+	svc->id  = *id;
+	svc->pos = store->svcs->len;
+
+	g_ptr_array_add ( store->svcs, svc );
+	g_hash_table_insert ( store->index, &svc->key, svc );
+
+	return svc;
+}
+
+static void epg_svc_free ( EpgSvc *svc )
+{
+	if ( svc->events ) g_array_free ( svc->events, TRUE );
+
+	free ( svc );
+}
+
+static GArray * epg_svc_events ( EpgSvc *svc )
+{
+	if ( svc->events ) return svc->events;
+
+	svc->events = g_array_sized_new ( FALSE, FALSE, sizeof ( EpgEvent ), svc->n_base + 16 );
+
+	if ( svc->n_base ) g_array_append_vals ( svc->events, svc->base, svc->n_base );
+
+	svc->base = NULL;
+	svc->n_base = 0;
+
+	return svc->events;
+}
+
+static uint32_t epg_intern ( EpgStore *store, const char *str )
+{
+	if ( !str || !str[0] ) return 0;
+
+	gpointer id = NULL;
+
+	if ( g_hash_table_lookup_extended ( store->intern, str, NULL, &id ) ) return GPOINTER_TO_UINT ( id );
+
+	const char *s = g_string_chunk_insert ( store->chunk, str );
+
+	uint32_t new_id = store->base_len + store->strs->len;
+
+	g_ptr_array_add ( store->strs, (gpointer)s );
+	g_hash_table_insert ( store->intern, (gpointer)s, GUINT_TO_POINTER ( new_id ) );
+
+	return new_id;
+}
+
+/* Caller holds the lock; the pointer is valid until it is released */
+const char * epg_store_str ( EpgStore *store, uint32_t id )
+{
+	if ( id < store->base_len ) return store->base_str + id;
+
+	id -= store->base_len;
+
+	return ( id < store->strs->len ) ? g_ptr_array_index ( store->strs, id ) : "";
+}
+
+/* An event replaces its older copy ( same id ) and whatever it overlaps: the schedule moved */
+static void epg_events_insert ( GArray *a, const EpgEvent *e )
+{
+	uint32_t end = e->start + e->duration;
+
+	guint i = 0; for ( i = 0; i < a->len; i++ )
+	{
+		EpgEvent *v = &g_array_index ( a, EpgEvent, i );
+
+		if ( v->event_id != e->event_id ) continue;
+
+		if ( v->start == e->start && v->duration == e->duration ) { *v = *e; return; }
+
+		g_array_remove_index ( a, i );
+		break;
+	}
+
+	guint lo = 0, hi = a->len;
+
+	while ( lo < hi )
+	{
+		guint mid = ( lo + hi ) / 2;
+
+		if ( g_array_index ( a, EpgEvent, mid ).start < e->start ) lo = mid + 1; else hi = mid;
+	}
+
+	if ( lo > 0 )
+	{
+		const EpgEvent *p = &g_array_index ( a, EpgEvent, lo - 1 );
+
+		if ( p->start + p->duration > e->start ) g_array_remove_index ( a, --lo );
+	}
+
+	while ( lo < a->len && g_array_index ( a, EpgEvent, lo ).start < MAX ( end, e->start + 1 ) ) g_array_remove_index ( a, lo );
+
+	g_array_insert_val ( a, lo, *e );
+}
+
+void epg_store_add ( EpgStore *store, const EpgService *id, const EpgEvent *event, const char *name, const char *text )
+{
+	g_mutex_lock ( &store->mutex );
+
+	EpgEvent e = *event;
+
+	e.name = epg_intern ( store, name );
+	e.text = epg_intern ( store, text );
+
+	epg_events_insert ( epg_svc_events ( epg_svc_get ( store, id ) ), &e );
+
+	g_mutex_unlock ( &store->mutex );
+}
+
+void epg_store_lock ( EpgStore *store )
+{
+	g_mutex_lock ( &store->mutex );
+}
+
+void epg_store_unlock ( EpgStore *store )
+{
+	g_mutex_unlock ( &store->mutex );
+}
+
+uint32_t epg_store_n_services ( EpgStore *store )
+{
+	return store->svcs->len;
+}
+
+/* Caller holds the lock: the events of service i in start order */
+const EpgEvent * epg_store_events ( EpgStore *store, uint32_t i, EpgService *id, uint32_t *n )
+{
+	EpgSvc *svc = g_ptr_array_index ( store->svcs, i );
+
+	if ( id ) *id = svc->id;
+
+	*n = ( svc->events ) ? svc->events->len : svc->n_base;
+
+	return ( svc->events ) ? (const EpgEvent *)svc->events->data : svc->base;
+}
+
+/* Caller holds the lock; -1 - no events for the service */
+int64_t epg_store_find ( EpgStore *store, const EpgService *id )
+{
+	int64_t key = epg_key ( id );
+
+	EpgSvc *svc = g_hash_table_lookup ( store->index, &key );
+
+	return ( svc ) ? svc->pos : -1;
+}
+
+static gboolean epg_check ( const EpgHeader *h, size_t size )
+{
+	if ( size < sizeof ( EpgHeader ) || memcmp ( h->magic, EPG_MAGIC, 8 ) || h->version != EPG_VERSION ) return FALSE;
+
+	if ( (uint64_t)h->svc_off + (uint64_t)h->n_svc * sizeof ( EpgSvcRec ) > size ) return FALSE;
+	if ( (uint64_t)h->evt_off + (uint64_t)h->n_evt * sizeof ( EpgEvent ) > size ) return FALSE;
+	if ( (uint64_t)h->str_off + h->str_len > size || h->str_len == 0 ) return FALSE;
+
+	return ( ( (const char *)h )[h->str_off + h->str_len - 1] == '\0' );
+}
+
+static void epg_store_map ( EpgStore *store )
+{
+	int fd = open ( store->file, O_RDONLY | O_CLOEXEC );
+
+	if ( fd == -1 ) return;
+
+	struct stat st;
+
+	if ( fstat ( fd, &st ) == -1 || st.st_size < (off_t)sizeof ( EpgHeader ) ) { close ( fd ); return; }
+
+	void *map = mmap ( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close ( fd );
+
+	if ( map == MAP_FAILED ) { g_warning ( "%s:: mmap %s: %m", __func__, store->file ); return; }
+
+	const EpgHeader *h = map;
+
+	if ( !epg_check ( h, (size_t)st.st_size ) ) { g_warning ( "%s:: %s: invalid EPG file.", __func__, store->file ); munmap ( map, (size_t)st.st_size ); return; }
+
+	store->map = map;
+	store->map_size = (size_t)st.st_size;
+	store->base_str = (const char *)map + h->str_off;
+	store->base_len = h->str_len;
+
+	const EpgSvcRec *rec = (const EpgSvcRec *)( (const char *)map + h->svc_off );
+	const EpgEvent  *evt = (const EpgEvent  *)( (const char *)map + h->evt_off );
+
+	uint32_t i = 0; for ( i = 0; i < h->n_svc; i++ )
+	{
+		if ( (uint64_t)rec[i].first + rec[i].count > h->n_evt ) continue;
+
+		EpgService id = { rec[i].onid, rec[i].tsid, rec[i].sid };
+		EpgSvc *svc = epg_svc_get ( store, &id );
+
+		svc->base = evt + rec[i].first;
+		svc->n_base = rec[i].count;
+	}
+
+	g_message ( "%s:: %s: %u services, %u events ", __func__, store->file, h->n_svc, h->n_evt );
+}
+
+/* file - the persistent copy: mapped now, rewritten by epg_store_save */
+EpgStore * epg_store_open ( const char *file )
+{
+	EpgStore *store = g_new0 ( EpgStore, 1 );
+
+	g_mutex_init ( &store->mutex );
+
+	store->file = g_strdup ( file );
+	store->base_str = "";
+	store->base_len = 1; // id 0 - no string
+
+	store->svcs   = g_ptr_array_new_with_free_func ( (GDestroyNotify)epg_svc_free );
+	store->index  = g_hash_table_new ( g_int64_hash, g_int64_equal );
+	store->chunk  = g_string_chunk_new ( 64 * 1024 );
+	store->strs   = g_ptr_array_new ();
+	store->intern = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	if ( file ) epg_store_map ( store );
+
+	return store;
+}
+
+static uint32_t epg_save_str ( GString *str, GHashTable *seen, const char *s )
+{
+	if ( !s[0] ) return 0;
+
+	gpointer off = NULL;
+
+	if ( g_hash_table_lookup_extended ( seen, s, NULL, &off ) ) return GPOINTER_TO_UINT ( off );
+
+	uint32_t o = (uint32_t)str->len;
+
+	g_string_append_len ( str, s, (gssize)strlen ( s ) + 1 );
+	g_hash_table_insert ( seen, (gpointer)s, GUINT_TO_POINTER ( o ) );
+
+	return o;
+}
+
+/* The whole store without the events that ended EPG_KEEP ago, written atomically */
+gboolean epg_store_save ( EpgStore *store )
+{
+	if ( !store->file ) return FALSE;
+
+	uint32_t now = (uint32_t)( g_get_real_time () / G_USEC_PER_SEC );
+
+	GArray *recs = g_array_new ( FALSE, FALSE, sizeof ( EpgSvcRec ) );
+	GArray *evts = g_array_new ( FALSE, FALSE, sizeof ( EpgEvent ) );
+	GString *str = g_string_new_len ( "", 1 );
+	GHashTable *seen = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	g_mutex_lock ( &store->mutex );
+
+	uint32_t i = 0; for ( i = 0; i < store->svcs->len; i++ )
+	{
+		uint32_t n = 0;
+		EpgService id;
+		const EpgEvent *ev = epg_store_events ( store, i, &id, &n );
+
+		EpgSvcRec r = { .onid = id.onid, .tsid = id.tsid, .sid = id.sid, .first = evts->len };
+
+		uint32_t e = 0; for ( e = 0; e < n; e++ )
+		{
+			if ( (uint64_t)ev[e].start + ev[e].duration + EPG_KEEP < now ) continue;
+
+			EpgEvent c = ev[e];
+
+			c.name = epg_save_str ( str, seen, epg_store_str ( store, ev[e].name ) );
+			c.text = epg_save_str ( str, seen, epg_store_str ( store, ev[e].text ) );
+
+			g_array_append_val ( evts, c );
+		}
+
+		r.count = evts->len - r.first;
+
+		if ( r.count ) g_array_append_val ( recs, r );
+	}
+
+	g_mutex_unlock ( &store->mutex );
+
+	EpgHeader h = { .version = EPG_VERSION, .n_svc = recs->len, .n_evt = evts->len, .str_len = (uint32_t)str->len };
+	memcpy ( h.magic, EPG_MAGIC, sizeof ( EPG_MAGIC ) );
+
+	h.svc_off = sizeof ( EpgHeader );
+	h.evt_off = h.svc_off + recs->len * (uint32_t)sizeof ( EpgSvcRec );
+	h.str_off = h.evt_off + evts->len * (uint32_t)sizeof ( EpgEvent );
+
+	GByteArray *data = g_byte_array_sized_new ( h.str_off + h.str_len );
+
+	g_byte_array_append ( data, (const uint8_t *)&h, sizeof ( h ) );
+	g_byte_array_append ( data, (const uint8_t *)recs->data, recs->len * (uint32_t)sizeof ( EpgSvcRec ) );
+	g_byte_array_append ( data, (const uint8_t *)evts->data, evts->len * (uint32_t)sizeof ( EpgEvent ) );
+	g_byte_array_append ( data, (const uint8_t *)str->str, (uint32_t)str->len );
+
+	// the mapping stays valid: the new file replaces the name, not the mapped inode
+	GError *error = NULL;
+	gboolean ret = g_file_set_contents ( store->file, (const char *)data->data, (gssize)data->len, &error );
+
+	if ( error ) { g_warning ( "%s:: %s ", __func__, error->message ); g_error_free ( error ); }
+
+	g_byte_array_free ( data, TRUE );
+	g_hash_table_unref ( seen );
+	g_string_free ( str, TRUE );
+	g_array_free ( evts, TRUE );
+	g_array_free ( recs, TRUE );
+
+	return ret;
+}
+
+void epg_store_free ( EpgStore *store )
+{
+	if ( !store ) return;
+
+	g_hash_table_unref ( store->intern );
+	g_ptr_array_free ( store->strs, TRUE );
+	g_string_chunk_free ( store->chunk );
+
+	g_hash_table_unref ( store->index );
+	g_ptr_array_free ( store->svcs, TRUE );
+
+	if ( store->map ) munmap ( store->map, store->map_size );
+
+	g_mutex_clear ( &store->mutex );
+
+	free ( store->file );
+	free ( store );
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <glib.h>
+
+#define EPG_FILE "epg.bin" // in g_get_user_cache_dir () / dvb5-gtk
+#define EPG_KEEP ( 3 * 3600 ) // s, events that ended longer ago are dropped
+
+typedef struct _EpgEvent EpgEvent;
+
+struct _EpgEvent
+{
+	uint32_t start, duration; // UTC, unix s; s
+	uint32_t name, text;      // epg_store_str ids
+	uint16_t event_id;
+	uint8_t running, tid;     // running_status, the EIT table the event came from
+};
+
+typedef struct _EpgService EpgService;
+
+struct _EpgService
+{
+	uint16_t onid, tsid, sid;
+};
+
+typedef struct _EpgStore EpgStore;
+
+EpgStore * epg_store_open ( const char * );
+
+gboolean epg_store_save ( EpgStore * );
+
+void epg_store_free ( EpgStore * );
+
+void epg_store_add ( EpgStore *, const EpgService *, const EpgEvent *, const char *, const char * );
+
+void epg_store_lock ( EpgStore * );
+
+void epg_store_unlock ( EpgStore * );
+
+uint32_t epg_store_n_services ( EpgStore * );
+
+const EpgEvent * epg_store_events ( EpgStore *, uint32_t, EpgService *, uint32_t * );
+
+int64_t epg_store_find ( EpgStore *, const EpgService * );
+
+const char * epg_store_str ( EpgStore *, uint32_t );
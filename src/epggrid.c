@@ -0,0 +1,452 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "epggrid.h"
+#include "epg.h"
+#include "chdb.h"
+
+#include <time.h>
+
+#define GRID_ROW_H  28
+#define GRID_HEAD_H 22
+#define GRID_NAME_W 160
+#define GRID_PX_MIN 4.0 // horizontal scale: px per minute
+
+#define GRID_BEFORE ( 3 * 3600 )       // s of the past
+#define GRID_AFTER  ( 14 * 24 * 3600 ) // s of the future
+
+/*
+* Services x time, drawn from the EPG store: only the visible rows and, per row, only the events
+* in the visible time span ( binary search ) are drawn; no widget per event or service.
+* v_adj - rows, h_adj - minutes from t0.
+*/
+struct _EpgGrid
+{
+	GtkBox parent_instance;
+
+	GtkDrawingArea *area;
+	GtkAdjustment *v_adj, *h_adj;
+
+	EpgStore *store; // not owned
+	ChDb *db;        // channel names
+	char *file;
+	int64_t t0;
+
+	guint src;
+};
+
+G_DEFINE_TYPE ( EpgGrid, epg_grid, GTK_TYPE_BOX )
+
+static uint32_t epg_grid_first ( const EpgEvent *ev, uint32_t n, int64_t t )
+{
+	uint32_t lo = 0, hi = n;
+
+	while ( lo < hi )
+	{
+		uint32_t mid = ( lo + hi ) / 2;
+
+		if ( (int64_t)ev[mid].start + ev[mid].duration <= t ) lo = mid + 1; else hi = mid;
+	}
+
+	return lo;
+}
+
+static char * epg_grid_name ( EpgGrid *grid, const EpgService *id )
+{
+	struct dvb_entry *entry = ( grid->db ) ? chdb_lookup_sid ( grid->db, id->sid ) : NULL;
+
+	if ( entry && entry->channel && ( !entry->transport_id || entry->transport_id == id->tsid ) ) return g_strdup ( entry->channel );
+
+	return g_strdup_printf ( "sid %u ( ts %u )", id->sid, id->tsid );
+}
+
+static void epg_grid_text ( cairo_t *cr, PangoLayout *layout, const char *text, double x, double y, double w, double h )
+{
+	if ( w < 8 ) return;
+
+	pango_layout_set_text ( layout, text, -1 );
+	pango_layout_set_width ( layout, (int)( ( w - 6 ) * PANGO_SCALE ) );
+
+	int th = 0;
+	pango_layout_get_pixel_size ( layout, NULL, &th );
+
+	cairo_move_to ( cr, x + 3, y + ( h - th ) / 2 );
+	pango_cairo_show_layout ( cr, layout );
+}
+
+static void epg_grid_head ( cairo_t *cr, PangoLayout *layout, int width, int64_t t_left, int64_t t_right )
+{
+	// a mark every 30 min
+	int64_t t = t_left - t_left % 1800 + 1800;
+
+	for ( ; t < t_right; t += 1800 )
+	{
+		double x = GRID_NAME_W + (double)( t - t_left ) / 60 * GRID_PX_MIN;
+
+		time_t tt = (time_t)t;
+		struct tm tm;
+		localtime_r ( &tt, &tm );
+
+		char str[32];
+		strftime ( str, sizeof ( str ), ( tm.tm_hour == 0 && tm.tm_min == 0 ) ? "%a %d" : "%H:%M", &tm );
+
+		cairo_set_source_rgba ( cr, 0.5, 0.5, 0.5, 0.5 );
+		cairo_move_to ( cr, x + 0.5, 0 );
+		cairo_line_to ( cr, x + 0.5, GRID_HEAD_H );
+		cairo_stroke ( cr );
+
+		cairo_set_source_rgba ( cr, 0.5, 0.5, 0.5, 1 );
+		epg_grid_text ( cr, layout, str, x, 0, MIN ( 30 * GRID_PX_MIN, width - x ), GRID_HEAD_H );
+	}
+}
+
+static gboolean epg_grid_draw ( GtkWidget *widget, cairo_t *cr, EpgGrid *grid )
+{
+	int width  = gtk_widget_get_allocated_width  ( widget );
+	int height = gtk_widget_get_allocated_height ( widget );
+
+	GtkStyleContext *ctx = gtk_widget_get_style_context ( widget );
+	gtk_render_background ( ctx, cr, 0, 0, width, height );
+
+	GdkRGBA fg;
+	gtk_style_context_get_color ( ctx, gtk_style_context_get_state ( ctx ), &fg );
+
+	if ( !grid->store || width <= GRID_NAME_W ) return TRUE;
+
+	int64_t now = g_get_real_time () / G_USEC_PER_SEC;
+	int64_t t_left  = grid->t0 + (int64_t)( gtk_adjustment_get_value ( grid->h_adj ) * 60 );
+	int64_t t_right = t_left + (int64_t)( ( width - GRID_NAME_W ) / GRID_PX_MIN * 60 ) + 1;
+
+	double v = gtk_adjustment_get_value ( grid->v_adj );
+
+	PangoLayout *layout = gtk_widget_create_pango_layout ( widget, NULL );
+	pango_layout_set_ellipsize ( layout, PANGO_ELLIPSIZE_END );
+
+	epg_store_lock ( grid->store );
+
+	uint32_t n_svc = epg_store_n_services ( grid->store );
+	uint32_t first = (uint32_t)v, rows = (uint32_t)( ( height - GRID_HEAD_H ) / GRID_ROW_H ) + 2;
+
+	uint32_t r = 0; for ( r = first; r < n_svc && r < first + rows; r++ )
+	{
+		double y = GRID_HEAD_H + ( r - v ) * GRID_ROW_H;
+
+		EpgService id;
+		uint32_t n = 0;
+		const EpgEvent *ev = epg_store_events ( grid->store, r, &id, &n );
+
+		cairo_save ( cr );
+		cairo_rectangle ( cr, GRID_NAME_W, GRID_HEAD_H, width - GRID_NAME_W, height - GRID_HEAD_H );
+		cairo_clip ( cr );
+
+		uint32_t e = 0; for ( e = epg_grid_first ( ev, n, t_left ); e < n && ev[e].start < t_right; e++ )
+		{
+			double x = GRID_NAME_W + (double)( (int64_t)ev[e].start - t_left ) / 60 * GRID_PX_MIN;
+			double w = (double)ev[e].duration / 60 * GRID_PX_MIN;
+
+			gboolean on_air = ( ev[e].start <= now && now < (int64_t)ev[e].start + ev[e].duration );
+
+			cairo_set_source_rgba ( cr, ( on_air ) ? 0.2 : 0.4, ( on_air ) ? 0.6 : 0.4, ( on_air ) ? 0.9 : 0.4, ( on_air ) ? 0.35 : 0.15 );
+			cairo_rectangle ( cr, x + 1, y + 1, MAX ( w - 2, 1 ), GRID_ROW_H - 2 );
+			cairo_fill ( cr );
+
+			// the text stays readable when the event starts off the left edge
+			double tx = MAX ( x, GRID_NAME_W );
+
+			gdk_cairo_set_source_rgba ( cr, &fg );
+			epg_grid_text ( cr, layout, epg_store_str ( grid->store, ev[e].name ), tx, y, x + w - tx, GRID_ROW_H );
+		}
+
+		cairo_restore ( cr );
+
+		g_autofree char *name = epg_grid_name ( grid, &id );
+
+		cairo_save ( cr );
+		cairo_rectangle ( cr, 0, GRID_HEAD_H, GRID_NAME_W, height - GRID_HEAD_H );
+		cairo_clip ( cr );
+
+		gdk_cairo_set_source_rgba ( cr, &fg );
+		epg_grid_text ( cr, layout, name, 0, y, GRID_NAME_W, GRID_ROW_H );
+
+		cairo_restore ( cr );
+	}
+
+	epg_store_unlock ( grid->store );
+
+	epg_grid_head ( cr, layout, width, t_left, t_right );
+
+	if ( now >= t_left && now < t_right )
+	{
+		double x = GRID_NAME_W + (double)( now - t_left ) / 60 * GRID_PX_MIN;
+
+		cairo_set_source_rgba ( cr, 1, 0, 0, 0.8 );
+		cairo_move_to ( cr, x + 0.5, 0 );
+		cairo_line_to ( cr, x + 0.5, height );
+		cairo_stroke ( cr );
+	}
+
+	g_object_unref ( layout );
+
+	return TRUE;
+}
+
+/* Caller holds the store lock: the event under x, y */
+static const EpgEvent * epg_grid_hit ( EpgGrid *grid, int x, int y, EpgService *id )
+{
+	if ( x < GRID_NAME_W || y < GRID_HEAD_H ) return NULL;
+
+	double row = gtk_adjustment_get_value ( grid->v_adj ) + (double)( y - GRID_HEAD_H ) / GRID_ROW_H;
+	int64_t t = grid->t0 + (int64_t)( ( gtk_adjustment_get_value ( grid->h_adj ) + ( x - GRID_NAME_W ) / GRID_PX_MIN ) * 60 );
+
+	if ( row < 0 || row >= epg_store_n_services ( grid->store ) ) return NULL;
+
+	uint32_t n = 0;
+	const EpgEvent *ev = epg_store_events ( grid->store, (uint32_t)row, id, &n );
+
+	uint32_t e = epg_grid_first ( ev, n, t );
+
+	return ( e < n && ev[e].start <= t ) ? &ev[e] : NULL;
+}
+
+static gboolean epg_grid_tooltip ( G_GNUC_UNUSED GtkWidget *widget, int x, int y, G_GNUC_UNUSED gboolean keyboard, GtkTooltip *tooltip, EpgGrid *grid )
+{
+	if ( !grid->store ) return FALSE;
+
+	epg_store_lock ( grid->store );
+
+	const EpgEvent *ev = epg_grid_hit ( grid, x, y, NULL );
+
+	if ( ev )
+	{
+		time_t ts = (time_t)ev->start, te = (time_t)( ev->start + ev->duration );
+		struct tm tm_s, tm_e;
+		localtime_r ( &ts, &tm_s );
+		localtime_r ( &te, &tm_e );
+
+		char str_s[32], str_e[16];
+		strftime ( str_s, sizeof ( str_s ), "%a %d %H:%M", &tm_s );
+		strftime ( str_e, sizeof ( str_e ), "%H:%M", &tm_e );
+
+		g_autofree char *markup = g_markup_printf_escaped ( "<b>%s</b>\n%s - %s\n%s", epg_store_str ( grid->store, ev->name ),
+			str_s, str_e, epg_store_str ( grid->store, ev->text ) );
+
+		gtk_tooltip_set_markup ( tooltip, markup );
+	}
+
+	epg_store_unlock ( grid->store );
+
+	return ( ev != NULL );
+}
+
+/* Double click: record the event ( or not any more ) */
+static gboolean epg_grid_press ( G_GNUC_UNUSED GtkWidget *widget, GdkEventButton *event, EpgGrid *grid )
+{
+	if ( !grid->store || !grid->file || event->type != GDK_2BUTTON_PRESS || event->button != GDK_BUTTON_PRIMARY ) return FALSE;
+
+	EpgService id;
+	uint16_t event_id = 0;
+
+	epg_store_lock ( grid->store );
+
+	const EpgEvent *ev = epg_grid_hit ( grid, (int)event->x, (int)event->y, &id );
+
+	if ( ev ) event_id = ev->event_id;
+
+	epg_store_unlock ( grid->store );
+
+	if ( ev ) g_signal_emit_by_name ( grid, "epg-record", grid->file, id.onid, id.tsid, id.sid, event_id );
+
+	return TRUE;
+}
+
+static gboolean epg_grid_scroll ( G_GNUC_UNUSED GtkWidget *widget, GdkEventScroll *event, EpgGrid *grid )
+{
+	double dx = 0, dy = 0;
+
+	if ( event->direction == GDK_SCROLL_SMOOTH ) { dx = event->delta_x; dy = event->delta_y; }
+	else if ( event->direction == GDK_SCROLL_UP    ) dy = -1;
+	else if ( event->direction == GDK_SCROLL_DOWN  ) dy =  1;
+	else if ( event->direction == GDK_SCROLL_LEFT  ) dx = -1;
+	else if ( event->direction == GDK_SCROLL_RIGHT ) dx =  1;
+
+	// Shift: the wheel moves in time
+	if ( event->state & GDK_SHIFT_MASK ) { dx += dy; dy = 0; }
+
+	if ( dy != 0 ) gtk_adjustment_set_value ( grid->v_adj, gtk_adjustment_get_value ( grid->v_adj ) + dy * 3 );
+	if ( dx != 0 ) gtk_adjustment_set_value ( grid->h_adj, gtk_adjustment_get_value ( grid->h_adj ) + dx * 30 );
+
+	return TRUE;
+}
+
+static void epg_grid_adjust ( EpgGrid *grid )
+{
+	int width  = gtk_widget_get_allocated_width  ( GTK_WIDGET ( grid->area ) );
+	int height = gtk_widget_get_allocated_height ( GTK_WIDGET ( grid->area ) );
+
+	uint32_t n_svc = 0;
+
+	if ( grid->store ) { epg_store_lock ( grid->store ); n_svc = epg_store_n_services ( grid->store ); epg_store_unlock ( grid->store ); }
+
+	double page_v = MAX ( (double)( height - GRID_HEAD_H ) / GRID_ROW_H, 1 );
+	double page_h = MAX ( (double)( width - GRID_NAME_W ) / GRID_PX_MIN, 1 );
+
+	gtk_adjustment_configure ( grid->v_adj, gtk_adjustment_get_value ( grid->v_adj ), 0, MAX ( n_svc, page_v ), 1, page_v, page_v );
+	gtk_adjustment_configure ( grid->h_adj, gtk_adjustment_get_value ( grid->h_adj ), 0, (double)( GRID_BEFORE + GRID_AFTER ) / 60, 30, page_h, page_h );
+}
+
+static void epg_grid_size ( G_GNUC_UNUSED GtkWidget *widget, G_GNUC_UNUSED GdkRectangle *alloc, EpgGrid *grid )
+{
+	epg_grid_adjust ( grid );
+}
+
+/* New events arrive all the time: redraw while shown */
+static gboolean epg_grid_refresh ( EpgGrid *grid )
+{
+	if ( !gtk_widget_get_mapped ( GTK_WIDGET ( grid->area ) ) ) return TRUE;
+
+	epg_grid_adjust ( grid );
+	gtk_widget_queue_draw ( GTK_WIDGET ( grid->area ) );
+
+	return TRUE;
+}
+
+static void epg_grid_redraw ( G_GNUC_UNUSED GtkAdjustment *adj, EpgGrid *grid )
+{
+	gtk_widget_queue_draw ( GTK_WIDGET ( grid->area ) );
+}
+
+static void epg_grid_handler_set_store ( EpgGrid *grid, gpointer store )
+{
+	grid->store = store;
+
+	epg_grid_refresh ( grid );
+}
+
+static void epg_grid_handler_set_file ( EpgGrid *grid, const char *file )
+{
+	chdb_unref ( grid->db );
+	free ( grid->file );
+
+	grid->db = chdb_open ( file, FILE_DVBV5, SYS_UNDEFINED );
+	grid->file = g_strdup ( file );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( grid->area ) );
+}
+
+static void epg_grid_now ( G_GNUC_UNUSED GtkButton *button, EpgGrid *grid )
+{
+	int64_t now = g_get_real_time () / G_USEC_PER_SEC;
+
+	gtk_adjustment_set_value ( grid->h_adj, (double)( now - grid->t0 ) / 60 - 30 );
+}
+
+static void epg_grid_init ( EpgGrid *grid )
+{
+	GtkBox *box = GTK_BOX ( grid );
+	gtk_orientable_set_orientation ( GTK_ORIENTABLE ( box ), GTK_ORIENTATION_VERTICAL );
+	gtk_box_set_spacing ( box, 5 );
+	gtk_widget_set_visible ( GTK_WIDGET ( box ), TRUE );
+
+	gtk_widget_set_margin_top    ( GTK_WIDGET ( box ), 10 );
+	gtk_widget_set_margin_bottom ( GTK_WIDGET ( box ), 10 );
+	gtk_widget_set_margin_start  ( GTK_WIDGET ( box ), 10 );
+	gtk_widget_set_margin_end    ( GTK_WIDGET ( box ), 10 );
+
+	int64_t now = g_get_real_time () / G_USEC_PER_SEC;
+
+	grid->t0 = now - now % 3600 - GRID_BEFORE;
+	grid->store = NULL;
+	grid->db = NULL;
+	grid->file = NULL;
+
+	grid->v_adj = gtk_adjustment_new ( 0, 0, 1, 1, 1, 1 );
+	grid->h_adj = gtk_adjustment_new ( (double)( now - grid->t0 ) / 60 - 30, 0, (double)( GRID_BEFORE + GRID_AFTER ) / 60, 30, 1, 1 );
+
+	g_signal_connect ( grid->v_adj, "value-changed", G_CALLBACK ( epg_grid_redraw ), grid );
+	g_signal_connect ( grid->h_adj, "value-changed", G_CALLBACK ( epg_grid_redraw ), grid );
+
+	GtkGrid *table = (GtkGrid *)gtk_grid_new ();
+	gtk_widget_set_visible ( GTK_WIDGET ( table ), TRUE );
+
+	grid->area = (GtkDrawingArea *)gtk_drawing_area_new ();
+	gtk_widget_set_hexpand ( GTK_WIDGET ( grid->area ), TRUE );
+	gtk_widget_set_vexpand ( GTK_WIDGET ( grid->area ), TRUE );
+	gtk_widget_set_has_tooltip ( GTK_WIDGET ( grid->area ), TRUE );
+	gtk_widget_add_events ( GTK_WIDGET ( grid->area ), GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK | GDK_BUTTON_PRESS_MASK );
+	gtk_widget_set_visible ( GTK_WIDGET ( grid->area ), TRUE );
+
+	g_signal_connect ( grid->area, "draw",          G_CALLBACK ( epg_grid_draw    ), grid );
+	g_signal_connect ( grid->area, "scroll-event",  G_CALLBACK ( epg_grid_scroll  ), grid );
+	g_signal_connect ( grid->area, "query-tooltip", G_CALLBACK ( epg_grid_tooltip ), grid );
+	g_signal_connect ( grid->area, "button-press-event", G_CALLBACK ( epg_grid_press ), grid );
+	g_signal_connect ( grid->area, "size-allocate", G_CALLBACK ( epg_grid_size    ), grid );
+
+	GtkWidget *v_bar = gtk_scrollbar_new ( GTK_ORIENTATION_VERTICAL,   grid->v_adj );
+	GtkWidget *h_bar = gtk_scrollbar_new ( GTK_ORIENTATION_HORIZONTAL, grid->h_adj );
+	gtk_widget_set_visible ( v_bar, TRUE );
+	gtk_widget_set_visible ( h_bar, TRUE );
+
+	gtk_grid_attach ( table, GTK_WIDGET ( grid->area ), 0, 0, 1, 1 );
+	gtk_grid_attach ( table, v_bar, 1, 0, 1, 1 );
+	gtk_grid_attach ( table, h_bar, 0, 1, 1, 1 );
+
+	gtk_box_pack_start ( box, GTK_WIDGET ( table ), TRUE, TRUE, 0 );
+
+	GtkButton *button_now = (GtkButton *)gtk_button_new_with_label ( "Now" );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( button_now ), "Wheel - services, Shift + Wheel - time, Double click - record" );
+	g_signal_connect ( button_now, "clicked", G_CALLBACK ( epg_grid_now ), grid );
+	gtk_widget_set_halign ( GTK_WIDGET ( button_now ), GTK_ALIGN_START );
+	gtk_widget_set_visible ( GTK_WIDGET ( button_now ), TRUE );
+	gtk_box_pack_start ( box, GTK_WIDGET ( button_now ), FALSE, FALSE, 0 );
+
+	grid->src = g_timeout_add_seconds ( 2, (GSourceFunc)epg_grid_refresh, grid );
+
+	g_signal_connect ( grid, "epg-set-store", G_CALLBACK ( epg_grid_handler_set_store ), NULL );
+	g_signal_connect ( grid, "epg-set-file",  G_CALLBACK ( epg_grid_handler_set_file  ), NULL );
+}
+
+static void epg_grid_finalize ( GObject *object )
+{
+	EpgGrid *grid = EPG_GRID ( object );
+
+	chdb_unref ( grid->db );
+	free ( grid->file );
+
+	G_OBJECT_CLASS (epg_grid_parent_class)->finalize (object);
+}
+
+static void epg_grid_dispose ( GObject *object )
+{
+	EpgGrid *grid = EPG_GRID ( object );
+
+	if ( grid->src ) g_source_remove ( grid->src );
+	grid->src = 0;
+
+	G_OBJECT_CLASS (epg_grid_parent_class)->dispose (object);
+}
+
+static void epg_grid_class_init ( EpgGridClass *class )
+{
+	G_OBJECT_CLASS (class)->dispose  = epg_grid_dispose;
+	G_OBJECT_CLASS (class)->finalize = epg_grid_finalize;
+
+	g_signal_new ( "epg-set-store", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER );
+
+	g_signal_new ( "epg-set-file", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING );
+
+	g_signal_new ( "epg-record", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 5, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT );
+}
+
+EpgGrid * epg_grid_new ( void )
+{
+	return g_object_new ( EPG_TYPE_GRID, NULL );
+}
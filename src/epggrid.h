@@ -0,0 +1,18 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#define EPG_TYPE_GRID epg_grid_get_type ()
+
+G_DECLARE_FINAL_TYPE ( EpgGrid, epg_grid, EPG, GRID, GtkBox )
+
+EpgGrid * epg_grid_new ( void );
@@ -0,0 +1,321 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "femon.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#define FEMON_INTERVAL_MIN ALIGN_MS
+
+// cumulative frontend counters behind the error rates
+enum femon_cnt { FC_UCB, FC_BLOCKS, FC_POST_ERR, FC_POST_TOT, FC_PRE_ERR, FC_PRE_TOT, FC_ALL };
+
+static const uint32_t femon_cnt_cmd[FC_ALL] =
+{
+	DTV_STAT_ERROR_BLOCK_COUNT, DTV_STAT_TOTAL_BLOCK_COUNT,
+	DTV_STAT_POST_ERROR_BIT_COUNT, DTV_STAT_POST_TOTAL_BIT_COUNT,
+	DTV_STAT_PRE_ERROR_BIT_COUNT, DTV_STAT_PRE_TOTAL_BIT_COUNT
+};
+
+typedef struct _FeCnt FeCnt;
+
+struct _FeCnt
+{
+	uint64_t val[FC_ALL];
+	gboolean have[FC_ALL];
+};
+
+struct _FeMon
+{
+	struct dvb_device *dev; // own read-only frontend: statistics
+	uint8_t adapter, frontend;
+	int event_fd; // frontend opened O_RDWR by the owner: events, -1 none, not owned
+	SigHist *hist; // not owned
+
+	gint64 interval;
+	GThread *thread;
+
+	FeCnt cnt[FEMON_LAYERS]; // previous sample, thread only
+	gint64 cnt_time;
+
+	gint align; // dish alignment: ALIGN_MS sampling + filter
+	AlignFilter af;
+
+	// seqlock: odd while the thread writes snap
+	guint seq;
+	FeSnap snap;
+
+	gint stop;
+};
+
+static void femon_publish ( FeMon *mon, const FeSnap *snap )
+{
+	g_atomic_int_inc ( &mon->seq );
+
+	mon->snap = *snap;
+
+	g_atomic_int_inc ( &mon->seq );
+
+	metrics_fe_publish ( mon->adapter, mon->frontend, snap );
+}
+
+/* Lock-free: copies the last published snapshot, FALSE - nothing published yet */
+gboolean femon_snapshot ( FeMon *mon, FeSnap *out )
+{
+	if ( !mon ) return FALSE;
+
+	while ( TRUE )
+	{
+		guint seq = g_atomic_int_get ( &mon->seq );
+
+		if ( seq & 1 ) continue;
+
+		*out = mon->snap;
+
+		if ( g_atomic_int_get ( &mon->seq ) == seq ) return ( seq != 0 );
+	}
+}
+
+static void femon_status ( FeSnap *snap, uint32_t status, gint64 now )
+{
+	uint8_t fe_lock = ( status & FE_HAS_LOCK ) ? 1 : 0;
+
+	if ( fe_lock && !snap->fe_lock ) snap->lock_since = now;
+	if ( !fe_lock ) snap->lock_since = 0;
+
+	snap->status  = status;
+	snap->fe_lock = fe_lock;
+}
+
+/*
+* Drivers keep 32-bit counters in the 64-bit fields or reset them on a retune:
+* a drop from near 2^32 is a wrap, any other drop a restart from zero.
+*/
+static uint64_t femon_delta ( uint64_t prev, uint64_t cur )
+{
+	if ( cur >= prev ) return cur - prev;
+
+	if ( prev <= UINT32_MAX && prev - cur > ( UINT32_MAX >> 1 ) ) return cur + ( (uint64_t)UINT32_MAX + 1 - prev );
+
+	return cur;
+}
+
+static float femon_ratio ( uint64_t err, uint64_t total )
+{
+	return ( total ) ? (float)err / (float)total : -1;
+}
+
+static void femon_errors ( FeMon *mon, struct dvb_v5_fe_parms *parms, uint8_t layer, FeErrors *err, double dt )
+{
+	FeCnt *prev = &mon->cnt[layer];
+	FeCnt cur;
+	uint64_t delta[FC_ALL] = { 0 };
+	gboolean have[FC_ALL] = { FALSE };
+
+	uint8_t c = 0; for ( c = 0; c < FC_ALL; c++ )
+	{
+		struct dtv_stats *st = dvb_fe_retrieve_stats_layer ( parms, femon_cnt_cmd[c], layer );
+
+		cur.have[c] = ( st && st->scale == FE_SCALE_COUNTER );
+		cur.val[c]  = ( cur.have[c] ) ? st->uvalue : 0;
+
+		have[c] = ( cur.have[c] && prev->have[c] && dt > 0 );
+
+		if ( have[c] ) delta[c] = femon_delta ( prev->val[c], cur.val[c] );
+	}
+
+	*prev = cur;
+
+	if ( have[FC_UCB] ) err->ucb += delta[FC_UCB];
+
+	err->ucb_s     = ( have[FC_UCB]      ) ? (float)( delta[FC_UCB]      / dt ) : -1;
+	err->ber_s     = ( have[FC_POST_ERR] ) ? (float)( delta[FC_POST_ERR] / dt ) : 0;
+	err->pre_ber_s = ( have[FC_PRE_ERR]  ) ? (float)( delta[FC_PRE_ERR]  / dt ) : 0;
+
+	err->per     = ( have[FC_UCB] && have[FC_BLOCKS] ) ? femon_ratio ( delta[FC_UCB], delta[FC_BLOCKS] ) : -1;
+	err->ber     = ( have[FC_POST_ERR] && have[FC_POST_TOT] ) ? femon_ratio ( delta[FC_POST_ERR], delta[FC_POST_TOT] ) : -1;
+	err->pre_ber = ( have[FC_PRE_ERR]  && have[FC_PRE_TOT]  ) ? femon_ratio ( delta[FC_PRE_ERR],  delta[FC_PRE_TOT]  ) : -1;
+}
+
+static void femon_errors_str ( const FeErrors *err, char *p, int len )
+{
+	if ( err->ber     >= 0 ) { int n = g_snprintf ( p, len, "  postBER %.1e", err->ber     ); p += MIN ( n, len ); len -= MIN ( n, len ); }
+	if ( err->pre_ber >= 0 ) { int n = g_snprintf ( p, len, "  preBER %.1e",  err->pre_ber ); p += MIN ( n, len ); len -= MIN ( n, len ); }
+	if ( err->per     >= 0 ) { int n = g_snprintf ( p, len, "  PER %.1e",     err->per     ); p += MIN ( n, len ); len -= MIN ( n, len ); }
+
+	if ( err->ucb_s   >= 0 && len > 0 ) g_snprintf ( p, len, "  UCB %" G_GUINT64_FORMAT " ( %.0f/s )", err->ucb, err->ucb_s );
+}
+
+static gboolean femon_sample ( FeMon *mon, struct dvb_v5_fe_parms *parms, FeSnap *snap, gint64 now )
+{
+	if ( dvb_fe_get_stats ( parms ) ) return FALSE;
+
+	uint32_t status = 0;
+	dvb_fe_retrieve_stats ( parms, DTV_STATUS,  &status );
+	dvb_fe_retrieve_stats ( parms, DTV_QUALITY, &snap->qual );
+
+	femon_status ( snap, status, now );
+
+	snap->sgl = 0; snap->snr = 0;
+	dvb_fe_retrieve_stats ( parms, DTV_STAT_CNR, &snap->snr );
+	dvb_fe_retrieve_stats ( parms, DTV_STAT_SIGNAL_STRENGTH, &snap->sgl );
+
+	snap->sgl_p = (uint8_t)( MIN ( snap->sgl, 65535 ) * 100 / 65535 );
+	snap->snr_p = (uint8_t)( MIN ( snap->snr, 65535 ) * 100 / 65535 );
+
+	if ( snap->aligning )
+	{
+		float raw[AL_ALL] = { (float)MIN ( snap->sgl, 65535 ) / 655.35f, (float)MIN ( snap->snr, 65535 ) / 655.35f };
+
+		align_filter_add ( &mon->af, raw, now, &snap->align );
+	}
+
+	double dt = ( mon->cnt_time ) ? (double)( now - mon->cnt_time ) / G_USEC_PER_SEC : 0;
+
+	mon->cnt_time = now;
+
+	int i = 0; for ( i = 0; i < FEMON_LAYERS; i++ )
+	{
+		char *p = snap->layer[i];
+		int len = sizeof ( snap->layer[i] ), show = 1;
+
+		snap->layer[i][0] = '\0';
+
+		dvb_fe_snprintf_stat ( parms, DTV_QUALITY, "Quality ", i, &p, &len, &show );
+		dvb_fe_snprintf_stat ( parms, DTV_STAT_SIGNAL_STRENGTH, "  Signal ", i, &p, &len, &show );
+		dvb_fe_snprintf_stat ( parms, DTV_STAT_CNR, "  C/N ", i, &p, &len, &show );
+
+		femon_errors ( mon, parms, (uint8_t)i, &snap->err[i], dt );
+
+		// the error figures only where the layer has statistics at all
+		if ( p != snap->layer[i] && len > 1 ) femon_errors_str ( &snap->err[i], p, len );
+	}
+
+	snap->time = now;
+
+	return TRUE;
+}
+
+/*
+* Lock changes come as frontend events ( poll POLLPRI + FE_GET_EVENT ) and are published at once,
+* the statistics are sampled every interval. Nothing here runs on the main loop.
+*/
+static gpointer femon_thread ( FeMon *mon )
+{
+	struct dvb_v5_fe_parms *parms = mon->dev->fe_parms;
+
+	FeSnap snap;
+	memset ( &snap, 0, sizeof ( FeSnap ) );
+
+	int i = 0; for ( i = 0; i < FEMON_LAYERS; i++ ) { snap.err[i].ucb_s = -1; snap.err[i].ber = -1; snap.err[i].pre_ber = -1; snap.err[i].per = -1; }
+
+	gint64 last = 0;
+
+	while ( !g_atomic_int_get ( &mon->stop ) )
+	{
+		gint64 now = g_get_monotonic_time ();
+
+		uint8_t aligning = ( g_atomic_int_get ( &mon->align ) ) ? 1 : 0;
+
+		if ( aligning && !snap.aligning ) align_filter_reset ( &mon->af );
+
+		snap.aligning = aligning;
+
+		gint64 interval = ( aligning ) ? ALIGN_MS * 1000 : mon->interval;
+
+		if ( now - last >= interval )
+		{
+			if ( femon_sample ( mon, parms, &snap, now ) && mon->hist )
+			{
+				uint8_t v[SH_ALL] = { snap.sgl_p, snap.snr_p, (uint8_t)MIN ( snap.qual, 255 ) };
+
+				sighist_add ( mon->hist, g_get_real_time (), v );
+			}
+
+			femon_publish ( mon, &snap );
+
+			last = now;
+		}
+
+		int timeout = (int)MIN ( ( last + interval - now ) / 1000, 100 );
+
+		if ( mon->event_fd < 0 ) { g_usleep ( (gulong)MAX ( timeout, 1 ) * 1000 ); continue; }
+
+		struct pollfd pfd = { .fd = mon->event_fd, .events = POLLPRI };
+
+		if ( poll ( &pfd, 1, MAX ( timeout, 1 ) ) <= 0 || !( pfd.revents & POLLPRI ) ) continue;
+
+		// one event per wake-up: FE_GET_EVENT blocks on an empty queue
+		struct dvb_frontend_event event;
+
+		if ( ioctl ( mon->event_fd, FE_GET_EVENT, &event ) == -1 ) continue;
+
+		femon_status ( &snap, event.status, g_get_monotonic_time () );
+		femon_publish ( mon, &snap );
+	}
+
+	return NULL;
+}
+
+/* event_fd - the owner's O_RDWR frontend fd or -1, it must outlive the monitor; hist - receives the samples or NULL */
+FeMon * femon_start ( uint8_t adapter, uint8_t frontend, int event_fd, uint32_t interval_ms, SigHist *hist )
+{
+	struct dvb_device *dev = dvb_dev_alloc ();
+
+	if ( !dev ) return NULL;
+
+	dvb_dev_set_log ( dev, 0, NULL );
+	dvb_dev_find ( dev, NULL, NULL );
+
+	struct dvb_dev_list *dvb_dev = dvb_dev_seek_by_adapter ( dev, adapter, frontend, DVB_DEVICE_FRONTEND );
+
+	if ( !dvb_dev || !dvb_dev_open ( dev, dvb_dev->sysname, O_RDONLY ) )
+	{
+		g_warning ( "%s:: adapter%u/frontend%u: opening device failed.", __func__, adapter, frontend );
+
+		dvb_dev_free ( dev );
+		return NULL;
+	}
+
+	FeMon *mon = g_new0 ( FeMon, 1 );
+
+	mon->dev = dev;
+	mon->adapter  = adapter;
+	mon->frontend = frontend;
+	mon->event_fd = event_fd;
+	mon->hist = hist;
+	mon->interval = (gint64)MAX ( interval_ms, FEMON_INTERVAL_MIN ) * 1000;
+	mon->thread = g_thread_new ( "fe-monitor", (GThreadFunc)femon_thread, mon );
+
+	return mon;
+}
+
+/* Dish alignment: sampling at ALIGN_MS with smoothing and peak hold, FALSE - back to the interval */
+void femon_align ( FeMon *mon, gboolean on )
+{
+	if ( mon ) g_atomic_int_set ( &mon->align, ( on ) ? 1 : 0 );
+}
+
+void femon_stop ( FeMon *mon )
+{
+	if ( !mon ) return;
+
+	g_atomic_int_set ( &mon->stop, 1 );
+	g_thread_join ( mon->thread );
+
+	metrics_fe_clear ( mon->adapter, mon->frontend );
+
+	dvb_dev_free ( mon->dev );
+
+	free ( mon );
+}
@@ -0,0 +1,56 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "sighist.h"
+#include "align.h"
+
+#include <libdvbv5/dvb-dev.h>
+
+#include <glib.h>
+
+#define FEMON_LAYERS 4 // MAX_DTV_STATS
+
+typedef struct _FeErrors FeErrors;
+
+struct _FeErrors
+{
+	uint64_t ucb;          // uncorrected blocks since the monitor start
+	float ucb_s;             // uncorrected blocks per second, -1 - not available
+	float ber_s, pre_ber_s;  // error bits per second: post / pre FEC
+	float ber, pre_ber, per; // ratios over the last interval, -1 - not available
+};
+
+typedef struct _FeSnap FeSnap;
+
+struct _FeSnap
+{
+	gint64 time;       // monotonic µs of the last statistics sample
+	gint64 lock_since; // monotonic µs of the last unlock -> lock, 0 - no lock
+
+	uint32_t status, qual, sgl, snr;
+	uint8_t sgl_p, snr_p, fe_lock;
+
+	uint8_t aligning; // align: filled at ALIGN_MS
+	AlignOut align;
+
+	FeErrors err[FEMON_LAYERS];
+	char layer[FEMON_LAYERS][256]; // per-layer text, "" - no data
+};
+
+typedef struct _FeMon FeMon;
+
+FeMon * femon_start ( uint8_t, uint8_t, int, uint32_t, SigHist * );
+
+void femon_stop ( FeMon * );
+
+void femon_align ( FeMon *, gboolean );
+
+gboolean femon_snapshot ( FeMon *, FeSnap * );
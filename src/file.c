@@ -12,11 +12,14 @@
 #define BUF_SIZE ( 8 * 128 * 188 )
 
 #include "file.h"
+#include "metrics.h"
 
 #include <time.h>
 #include <poll.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
@@ -24,24 +27,105 @@ typedef struct _DwrRec DwrRec;
 
 struct _DwrRec
 {
-	int dvr_fd;
+	int dvr_fd; // -1 - fed by a tee
 	int rec_fd;
 
 	GMutex mutex;
 	DwrRecMonitor *drm;
+
+	uint64_t total;
+	time_t t_check;
+
+	MetricsRec *metrics;
 };
 
-static gpointer dvr_rec_thread ( DwrRec *dvr_rec )
+/* The monitor is read once per second and on an idle poll: a recording without data still stops */
+static gboolean dvr_rec_stopped ( DwrRec *dvr_rec, uint64_t total )
 {
+	gboolean stop = FALSE;
+
+	g_mutex_lock ( &dvr_rec->mutex );
+
+	if ( dvr_rec->drm->stop_rec ) { stop = TRUE; dvr_rec->drm->total_rec = 0; } else dvr_rec->drm->total_rec = total;
+
+	g_mutex_unlock ( &dvr_rec->mutex );
+
+	return stop;
+}
+
+/* fd is taken: closed on error and by dvr_rec_free */
+static DwrRec * dvr_rec_new ( int fd, uint8_t adapter, const char *rec, DwrRecMonitor *dm, const char **error )
+{
+	int rec_fd = open ( rec, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0664 );
+
+	if ( rec_fd == -1 )
+	{
+		perror ( "Cannot open rec file" );
+		if ( fd != -1 ) close ( fd );
+
+		*error = "Cannot open rec file";
+		return NULL;
+	}
+
+	DwrRec *dvr_rec = g_new0 ( DwrRec, 1 );
+
 	g_mutex_init ( &dvr_rec->mutex );
 
+	dvr_rec->drm = dm;
+	dvr_rec->dvr_fd = fd;
+	dvr_rec->rec_fd = rec_fd;
+	dvr_rec->metrics = metrics_rec_claim ( adapter, rec );
+
+	time ( &dvr_rec->t_check );
+
+	return dvr_rec;
+}
+
+static void dvr_rec_free ( DwrRec *dvr_rec )
+{
+	if ( dvr_rec->dvr_fd != -1 ) close ( dvr_rec->dvr_fd );
+	close ( dvr_rec->rec_fd );
+
+	metrics_rec_release ( dvr_rec->metrics );
+
+	g_mutex_clear ( &dvr_rec->mutex );
+	free ( dvr_rec );
+}
+
+/* TRUE - done: stopped or a write error */
+static gboolean dvr_rec_write ( DwrRec *dvr_rec, const void *buf, size_t size )
+{
+	gint64 w_start = g_get_monotonic_time ();
+
+	ssize_t w = write ( dvr_rec->rec_fd, buf, size );
+
+	if ( w > 0 ) metrics_rec_write ( dvr_rec->metrics, (uint64_t)w, g_get_monotonic_time () - w_start );
+
+	if ( w == -1 )
+	{
+		if ( errno != EINTR ) { printf ( "Write error: %m \n" ); return TRUE; }
+	}
+
+	dvr_rec->total += size;
+
+	time_t t_cur;
+	time ( &t_cur );
+
+	if ( t_cur > dvr_rec->t_check )
+	{
+		dvr_rec->t_check = t_cur;
+
+		return dvr_rec_stopped ( dvr_rec, dvr_rec->total );
+	}
+
+	return FALSE;
+}
+
+static gpointer dvr_rec_thread ( DwrRec *dvr_rec )
+{
 	gboolean stop = FALSE;
 	uint32_t buf[BUF_SIZE];
-	ssize_t r = 0, w = 0;
-	uint64_t total = 0;
-
-	time_t t_start, t_cur;
-	time ( &t_start );
+	ssize_t r = 0;
 
 	struct pollfd pfd;
 	pfd.fd = dvr_rec->dvr_fd;
@@ -59,7 +143,7 @@ static gpointer dvr_rec_thread ( DwrRec *dvr_rec )
 			break;
 		}
 
-		if ( pfd.revents == 0 ) continue;
+		if ( pfd.revents == 0 ) { stop = dvr_rec_stopped ( dvr_rec, dvr_rec->total ); continue; }
 
 		r = read ( dvr_rec->dvr_fd, buf, sizeof(buf) );
 
@@ -67,80 +151,326 @@ static gpointer dvr_rec_thread ( DwrRec *dvr_rec )
 		{
 			perror ( "Read" );
 
-			if ( errno == EOVERFLOW ) continue;
+			if ( errno == EOVERFLOW ) { metrics_rec_overflow ( dvr_rec->metrics ); continue; }
 
 			printf ( "Read error \n" );
 			break;
 		}
 
-		w = write ( dvr_rec->rec_fd, buf, (size_t)r );
-
-		if ( w == -1 )
-		{
-			if ( errno != EINTR ) { printf ( "Write error: %m \n" ); break; }
-		}
-
-		total += (uint32_t)r;
+		stop = dvr_rec_write ( dvr_rec, buf, (size_t)r );
+	}
 
-		time ( &t_cur );
+	dvr_rec_free ( dvr_rec );
 
-		if ( t_cur > t_start )
-		{
-			g_mutex_lock ( &dvr_rec->mutex );
+	return NULL;
+}
 
-			if ( dvr_rec->drm->stop_rec ) { stop = TRUE; dvr_rec->drm->total_rec = 0; total = 0; } else dvr_rec->drm->total_rec = total;
+/*
+* Any TS source: the dvr device or a demux filter with DMX_OUT_TSDEMUX_TAP; fd is closed by the thread.
+* thread - NULL: detached; else joinable, the caller joins after stop_rec.
+*/
+const char * dvr_rec_create_fd ( int fd, uint8_t adapter, const char *rec, DwrRecMonitor *dm, GThread **thread )
+{
+	const char *error = NULL;
 
-			g_mutex_unlock ( &dvr_rec->mutex );
+	DwrRec *dvr_rec = dvr_rec_new ( fd, adapter, rec, dm, &error );
 
-			time ( &t_start );
-		}
-	}
+	if ( !dvr_rec ) return error;
 
-	close ( dvr_rec->dvr_fd );
-	close ( dvr_rec->rec_fd );
+	GThread *th = g_thread_new ( "dmx-rec-thread", (GThreadFunc)dvr_rec_thread, dvr_rec );
 
-	g_mutex_clear ( &dvr_rec->mutex );
-	free ( dvr_rec );
+	if ( thread ) *thread = th; else g_thread_unref ( th );
 
 	return NULL;
 }
 
-const char * dvr_rec_create ( uint8_t adapter, const char *rec, DwrRecMonitor *dm )
+static int dvr_open ( uint8_t adapter, uint8_t demux )
 {
 	char dvrdev[PATH_MAX];
-	sprintf ( dvrdev, "/dev/dvb/adapter%d/dvr0", adapter );
+	sprintf ( dvrdev, "/dev/dvb/adapter%d/dvr%d", adapter, demux );
 
 	int dvr_fd = open ( dvrdev, O_RDONLY );
 
-	if ( dvr_fd == -1 )
+	if ( dvr_fd == -1 ) perror ( "Cannot open dvr device" );
+
+	return dvr_fd;
+}
+
+/* thread - see dvr_rec_create_fd */
+const char * dvr_rec_start ( uint8_t adapter, const char *rec, DwrRecMonitor *dm, GThread **thread )
+{
+	int dvr_fd = dvr_open ( adapter, 0 );
+
+	if ( dvr_fd == -1 ) return "Cannot open dvr device";
+
+	return dvr_rec_create_fd ( dvr_fd, adapter, rec, dm, thread );
+}
+
+/*
+* One reader of the dvr device for the recording and the players: each read goes to every sink in whole TS packets.
+* A player gets the packets its pipe has room for, the rest is dropped; a paused player never holds up the recording.
+*/
+#define TEE_TS_SIZE 188
+
+typedef struct _DvrTeePlay DvrTeePlay;
+
+struct _DvrTeePlay
+{
+	int fd;
+
+	uint8_t cut[TEE_TS_SIZE]; // a packet the pipe took only in part
+	size_t cut_rest; // its bytes still owed: sent before anything else
+};
+
+struct _DvrTee
+{
+	int dvr_fd;
+	int dvr_next; // -1, or the device after a hand-off: swapped by the thread
+	uint8_t adapter, demux;
+
+	GMutex mutex; // the sinks and dvr_next
+	DwrRec *rec;
+	GSList *play; // DvrTeePlay
+
+	int stop;
+	GThread *thread;
+};
+
+static void dvr_tee_play_free ( DvrTeePlay *play )
+{
+	close ( play->fd );
+	free ( play );
+}
+
+/* FALSE - the player is gone */
+static gboolean dvr_tee_play_write ( DvrTeePlay *play, const uint8_t *buf, size_t size )
+{
+	ssize_t w = 0;
+
+	if ( play->cut_rest )
 	{
-		perror ( "Cannot open dvr device" );
+		w = write ( play->fd, play->cut + TEE_TS_SIZE - play->cut_rest, play->cut_rest );
+
+		if ( w == -1 ) return ( errno == EAGAIN || errno == EINTR );
 
-		return "Cannot open dvr device";
+		play->cut_rest -= (size_t)w;
+
+		if ( play->cut_rest ) return TRUE; // still full: this chunk is dropped
 	}
 
-	int rec_fd = open ( rec, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0664 );
+	w = write ( play->fd, buf, size );
 
-	if ( rec_fd == -1 )
+	if ( w == -1 ) return ( errno == EAGAIN || errno == EINTR );
+
+	// a short write: the packet it cut is finished next time, the packets after it are dropped
+	size_t part = (size_t)w % TEE_TS_SIZE;
+
+	if ( part && (size_t)w < size )
 	{
-		perror ( "Cannot open rec file" );
-		close ( dvr_fd );
+		memcpy ( play->cut, buf + (size_t)w - part, TEE_TS_SIZE );
+		play->cut_rest = TEE_TS_SIZE - part;
+	}
+
+	return TRUE;
+}
+
+/* size - whole packets */
+static void dvr_tee_write_play ( DvrTee *tee, const uint8_t *buf, size_t size )
+{
+	GSList *l = tee->play;
+
+	while ( l != NULL )
+	{
+		GSList *next = l->next;
 
-		return "Cannot open rec file";
+		if ( !dvr_tee_play_write ( l->data, buf, size ) )
+		{
+			dvr_tee_play_free ( l->data );
+			tee->play = g_slist_delete_link ( tee->play, l );
+		}
+
+		l = next;
 	}
+}
 
-	DwrRec *dvr_rec = g_new0 ( DwrRec, 1 );
+static gpointer dvr_tee_thread ( DvrTee *tee )
+{
+	uint8_t buf[BUF_SIZE];
+	ssize_t r = 0;
+	size_t rest = 0; // the start of a packet the last read cut
 
-	dvr_rec->drm = dm;
-	dvr_rec->dvr_fd = dvr_fd;
-	dvr_rec->rec_fd = rec_fd;
+	struct pollfd pfd;
+	pfd.events = POLLIN | POLLPRI | POLLERR;
+
+	while ( !g_atomic_int_get ( &tee->stop ) )
+	{
+		g_mutex_lock ( &tee->mutex );
+
+		if ( tee->dvr_next != -1 ) { close ( tee->dvr_fd ); tee->dvr_fd = tee->dvr_next; tee->dvr_next = -1; rest = 0; }
+
+		g_mutex_unlock ( &tee->mutex );
+
+		pfd.fd = tee->dvr_fd;
+
+		int ret = poll ( &pfd, 1, 10 );
+
+		if ( ret == -1 )
+		{
+			if ( errno == EINTR ) continue;
+
+			printf ( "Dvr device poll failure \n" );
+			break;
+		}
+
+		g_mutex_lock ( &tee->mutex );
+
+		if ( pfd.revents == 0 )
+		{
+			if ( tee->rec && dvr_rec_stopped ( tee->rec, tee->rec->total ) ) { dvr_rec_free ( tee->rec ); tee->rec = NULL; }
+
+			g_mutex_unlock ( &tee->mutex );
+			continue;
+		}
+
+		r = read ( tee->dvr_fd, buf + rest, sizeof(buf) - rest );
+
+		if ( r < 0 )
+		{
+			perror ( "Read" );
+
+			if ( errno == EOVERFLOW ) { if ( tee->rec ) metrics_rec_overflow ( tee->rec->metrics ); rest = 0; g_mutex_unlock ( &tee->mutex ); continue; }
 
-	GThread *thread = g_thread_new ( "dmx-rec-thread", (GThreadFunc)dvr_rec_thread, dvr_rec );
-	g_thread_unref ( thread );
+			g_mutex_unlock ( &tee->mutex );
+
+			printf ( "Read error \n" );
+			break;
+		}
+
+		size_t len = rest + (size_t)r, whole = len - len % TEE_TS_SIZE;
+
+		if ( whole && tee->rec && dvr_rec_write ( tee->rec, buf, whole ) ) { dvr_rec_free ( tee->rec ); tee->rec = NULL; }
+
+		if ( whole ) dvr_tee_write_play ( tee, buf, whole );
+
+		g_mutex_unlock ( &tee->mutex );
+
+		rest = len - whole;
+		memmove ( buf, buf + whole, rest );
+	}
 
 	return NULL;
 }
 
+DvrTee * dvr_tee_new ( uint8_t adapter, uint8_t demux )
+{
+	int dvr_fd = dvr_open ( adapter, demux );
+
+	if ( dvr_fd == -1 ) return NULL;
+
+	// a player that quits must not take the program with it
+	signal ( SIGPIPE, SIG_IGN );
+
+	DvrTee *tee = g_new0 ( DvrTee, 1 );
+
+	g_mutex_init ( &tee->mutex );
+
+	tee->dvr_fd = dvr_fd;
+	tee->dvr_next = -1;
+	tee->adapter = adapter;
+	tee->demux = demux;
+	tee->thread = g_thread_new ( "dvr-tee-thread", (GThreadFunc)dvr_tee_thread, tee );
+
+	return tee;
+}
+
+void dvr_tee_free ( DvrTee *tee )
+{
+	if ( !tee ) return;
+
+	g_atomic_int_set ( &tee->stop, 1 );
+	g_thread_join ( tee->thread );
+
+	if ( tee->rec ) dvr_rec_free ( tee->rec );
+
+	g_slist_free_full ( tee->play, (GDestroyNotify)dvr_tee_play_free );
+
+	close ( tee->dvr_fd );
+	if ( tee->dvr_next != -1 ) close ( tee->dvr_next );
+
+	g_mutex_clear ( &tee->mutex );
+	free ( tee );
+}
+
+/* The sinks follow a hand-off to another adapter */
+const char * dvr_tee_set_adapter ( DvrTee *tee, uint8_t adapter, uint8_t demux )
+{
+	// the dvr device has a single reader: the same one is never opened twice
+	if ( tee->adapter == adapter && tee->demux == demux ) return NULL;
+
+	int dvr_fd = dvr_open ( adapter, demux );
+
+	if ( dvr_fd == -1 ) return "Cannot open dvr device";
+
+	g_mutex_lock ( &tee->mutex );
+
+	if ( tee->dvr_next != -1 ) close ( tee->dvr_next );
+
+	tee->dvr_next = dvr_fd;
+	tee->adapter = adapter;
+	tee->demux = demux;
+
+	g_mutex_unlock ( &tee->mutex );
+
+	return NULL;
+}
+
+/* Stops as dvr_rec_create_fd: dm->stop_rec */
+const char * dvr_tee_record ( DvrTee *tee, const char *rec, DwrRecMonitor *dm )
+{
+	const char *error = NULL;
+
+	g_mutex_lock ( &tee->mutex );
+
+	if ( tee->rec ) error = "Recording already.";
+
+	if ( !error ) tee->rec = dvr_rec_new ( -1, tee->adapter, rec, dm, &error );
+
+	g_mutex_unlock ( &tee->mutex );
+
+	return error;
+}
+
+/* Now, not on the next check: a new recording may follow at once */
+void dvr_tee_record_stop ( DvrTee *tee )
+{
+	g_mutex_lock ( &tee->mutex );
+
+	if ( tee->rec ) { dvr_rec_free ( tee->rec ); tee->rec = NULL; }
+
+	g_mutex_unlock ( &tee->mutex );
+}
+
+/* fd - the write end of a player's stdin, taken; dropped once the player is gone */
+void dvr_tee_play ( DvrTee *tee, int fd )
+{
+	fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL ) | O_NONBLOCK );
+
+#ifdef F_SETPIPE_SZ
+	// about a second of a HD service: room for the player's start-up
+	fcntl ( fd, F_SETPIPE_SZ, 1024 * 1024 );
+#endif
+
+	DvrTeePlay *play = g_new0 ( DvrTeePlay, 1 );
+
+	play->fd = fd;
+
+	g_mutex_lock ( &tee->mutex );
+
+	tee->play = g_slist_prepend ( tee->play, play );
+
+	g_mutex_unlock ( &tee->mutex );
+}
+
 void dvb5_message_dialog ( const char *error, const char *file_or_info, GtkMessageType mesg_type, GtkWindow *window )
 {
 	GtkMessageDialog *dialog = ( GtkMessageDialog *)gtk_message_dialog_new (
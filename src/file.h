@@ -29,4 +29,20 @@ char * file_save ( const char *, const char *, GtkWindow * );
 
 void dvb5_message_dialog ( const char *, const char *, GtkMessageType , GtkWindow * );
 
-const char * dvr_rec_create ( uint8_t , const char *, DwrRecMonitor * );
+const char * dvr_rec_start ( uint8_t , const char *, DwrRecMonitor *, GThread ** );
+
+const char * dvr_rec_create_fd ( int, uint8_t , const char *, DwrRecMonitor *, GThread ** );
+
+typedef struct _DvrTee DvrTee;
+
+DvrTee * dvr_tee_new ( uint8_t, uint8_t );
+
+void dvr_tee_free ( DvrTee * );
+
+const char * dvr_tee_set_adapter ( DvrTee *, uint8_t, uint8_t );
+
+const char * dvr_tee_record ( DvrTee *, const char *, DwrRecMonitor * );
+
+void dvr_tee_record_stop ( DvrTee * );
+
+void dvr_tee_play ( DvrTee *, int );
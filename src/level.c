@@ -8,6 +8,7 @@
 */
 
 #include "level.h"
+#include "sighist.h"
 
 struct _Level
 {
@@ -16,12 +17,21 @@ struct _Level
 	GtkLabel *sgn_snr;
 	GtkProgressBar *bar_sgn;
 	GtkProgressBar *bar_snr;
+
+	GtkDrawingArea *graph;
+	GBytes *hist; // SigBucket, oldest first
+	uint32_t hist_res;
+	uint8_t hist_level;
+
+	gboolean align; // the alignment readout owns the label and bars
 };
 
 G_DEFINE_TYPE ( Level, level, GTK_TYPE_BOX )
 
 static void level_handler_update ( Level *level, uint8_t qual, char *sgl, char *snr, uint8_t sgl_gd, uint8_t snr_gd, gboolean fe_lock )
 {
+	if ( level->align ) return;
+
 	gtk_progress_bar_set_fraction ( level->bar_sgn, (double)sgl_gd / 100 );
 	gtk_progress_bar_set_fraction ( level->bar_snr, (double)snr_gd / 100 );
 
@@ -40,6 +50,109 @@ static void level_handler_update ( Level *level, uint8_t qual, char *sgl, char *
 	gtk_label_set_markup ( level->sgn_snr, markup );
 }
 
+static void level_handler_align ( Level *level, gboolean on, double sgl, double snr, double sgl_peak, double snr_peak, gboolean fe_lock )
+{
+	level->align = on;
+
+	if ( !on ) { gtk_label_set_text ( level->sgn_snr, "Quality  ◉  Signal  ◉  C/N" ); return; }
+
+	gtk_progress_bar_set_fraction ( level->bar_sgn, CLAMP ( sgl / 100, 0, 1 ) );
+	gtk_progress_bar_set_fraction ( level->bar_snr, CLAMP ( snr / 100, 0, 1 ) );
+
+	const char *text_l = ( fe_lock ) ? "00ff00" : "ff0000";
+
+	g_autofree char *markup = g_markup_printf_escaped ( "Align<span foreground=\"#%s\">  ◉  </span>Signal:  %.1f%%  ( peak %.1f )<span foreground=\"#%s\">  ◉  </span>C/N:  %.1f%%  ( peak %.1f )",
+		text_l, sgl, sgl_peak, text_l, snr, snr_peak );
+
+	gtk_label_set_markup ( level->sgn_snr, markup );
+}
+
+static void level_graph_line ( cairo_t *cr, const SigBucket *b, uint32_t n, uint8_t v, double dx, int height )
+{
+	gboolean move = TRUE;
+
+	uint32_t i = 0; for ( i = 0; i < n; i++ )
+	{
+		if ( !b[i].n ) { move = TRUE; continue; }
+
+		double y = height - (double)height * b[i].sum[v] / b[i].n / 100;
+
+		if ( move ) cairo_move_to ( cr, i * dx, y ); else cairo_line_to ( cr, i * dx, y );
+
+		move = FALSE;
+	}
+
+	cairo_stroke ( cr );
+}
+
+/* Min / max band and the average line: Signal - Aqua, C/N - Magenta */
+static gboolean level_graph_draw ( GtkWidget *widget, cairo_t *cr, Level *level )
+{
+	if ( !level->hist ) return TRUE;
+
+	int width  = gtk_widget_get_allocated_width  ( widget );
+	int height = gtk_widget_get_allocated_height ( widget );
+
+	gsize size = 0;
+	const SigBucket *b = g_bytes_get_data ( level->hist, &size );
+	uint32_t n = (uint32_t)( size / sizeof ( SigBucket ) );
+
+	if ( n < 2 ) return TRUE;
+
+	double dx = (double)width / ( n - 1 );
+	double rgb[2][3] = { { 0, 1, 1 }, { 1, 0, 1 } };
+
+	uint8_t v = 0; for ( v = SH_SGL; v <= SH_SNR; v++ )
+	{
+		cairo_set_source_rgba ( cr, rgb[v][0], rgb[v][1], rgb[v][2], 0.25 );
+
+		uint32_t i = 0; for ( i = 0; i < n; i++ )
+		{
+			if ( !b[i].n ) continue;
+
+			double y_max = height - (double)height * b[i].max[v] / 100;
+			double y_min = height - (double)height * b[i].min[v] / 100;
+
+			cairo_rectangle ( cr, i * dx - dx / 2, y_max, MAX ( dx, 1 ), MAX ( y_min - y_max, 1 ) );
+		}
+
+		cairo_fill ( cr );
+
+		cairo_set_source_rgba ( cr, rgb[v][0], rgb[v][1], rgb[v][2], 0.9 );
+		cairo_set_line_width ( cr, 1.5 );
+
+		level_graph_line ( cr, b, n, v, dx, height );
+	}
+
+	return TRUE;
+}
+
+static gboolean level_graph_press ( G_GNUC_UNUSED GtkWidget *widget, G_GNUC_UNUSED GdkEventButton *event, Level *level )
+{
+	level->hist_level = ( level->hist_level + 1 ) % SIGHIST_LEVELS;
+
+	g_signal_emit_by_name ( level, "hist-level", level->hist_level );
+
+	return TRUE;
+}
+
+static void level_handler_history ( Level *level, uint32_t res, GBytes *hist )
+{
+	if ( level->hist ) g_bytes_unref ( level->hist );
+
+	level->hist = ( hist ) ? g_bytes_ref ( hist ) : NULL;
+	level->hist_res = res;
+
+	gsize size = ( hist ) ? g_bytes_get_size ( hist ) : 0;
+	uint32_t span = (uint32_t)( size / sizeof ( SigBucket ) ) * res;
+
+	g_autofree char *tooltip = g_strdup_printf ( "Signal / C/N history: %u %s, %u s buckets ( min / avg / max ). Click - resolution",
+		( span >= 3600 ) ? span / 3600 : span / 60, ( span >= 3600 ) ? "h" : "min", res );
+
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( level->graph ), tooltip );
+	gtk_widget_queue_draw ( GTK_WIDGET ( level->graph ) );
+}
+
 static void level_init ( Level *level )
 {
 	GtkBox *box = GTK_BOX ( level );
@@ -59,11 +172,30 @@ static void level_init ( Level *level )
 	gtk_box_pack_start ( box, GTK_WIDGET ( level->bar_sgn ), FALSE, FALSE, 0 );
 	gtk_box_pack_start ( box, GTK_WIDGET ( level->bar_snr ), FALSE, FALSE, 0 );
 
+	level->hist = NULL;
+	level->hist_res = 0;
+	level->hist_level = 0;
+	level->align = FALSE;
+
+	level->graph = (GtkDrawingArea *)gtk_drawing_area_new ();
+	gtk_widget_set_size_request ( GTK_WIDGET ( level->graph ), -1, 60 );
+	gtk_widget_add_events ( GTK_WIDGET ( level->graph ), GDK_BUTTON_PRESS_MASK );
+	g_signal_connect ( level->graph, "draw", G_CALLBACK ( level_graph_draw ), level );
+	g_signal_connect ( level->graph, "button-press-event", G_CALLBACK ( level_graph_press ), level );
+	gtk_box_pack_start ( box, GTK_WIDGET ( level->graph ), FALSE, FALSE, 0 );
+	gtk_widget_set_visible ( GTK_WIDGET ( level->graph ), TRUE );
+
 	g_signal_connect ( level, "level-update", G_CALLBACK ( level_handler_update ), NULL );
+	g_signal_connect ( level, "level-history", G_CALLBACK ( level_handler_history ), NULL );
+	g_signal_connect ( level, "level-align",   G_CALLBACK ( level_handler_align   ), NULL );
 }
 
 static void level_finalize ( GObject *object )
 {
+	Level *level = LEVEL_BOX ( object );
+
+	if ( level->hist ) g_bytes_unref ( level->hist );
+
 	G_OBJECT_CLASS (level_parent_class)->finalize (object);
 }
 
@@ -73,6 +205,15 @@ static void level_class_init ( LevelClass *class )
 
 	g_signal_new ( "level-update", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 6, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "level-history", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_BYTES );
+
+	g_signal_new ( "level-align", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 6, G_TYPE_BOOLEAN, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "hist-level", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_UINT );
 }
 
 Level * level_new ( void )
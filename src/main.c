@@ -8,14 +8,72 @@
 */
 
 #include "dvb5-app.h"
+#include "metrics.h"
+#include "ctl.h"
+#include "cli.h"
 
-int main ( void )
+#include <locale.h>
+#include <signal.h>
+#include <glib-unix.h>
+
+static gboolean dvb5_daemon_quit ( GMainLoop *loop )
+{
+	g_main_loop_quit ( loop );
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* No display: the engine behind the control socket only */
+static int dvb5_daemon ( const char *path )
 {
-	Dvb5App *app = dvb5_app_new ();
+	setlocale ( LC_NUMERIC, "C" );
+
+	Dvb *dvb = dvb_new ();
+	Ctl *ctl = ctl_new ( dvb, path );
+
+	if ( !ctl ) { g_object_unref ( dvb ); return 1; }
+
+	GMainLoop *loop = g_main_loop_new ( NULL, FALSE );
+
+	g_unix_signal_add ( SIGINT,  (GSourceFunc)dvb5_daemon_quit, loop );
+	g_unix_signal_add ( SIGTERM, (GSourceFunc)dvb5_daemon_quit, loop );
+
+	// a client gone mid-write must not take the daemon with it
+	signal ( SIGPIPE, SIG_IGN );
+
+	g_main_loop_run ( loop );
+	g_main_loop_unref ( loop );
+
+	ctl_free ( ctl );
+	g_object_unref ( dvb );
+
+	return 0;
+}
+
+int main ( int argc, char **argv )
+{
+	metrics_serve ( g_getenv ( METRICS_ENV ) );
+
+	int status = 0;
+
+	if ( argc > 1 && ( g_str_equal ( argv[1], "--daemon" ) || g_str_equal ( argv[1], "-d" ) ) )
+	{
+		status = dvb5_daemon ( ( argc > 2 ) ? argv[2] : NULL );
+	}
+	else if ( argc > 1 && cli_command ( argv[1] ) )
+	{
+		status = cli_run ( argc - 1, argv + 1 );
+	}
+	else
+	{
+		Dvb5App *app = dvb5_app_new ();
+
+		status = g_application_run ( G_APPLICATION ( app ), 0, NULL );
 
-	int status = g_application_run ( G_APPLICATION ( app ), 0, NULL );
+		g_object_unref ( app );
+	}
 
-	g_object_unref ( app );
+	metrics_stop ();
 
 	return status;
 }
@@ -0,0 +1,476 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "metrics.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define METRICS_FE_MAX  16
+#define METRICS_REC_MAX 8
+#define METRICS_PORT 9436
+
+/*
+* Writers ( monitor, recorder and scan threads ) only store atomics: a scrape never holds them up.
+* Slots are static, a frontend keeps its slot for the whole run.
+*/
+
+typedef struct _MetricsFe MetricsFe;
+
+struct _MetricsFe
+{
+	atomic_uint key; // 0 - free, 1 + ( adapter << 8 | frontend )
+
+	atomic_uint lock, signal, cnr, qual;
+
+	_Atomic uint64_t ucb[FEMON_LAYERS];
+	_Atomic double ber[FEMON_LAYERS], pre_ber[FEMON_LAYERS], per[FEMON_LAYERS], ucb_s[FEMON_LAYERS]; // -1 - not available
+};
+
+struct _MetricsRec
+{
+	atomic_uint used; // 0 - free, 1 - filling, 2 - live
+	atomic_uint gen;  // bumped on every claim: the reader checks the name did not change under it
+
+	uint8_t adapter;
+	char file[256];
+
+	_Atomic uint64_t bytes, overflows, writes, write_us, write_us_max;
+};
+
+static MetricsFe  metrics_fe[METRICS_FE_MAX];
+static MetricsRec metrics_rec[METRICS_REC_MAX];
+
+static atomic_uint metrics_scan_run, metrics_scan_freq, metrics_scan_tp, metrics_scan_progs;
+
+static struct
+{
+	int fd;
+	char *unix_path;
+	GThread *thread;
+	atomic_int stop;
+} metrics_srv = { .fd = -1 };
+
+static MetricsFe * metrics_fe_slot ( uint8_t adapter, uint8_t frontend )
+{
+	uint key = 1 + ( ( (uint)adapter << 8 ) | frontend );
+
+	uint8_t i = 0; for ( i = 0; i < METRICS_FE_MAX; i++ ) if ( atomic_load ( &metrics_fe[i].key ) == key ) return &metrics_fe[i];
+
+	for ( i = 0; i < METRICS_FE_MAX; i++ )
+	{
+		uint expected = 0;
+
+		if ( atomic_compare_exchange_strong ( &metrics_fe[i].key, &expected, key ) || expected == key ) return &metrics_fe[i];
+	}
+
+	return NULL;
+}
+
+/* Monitor thread: every published snapshot */
+void metrics_fe_publish ( uint8_t adapter, uint8_t frontend, const FeSnap *snap )
+{
+	MetricsFe *fe = metrics_fe_slot ( adapter, frontend );
+
+	if ( !fe ) return;
+
+	atomic_store ( &fe->lock,   snap->fe_lock );
+	atomic_store ( &fe->signal, snap->sgl_p );
+	atomic_store ( &fe->cnr,    snap->snr_p );
+	atomic_store ( &fe->qual,   snap->qual );
+
+	uint8_t l = 0; for ( l = 0; l < FEMON_LAYERS; l++ )
+	{
+		const FeErrors *err = &snap->err[l];
+
+		atomic_store ( &fe->ucb[l],     err->ucb     );
+		atomic_store ( &fe->ucb_s[l],   err->ucb_s   );
+		atomic_store ( &fe->ber[l],     err->ber     );
+		atomic_store ( &fe->pre_ber[l], err->pre_ber );
+		atomic_store ( &fe->per[l],     err->per     );
+	}
+}
+
+/* The monitor stopped: the series go, a lock of a closed frontend is not left standing; the slot is free again */
+void metrics_fe_clear ( uint8_t adapter, uint8_t frontend )
+{
+	uint key = 1 + ( ( (uint)adapter << 8 ) | frontend );
+
+	uint8_t i = 0; for ( i = 0; i < METRICS_FE_MAX; i++ )
+	{
+		MetricsFe *fe = &metrics_fe[i];
+
+		if ( atomic_load ( &fe->key ) != key ) continue;
+
+		atomic_store ( &fe->lock,   0 );
+		atomic_store ( &fe->signal, 0 );
+		atomic_store ( &fe->cnr,    0 );
+		atomic_store ( &fe->qual,   0 );
+
+		uint8_t l = 0; for ( l = 0; l < FEMON_LAYERS; l++ )
+		{
+			atomic_store ( &fe->ucb[l],     0  );
+			atomic_store ( &fe->ucb_s[l],   -1 );
+			atomic_store ( &fe->ber[l],     -1 );
+			atomic_store ( &fe->pre_ber[l], -1 );
+			atomic_store ( &fe->per[l],     -1 );
+		}
+
+		atomic_store ( &fe->key, 0 );
+	}
+}
+
+/* Recorder thread: NULL - all slots busy, the recording goes on unmetered */
+MetricsRec * metrics_rec_claim ( uint8_t adapter, const char *file )
+{
+	uint8_t i = 0; for ( i = 0; i < METRICS_REC_MAX; i++ )
+	{
+		MetricsRec *rec = &metrics_rec[i];
+		uint expected = 0;
+
+		if ( !atomic_compare_exchange_strong ( &rec->used, &expected, 1 ) ) continue;
+
+		atomic_fetch_add ( &rec->gen, 1 );
+
+		rec->adapter = adapter;
+		g_strlcpy ( rec->file, file, sizeof ( rec->file ) );
+
+		atomic_store ( &rec->bytes, 0 );
+		atomic_store ( &rec->overflows, 0 );
+		atomic_store ( &rec->writes, 0 );
+		atomic_store ( &rec->write_us, 0 );
+		atomic_store ( &rec->write_us_max, 0 );
+
+		atomic_store ( &rec->used, 2 );
+
+		return rec;
+	}
+
+	return NULL;
+}
+
+/* bytes - written by one write (), write_us - its duration */
+void metrics_rec_write ( MetricsRec *rec, uint64_t bytes, gint64 write_us )
+{
+	if ( !rec ) return;
+
+	atomic_fetch_add ( &rec->bytes, bytes );
+	atomic_fetch_add ( &rec->writes, 1 );
+	atomic_fetch_add ( &rec->write_us, (uint64_t)write_us );
+
+	if ( (uint64_t)write_us > atomic_load ( &rec->write_us_max ) ) atomic_store ( &rec->write_us_max, (uint64_t)write_us ); // one writer
+}
+
+void metrics_rec_overflow ( MetricsRec *rec )
+{
+	if ( rec ) atomic_fetch_add ( &rec->overflows, 1 );
+}
+
+void metrics_rec_release ( MetricsRec *rec )
+{
+	if ( rec ) atomic_store ( &rec->used, 0 );
+}
+
+/* Scan thread: running, current frequency, transponders and programs so far */
+void metrics_scan ( gboolean run, uint32_t freq, uint32_t tp, uint32_t progs )
+{
+	atomic_store ( &metrics_scan_run,   ( run ) ? 1 : 0 );
+	atomic_store ( &metrics_scan_freq,  freq  );
+	atomic_store ( &metrics_scan_tp,    tp    );
+	atomic_store ( &metrics_scan_progs, progs );
+}
+
+static void metrics_head ( GString *s, const char *name, const char *type, const char *help )
+{
+	g_string_append_printf ( s, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+
+enum metrics_fe_field { MF_LOCK, MF_SIGNAL, MF_CNR, MF_QUAL, MF_BER, MF_PRE_BER, MF_PER, MF_UCB };
+
+static void metrics_fe_gauge ( GString *s, const char *name, const char *help, enum metrics_fe_field field )
+{
+	metrics_head ( s, name, "gauge", help );
+
+	uint8_t i = 0; for ( i = 0; i < METRICS_FE_MAX; i++ )
+	{
+		MetricsFe *fe = &metrics_fe[i];
+		uint key = atomic_load ( &fe->key );
+
+		if ( !key ) continue;
+
+		uint val = 0;
+
+		if ( field == MF_LOCK   ) val = atomic_load ( &fe->lock   );
+		if ( field == MF_SIGNAL ) val = atomic_load ( &fe->signal );
+		if ( field == MF_CNR    ) val = atomic_load ( &fe->cnr    );
+		if ( field == MF_QUAL   ) val = atomic_load ( &fe->qual   );
+
+		g_string_append_printf ( s, "%s{adapter=\"%u\",frontend=\"%u\"} %u\n", name, ( key - 1 ) >> 8, ( key - 1 ) & 0xff, val );
+	}
+}
+
+/* Layers without the figure ( -1 ) are left out */
+static void metrics_fe_layer ( GString *s, const char *name, const char *type, const char *help, enum metrics_fe_field field )
+{
+	metrics_head ( s, name, type, help );
+
+	uint8_t i = 0; for ( i = 0; i < METRICS_FE_MAX; i++ )
+	{
+		MetricsFe *fe = &metrics_fe[i];
+		uint key = atomic_load ( &fe->key );
+
+		if ( !key ) continue;
+
+		uint8_t l = 0; for ( l = 0; l < FEMON_LAYERS; l++ )
+		{
+			double val = -1;
+
+			if ( field == MF_BER     ) val = atomic_load ( &fe->ber[l]     );
+			if ( field == MF_PRE_BER ) val = atomic_load ( &fe->pre_ber[l] );
+			if ( field == MF_PER     ) val = atomic_load ( &fe->per[l]     );
+			if ( field == MF_UCB && atomic_load ( &fe->ucb_s[l] ) >= 0 ) val = (double)atomic_load ( &fe->ucb[l] );
+
+			if ( val < 0 ) continue;
+
+			g_string_append_printf ( s, "%s{adapter=\"%u\",frontend=\"%u\",layer=\"%c\"} %.10g\n", name, ( key - 1 ) >> 8, ( key - 1 ) & 0xff, 'A' + l, val );
+		}
+	}
+}
+
+static void metrics_label_escape ( GString *s, const char *str )
+{
+	const char *p = str; for ( p = str; *p; p++ )
+	{
+		if ( *p == '\\' || *p == '"' ) g_string_append_c ( s, '\\' );
+
+		if ( *p == '\n' ) g_string_append ( s, "\\n" ); else g_string_append_c ( s, *p );
+	}
+}
+
+static void metrics_rec_series ( GString *s, const char *name, const char *type, const char *help, int field )
+{
+	metrics_head ( s, name, type, help );
+
+	uint8_t i = 0; for ( i = 0; i < METRICS_REC_MAX; i++ )
+	{
+		MetricsRec *rec = &metrics_rec[i];
+
+		uint gen = atomic_load ( &rec->gen );
+
+		if ( atomic_load ( &rec->used ) != 2 ) continue;
+
+		char file[256];
+		uint8_t adapter = rec->adapter;
+		g_strlcpy ( file, rec->file, sizeof ( file ) );
+
+		if ( atomic_load ( &rec->gen ) != gen || atomic_load ( &rec->used ) != 2 ) continue;
+
+		double val = 0;
+
+		if ( field == 0 ) val = (double)atomic_load ( &rec->bytes );
+		if ( field == 1 ) val = (double)atomic_load ( &rec->overflows );
+		if ( field == 2 ) val = (double)atomic_load ( &rec->write_us ) / G_USEC_PER_SEC;
+		if ( field == 3 ) val = (double)atomic_load ( &rec->writes );
+		if ( field == 4 ) val = (double)atomic_load ( &rec->write_us_max ) / G_USEC_PER_SEC;
+
+		g_string_append_printf ( s, "%s{adapter=\"%u\",file=\"", name, adapter );
+		metrics_label_escape ( s, file );
+		g_string_append_printf ( s, "\"} %.17g\n", val );
+	}
+}
+
+static char * metrics_text ( void )
+{
+	GString *s = g_string_new ( NULL );
+
+	metrics_fe_gauge ( s, "dvb5_frontend_lock", "Frontend has lock ( 1 / 0 ).", MF_LOCK );
+	metrics_fe_gauge ( s, "dvb5_frontend_signal_percent", "Signal strength, %.", MF_SIGNAL );
+	metrics_fe_gauge ( s, "dvb5_frontend_cnr_percent", "Carrier to noise, %.", MF_CNR );
+	metrics_fe_gauge ( s, "dvb5_frontend_quality", "Quality: 0 - unknown, 1 - poor, 2 - ok, 3 - good.", MF_QUAL );
+
+	metrics_fe_layer ( s, "dvb5_frontend_ber", "gauge", "Post-FEC bit error ratio over the last sample interval.", MF_BER );
+	metrics_fe_layer ( s, "dvb5_frontend_pre_ber", "gauge", "Pre-FEC bit error ratio over the last sample interval.", MF_PRE_BER );
+	metrics_fe_layer ( s, "dvb5_frontend_per", "gauge", "Packet ( block ) error ratio over the last sample interval.", MF_PER );
+	metrics_fe_layer ( s, "dvb5_frontend_ucb_total", "counter", "Uncorrected blocks since the monitor start.", MF_UCB );
+
+	metrics_rec_series ( s, "dvb5_recorder_bytes_total", "counter", "Bytes written by the recorder.", 0 );
+	metrics_rec_series ( s, "dvb5_recorder_overflows_total", "counter", "Dvr buffer overflows ( EOVERFLOW ).", 1 );
+	metrics_rec_series ( s, "dvb5_recorder_write_seconds_total", "counter", "Time spent in write ().", 2 );
+	metrics_rec_series ( s, "dvb5_recorder_writes_total", "counter", "Calls of write ().", 3 );
+	metrics_rec_series ( s, "dvb5_recorder_write_max_seconds", "gauge", "Slowest write ().", 4 );
+
+	metrics_head ( s, "dvb5_scan_running", "gauge", "Scan in progress ( 1 / 0 )." );
+	g_string_append_printf ( s, "dvb5_scan_running %u\n", atomic_load ( &metrics_scan_run ) );
+	metrics_head ( s, "dvb5_scan_frequency", "gauge", "Frequency being scanned ( as in the channel file )." );
+	g_string_append_printf ( s, "dvb5_scan_frequency %u\n", atomic_load ( &metrics_scan_freq ) );
+	metrics_head ( s, "dvb5_scan_transponders", "gauge", "Transponders tried by the current / last scan." );
+	g_string_append_printf ( s, "dvb5_scan_transponders %u\n", atomic_load ( &metrics_scan_tp ) );
+	metrics_head ( s, "dvb5_scan_programs", "gauge", "Programs found by the current / last scan." );
+	g_string_append_printf ( s, "dvb5_scan_programs %u\n", atomic_load ( &metrics_scan_progs ) );
+
+	return g_string_free ( s, FALSE );
+}
+
+static void metrics_send ( int fd, const char *data, size_t len )
+{
+	while ( len )
+	{
+		ssize_t w = send ( fd, data, len, MSG_NOSIGNAL );
+
+		if ( w == -1 && errno == EINTR ) continue;
+		if ( w <= 0 ) return;
+
+		data += w; len -= (size_t)w;
+	}
+}
+
+static void metrics_client ( int fd )
+{
+	char req[2048] = "";
+	size_t len = 0;
+
+	// the request line is all that matters; a slow client gets 1 s
+	while ( len < sizeof ( req ) - 1 && !strstr ( req, "\r\n" ) )
+	{
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		if ( poll ( &pfd, 1, 1000 ) <= 0 ) break;
+
+		ssize_t r = recv ( fd, req + len, sizeof ( req ) - 1 - len, 0 );
+
+		if ( r <= 0 ) break;
+
+		len += (size_t)r;
+		req[len] = '\0';
+	}
+
+	req[len] = '\0';
+
+	gboolean found = ( g_str_has_prefix ( req, "GET /metrics " ) || g_str_has_prefix ( req, "GET / " ) );
+
+	g_autofree char *body = ( found ) ? metrics_text () : g_strdup ( "Not found\n" );
+
+	g_autofree char *head = g_strdup_printf ( "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		( found ) ? "200 OK" : "404 Not Found", strlen ( body ) );
+
+	metrics_send ( fd, head, strlen ( head ) );
+	metrics_send ( fd, body, strlen ( body ) );
+}
+
+static gpointer metrics_thread ( G_GNUC_UNUSED gpointer data )
+{
+	while ( !atomic_load ( &metrics_srv.stop ) )
+	{
+		struct pollfd pfd = { .fd = metrics_srv.fd, .events = POLLIN };
+
+		if ( poll ( &pfd, 1, 100 ) <= 0 ) continue;
+
+		int fd = accept ( metrics_srv.fd, NULL, NULL );
+
+		if ( fd == -1 ) continue;
+
+		metrics_client ( fd );
+
+		close ( fd );
+	}
+
+	return NULL;
+}
+
+static int metrics_listen_unix ( const char *path )
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+	if ( strlen ( path ) >= sizeof ( sun.sun_path ) ) return -1;
+
+	strcpy ( sun.sun_path, path );
+
+	int fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+	if ( fd == -1 ) return -1;
+
+	unlink ( path );
+
+	if ( bind ( fd, (struct sockaddr *)&sun, sizeof ( sun ) ) == -1 ) { close ( fd ); return -1; }
+
+	metrics_srv.unix_path = g_strdup ( path );
+
+	return fd;
+}
+
+/* "port" or "host:port"; the host defaults to 127.0.0.1 */
+static int metrics_listen_tcp ( const char *addr )
+{
+	const char *colon = strrchr ( addr, ':' );
+
+	g_autofree char *host = ( colon ) ? g_strndup ( addr, (gsize)( colon - addr ) ) : g_strdup ( "127.0.0.1" );
+
+	uint64_t port = g_ascii_strtoull ( ( colon ) ? colon + 1 : addr, NULL, 10 );
+
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons ( (uint16_t)( ( port && port < 65536 ) ? port : METRICS_PORT ) ) };
+
+	if ( inet_pton ( AF_INET, host, &sin.sin_addr ) != 1 ) return -1;
+
+	int fd = socket ( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+	if ( fd == -1 ) return -1;
+
+	int on = 1;
+	setsockopt ( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof ( on ) );
+
+	if ( bind ( fd, (struct sockaddr *)&sin, sizeof ( sin ) ) == -1 ) { close ( fd ); return -1; }
+
+	return fd;
+}
+
+/* addr - see METRICS_ENV; NULL or "" - no endpoint */
+gboolean metrics_serve ( const char *addr )
+{
+	if ( !addr || !addr[0] || metrics_srv.thread ) return FALSE;
+
+	int fd = ( g_str_has_prefix ( addr, "unix:" ) ) ? metrics_listen_unix ( addr + 5 ) : metrics_listen_tcp ( addr );
+
+	if ( fd == -1 || listen ( fd, 4 ) == -1 )
+	{
+		g_warning ( "%s:: %s: %s ", __func__, addr, g_strerror ( errno ) );
+
+		if ( fd != -1 ) close ( fd );
+		return FALSE;
+	}
+
+	metrics_srv.fd = fd;
+	atomic_store ( &metrics_srv.stop, 0 );
+	metrics_srv.thread = g_thread_new ( "metrics", metrics_thread, NULL );
+
+	g_message ( "%s:: %s ", __func__, addr );
+
+	return TRUE;
+}
+
+void metrics_stop ( void )
+{
+	if ( !metrics_srv.thread ) return;
+
+	atomic_store ( &metrics_srv.stop, 1 );
+	g_thread_join ( metrics_srv.thread );
+	metrics_srv.thread = NULL;
+
+	close ( metrics_srv.fd );
+	metrics_srv.fd = -1;
+
+	if ( metrics_srv.unix_path ) { unlink ( metrics_srv.unix_path ); free ( metrics_srv.unix_path ); metrics_srv.unix_path = NULL; }
+}
@@ -0,0 +1,34 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "femon.h"
+
+#define METRICS_ENV "DVB5_METRICS" // "9436", "127.0.0.1:9436" or "unix:/path"
+
+typedef struct _MetricsRec MetricsRec;
+
+void metrics_fe_publish ( uint8_t, uint8_t, const FeSnap * );
+
+void metrics_fe_clear ( uint8_t, uint8_t );
+
+MetricsRec * metrics_rec_claim ( uint8_t, const char * );
+
+void metrics_rec_write ( MetricsRec *, uint64_t, gint64 );
+
+void metrics_rec_overflow ( MetricsRec * );
+
+void metrics_rec_release ( MetricsRec * );
+
+void metrics_scan ( gboolean, uint32_t, uint32_t, uint32_t );
+
+gboolean metrics_serve ( const char * );
+
+void metrics_stop ( void );
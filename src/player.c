@@ -0,0 +1,122 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "player.h"
+
+#include <signal.h>
+
+/*
+* Player sessions started from a command line: each child is known by the pid we spawned.
+* Nothing else reaps it, so the pid stays ours until its child watch runs.
+*/
+
+typedef struct _PlayerProc PlayerProc;
+
+struct _PlayerProc
+{
+	GPid pid;
+	Player *player; // NULL - the owner is gone, the watch only reaps
+};
+
+struct _Player
+{
+	GSList *procs;
+
+	PlayerExit exit;
+	gpointer data;
+};
+
+Player * player_new ( PlayerExit exit, gpointer data )
+{
+	Player *player = g_new0 ( Player, 1 );
+
+	player->exit = exit;
+	player->data = data;
+
+	return player;
+}
+
+static void player_exited ( GPid pid, int status, PlayerProc *proc )
+{
+	Player *player = proc->player;
+
+	g_message ( "%s:: pid %d, status %d ", __func__, pid, status );
+
+	g_spawn_close_pid ( pid );
+
+	if ( player )
+	{
+		player->procs = g_slist_remove ( player->procs, proc );
+
+		if ( player->exit ) player->exit ( pid, player->data );
+	}
+
+	free ( proc );
+}
+
+/* The command as typed: split like a shell, no shell run; fd_in - NULL, or the write end of its stdin; 0 - error */
+GPid player_start ( Player *player, const char *cmd, int *fd_in, GError **error )
+{
+	char **argv = NULL;
+
+	if ( !g_shell_parse_argv ( cmd, NULL, &argv, error ) ) return 0;
+
+	GPid pid = 0;
+	gboolean ret = g_spawn_async_with_pipes ( NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, fd_in, NULL, NULL, error );
+
+	g_strfreev ( argv );
+
+	if ( !ret ) return 0;
+
+	PlayerProc *proc = g_new0 ( PlayerProc, 1 );
+
+	proc->pid = pid;
+	proc->player = player;
+
+	player->procs = g_slist_prepend ( player->procs, proc );
+
+	g_child_watch_add ( pid, (GChildWatchFunc)player_exited, proc );
+
+	return pid;
+}
+
+/* pid 0 - every session; the child watch reports each one gone */
+void player_stop ( Player *player, GPid pid )
+{
+	GSList *l = NULL;
+
+	for ( l = player->procs; l != NULL; l = l->next )
+	{
+		PlayerProc *proc = l->data;
+
+		if ( !pid || proc->pid == pid ) kill ( proc->pid, SIGINT );
+	}
+}
+
+uint32_t player_count ( Player *player )
+{
+	return g_slist_length ( player->procs );
+}
+
+void player_free ( Player *player )
+{
+	GSList *l = NULL;
+
+	for ( l = player->procs; l != NULL; l = l->next )
+	{
+		PlayerProc *proc = l->data;
+
+		kill ( proc->pid, SIGINT );
+		proc->player = NULL;
+	}
+
+	g_slist_free ( player->procs );
+
+	free ( player );
+}
@@ -0,0 +1,26 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct _Player Player;
+
+typedef void ( *PlayerExit ) ( GPid, gpointer ); // a session is gone: stopped or quit by itself
+
+Player * player_new ( PlayerExit, gpointer );
+
+void player_free ( Player * );
+
+GPid player_start ( Player *, const char *, int *, GError ** );
+
+void player_stop ( Player *, GPid );
+
+uint32_t player_count ( Player * );
@@ -0,0 +1,316 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "pretune.h"
+#include "chdb.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#define PRETUNE_MAX 8
+
+typedef struct _PreTuneJob PreTuneJob;
+
+struct _PreTuneJob
+{
+	struct dvb_device *dev; // of a slot, its fe_parms already stored
+	uint8_t adapter, frontend;
+	uint32_t freq;
+	gboolean ok;
+};
+
+/*
+* dvb_fe_set_parms blocks ( DiSEqC, LNB power ): the tuning of an update runs on a thread.
+* Its slots are not handed off and the next update waits until it is done.
+*/
+struct _PreTune
+{
+	GArray *slots; // PreTuneSlot: idle frontends, the one in use by zap is not here
+
+	GThread *thread;
+	GArray *jobs; // PreTuneJob of the thread
+	gint run;     // 1 - the thread is not done yet
+};
+
+static gpointer pretune_thread ( PreTune *pt )
+{
+	uint32_t i = 0; for ( i = 0; i < pt->jobs->len; i++ )
+	{
+		PreTuneJob *job = &g_array_index ( pt->jobs, PreTuneJob, i );
+
+		job->ok = ( dvb_fe_set_parms ( job->dev->fe_parms ) == 0 );
+
+		if ( job->ok ) g_message ( "%s:: adapter%u/frontend%u -> %u ", __func__, job->adapter, job->frontend, job->freq );
+	}
+
+	g_atomic_int_set ( &pt->run, 0 );
+
+	return NULL;
+}
+
+/* Waits for the thread if it still runs; slots it could not tune go idle */
+static void pretune_join ( PreTune *pt )
+{
+	if ( !pt->thread ) return;
+
+	g_thread_join ( pt->thread );
+	pt->thread = NULL;
+
+	uint32_t j = 0; for ( j = 0; j < pt->jobs->len; j++ )
+	{
+		const PreTuneJob *job = &g_array_index ( pt->jobs, PreTuneJob, j );
+
+		if ( job->ok ) continue;
+
+		uint32_t i = 0; for ( i = 0; i < pt->slots->len; i++ )
+		{
+			PreTuneSlot *slot = &g_array_index ( pt->slots, PreTuneSlot, i );
+
+			if ( slot->dev == job->dev ) memset ( &slot->tp, 0, sizeof ( PsiTp ) );
+		}
+	}
+
+	g_array_set_size ( pt->jobs, 0 );
+}
+
+static gboolean pretune_tuning ( PreTune *pt, const PreTuneSlot *slot )
+{
+	if ( !g_atomic_int_get ( &pt->run ) ) return FALSE;
+
+	uint32_t j = 0; for ( j = 0; j < pt->jobs->len; j++ ) if ( g_array_index ( pt->jobs, PreTuneJob, j ).dev == slot->dev ) return TRUE;
+
+	return FALSE;
+}
+
+static gboolean pretune_tp_equal ( const PsiTp *a, const PsiTp *b )
+{
+	return ( a->freq && memcmp ( a, b, sizeof ( PsiTp ) ) == 0 );
+}
+
+static gboolean pretune_slot_lock ( PreTuneSlot *slot )
+{
+	fe_status_t status = 0;
+
+	return ( ioctl ( dvb_dev_get_fd ( slot->fe_fd ), FE_READ_STATUS, &status ) == 0 && ( status & FE_HAS_LOCK ) );
+}
+
+/* The frontend opened O_RDWR and its demux; the scheduler's recordings open tuners this way too */
+gboolean pretune_slot_open ( PreTuneSlot *slot, uint8_t a, uint8_t f )
+{
+	memset ( slot, 0, sizeof ( PreTuneSlot ) );
+
+	slot->dev = dvb_dev_alloc ();
+
+	if ( !slot->dev ) return FALSE;
+
+	dvb_dev_set_log ( slot->dev, 0, NULL );
+	dvb_dev_find ( slot->dev, NULL, NULL );
+
+	// demux N goes with frontend N on multi-frontend adapters, demux 0 otherwise
+	uint8_t d = f;
+	struct dvb_dev_list *dvb_dev = dvb_dev_seek_by_adapter ( slot->dev, a, d, DVB_DEVICE_DEMUX );
+
+	if ( !dvb_dev ) { d = 0; dvb_dev = dvb_dev_seek_by_adapter ( slot->dev, a, d, DVB_DEVICE_DEMUX ); }
+
+	if ( !dvb_dev ) { dvb_dev_free ( slot->dev ); return FALSE; }
+
+	slot->demux_dev = dvb_dev->sysname;
+
+	dvb_dev = dvb_dev_seek_by_adapter ( slot->dev, a, f, DVB_DEVICE_FRONTEND );
+
+	// a frontend busy in another program fails here and just stays out of the pool
+	if ( !dvb_dev || ( slot->fe_fd = dvb_dev_open ( slot->dev, dvb_dev->sysname, O_RDWR ) ) == NULL ) { dvb_dev_free ( slot->dev ); return FALSE; }
+
+	struct dvb_v5_fe_parms *parms = slot->dev->fe_parms;
+
+	parms->diseqc_wait = 0;
+	parms->freq_bpf = 0;
+	parms->lna = -1;
+
+	slot->adapter  = a;
+	slot->frontend = f;
+	slot->demux    = d;
+
+	return TRUE;
+}
+
+/* Every frontend that can be opened now, outside the zap adapter and those busy says are in use ( recordings ) */
+PreTune * pretune_new ( uint8_t zap_adapter, PreTuneBusy busy, gpointer data )
+{
+	struct dvb_device *dvb = dvb_dev_alloc ();
+
+	if ( !dvb ) return NULL;
+
+	dvb_dev_set_log ( dvb, 0, NULL );
+	dvb_dev_find ( dvb, NULL, NULL );
+
+	PreTune *pt = g_new0 ( PreTune, 1 );
+	pt->slots = g_array_new ( FALSE, TRUE, sizeof ( PreTuneSlot ) );
+	pt->jobs  = g_array_new ( FALSE, TRUE, sizeof ( PreTuneJob ) );
+
+	int i = 0; for ( i = 0; i < dvb->num_devices && pt->slots->len < PRETUNE_MAX; i++ )
+	{
+		struct dvb_dev_list *dev = &dvb->devices[i];
+
+		uint a = 0, f = 0;
+		PreTuneSlot slot;
+
+		if ( dev->dvb_type != DVB_DEVICE_FRONTEND || sscanf ( dev->sysname, "dvb%u.frontend%u", &a, &f ) != 2 ) continue;
+
+		// frontends of one adapter usually share the tuner
+		if ( a == zap_adapter || ( busy && busy ( data, (uint8_t)a ) ) ) continue;
+
+		if ( pretune_slot_open ( &slot, (uint8_t)a, (uint8_t)f ) ) g_array_append_val ( pt->slots, slot );
+	}
+
+	dvb_dev_free ( dvb );
+
+	g_message ( "%s:: idle frontends: %u ", __func__, pt->slots->len );
+
+	return pt;
+}
+
+void pretune_free ( PreTune *pt )
+{
+	if ( !pt ) return;
+
+	pretune_join ( pt );
+
+	uint32_t i = 0; for ( i = 0; i < pt->slots->len; i++ ) dvb_dev_free ( g_array_index ( pt->slots, PreTuneSlot, i ).dev );
+
+	g_array_free ( pt->slots, TRUE );
+	g_array_free ( pt->jobs,  TRUE );
+	free ( pt );
+}
+
+uint32_t pretune_count ( PreTune *pt )
+{
+	return ( pt ) ? pt->slots->len : 0;
+}
+
+/*
+* Keeps the transponders of channels ( most likely first ) tuned on the idle frontends.
+* Transponders already held stay untouched; busy - the transponder of the zap session.
+* Skipped while the tuning of the last update is still running: the next zap brings another.
+*/
+void pretune_update ( PreTune *pt, const char *file, const char * const *channels, const PsiTp *busy )
+{
+	if ( !pt || !pt->slots->len || !channels || g_atomic_int_get ( &pt->run ) ) return;
+
+	pretune_join ( pt );
+
+	ChDb *db = chdb_open ( file, FILE_DVBV5, SYS_UNDEFINED );
+
+	if ( !db ) return;
+
+	struct dvb_entry *want[PRETUNE_MAX];
+	PsiTp want_tp[PRETUNE_MAX];
+	gboolean held[PRETUNE_MAX] = { FALSE };
+	g_autofree gboolean *keep = g_new0 ( gboolean, pt->slots->len ); // slot keeps its transponder or got a new one
+	uint8_t n = 0;
+
+	const char * const *ch = channels; for ( ch = channels; *ch && n < MIN ( pt->slots->len, PRETUNE_MAX ); ch++ )
+	{
+		struct dvb_entry *entry = chdb_lookup ( db, *ch );
+
+		if ( !entry ) continue;
+
+		PsiTp tp;
+		psi_entry_tp ( entry, &tp );
+
+		if ( !tp.freq || pretune_tp_equal ( &tp, busy ) ) continue;
+
+		gboolean dup = FALSE;
+		uint8_t w = 0; for ( w = 0; w < n; w++ ) if ( pretune_tp_equal ( &tp, &want_tp[w] ) ) dup = TRUE;
+
+		if ( dup ) continue;
+
+		want[n] = entry;
+		want_tp[n++] = tp;
+	}
+
+	uint32_t i = 0; for ( i = 0; i < pt->slots->len; i++ )
+	{
+		PreTuneSlot *slot = &g_array_index ( pt->slots, PreTuneSlot, i );
+
+		uint8_t w = 0; for ( w = 0; w < n; w++ ) if ( !held[w] && pretune_tp_equal ( &slot->tp, &want_tp[w] ) ) { held[w] = TRUE; keep[i] = TRUE; break; }
+	}
+
+	uint8_t w = 0; for ( w = 0; w < n; w++ )
+	{
+		if ( held[w] ) continue;
+
+		for ( i = 0; i < pt->slots->len; i++ )
+		{
+			if ( keep[i] ) continue;
+
+			PreTuneSlot *slot = &g_array_index ( pt->slots, PreTuneSlot, i );
+
+			keep[i] = TRUE;
+
+			if ( psi_store_tp ( slot->dev->fe_parms, want[w], &slot->tp ) )
+			{
+				PreTuneJob job = { slot->dev, slot->adapter, slot->frontend, slot->tp.freq, FALSE };
+				g_array_append_val ( pt->jobs, job );
+			}
+			else
+				memset ( &slot->tp, 0, sizeof ( PsiTp ) );
+
+			break;
+		}
+	}
+
+	chdb_unref ( db );
+
+	if ( !pt->jobs->len ) return;
+
+	g_atomic_int_set ( &pt->run, 1 );
+	pt->thread = g_thread_new ( "pretune-thread", (GThreadFunc)pretune_thread, pt );
+}
+
+/* Hand-off: the locked idle frontend already on the channel's transponder leaves the pool */
+gboolean pretune_take ( PreTune *pt, const char *file, const char *channel, PreTuneSlot *out )
+{
+	if ( !pt || !pt->slots->len ) return FALSE;
+
+	ChDb *db = chdb_open ( file, FILE_DVBV5, SYS_UNDEFINED );
+
+	if ( !db ) return FALSE;
+
+	struct dvb_entry *entry = chdb_lookup ( db, channel );
+
+	PsiTp tp;
+	if ( entry ) psi_entry_tp ( entry, &tp );
+
+	chdb_unref ( db );
+
+	if ( !entry ) return FALSE;
+
+	uint32_t i = 0; for ( i = 0; i < pt->slots->len; i++ )
+	{
+		PreTuneSlot *slot = &g_array_index ( pt->slots, PreTuneSlot, i );
+
+		if ( !pretune_tp_equal ( &slot->tp, &tp ) || pretune_tuning ( pt, slot ) || !pretune_slot_lock ( slot ) ) continue;
+
+		*out = *slot;
+		g_array_remove_index ( pt->slots, i );
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* The frontend left by zap joins the pool, still tuned: zapping back is a hand-off too */
+void pretune_give ( PreTune *pt, PreTuneSlot *slot )
+{
+	g_array_append_val ( pt->slots, *slot );
+}
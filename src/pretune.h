@@ -0,0 +1,43 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "psi.h"
+
+typedef struct _PreTuneSlot PreTuneSlot;
+
+struct _PreTuneSlot
+{
+	struct dvb_device *dev;
+	struct dvb_open_descriptor *fe_fd;
+	char *demux_dev; // owned by dev
+
+	uint8_t adapter, frontend, demux;
+
+	PsiTp tp; // freq 0 - idle
+};
+
+gboolean pretune_slot_open ( PreTuneSlot *, uint8_t, uint8_t );
+
+typedef struct _PreTune PreTune;
+
+typedef gboolean ( *PreTuneBusy ) ( gpointer, uint8_t ); // TRUE - the adapter is in use
+
+PreTune * pretune_new ( uint8_t, PreTuneBusy, gpointer );
+
+void pretune_free ( PreTune * );
+
+uint32_t pretune_count ( PreTune * );
+
+void pretune_update ( PreTune *, const char *, const char * const *, const PsiTp * );
+
+gboolean pretune_take ( PreTune *, const char *, const char *, PreTuneSlot * );
+
+void pretune_give ( PreTune *, PreTuneSlot * );
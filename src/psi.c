@@ -0,0 +1,436 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "psi.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <linux/dvb/dmx.h>
+
+#include <libdvbv5/pat.h>
+#include <libdvbv5/pmt.h>
+#include <libdvbv5/sdt.h>
+#include <libdvbv5/nit.h>
+#include <libdvbv5/vct.h>
+
+#define PSI_SECT_SIZE 4096
+#define PSI_LOCK_TIME ( 2 * G_USEC_PER_SEC )
+#define PSI_LOCK_POLL ( 50 * 1000 )
+
+typedef struct _PsiFilter PsiFilter;
+
+struct _PsiFilter
+{
+	struct dvb_open_descriptor *fd;
+
+	uint8_t kind, done;
+	uint16_t pid;
+
+	int ext; // table_id_extension of the first section, -1 until seen
+	uint8_t last_section;
+	uint8_t sections[32]; // received section_number bitmap
+
+	gint64 start, deadline;
+	void **table;
+
+	PsiStats *stats;
+};
+
+void psi_store_entry ( struct dvb_v5_fe_parms *parms, struct dvb_entry *entry )
+{
+	uint32_t sys = parms->current_sys;
+
+	dvb_retrieve_entry_prop ( entry, DTV_DELIVERY_SYSTEM, &sys );
+	dvb_set_compat_delivery_system ( parms, sys );
+
+	/* Copy data into parms */
+	uint32_t i = 0; for ( i = 0; i < entry->n_props; i++ )
+	{
+		uint32_t data = entry->props[i].u.data;
+
+		/* Don't change the delivery system */
+		if ( entry->props[i].cmd == DTV_DELIVERY_SYSTEM ) continue;
+
+		dvb_fe_store_parm ( parms, entry->props[i].cmd, data );
+
+		if ( parms->current_sys == SYS_ISDBT )
+		{
+			dvb_fe_store_parm ( parms, DTV_ISDBT_PARTIAL_RECEPTION,  0 );
+			dvb_fe_store_parm ( parms, DTV_ISDBT_SOUND_BROADCASTING, 0 );
+			dvb_fe_store_parm ( parms, DTV_ISDBT_LAYER_ENABLED,   0x07 );
+
+			if ( entry->props[i].cmd == DTV_CODE_RATE_HP )
+			{
+				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERA_FEC, data );
+				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERB_FEC, data );
+				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERC_FEC, data );
+			}
+			else if ( entry->props[i].cmd == DTV_MODULATION )
+			{
+				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERA_MODULATION, data );
+				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERB_MODULATION, data );
+				dvb_fe_store_parm ( parms, DTV_ISDBT_LAYERC_MODULATION, data );
+			}
+		}
+
+		if ( parms->current_sys == SYS_ATSC && entry->props[i].cmd == DTV_MODULATION )
+		{
+			if ( data != VSB_8 && data != VSB_16 )
+				dvb_fe_store_parm ( parms, DTV_DELIVERY_SYSTEM, SYS_DVBC_ANNEX_B );
+		}
+	}
+}
+
+/* The transponder an entry lands on: entries with equal PsiTp share one tuning */
+void psi_entry_tp ( struct dvb_entry *entry, PsiTp *tp )
+{
+	memset ( tp, 0, sizeof ( PsiTp ) );
+
+	tp->sat_number = entry->sat_number;
+
+	if ( dvb_retrieve_entry_prop ( entry, DTV_DELIVERY_SYSTEM, &tp->sys ) ) tp->sys = SYS_UNDEFINED;
+	if ( dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &tp->freq ) ) tp->freq = 0;
+	if ( dvb_retrieve_entry_prop ( entry, DTV_POLARIZATION, &tp->pol ) ) tp->pol = POLARIZATION_OFF;
+	if ( dvb_retrieve_entry_prop ( entry, DTV_STREAM_ID, &tp->stream_id ) ) tp->stream_id = NO_STREAM_ID_FILTER;
+}
+
+/* Zap tuning of an entry: LNB, satellite number and properties */
+uint8_t psi_store_tp ( struct dvb_v5_fe_parms *parms, struct dvb_entry *entry, PsiTp *tp )
+{
+	if ( entry->lnb )
+	{
+		int lnb = dvb_sat_search_lnb ( entry->lnb );
+
+		if ( lnb == -1 ) { g_warning ( "%s:: Unknown LNB %s", __func__, entry->lnb ); return 0; }
+
+		parms->lnb = dvb_sat_get_lnb ( lnb );
+	}
+
+	if ( entry->sat_number >= 0 ) parms->sat_number = entry->sat_number;
+
+	psi_store_entry ( parms, entry );
+
+	if ( tp ) psi_entry_tp ( entry, tp );
+
+	return 1;
+}
+
+uint8_t psi_tune_entry ( struct dvb_v5_fe_parms *parms, struct dvb_entry *entry, uint8_t time_mult, PsiStats *stats )
+{
+	psi_store_entry ( parms, entry );
+
+	if ( stats ) stats->lock = -1;
+
+	if ( dvb_fe_set_parms ( parms ) < 0 ) return 0;
+
+	uint32_t status = 0;
+	gint64 start = g_get_monotonic_time (), deadline = start + PSI_LOCK_TIME * ( ( time_mult ) ? time_mult : 1 );
+
+	while ( !parms->abort && g_get_monotonic_time () < deadline )
+	{
+		if ( dvb_fe_get_stats ( parms ) == 0 && dvb_fe_retrieve_stats ( parms, DTV_STATUS, &status ) == 0 && ( status & FE_HAS_LOCK ) )
+		{
+			if ( stats ) stats->lock = g_get_monotonic_time () - start;
+
+			return 1;
+		}
+
+		g_usleep ( PSI_LOCK_POLL );
+	}
+
+	return 0;
+}
+
+static PsiFilter * psi_filter_open ( struct dvb_device *dvb, const char *demux_dev, int epfd, uint8_t kind, uint16_t pid, uint8_t tid, uint8_t tid_mask, int ext,
+	void **table, gint64 timeout, PsiStats *stats )
+{
+	struct dvb_open_descriptor *fd = dvb_dev_open ( dvb, demux_dev, O_RDWR | O_NONBLOCK );
+
+	if ( !fd ) { g_critical ( "%s:: pid 0x%04x: failed opening %s", __func__, pid, demux_dev ); return NULL; }
+
+	// Linux section filters skip the two section_length bytes: filter[1..2] is table_id_extension
+	uint8_t filter[DMX_FILTER_SIZE] = { tid }, mask[DMX_FILTER_SIZE] = { tid_mask }, mode[DMX_FILTER_SIZE] = { 0 };
+	unsigned filtsize = 1;
+
+	if ( ext >= 0 )
+	{
+		filter[1] = (uint8_t)( ext >> 8 ); mask[1] = 0xff;
+		filter[2] = (uint8_t)( ext & 0xff ); mask[2] = 0xff;
+		filtsize = 3;
+	}
+
+	if ( dvb_dev_dmx_set_section_filter ( fd, pid, filtsize, filter, mask, mode, DMX_IMMEDIATE_START | DMX_CHECK_CRC ) < 0 )
+	{
+		g_critical ( "%s:: pid 0x%04x: set section filter failed.", __func__, pid );
+		dvb_dev_close ( fd );
+		return NULL;
+	}
+
+	PsiFilter *flt = g_new0 ( PsiFilter, 1 );
+
+	flt->fd = fd;
+	flt->kind = kind;
+	flt->pid = pid;
+	flt->ext = -1;
+	flt->table = table;
+	flt->stats = stats;
+	flt->start = g_get_monotonic_time ();
+	flt->deadline = flt->start + timeout;
+
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLPRI, .data.ptr = flt };
+
+	if ( epoll_ctl ( epfd, EPOLL_CTL_ADD, dvb_dev_get_fd ( fd ), &ev ) == -1 )
+	{
+		g_critical ( "%s:: pid 0x%04x: epoll_ctl failed: %m", __func__, pid );
+		dvb_dev_close ( fd );
+		free ( flt );
+		return NULL;
+	}
+
+	return flt;
+}
+
+static void psi_filter_done ( PsiFilter *flt, int epfd, gint64 stats_start, uint8_t complete )
+{
+	if ( flt->done ) return;
+
+	PsiStats *st = flt->stats;
+
+	if ( complete )
+	{
+		gint64 elapsed = g_get_monotonic_time () - stats_start;
+
+		if ( st->table[flt->kind] >= 0 && elapsed > st->table[flt->kind] ) st->table[flt->kind] = elapsed;
+		if ( flt->kind == PSI_PMT ) st->pmt_done++;
+	}
+	else
+		st->table[flt->kind] = -1;
+
+	epoll_ctl ( epfd, EPOLL_CTL_DEL, dvb_dev_get_fd ( flt->fd ), NULL );
+	dvb_dev_close ( flt->fd );
+
+	flt->fd = NULL;
+	flt->done = 1;
+}
+
+static ssize_t psi_table_init ( struct dvb_v5_fe_parms *parms, PsiFilter *flt, const uint8_t *buf, ssize_t len )
+{
+	switch ( flt->kind )
+	{
+		case PSI_PAT: return dvb_table_pat_init ( parms, buf, len, (struct dvb_table_pat **)flt->table );
+		case PSI_PMT: return dvb_table_pmt_init ( parms, buf, len, (struct dvb_table_pmt **)flt->table );
+		case PSI_SDT: return dvb_table_sdt_init ( parms, buf, len, (struct dvb_table_sdt **)flt->table );
+		case PSI_NIT: return dvb_table_nit_init ( parms, buf, len, (struct dvb_table_nit **)flt->table );
+		case PSI_VCT: return atsc_table_vct_init ( parms, buf, len, (struct atsc_table_vct **)flt->table );
+		default: break;
+	}
+
+	return -1;
+}
+
+/* Returns 1 once every section 0..last_section of the table has been seen */
+static uint8_t psi_filter_section ( struct dvb_v5_fe_parms *parms, PsiFilter *flt, const uint8_t *buf, ssize_t len )
+{
+	if ( len < 8 ) return 0;
+
+	int ext = ( buf[3] << 8 ) | buf[4];
+	uint8_t current_next = buf[5] & 0x01, number = buf[6], last = buf[7];
+
+	if ( !current_next ) return 0;
+
+	if ( flt->ext == -1 ) { flt->ext = ext; flt->last_section = last; }
+
+	if ( ext != flt->ext ) return 0; // another transport stream ( SDT/NIT other )
+	if ( flt->sections[number / 8] & ( 1 << ( number % 8 ) ) ) return 0;
+
+	if ( psi_table_init ( parms, flt, buf, len ) < 0 ) return 0;
+
+	flt->sections[number / 8] |= (uint8_t)( 1 << ( number % 8 ) );
+	flt->stats->sections[flt->kind]++;
+
+	uint16_t n = 0; for ( n = 0; n <= flt->last_section; n++ )
+		if ( !( flt->sections[n / 8] & ( 1 << ( n % 8 ) ) ) ) return 0;
+
+	return 1;
+}
+
+static void psi_pmt_filters_open ( struct dvb_device *dvb, const char *demux_dev, int epfd, struct dvb_v5_descriptors *handler, GPtrArray *filters, gint64 timeout,
+	PsiStats *stats )
+{
+	uint32_t num = 0;
+	dvb_pat_program_foreach ( program, handler->pat ) num++;
+
+	handler->program = calloc ( num, sizeof ( *handler->program ) );
+
+	if ( !handler->program ) return;
+
+	num = 0;
+	dvb_pat_program_foreach ( program, handler->pat )
+	{
+		handler->program[num].pat_pgm = program;
+
+		if ( program->service_id )
+		{
+			PsiFilter *flt = psi_filter_open ( dvb, demux_dev, epfd, PSI_PMT, program->pid, DVB_TABLE_PMT, 0xff, program->service_id,
+				(void **)&handler->program[num].pmt, timeout, stats );
+
+			if ( flt ) g_ptr_array_add ( filters, flt );
+
+			stats->pmt_total++;
+		}
+
+		num++;
+	}
+
+	handler->num_program = num;
+}
+
+static void psi_filter_free ( PsiFilter *flt )
+{
+	if ( flt->fd ) dvb_dev_close ( flt->fd );
+
+	free ( flt );
+}
+
+/*
+* One section filter per table ( PAT, SDT | VCT, NIT ) and one per PMT once PAT is known,
+* all read through a single epoll loop: dwell time is bounded by the slowest table.
+*/
+struct dvb_v5_descriptors * psi_scan_transponder ( struct dvb_device *dvb, const char *demux_dev, uint8_t other_nit, uint8_t time_mult, PsiStats *stats )
+{
+	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
+
+	PsiStats st_local = { .lock = -1 };
+	PsiStats *st = ( stats ) ? stats : &st_local;
+
+	gint64 lock = st->lock;
+	memset ( st, 0, sizeof ( PsiStats ) );
+	st->lock = lock;
+
+	gint64 start = g_get_monotonic_time ();
+
+	gint64 mult = ( time_mult ) ? time_mult : 1;
+	gint64 pat_pmt_time = 1 * G_USEC_PER_SEC, sdt_time = 2 * G_USEC_PER_SEC, nit_time = 10 * G_USEC_PER_SEC;
+
+	uint8_t atsc = ( parms->current_sys == SYS_ATSC || parms->current_sys == SYS_DVBC_ANNEX_B );
+	if ( atsc ) pat_pmt_time = 2 * G_USEC_PER_SEC;
+
+	int epfd = epoll_create1 ( EPOLL_CLOEXEC );
+
+	if ( epfd == -1 ) { g_critical ( "%s:: epoll_create1 failed: %m", __func__ ); return NULL; }
+
+	struct dvb_v5_descriptors *handler = dvb_scan_alloc_handler_table ( parms->current_sys );
+
+	if ( !handler ) { close ( epfd ); return NULL; }
+
+	GPtrArray *filters = g_ptr_array_new_with_free_func ( (GDestroyNotify)psi_filter_free );
+
+	PsiFilter *pat = psi_filter_open ( dvb, demux_dev, epfd, PSI_PAT, DVB_TABLE_PAT_PID, DVB_TABLE_PAT, 0xff, -1, (void **)&handler->pat, pat_pmt_time * mult, st );
+	PsiFilter *flt = NULL;
+
+	if ( pat ) g_ptr_array_add ( filters, pat );
+
+	if ( atsc )
+	{
+		// TVCT 0xc8 / CVCT 0xc9
+		flt = psi_filter_open ( dvb, demux_dev, epfd, PSI_VCT, ATSC_BASE_PID, ATSC_TABLE_TVCT, 0xfe, -1, (void **)&handler->vct, sdt_time * mult, st );
+		if ( flt ) g_ptr_array_add ( filters, flt );
+	}
+	else
+	{
+		flt = psi_filter_open ( dvb, demux_dev, epfd, PSI_SDT, DVB_TABLE_SDT_PID, DVB_TABLE_SDT, 0xff, -1, (void **)&handler->sdt, sdt_time * mult, st );
+		if ( flt ) g_ptr_array_add ( filters, flt );
+
+		flt = psi_filter_open ( dvb, demux_dev, epfd, PSI_NIT, DVB_TABLE_NIT_PID, ( other_nit ) ? DVB_TABLE_NIT2 : DVB_TABLE_NIT, 0xff, -1,
+			(void **)&handler->nit, nit_time * mult, st );
+		if ( flt ) g_ptr_array_add ( filters, flt );
+	}
+
+	if ( !pat )
+	{
+		g_ptr_array_free ( filters, TRUE );
+		dvb_scan_free_handler_table ( handler );
+		close ( epfd );
+		return NULL;
+	}
+
+	uint8_t buf[PSI_SECT_SIZE];
+	struct epoll_event events[16];
+
+	while ( !parms->abort )
+	{
+		gint64 now = g_get_monotonic_time (), next = G_MAXINT64;
+		uint32_t i = 0, active = 0;
+
+		for ( i = 0; i < filters->len; i++ )
+		{
+			flt = g_ptr_array_index ( filters, i );
+
+			if ( flt->done ) continue;
+
+			if ( now >= flt->deadline )
+			{
+				g_debug ( "%s:: pid 0x%04x: table timeout.", __func__, flt->pid );
+				psi_filter_done ( flt, epfd, start, 0 );
+				continue;
+			}
+
+			active++;
+			if ( flt->deadline < next ) next = flt->deadline;
+		}
+
+		if ( !active ) break;
+
+		int timeout = (int)( ( next - now ) / 1000 ) + 1;
+		if ( timeout > 100 ) timeout = 100; // re-check abort
+
+		int n = epoll_wait ( epfd, events, G_N_ELEMENTS ( events ), timeout );
+
+		if ( n == -1 )
+		{
+			if ( errno == EINTR ) continue;
+
+			g_critical ( "%s:: epoll_wait failed: %m", __func__ );
+			break;
+		}
+
+		int e = 0; for ( e = 0; e < n; e++ )
+		{
+			flt = events[e].data.ptr;
+
+			if ( flt->done ) continue;
+
+			ssize_t len = read ( dvb_dev_get_fd ( flt->fd ), buf, sizeof ( buf ) );
+
+			if ( len <= 0 ) continue; // EAGAIN, EOVERFLOW, ETIMEDOUT
+
+			if ( !psi_filter_section ( parms, flt, buf, len ) ) continue;
+
+			psi_filter_done ( flt, epfd, start, 1 );
+
+			if ( flt == pat && handler->pat ) psi_pmt_filters_open ( dvb, demux_dev, epfd, handler, filters, pat_pmt_time * mult, st );
+		}
+	}
+
+	g_ptr_array_free ( filters, TRUE );
+	close ( epfd );
+
+	st->dwell = g_get_monotonic_time () - start;
+
+	if ( !handler->pat || parms->abort )
+	{
+		dvb_scan_free_handler_table ( handler );
+		return NULL;
+	}
+
+	return handler;
+}
@@ -0,0 +1,56 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-dev.h>
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/dvb-file.h>
+
+#include <glib.h>
+
+enum psi_kind
+{
+	PSI_PAT,
+	PSI_PMT,
+	PSI_SDT,
+	PSI_NIT,
+	PSI_VCT,
+	PSI_ALL
+};
+
+typedef struct _PsiStats PsiStats;
+
+struct _PsiStats
+{
+	gint64 lock;  // µs from dvb_fe_set_parms to FE_HAS_LOCK, -1 no lock
+	gint64 dwell; // µs spent reading tables
+	gint64 table[PSI_ALL]; // µs to complete table ( PMT - the slowest one ), 0 not read, -1 timeout
+
+	uint32_t sections[PSI_ALL];
+	uint32_t pmt_total, pmt_done;
+};
+
+typedef struct _PsiTp PsiTp;
+
+struct _PsiTp
+{
+	uint32_t freq, pol, stream_id, sys;
+	int sat_number;
+};
+
+void psi_entry_tp ( struct dvb_entry *, PsiTp * );
+
+uint8_t psi_store_tp ( struct dvb_v5_fe_parms *, struct dvb_entry *, PsiTp * );
+
+void psi_store_entry ( struct dvb_v5_fe_parms *, struct dvb_entry * );
+
+uint8_t psi_tune_entry ( struct dvb_v5_fe_parms *, struct dvb_entry *, uint8_t, PsiStats * );
+
+struct dvb_v5_descriptors * psi_scan_transponder ( struct dvb_device *, const char *, uint8_t, uint8_t, PsiStats * );
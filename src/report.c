@@ -0,0 +1,87 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "report.h"
+
+static gint64 report_ms ( gint64 usec )
+{
+	return ( usec > 0 ) ? usec / 1000 : usec;
+}
+
+/* JSON, not C escapes: UTF-8 as is, a path in another charset made valid first */
+static void report_json_str ( GString *json, const char *name, const char *str )
+{
+	g_autofree char *utf = g_utf8_make_valid ( ( str ) ? str : "", -1 );
+
+	g_string_append_printf ( json, "\"%s\": \"", name );
+
+	const char *p = NULL; for ( p = utf; *p; p++ )
+	{
+		if ( *p == '"' || *p == '\\' ) { g_string_append_c ( json, '\\' ); g_string_append_c ( json, *p ); }
+		else if ( (uint8_t)*p < 0x20 ) g_string_append_printf ( json, "\\u%04x", (uint8_t)*p );
+		else g_string_append_c ( json, *p );
+	}
+
+	g_string_append_c ( json, '"' );
+}
+
+static void report_json_record ( GString *json, ScanRecord *rec )
+{
+	const char *tables[PSI_ALL] = { "pat", "pmt", "sdt", "nit", "vct" };
+
+	g_string_append_printf ( json, "\t\t{ \"frequency\": %u, \"polarization\": %u, \"stream_id\": %u, \"locked\": %s, ",
+		rec->freq, rec->pol, rec->stream_id, ( rec->locked ) ? "true" : "false" );
+
+	g_string_append_printf ( json, "\"lock_ms\": %" G_GINT64_FORMAT ", \"dwell_ms\": %" G_GINT64_FORMAT ", \"signal\": %u, \"cnr\": %u, \"services\": %u,\n",
+		report_ms ( rec->stats.lock ), report_ms ( rec->stats.dwell ), rec->sgl_p, rec->snr_p, rec->services );
+
+	// time to table in ms: 0 - not read, -1 - timeout
+	g_string_append ( json, "\t\t  \"tables_ms\": { " );
+
+	uint8_t t = 0; for ( t = 0; t < PSI_ALL; t++ )
+		g_string_append_printf ( json, "%s\"%s\": %" G_GINT64_FORMAT, ( t ) ? ", " : "", tables[t], report_ms ( rec->stats.table[t] ) );
+
+	g_string_append ( json, " },\n\t\t  \"sections\": { " );
+
+	for ( t = 0; t < PSI_ALL; t++ )
+		g_string_append_printf ( json, "%s\"%s\": %u", ( t ) ? ", " : "", tables[t], rec->stats.sections[t] );
+
+	g_string_append_printf ( json, " }, \"pmt_done\": %u, \"pmt_total\": %u }", rec->stats.pmt_done, rec->stats.pmt_total );
+}
+
+/* Machine-readable per-transponder scan report ( JSON ) */
+gboolean report_scan_write ( const char *file, GArray *records, const char *input_file, const char *output_file, uint8_t time_mult )
+{
+	GString *json = g_string_new ( "{\n\t" );
+
+	report_json_str ( json, "version", VERSION );
+	g_string_append ( json, ",\n\t" );
+	report_json_str ( json, "input", input_file );
+	g_string_append ( json, ",\n\t" );
+	report_json_str ( json, "output", output_file );
+	g_string_append_printf ( json, ",\n\t\"time_mult\": %u,\n\t\"transponders\":\n\t[\n", time_mult );
+
+	uint32_t i = 0; for ( i = 0; i < records->len; i++ )
+	{
+		report_json_record ( json, &g_array_index ( records, ScanRecord, i ) );
+
+		g_string_append ( json, ( i + 1 < records->len ) ? ",\n" : "\n" );
+	}
+
+	g_string_append ( json, "\t]\n}\n" );
+
+	GError *error = NULL;
+	gboolean ret = g_file_set_contents ( file, json->str, (gssize)json->len, &error );
+
+	if ( error ) { g_warning ( "%s:: %s ", __func__, error->message ); g_error_free ( error ); }
+
+	g_string_free ( json, TRUE );
+
+	return ret;
+}
@@ -0,0 +1,25 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "psi.h"
+
+typedef struct _ScanRecord ScanRecord;
+
+struct _ScanRecord
+{
+	uint32_t freq, pol, stream_id;
+	uint8_t locked, sgl_p, snr_p;
+	uint32_t services;
+
+	PsiStats stats;
+};
+
+gboolean report_scan_write ( const char *, GArray *, const char *, const char *, uint8_t );
@@ -0,0 +1,446 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "sched.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include <sys/timerfd.h>
+
+#define SCHED_EPG_POLL 60 // s, the EPG times of waiting events are re-read at least this often
+
+/*
+* Timed and EPG-event recordings over a set of tuners. No device is touched here: the clock
+* and the frontends are SchedOps, the timerfd only wakes the main loop up.
+*/
+struct _Sched
+{
+	SchedOps ops;
+	gpointer data;
+
+	SchedTuner *tuners;
+	uint8_t n_tuners;
+
+	GArray *recs; // SchedRec
+	uint32_t last_id, conflicts;
+
+	EpgStore *epg; // not owned
+
+	int tfd; // CLOCK_REALTIME, absolute
+	guint tfd_src;
+};
+
+static int64_t sched_from ( const SchedRec *r )
+{
+	return r->start - r->pre;
+}
+
+static int64_t sched_to ( const SchedRec *r )
+{
+	return r->stop + r->post;
+}
+
+static gboolean sched_overlap ( const SchedRec *a, const SchedRec *b )
+{
+	return ( sched_from ( a ) < sched_to ( b ) && sched_from ( b ) < sched_to ( a ) );
+}
+
+static gboolean sched_tp_equal ( const PsiTp *a, const PsiTp *b )
+{
+	return ( a->freq && memcmp ( a, b, sizeof ( PsiTp ) ) == 0 );
+}
+
+static void sched_rec_clear ( SchedRec *r )
+{
+	free ( r->channel );
+	free ( r->file );
+	free ( r->out );
+}
+
+/* Waiting events move with the EPG; a running one only gets longer or shorter */
+static void sched_follow_epg ( Sched *s )
+{
+	if ( !s->epg ) return;
+
+	epg_store_lock ( s->epg );
+
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( !r->event_id || ( r->state != SCHED_WAIT && r->state != SCHED_RUN ) ) continue;
+
+		int64_t pos = epg_store_find ( s->epg, &r->svc );
+
+		if ( pos < 0 ) continue;
+
+		uint32_t n = 0;
+		const EpgEvent *ev = epg_store_events ( s->epg, (uint32_t)pos, NULL, &n );
+
+		uint32_t e = 0; for ( e = 0; e < n && ev[e].event_id != r->event_id; e++ );
+
+		if ( e == n ) continue;
+
+		if ( r->state == SCHED_WAIT ) r->start = ev[e].start;
+
+		r->stop = (int64_t)ev[e].start + ev[e].duration;
+	}
+
+	epg_store_unlock ( s->epg );
+}
+
+static int sched_rec_cmp ( gconstpointer a, gconstpointer b )
+{
+	int64_t fa = sched_from ( *(const SchedRec * const *)a ), fb = sched_from ( *(const SchedRec * const *)b );
+
+	return ( fa > fb ) - ( fa < fb );
+}
+
+/*
+* Earliest first, each waiting recording goes to a tuner already on its transponder over the
+* same time ( merge ), else to one free over its padded span; none left - a conflict, known
+* as soon as the recording is added. Running recordings keep their tuners.
+*/
+static void sched_plan ( Sched *s )
+{
+	sched_follow_epg ( s );
+
+	GPtrArray *wait = g_ptr_array_new ();
+	g_autofree int *prev = g_new0 ( int, s->recs->len + 1 );
+
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		prev[i] = r->tuner;
+
+		if ( r->state != SCHED_WAIT ) continue;
+
+		r->tuner = -1;
+		g_ptr_array_add ( wait, r );
+	}
+
+	g_ptr_array_sort ( wait, sched_rec_cmp );
+
+	uint32_t conflicts = 0;
+
+	for ( i = 0; i < wait->len; i++ )
+	{
+		SchedRec *r = g_ptr_array_index ( wait, i );
+
+		int merge = -1, idle = -1;
+
+		uint8_t t = 0; for ( t = 0; t < s->n_tuners; t++ )
+		{
+			if ( s->tuners[t].busy ) continue;
+
+			gboolean share = FALSE, clash = FALSE;
+
+			uint32_t j = 0; for ( j = 0; j < s->recs->len; j++ )
+			{
+				const SchedRec *q = &g_array_index ( s->recs, SchedRec, j );
+
+				// not yet planned ones have tuner -1
+				if ( q == r || q->tuner != t || ( q->state != SCHED_WAIT && q->state != SCHED_RUN ) || !sched_overlap ( r, q ) ) continue;
+
+				if ( sched_tp_equal ( &r->tp, &q->tp ) ) share = TRUE; else clash = TRUE;
+			}
+
+			if ( clash ) continue;
+
+			if ( share && merge == -1 ) merge = t;
+			if ( !share && idle == -1 ) idle = t;
+		}
+
+		r->tuner = ( merge != -1 ) ? merge : idle;
+
+		if ( r->tuner == -1 ) conflicts++;
+	}
+
+	gboolean changed = ( conflicts != s->conflicts );
+
+	for ( i = 0; i < s->recs->len; i++ )
+	{
+		const SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( r->tuner == prev[i] ) continue;
+
+		changed = TRUE;
+
+		if ( r->tuner == -1 )
+			g_warning ( "%s:: conflict: %s ( %u ) - no free tuner ", __func__, r->channel, r->id );
+		else
+			g_message ( "%s:: %s ( %u ) -> adapter%u/frontend%u ", __func__, r->channel, r->id, s->tuners[r->tuner].adapter, s->tuners[r->tuner].frontend );
+	}
+
+	s->conflicts = conflicts;
+
+	g_ptr_array_free ( wait, TRUE );
+
+	if ( changed && s->ops.plan ) s->ops.plan ( s->data, conflicts );
+}
+
+/* -1 - nothing to wait for */
+int64_t sched_next ( Sched *s )
+{
+	int64_t next = -1;
+	gboolean epg = FALSE;
+
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		const SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		int64_t t = ( r->state == SCHED_WAIT ) ? sched_from ( r ) : ( r->state == SCHED_RUN ) ? sched_to ( r ) : -1;
+
+		if ( t == -1 ) continue;
+
+		if ( next == -1 || t < next ) next = t;
+
+		if ( r->event_id ) epg = TRUE;
+	}
+
+	if ( epg && s->epg )
+	{
+		int64_t poll = s->ops.now ( s->data ) + SCHED_EPG_POLL;
+
+		if ( poll < next ) next = poll;
+	}
+
+	return next;
+}
+
+static void sched_arm ( Sched *s )
+{
+	if ( s->tfd == -1 ) return;
+
+	struct itimerspec its;
+	memset ( &its, 0, sizeof ( its ) );
+
+	int64_t next = sched_next ( s );
+
+	// zero disarms, a time already past fires at once
+	its.it_value.tv_sec = ( next == -1 ) ? 0 : MAX ( next, 1 );
+
+	if ( timerfd_settime ( s->tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL ) == -1 ) g_warning ( "%s:: %m ", __func__ );
+}
+
+/* Everything due at ops.now: stops first, a tuner freed this second takes the next recording */
+void sched_tick ( Sched *s )
+{
+	int64_t now = s->ops.now ( s->data );
+
+	sched_plan ( s );
+
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( r->state != SCHED_RUN || now < sched_to ( r ) ) continue;
+
+		s->ops.stop ( s->data, &s->tuners[r->tuner], r );
+		r->state = SCHED_DONE;
+
+		g_message ( "%s:: done: %s ( %u ) ", __func__, r->channel, r->id );
+	}
+
+	for ( i = 0; i < s->recs->len; i++ )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( r->state != SCHED_WAIT || now < sched_from ( r ) ) continue;
+
+		if ( now >= sched_to ( r ) || r->tuner == -1 )
+		{
+			r->state = SCHED_FAIL;
+			g_warning ( "%s:: missed: %s ( %u ) ", __func__, r->channel, r->id );
+
+			continue;
+		}
+
+		r->state = ( s->ops.start ( s->data, &s->tuners[r->tuner], r ) ) ? SCHED_RUN : SCHED_FAIL;
+
+		if ( r->state == SCHED_RUN )
+			g_message ( "%s:: start: %s ( %u ) -> %s ", __func__, r->channel, r->id, r->out );
+		else
+			g_warning ( "%s:: start failed: %s ( %u ) ", __func__, r->channel, r->id );
+	}
+
+	for ( i = s->recs->len; i > 0; i-- )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i - 1 );
+
+		if ( ( r->state == SCHED_DONE || r->state == SCHED_FAIL ) && now > sched_to ( r ) + SCHED_KEEP )
+		{
+			sched_rec_clear ( r );
+			g_array_remove_index ( s->recs, i - 1 );
+		}
+	}
+
+	sched_arm ( s );
+}
+
+static gboolean sched_timer ( int fd, G_GNUC_UNUSED GIOCondition cond, Sched *s )
+{
+	uint64_t exp = 0;
+
+	// ECANCELED: the wall clock was set, the next tick re-arms on the new time
+	if ( read ( fd, &exp, sizeof ( exp ) ) == -1 && errno != ECANCELED && errno != EAGAIN ) g_warning ( "%s:: %m ", __func__ );
+
+	sched_tick ( s );
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Returns the id, 0 - not added; the strings are copied */
+uint32_t sched_add ( Sched *s, const SchedRec *rec )
+{
+	if ( !rec->channel || !rec->file || !rec->out || !rec->tp.freq || rec->stop <= rec->start ) return 0;
+
+	SchedRec r = *rec;
+
+	r.id = ++s->last_id;
+	r.channel = g_strdup ( rec->channel );
+	r.file = g_strdup ( rec->file );
+	r.out = g_strdup ( rec->out );
+	r.state = SCHED_WAIT;
+	r.tuner = -1;
+
+	g_array_append_val ( s->recs, r );
+
+	sched_tick ( s );
+
+	return r.id;
+}
+
+gboolean sched_remove ( Sched *s, uint32_t id )
+{
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( r->id != id ) continue;
+
+		if ( r->state == SCHED_RUN ) s->ops.stop ( s->data, &s->tuners[r->tuner], r );
+
+		sched_rec_clear ( r );
+		g_array_remove_index ( s->recs, i );
+
+		sched_tick ( s );
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Every frontend of the adapter: they usually share the tuner */
+void sched_set_busy ( Sched *s, uint8_t adapter, gboolean busy )
+{
+	if ( !s ) return;
+
+	gboolean changed = FALSE;
+
+	uint8_t t = 0; for ( t = 0; t < s->n_tuners; t++ )
+	{
+		if ( s->tuners[t].adapter != adapter || s->tuners[t].busy == busy ) continue;
+
+		s->tuners[t].busy = busy;
+		changed = TRUE;
+	}
+
+	if ( changed ) sched_tick ( s );
+}
+
+/* A recording runs on a frontend of the adapter */
+gboolean sched_adapter_used ( Sched *s, uint8_t adapter )
+{
+	if ( !s ) return FALSE;
+
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		const SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( r->state == SCHED_RUN && s->tuners[r->tuner].adapter == adapter ) return TRUE;
+	}
+
+	return FALSE;
+}
+
+void sched_set_epg ( Sched *s, EpgStore *store )
+{
+	s->epg = store;
+}
+
+/* Valid until the next call into the scheduler */
+const SchedRec * sched_list ( Sched *s, uint32_t *n )
+{
+	*n = s->recs->len;
+
+	return (const SchedRec *)s->recs->data;
+}
+
+uint32_t sched_conflicts ( Sched *s )
+{
+	return s->conflicts;
+}
+
+/* timer - wake up on a timerfd in the main loop; FALSE - the caller drives sched_tick */
+Sched * sched_new ( const SchedOps *ops, gpointer data, const SchedTuner *tuners, uint8_t n_tuners, gboolean timer )
+{
+	Sched *s = g_new0 ( Sched, 1 );
+
+	s->ops = *ops;
+	s->data = data;
+
+	s->tuners = g_new0 ( SchedTuner, n_tuners + 1 );
+	s->n_tuners = n_tuners;
+	memcpy ( s->tuners, tuners, n_tuners * sizeof ( SchedTuner ) );
+
+	s->recs = g_array_new ( FALSE, TRUE, sizeof ( SchedRec ) );
+	s->tfd = -1;
+
+	if ( timer )
+	{
+		s->tfd = timerfd_create ( CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC );
+
+		if ( s->tfd == -1 )
+			g_warning ( "%s:: timerfd: %m ", __func__ );
+		else
+			s->tfd_src = g_unix_fd_add ( s->tfd, G_IO_IN, (GUnixFDSourceFunc)sched_timer, s );
+	}
+
+	g_message ( "%s:: tuners: %u ", __func__, n_tuners );
+
+	return s;
+}
+
+/* Running recordings are stopped */
+void sched_free ( Sched *s )
+{
+	if ( !s ) return;
+
+	if ( s->tfd_src ) g_source_remove ( s->tfd_src );
+	if ( s->tfd != -1 ) close ( s->tfd );
+
+	uint32_t i = 0; for ( i = 0; i < s->recs->len; i++ )
+	{
+		SchedRec *r = &g_array_index ( s->recs, SchedRec, i );
+
+		if ( r->state == SCHED_RUN ) s->ops.stop ( s->data, &s->tuners[r->tuner], r );
+
+		sched_rec_clear ( r );
+	}
+
+	g_array_free ( s->recs, TRUE );
+
+	free ( s->tuners );
+	free ( s );
+}
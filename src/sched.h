@@ -0,0 +1,83 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "psi.h"
+#include "epg.h"
+
+#define SCHED_PRE  ( 2 * 60 ) // s, default padding
+#define SCHED_POST ( 5 * 60 )
+#define SCHED_KEEP ( 24 * 3600 ) // s, finished entries stay listed
+
+enum sched_state { SCHED_WAIT, SCHED_RUN, SCHED_DONE, SCHED_FAIL };
+
+typedef struct _SchedTuner SchedTuner;
+
+struct _SchedTuner
+{
+	uint8_t adapter, frontend;
+	gboolean busy; // in use outside the scheduler ( zap, scan )
+};
+
+typedef struct _SchedRec SchedRec;
+
+struct _SchedRec
+{
+	uint32_t id;
+	char *channel, *file, *out; // channel, channel file, output .ts
+
+	PsiTp tp;      // recordings on one transponder share a tuner
+	int64_t start, stop; // unix s, without the padding
+	uint32_t pre, post;  // s
+
+	EpgService svc;    // event_id != 0: the times follow the EPG
+	uint16_t event_id;
+
+	uint8_t state; // enum sched_state
+	int tuner;     // planned; -1 - conflict
+};
+
+/*
+* Everything the scheduler touches outside itself: the clock and the frontends.
+* The real set is scheddvb.c; a test passes a fake clock and fake tuners and calls sched_tick.
+*/
+typedef struct _SchedOps SchedOps;
+
+struct _SchedOps
+{
+	int64_t  ( *now   ) ( gpointer ); // unix s
+	gboolean ( *start ) ( gpointer, const SchedTuner *, const SchedRec * ); // tune if not on rec->tp yet, record the service
+	void     ( *stop  ) ( gpointer, const SchedTuner *, const SchedRec * ); // the tuner is released with its last recording
+	void     ( *plan  ) ( gpointer, uint32_t ); // optional: the plan changed, conflicts
+};
+
+typedef struct _Sched Sched;
+
+Sched * sched_new ( const SchedOps *, gpointer, const SchedTuner *, uint8_t, gboolean );
+
+void sched_free ( Sched * );
+
+void sched_set_epg ( Sched *, EpgStore * );
+
+void sched_set_busy ( Sched *, uint8_t, gboolean );
+
+gboolean sched_adapter_used ( Sched *, uint8_t );
+
+uint32_t sched_add ( Sched *, const SchedRec * );
+
+gboolean sched_remove ( Sched *, uint32_t );
+
+void sched_tick ( Sched * );
+
+int64_t sched_next ( Sched * );
+
+const SchedRec * sched_list ( Sched *, uint32_t * );
+
+uint32_t sched_conflicts ( Sched * );
@@ -0,0 +1,254 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "scheddvb.h"
+#include "pretune.h"
+#include "chdb.h"
+#include "file.h"
+#include "svc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SCHED_DVB_BUF ( 1024 * 1024 ) // demux buffer: nobody watches a scheduled recording
+
+typedef struct _SchedDvbTuner SchedDvbTuner;
+
+struct _SchedDvbTuner
+{
+	PreTuneSlot slot; // dev NULL - closed
+	uint32_t users;
+};
+
+typedef struct _SchedDvbJob SchedDvbJob;
+
+struct _SchedDvbJob
+{
+	uint32_t id;
+	SchedDvbTuner *tuner;
+
+	struct dvb_open_descriptor *fd;
+	DwrRecMonitor dm;
+	GThread *thread;
+};
+
+/*
+* The frontends of the scheduler: one tuner tuned per transponder, every recording on it gets
+* its own demux filter with DMX_OUT_TSDEMUX_TAP - several services of one transponder, one file each.
+*/
+struct _SchedDvb
+{
+	GPtrArray *tuners; // SchedDvbTuner
+	GPtrArray *jobs;   // SchedDvbJob
+};
+
+/* One per adapter: its frontends usually share the tuner */
+SchedTuner * sched_dvb_tuners ( uint8_t *n )
+{
+	GArray *tuners = g_array_new ( FALSE, TRUE, sizeof ( SchedTuner ) );
+
+	struct dvb_device *dvb = dvb_dev_alloc ();
+
+	if ( dvb )
+	{
+		dvb_dev_set_log ( dvb, 0, NULL );
+		dvb_dev_find ( dvb, NULL, NULL );
+
+		int i = 0; for ( i = 0; i < dvb->num_devices && tuners->len < UINT8_MAX; i++ )
+		{
+			struct dvb_dev_list *dev = &dvb->devices[i];
+
+			uint a = 0, f = 0;
+
+			if ( dev->dvb_type != DVB_DEVICE_FRONTEND || sscanf ( dev->sysname, "dvb%u.frontend%u", &a, &f ) != 2 ) continue;
+
+			gboolean dup = FALSE;
+			uint32_t t = 0; for ( t = 0; t < tuners->len; t++ ) if ( g_array_index ( tuners, SchedTuner, t ).adapter == a ) dup = TRUE;
+
+			if ( dup ) continue;
+
+			SchedTuner tuner = { (uint8_t)a, (uint8_t)f, FALSE };
+			g_array_append_val ( tuners, tuner );
+		}
+
+		dvb_dev_free ( dvb );
+	}
+
+	*n = (uint8_t)tuners->len;
+
+	return (SchedTuner *)g_array_free ( tuners, FALSE );
+}
+
+static SchedDvbTuner * sched_dvb_tuner ( SchedDvb *sd, const SchedTuner *t )
+{
+	uint32_t i = 0; for ( i = 0; i < sd->tuners->len; i++ )
+	{
+		SchedDvbTuner *st = g_ptr_array_index ( sd->tuners, i );
+
+		if ( st->slot.adapter == t->adapter && st->slot.frontend == t->frontend ) return st;
+	}
+
+	SchedDvbTuner *st = g_new0 ( SchedDvbTuner, 1 );
+
+	st->slot.adapter  = t->adapter;
+	st->slot.frontend = t->frontend;
+
+	g_ptr_array_add ( sd->tuners, st );
+
+	return st;
+}
+
+static void sched_dvb_release ( SchedDvbTuner *st )
+{
+	if ( st->users || !st->slot.dev ) return;
+
+	g_message ( "%s:: adapter%u/frontend%u ", __func__, st->slot.adapter, st->slot.frontend );
+
+	uint8_t a = st->slot.adapter, f = st->slot.frontend;
+
+	dvb_dev_free ( st->slot.dev );
+
+	memset ( &st->slot, 0, sizeof ( PreTuneSlot ) );
+	st->slot.adapter  = a;
+	st->slot.frontend = f;
+}
+
+int64_t sched_dvb_now ( G_GNUC_UNUSED SchedDvb *sd )
+{
+	return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+/* On the transponder, one more demux filter and writer thread */
+static gboolean sched_dvb_record ( SchedDvb *sd, SchedDvbTuner *st, struct dvb_entry *entry, const SchedRec *rec )
+{
+	if ( memcmp ( &st->slot.tp, &rec->tp, sizeof ( PsiTp ) ) != 0 )
+	{
+		// the plan merges one transponder per tuner only
+		if ( st->users ) { g_warning ( "%s:: adapter%u: on another transponder ", __func__, st->slot.adapter ); return FALSE; }
+
+		if ( !psi_store_tp ( st->slot.dev->fe_parms, entry, &st->slot.tp ) || dvb_fe_set_parms ( st->slot.dev->fe_parms ) != 0 )
+		{
+			memset ( &st->slot.tp, 0, sizeof ( PsiTp ) );
+
+			g_warning ( "%s:: adapter%u: tune failed ", __func__, st->slot.adapter );
+			return FALSE;
+		}
+	}
+
+	SvcPids sp;
+	svc_pids_from_entry ( entry, TRUE, &sp );
+
+	struct dvb_open_descriptor *fd = svc_filter_open ( st->slot.dev, st->slot.demux_dev, &sp, DMX_OUT_TSDEMUX_TAP, SCHED_DVB_BUF );
+
+	if ( !fd ) return FALSE;
+
+	SchedDvbJob *job = g_new0 ( SchedDvbJob, 1 );
+
+	const char *err = dvr_rec_create_fd ( dup ( dvb_dev_get_fd ( fd ) ), st->slot.adapter, rec->out, &job->dm, &job->thread );
+
+	if ( err )
+	{
+		g_warning ( "%s:: %s: %s ", __func__, rec->out, err );
+
+		dvb_dev_close ( fd );
+		free ( job );
+
+		return FALSE;
+	}
+
+	job->id = rec->id;
+	job->tuner = st;
+	job->fd = fd;
+
+	st->users++;
+	g_ptr_array_add ( sd->jobs, job );
+
+	return TRUE;
+}
+
+gboolean sched_dvb_start ( SchedDvb *sd, const SchedTuner *t, const SchedRec *rec )
+{
+	SchedDvbTuner *st = sched_dvb_tuner ( sd, t );
+
+	if ( !st->slot.dev && !pretune_slot_open ( &st->slot, t->adapter, t->frontend ) )
+	{
+		g_warning ( "%s:: adapter%u/frontend%u: open failed ", __func__, t->adapter, t->frontend );
+		return FALSE;
+	}
+
+	ChDb *db = chdb_open ( rec->file, FILE_DVBV5, SYS_UNDEFINED );
+	struct dvb_entry *entry = ( db ) ? chdb_lookup ( db, rec->channel ) : NULL;
+
+	gboolean ret = FALSE;
+
+	if ( entry )
+		ret = sched_dvb_record ( sd, st, entry, rec );
+	else
+		g_warning ( "%s:: %s: not in %s ", __func__, rec->channel, rec->file );
+
+	chdb_unref ( db );
+
+	// nothing recorded: the frontend goes back
+	sched_dvb_release ( st );
+
+	return ret;
+}
+
+void sched_dvb_stop ( SchedDvb *sd, G_GNUC_UNUSED const SchedTuner *t, const SchedRec *rec )
+{
+	uint32_t i = 0; for ( i = 0; i < sd->jobs->len; i++ )
+	{
+		SchedDvbJob *job = g_ptr_array_index ( sd->jobs, i );
+
+		if ( job->id != rec->id ) continue;
+
+		// the thread reads stop_rec at least on every idle poll
+		job->dm.stop_rec = 1;
+		g_thread_join ( job->thread );
+
+		dvb_dev_close ( job->fd );
+
+		job->tuner->users--;
+		sched_dvb_release ( job->tuner );
+
+		g_ptr_array_remove_index ( sd->jobs, i );
+		free ( job );
+
+		return;
+	}
+}
+
+SchedDvb * sched_dvb_new ( void )
+{
+	SchedDvb *sd = g_new0 ( SchedDvb, 1 );
+
+	sd->tuners = g_ptr_array_new_with_free_func ( free );
+	sd->jobs = g_ptr_array_new ();
+
+	return sd;
+}
+
+/* The scheduler stops its recordings first: sched_free */
+void sched_dvb_free ( SchedDvb *sd )
+{
+	if ( !sd ) return;
+
+	uint32_t i = 0; for ( i = 0; i < sd->tuners->len; i++ )
+	{
+		SchedDvbTuner *st = g_ptr_array_index ( sd->tuners, i );
+
+		if ( st->slot.dev ) dvb_dev_free ( st->slot.dev );
+	}
+
+	g_ptr_array_free ( sd->jobs, TRUE );
+	g_ptr_array_free ( sd->tuners, TRUE );
+
+	free ( sd );
+}
@@ -0,0 +1,26 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include "sched.h"
+
+typedef struct _SchedDvb SchedDvb;
+
+SchedTuner * sched_dvb_tuners ( uint8_t * );
+
+SchedDvb * sched_dvb_new ( void );
+
+void sched_dvb_free ( SchedDvb * );
+
+int64_t sched_dvb_now ( SchedDvb * );
+
+gboolean sched_dvb_start ( SchedDvb *, const SchedTuner *, const SchedRec * );
+
+void sched_dvb_stop ( SchedDvb *, const SchedTuner *, const SchedRec * );
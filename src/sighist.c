@@ -0,0 +1,143 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "sighist.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// 1 hour of seconds, 1 day of 10 s, 2 weeks of minutes: ~1 MB per frontend, whatever the uptime
+const uint32_t sighist_res[SIGHIST_LEVELS] = { 1, 10, 60 };
+const uint32_t sighist_len[SIGHIST_LEVELS] = { 3600, 8640, 20160 };
+
+struct _SigHist
+{
+	GMutex mutex;
+	SigBucket *ring[SIGHIST_LEVELS]; // slot = period % len
+};
+
+SigHist * sighist_new ( void )
+{
+	SigHist *sh = g_new0 ( SigHist, 1 );
+
+	g_mutex_init ( &sh->mutex );
+
+	uint8_t l = 0; for ( l = 0; l < SIGHIST_LEVELS; l++ ) sh->ring[l] = g_new0 ( SigBucket, sighist_len[l] );
+
+	return sh;
+}
+
+void sighist_free ( SigHist *sh )
+{
+	if ( !sh ) return;
+
+	uint8_t l = 0; for ( l = 0; l < SIGHIST_LEVELS; l++ ) free ( sh->ring[l] );
+
+	g_mutex_clear ( &sh->mutex );
+
+	free ( sh );
+}
+
+/* time - wall clock µs, v - SH_ALL values: signal %, C/N %, quality. Every level takes the sample directly */
+void sighist_add ( SigHist *sh, gint64 time, const uint8_t *v )
+{
+	int64_t sec = time / G_USEC_PER_SEC;
+
+	g_mutex_lock ( &sh->mutex );
+
+	uint8_t l = 0; for ( l = 0; l < SIGHIST_LEVELS; l++ )
+	{
+		int64_t period = sec / sighist_res[l];
+		SigBucket *b = &sh->ring[l][period % sighist_len[l]];
+
+		// the slot still holds a period one lap ago ( or older after a gap )
+		if ( b->period != period ) { memset ( b, 0, sizeof ( SigBucket ) ); b->period = period; }
+
+		uint8_t c = 0; for ( c = 0; c < SH_ALL; c++ )
+		{
+			if ( !b->n || v[c] < b->min[c] ) b->min[c] = v[c];
+			if ( !b->n || v[c] > b->max[c] ) b->max[c] = v[c];
+
+			b->sum[c] += v[c];
+		}
+
+		b->n++;
+	}
+
+	g_mutex_unlock ( &sh->mutex );
+}
+
+/* The last count periods of the level up to time, oldest first; missing periods come with n = 0 */
+uint32_t sighist_copy ( SigHist *sh, uint8_t level, gint64 time, uint32_t count, SigBucket *out )
+{
+	if ( level >= SIGHIST_LEVELS ) return 0;
+
+	count = MIN ( count, sighist_len[level] );
+
+	int64_t last = time / G_USEC_PER_SEC / sighist_res[level];
+
+	g_mutex_lock ( &sh->mutex );
+
+	uint32_t i = 0; for ( i = 0; i < count; i++ )
+	{
+		int64_t period = last - count + 1 + i;
+		const SigBucket *b = &sh->ring[level][period % sighist_len[level]];
+
+		if ( b->period == period ) out[i] = *b; else { memset ( &out[i], 0, sizeof ( SigBucket ) ); out[i].period = period; }
+	}
+
+	g_mutex_unlock ( &sh->mutex );
+
+	return count;
+}
+
+/* CSV: every level, non-empty buckets only */
+gboolean sighist_export ( SigHist *sh, const char *file )
+{
+	FILE *fp = fopen ( file, "w" );
+
+	if ( !fp ) { g_warning ( "%s:: %s: %s ", __func__, file, g_strerror ( errno ) ); return FALSE; }
+
+	fprintf ( fp, "resolution_s,time,samples,signal_min,signal_avg,signal_max,cn_min,cn_avg,cn_max,quality_min,quality_avg,quality_max\n" );
+
+	gint64 now = g_get_real_time ();
+
+	uint8_t l = 0; for ( l = 0; l < SIGHIST_LEVELS; l++ )
+	{
+		// copied first: the monitor thread is not held while writing
+		SigBucket *buf = g_new0 ( SigBucket, sighist_len[l] );
+
+		uint32_t count = sighist_copy ( sh, l, now, sighist_len[l], buf );
+
+		uint32_t i = 0; for ( i = 0; i < count; i++ )
+		{
+			SigBucket *b = &buf[i];
+
+			if ( !b->n ) continue;
+
+			char date_str[32];
+			time_t t = (time_t)( b->period * sighist_res[l] );
+			strftime ( date_str, sizeof ( date_str ), "%F %T", localtime ( &t ) );
+
+			fprintf ( fp, "%u,%s,%u", sighist_res[l], date_str, b->n );
+
+			uint8_t c = 0; for ( c = 0; c < SH_ALL; c++ ) fprintf ( fp, ",%u,%.1f,%u", b->min[c], b->sum[c] / b->n, b->max[c] );
+
+			fprintf ( fp, "\n" );
+		}
+
+		free ( buf );
+	}
+
+	fclose ( fp );
+
+	return TRUE;
+}
@@ -0,0 +1,43 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <glib.h>
+
+#define SIGHIST_LEVELS 3 // 1 s, 10 s, 1 min
+
+enum sighist_value { SH_SGL, SH_SNR, SH_QUAL, SH_ALL };
+
+typedef struct _SigBucket SigBucket;
+
+struct _SigBucket
+{
+	int64_t period; // wall time in s / resolution
+	uint32_t n;     // samples, 0 - empty
+
+	uint8_t min[SH_ALL], max[SH_ALL];
+	float sum[SH_ALL];
+};
+
+typedef struct _SigHist SigHist;
+
+extern const uint32_t sighist_res[SIGHIST_LEVELS];
+extern const uint32_t sighist_len[SIGHIST_LEVELS];
+
+SigHist * sighist_new ( void );
+
+void sighist_free ( SigHist * );
+
+void sighist_add ( SigHist *, gint64, const uint8_t * );
+
+uint32_t sighist_copy ( SigHist *, uint8_t, gint64, uint32_t, SigBucket * );
+
+gboolean sighist_export ( SigHist *, const char * );
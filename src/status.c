@@ -10,16 +10,30 @@
 #include "status.h"
 #include "level.h"
 
+#define HIST_BINS 20
+#define HIST_BIN_MS 500
+#define ZAP_HIST 10
+
 struct _Status
 {
 	GtkBox parent_instance;
 
 	Level *level;
 
+	GtkDrawingArea *hist;
+	GtkLabel *hist_info;
+	uint32_t hist_bins[HIST_BINS]; // dwell time per transponder, last bin - overflow
+	uint32_t hist_count, slow_freq, slow_ms;
+
 	GtkLabel *dvb_name;
+	GtkLabel *zap_lock;
+	GtkLabel *zap_trace;
+	GPtrArray *zap_hist; // last ZAP_HIST traces, tooltip of zap_trace
 	GtkLabel *freq_scan;
 	GtkLabel *dvr_record;
 	GtkLabel *org_status[4]; // MAX_DTV_STATS
+
+	GtkCheckButton *check_align, *check_tone;
 };
 
 G_DEFINE_TYPE ( Status, status, GTK_TYPE_BOX )
@@ -48,6 +62,112 @@ static void status_handler_update ( Status *status, uint32_t freq, char *fmt_siz
 	g_signal_emit_by_name ( status->level, "level-update", qual, sgl, snr, sgl_gd, snr_gd, fe_lock );
 }
 
+static gboolean status_hist_draw ( GtkWidget *widget, cairo_t *cr, Status *status )
+{
+	int width  = gtk_widget_get_allocated_width  ( widget );
+	int height = gtk_widget_get_allocated_height ( widget );
+
+	uint32_t max = 1;
+	uint8_t b = 0; for ( b = 0; b < HIST_BINS; b++ ) if ( status->hist_bins[b] > max ) max = status->hist_bins[b];
+
+	double bw = (double)width / HIST_BINS;
+
+	cairo_set_source_rgba ( cr, 0, 1, 1, 0.75 ); // Aqua
+
+	for ( b = 0; b < HIST_BINS; b++ )
+	{
+		double bh = (double)( height - 2 ) * status->hist_bins[b] / max;
+
+		if ( b == HIST_BINS - 1 ) cairo_set_source_rgba ( cr, 1, 0.56, 0, 0.75 ); // Orange - overflow
+
+		cairo_rectangle ( cr, b * bw + 1, height - bh, bw - 2, bh );
+		cairo_fill ( cr );
+	}
+
+	return TRUE;
+}
+
+static void status_hist_reset ( Status *status )
+{
+	memset ( status->hist_bins, 0, sizeof ( status->hist_bins ) );
+
+	status->hist_count = status->slow_freq = status->slow_ms = 0;
+
+	gtk_label_set_text ( status->hist_info, "" );
+	gtk_widget_queue_draw ( GTK_WIDGET ( status->hist ) );
+}
+
+static void status_handler_scan_add ( Status *status, uint32_t freq, uint32_t lock_ms, uint32_t dwell_ms, uint32_t services )
+{
+	uint32_t bin = ( lock_ms + dwell_ms ) / HIST_BIN_MS;
+
+	status->hist_bins[MIN ( bin, HIST_BINS - 1 )]++;
+	status->hist_count++;
+
+	if ( lock_ms + dwell_ms > status->slow_ms ) { status->slow_ms = lock_ms + dwell_ms; status->slow_freq = freq; }
+
+	char text[256];
+	sprintf ( text, "Tp: %u  ( %u ms / %u ms / %u )   Slowest: %u  %u ms ", status->hist_count, lock_ms, dwell_ms, services, status->slow_freq, status->slow_ms );
+
+	gtk_label_set_text ( status->hist_info, text );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( status->hist ), "Tune + tables time per transponder, 0.5 s bins" );
+	gtk_widget_queue_draw ( GTK_WIDGET ( status->hist ) );
+}
+
+static void status_handler_zap_lock ( Status *status, uint32_t lock_ms, gboolean timeout, gboolean retune )
+{
+	char text[256];
+
+	if ( timeout )
+		sprintf ( text, "Zap -> Lock:  timeout " );
+	else
+		sprintf ( text, "Zap -> Lock:  %u ms %s", lock_ms, ( retune ) ? "" : "( same Tp ) " );
+
+	gtk_label_set_text ( status->zap_lock, text );
+}
+
+static void status_handler_zap_trace ( Status *status, const char *channel, const char *trace )
+{
+	char *text = g_strdup_printf ( "%s:  %s ", channel, trace );
+
+	gtk_label_set_text ( status->zap_trace, text );
+
+	if ( status->zap_hist->len >= ZAP_HIST ) g_ptr_array_remove_index ( status->zap_hist, 0 );
+	g_ptr_array_add ( status->zap_hist, text );
+
+	GString *tooltip = g_string_new ( NULL );
+
+	uint c = 0; for ( c = 0; c < status->zap_hist->len; c++ )
+		g_string_append_printf ( tooltip, "%s%s", ( c ) ? "\n" : "", (char *)g_ptr_array_index ( status->zap_hist, c ) );
+
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( status->zap_trace ), tooltip->str );
+
+	g_string_free ( tooltip, TRUE );
+}
+
+static void status_handler_history ( Status *status, uint32_t res, GBytes *hist )
+{
+	g_signal_emit_by_name ( status->level, "level-history", res, hist );
+}
+
+static void status_handler_hist_level ( G_GNUC_UNUSED Level *level, uint32_t hist_level, Status *status )
+{
+	g_signal_emit_by_name ( status, "hist-level", hist_level );
+}
+
+static void status_handler_align ( Status *status, gboolean on, double sgl, double snr, double sgl_peak, double snr_peak, gboolean fe_lock )
+{
+	g_signal_emit_by_name ( status->level, "level-align", on, sgl, snr, sgl_peak, snr_peak, fe_lock );
+}
+
+static void status_toggled_align ( G_GNUC_UNUSED GtkToggleButton *button, Status *status )
+{
+	gboolean on   = gtk_toggle_button_get_active ( GTK_TOGGLE_BUTTON ( status->check_align ) );
+	gboolean tone = gtk_toggle_button_get_active ( GTK_TOGGLE_BUTTON ( status->check_tone  ) );
+
+	g_signal_emit_by_name ( status, "align", on, tone );
+}
+
 static void status_handler_set_dvb_name ( Status *status, const char *dvb_name )
 {
 	gtk_label_set_text ( status->dvb_name, dvb_name );
@@ -55,6 +175,8 @@ static void status_handler_set_dvb_name ( Status *status, const char *dvb_name )
 
 static void status_clicked_scan ( G_GNUC_UNUSED GtkButton *button, Status *status )
 {
+	status_hist_reset ( status );
+
 	g_signal_emit_by_name ( status, "scan-start" );
 }
 
@@ -63,6 +185,7 @@ static void status_clicked_stop ( G_GNUC_UNUSED GtkButton *button, Status *statu
 	g_signal_emit_by_name ( status, "scan-stop" );
 
 	gtk_label_set_text ( status->freq_scan,  "" );
+	gtk_label_set_text ( status->zap_lock,   "" );
 	gtk_label_set_text ( status->dvr_record, "" );
 
 	const char *label[4] = { "Layer A: ", "Layer B: ","Layer C: ", "Layer D: " };
@@ -73,6 +196,11 @@ static void status_clicked_stop ( G_GNUC_UNUSED GtkButton *button, Status *statu
 	}
 }
 
+static void status_clicked_export ( G_GNUC_UNUSED GtkButton *button, Status *status )
+{
+	g_signal_emit_by_name ( status, "hist-export" );
+}
+
 static void status_clicked_info ( G_GNUC_UNUSED GtkButton *button, Status *status )
 {
 	g_signal_emit_by_name ( status, "win-info" );
@@ -125,6 +253,17 @@ static void status_init ( Status *status )
 	gtk_box_pack_end ( h_box, GTK_WIDGET ( gswitch ), FALSE, FALSE, 0 );
 	gtk_widget_set_visible (  GTK_WIDGET ( gswitch ), TRUE );
 
+	status->check_align = (GtkCheckButton *)gtk_check_button_new_with_label ( "Align" );
+	status->check_tone  = (GtkCheckButton *)gtk_check_button_new_with_label ( "Tone" );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( status->check_align ), "Dish alignment: fast smoothed Signal / C/N with peak hold" );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( status->check_tone  ), "Alignment tone ( aplay ): pitch follows C/N, Signal without lock" );
+	g_signal_connect ( status->check_align, "toggled", G_CALLBACK ( status_toggled_align ), status );
+	g_signal_connect ( status->check_tone,  "toggled", G_CALLBACK ( status_toggled_align ), status );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( status->check_align ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( status->check_tone  ), FALSE, FALSE, 0 );
+	gtk_widget_set_visible (  GTK_WIDGET ( status->check_align ), TRUE );
+	gtk_widget_set_visible (  GTK_WIDGET ( status->check_tone  ), TRUE );
+
 	gtk_box_pack_start ( box, GTK_WIDGET ( h_box ), FALSE, FALSE, 5 );
 
 	const char *label[4] = { "Layer A: ", "Layer B: ","Layer C: ", "Layer D: " };
@@ -137,33 +276,59 @@ static void status_init ( Status *status )
 		gtk_widget_set_visible (  GTK_WIDGET ( status->org_status[c] ), FALSE );
 	}
 
+	status->hist = (GtkDrawingArea *)gtk_drawing_area_new ();
+	gtk_widget_set_size_request ( GTK_WIDGET ( status->hist ), -1, 60 );
+	g_signal_connect ( status->hist, "draw", G_CALLBACK ( status_hist_draw ), status );
+	gtk_box_pack_start ( box, GTK_WIDGET ( status->hist ), TRUE, TRUE, 5 );
+	gtk_widget_set_visible (  GTK_WIDGET ( status->hist ), TRUE );
+
+	status->hist_info = (GtkLabel *)gtk_label_new ( "" );
+	gtk_widget_set_halign ( GTK_WIDGET ( status->hist_info ), GTK_ALIGN_START );
+	gtk_box_pack_start ( box, GTK_WIDGET ( status->hist_info ), FALSE, FALSE, 0 );
+	gtk_widget_set_visible (  GTK_WIDGET ( status->hist_info ), TRUE );
+
+	status->zap_hist = g_ptr_array_new_with_free_func ( g_free );
+
+	status->zap_trace = (GtkLabel *)gtk_label_new ( "" );
+	gtk_label_set_ellipsize ( status->zap_trace, PANGO_ELLIPSIZE_END );
+	gtk_widget_set_halign ( GTK_WIDGET ( status->zap_trace ), GTK_ALIGN_START );
+	gtk_box_pack_start ( box, GTK_WIDGET ( status->zap_trace ), FALSE, FALSE, 0 );
+	gtk_widget_set_visible (  GTK_WIDGET ( status->zap_trace ), TRUE );
+
 	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
 	gtk_box_set_spacing ( h_box, 5 );
 	gtk_widget_set_visible (  GTK_WIDGET ( h_box ), TRUE );
 
 	GtkButton *bscan = (GtkButton *)gtk_button_new_with_label ( "⏵" );
 	GtkButton *bstop = (GtkButton *)gtk_button_new_with_label ( "⏹" );
+	GtkButton *bhist = (GtkButton *)gtk_button_new_with_label ( "⇩" );
 	GtkButton *binfo = (GtkButton *)gtk_button_new_with_label ( "🛈" );
 	GtkButton *bexit = (GtkButton *)gtk_button_new_with_label ( "⏻" );
 
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( bhist ), "Export signal history ( CSV )" );
+
 	g_signal_connect ( bscan, "clicked", G_CALLBACK ( status_clicked_scan ), status );
 	g_signal_connect ( bstop, "clicked", G_CALLBACK ( status_clicked_stop ), status );
+	g_signal_connect ( bhist, "clicked", G_CALLBACK ( status_clicked_export ), status );
 	g_signal_connect ( binfo, "clicked", G_CALLBACK ( status_clicked_info ), status );
 	g_signal_connect ( bexit, "clicked", G_CALLBACK ( status_clicked_exit ), status );
 
 	gtk_widget_set_visible (  GTK_WIDGET ( bscan ), TRUE );
 	gtk_widget_set_visible (  GTK_WIDGET ( bstop ), TRUE );
+	gtk_widget_set_visible (  GTK_WIDGET ( bhist ), TRUE );
 	gtk_widget_set_visible (  GTK_WIDGET ( binfo ), TRUE );
 	gtk_widget_set_visible (  GTK_WIDGET ( bexit ), TRUE );
 
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( bscan  ), TRUE, TRUE, 0 );
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( bstop  ), TRUE, TRUE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( bhist  ), TRUE, TRUE, 0 );
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( binfo  ), TRUE, TRUE, 0 );
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( bexit  ), TRUE, TRUE, 0 );
 
 	gtk_box_pack_end ( box, GTK_WIDGET ( h_box ), FALSE, FALSE, 5 );
 
 	status->level = level_new ();
+	g_signal_connect ( status->level, "hist-level", G_CALLBACK ( status_handler_hist_level ), status );
 	gtk_box_pack_end ( box, GTK_WIDGET ( status->level ), FALSE, FALSE, 5 );
 
 	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
@@ -177,6 +342,11 @@ static void status_init ( Status *status )
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( status->freq_scan ), FALSE, FALSE, 0 );
 	gtk_widget_set_visible (  GTK_WIDGET ( status->freq_scan ), TRUE );
 
+	status->zap_lock = (GtkLabel *)gtk_label_new ( "" );
+	gtk_widget_set_halign ( GTK_WIDGET ( status->zap_lock ), GTK_ALIGN_START );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( status->zap_lock ), FALSE, FALSE, 0 );
+	gtk_widget_set_visible (  GTK_WIDGET ( status->zap_lock ), TRUE );
+
 	status->dvr_record = (GtkLabel *)gtk_label_new ( "" );
 	gtk_widget_set_halign ( GTK_WIDGET ( status->dvr_record ), GTK_ALIGN_START );
 	gtk_box_pack_end ( h_box, GTK_WIDGET ( status->dvr_record ), FALSE, FALSE, 0 );
@@ -185,10 +355,19 @@ static void status_init ( Status *status )
 	g_signal_connect ( status, "set-dvb-name",  G_CALLBACK ( status_handler_set_dvb_name  ), NULL );
 	g_signal_connect ( status, "status-update", G_CALLBACK ( status_handler_update ), NULL );
 	g_signal_connect ( status, "status-org",    G_CALLBACK ( status_handler_org    ), NULL );	
+	g_signal_connect ( status, "status-scan-add", G_CALLBACK ( status_handler_scan_add ), NULL );
+	g_signal_connect ( status, "status-zap-lock", G_CALLBACK ( status_handler_zap_lock ), NULL );
+	g_signal_connect ( status, "status-zap-trace", G_CALLBACK ( status_handler_zap_trace ), NULL );
+	g_signal_connect ( status, "status-history", G_CALLBACK ( status_handler_history ), NULL );
+	g_signal_connect ( status, "status-align",   G_CALLBACK ( status_handler_align   ), NULL );
 }
 
 static void status_finalize ( GObject *object )
 {
+	Status *status = STATUS_BOX ( object );
+
+	g_ptr_array_free ( status->zap_hist, TRUE );
+
 	G_OBJECT_CLASS (status_parent_class)->finalize (object);
 }
 
@@ -202,6 +381,18 @@ static void status_class_init ( StatusClass *class )
 	g_signal_new ( "scan-stop", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
 
+	g_signal_new ( "align", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "status-align", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 6, G_TYPE_BOOLEAN, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "hist-export", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
+
+	g_signal_new ( "hist-level", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_UINT );
+
 	g_signal_new ( "win-info", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
 
@@ -214,6 +405,18 @@ static void status_class_init ( StatusClass *class )
 	g_signal_new ( "status-org", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_INT, G_TYPE_STRING );
 
+	g_signal_new ( "status-zap-lock", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN );
+
+	g_signal_new ( "status-zap-trace", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_STRING );
+
+	g_signal_new ( "status-history", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_BYTES );
+
+	g_signal_new ( "status-scan-add", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 4, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT );
+
 	g_signal_new ( "status-update", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 8, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_BOOLEAN );
 }
@@ -0,0 +1,344 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "svc.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dvb/dmx.h>
+
+#define SVC_SECT_SIZE 4096
+
+struct _SvcMon
+{
+	struct dvb_open_descriptor *fd, *pat_fd, *pmt_fd; // fd - the service filter, not owned
+	uint16_t sid, pmt_pid;
+	int pat_ver, pmt_ver; // -1 not seen
+
+	SvcPids pids; // on the service filter
+	SvcPids es;   // PCR + streams of the last PMT
+	GThread *thread;
+
+	GAsyncQueue *changes; // char *, "date time sid N: ...", not owned
+
+	gint stop;
+};
+
+gboolean svc_pids_add ( SvcPids *sp, uint16_t pid )
+{
+	uint8_t i = 0; for ( i = 0; i < sp->n; i++ ) if ( sp->pid[i] == pid ) return FALSE;
+
+	if ( sp->n >= SVC_PIDS_MAX || pid >= 0x1fff ) return FALSE;
+
+	sp->pid[sp->n++] = pid;
+
+	return TRUE;
+}
+
+/* What the channel file knows: PAT, every video, audio and other elementary pid; eit - + EIT */
+void svc_pids_from_entry ( struct dvb_entry *entry, gboolean eit, SvcPids *sp )
+{
+	sp->n = 0;
+
+	svc_pids_add ( sp, SVC_PID_PAT );
+
+	if ( eit ) svc_pids_add ( sp, SVC_PID_EIT );
+
+	uint32_t i = 0;
+	for ( i = 0; i < entry->video_pid_len; i++ ) svc_pids_add ( sp, entry->video_pid[i] );
+	for ( i = 0; i < entry->audio_pid_len; i++ ) svc_pids_add ( sp, entry->audio_pid[i] );
+	for ( i = 0; i < entry->other_el_pid_len; i++ ) svc_pids_add ( sp, entry->other_el_pid[i].pid );
+}
+
+/* The whole service on one TS filter: the first pid sets it up, the rest go in with DMX_ADD_PID */
+struct dvb_open_descriptor * svc_filter_open ( struct dvb_device *dvb, const char *demux_dev, const SvcPids *sp, uint8_t dmx_out, uint32_t buf_size )
+{
+	if ( !sp->n ) return NULL;
+
+	struct dvb_open_descriptor *fd = dvb_dev_open ( dvb, demux_dev, O_RDWR );
+
+	if ( !fd ) { g_critical ( "%s:: failed opening %s", __func__, demux_dev ); return NULL; }
+
+	if ( dvb_dev_dmx_set_pesfilter ( fd, sp->pid[0], DMX_PES_OTHER, dmx_out, (int)buf_size ) < 0 )
+	{
+		g_critical ( "%s:: pid 0x%04x: set pes filter failed.", __func__, sp->pid[0] );
+		dvb_dev_close ( fd );
+		return NULL;
+	}
+
+	uint8_t i = 0; for ( i = 1; i < sp->n; i++ )
+	{
+		uint16_t pid = sp->pid[i];
+
+		if ( ioctl ( dvb_dev_get_fd ( fd ), DMX_ADD_PID, &pid ) < 0 ) g_warning ( "%s:: DMX_ADD_PID 0x%04x: %m ", __func__, pid );
+	}
+
+	g_message ( "%s:: %u pids on one filter ", __func__, sp->n );
+
+	return fd;
+}
+
+/*
+* Section filter on pid / table_id ( / table_id_extension, ext >= 0 ), current sections only.
+* ver >= 0: negative match on version_number - only a new version gets through.
+*/
+static gboolean svc_section_filter ( struct dvb_open_descriptor *fd, uint16_t pid, uint8_t tid, int ext, int ver )
+{
+	// Linux section filters skip the two section_length bytes: filter[1..2] is table_id_extension, filter[3] version / current_next
+	uint8_t filter[DMX_FILTER_SIZE] = { tid }, mask[DMX_FILTER_SIZE] = { 0xff }, mode[DMX_FILTER_SIZE] = { 0 };
+
+	if ( ext >= 0 )
+	{
+		filter[1] = (uint8_t)( ext >> 8 ); mask[1] = 0xff;
+		filter[2] = (uint8_t)( ext & 0xff ); mask[2] = 0xff;
+	}
+
+	filter[3] = 0x01; mask[3] = 0x01;
+
+	if ( ver >= 0 ) { filter[3] |= (uint8_t)( ver << 1 ); mask[3] |= 0x3e; mode[3] = 0x3e; }
+
+	ioctl ( dvb_dev_get_fd ( fd ), DMX_STOP );
+
+	if ( dvb_dev_dmx_set_section_filter ( fd, pid, 4, filter, mask, mode, DMX_IMMEDIATE_START | DMX_CHECK_CRC ) < 0 )
+	{
+		g_warning ( "%s:: pid 0x%04x: set section filter failed.", __func__, pid );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static uint16_t svc_pat_pmt_pid ( const uint8_t *s, ssize_t len, uint16_t sid )
+{
+	uint16_t slen = (uint16_t)( ( ( s[1] & 0x0f ) << 8 ) | s[2] );
+	const uint8_t *end = s + MIN ( (ssize_t)( 3 + slen - 4 ), len - 4 );
+
+	const uint8_t *p = s + 8; for ( p = s + 8; p + 4 <= end; p += 4 )
+	{
+		uint16_t prog = (uint16_t)( ( p[0] << 8 ) | p[1] );
+
+		if ( prog == sid ) return (uint16_t)( ( ( p[2] & 0x1f ) << 8 ) | p[3] );
+	}
+
+	return 0;
+}
+
+/* PCR and every elementary stream of a PMT section */
+static void svc_pmt_pids ( const uint8_t *s, ssize_t len, SvcPids *sp )
+{
+	uint16_t slen = (uint16_t)( ( ( s[1] & 0x0f ) << 8 ) | s[2] );
+	uint16_t pil  = (uint16_t)( ( ( s[10] & 0x0f ) << 8 ) | s[11] );
+	const uint8_t *end = s + MIN ( (ssize_t)( 3 + slen - 4 ), len - 4 );
+
+	sp->n = 0;
+
+	svc_pids_add ( sp, (uint16_t)( ( ( s[8] & 0x1f ) << 8 ) | s[9] ) );
+
+	const uint8_t *p = s + 12 + pil;
+
+	while ( p + 5 <= end )
+	{
+		svc_pids_add ( sp, (uint16_t)( ( ( p[1] & 0x1f ) << 8 ) | p[2] ) );
+
+		p += 5 + ( ( ( p[3] & 0x0f ) << 8 ) | p[4] );
+	}
+}
+
+static gboolean svc_pids_has ( const SvcPids *sp, uint16_t pid )
+{
+	uint8_t i = 0; for ( i = 0; i < sp->n; i++ ) if ( sp->pid[i] == pid ) return TRUE;
+
+	return FALSE;
+}
+
+static void svc_pids_remove ( SvcPids *sp, uint16_t pid )
+{
+	uint8_t i = 0; for ( i = 0; i < sp->n; i++ ) if ( sp->pid[i] == pid ) { sp->pid[i] = sp->pid[--sp->n]; return; }
+}
+
+static void svc_mon_add ( SvcMon *mon, uint16_t pid, GString *log )
+{
+	if ( !svc_pids_add ( &mon->pids, pid ) ) return;
+
+	if ( ioctl ( dvb_dev_get_fd ( mon->fd ), DMX_ADD_PID, &pid ) < 0 ) g_warning ( "%s:: DMX_ADD_PID 0x%04x: %m ", __func__, pid );
+
+	if ( log ) g_string_append_printf ( log, " +0x%04x", pid );
+}
+
+static void svc_mon_remove ( SvcMon *mon, uint16_t pid, GString *log )
+{
+	// the PSI base of the filter stays
+	if ( pid == SVC_PID_PAT || pid == SVC_PID_EIT || !svc_pids_has ( &mon->pids, pid ) ) return;
+
+	svc_pids_remove ( &mon->pids, pid );
+
+	if ( ioctl ( dvb_dev_get_fd ( mon->fd ), DMX_REMOVE_PID, &pid ) < 0 ) g_warning ( "%s:: DMX_REMOVE_PID 0x%04x: %m ", __func__, pid );
+
+	if ( log ) g_string_append_printf ( log, " -0x%04x", pid );
+}
+
+static void svc_mon_log ( SvcMon *mon, GString *log )
+{
+	g_autoptr ( GDateTime ) date = g_date_time_new_now_local ();
+	g_autofree char *date_str = g_date_time_format ( date, "%F %T" );
+
+	char *str = g_strdup_printf ( "%s sid %u: %s", date_str, mon->sid, log->str );
+
+	g_async_queue_push ( mon->changes, str );
+}
+
+/* PAT: the PMT pid of the service moved */
+static void svc_mon_pat ( SvcMon *mon, const uint8_t *buf, ssize_t len )
+{
+	int ver = ( buf[5] >> 1 ) & 0x1f;
+	uint16_t pmt_pid = svc_pat_pmt_pid ( buf, len, mon->sid );
+
+	// sid in another section of a multi-section PAT: wait for it with the same filter
+	if ( !pmt_pid ) return;
+
+	if ( mon->pat_ver >= 0 || pmt_pid != mon->pmt_pid )
+	{
+		GString *log = g_string_new ( NULL );
+		g_string_append_printf ( log, "PAT v%d -> v%d: PMT 0x%04x -> 0x%04x", mon->pat_ver, ver, mon->pmt_pid, pmt_pid );
+
+		if ( pmt_pid != mon->pmt_pid )
+		{
+			if ( mon->pmt_pid ) svc_mon_remove ( mon, mon->pmt_pid, log );
+			svc_mon_add ( mon, pmt_pid, log );
+
+			mon->pmt_pid = pmt_pid;
+			mon->pmt_ver = -1;
+
+			svc_section_filter ( mon->pmt_fd, pmt_pid, 0x02, mon->sid, -1 );
+		}
+
+		if ( mon->pat_ver >= 0 ) svc_mon_log ( mon, log );
+
+		g_string_free ( log, TRUE );
+	}
+
+	mon->pat_ver = ver;
+
+	svc_section_filter ( mon->pat_fd, SVC_PID_PAT, 0x00, -1, ver );
+}
+
+/* PMT: streams added or dropped, the filter follows in place */
+static void svc_mon_pmt ( SvcMon *mon, const uint8_t *buf, ssize_t len )
+{
+	int ver = ( buf[5] >> 1 ) & 0x1f;
+
+	SvcPids es;
+	svc_pmt_pids ( buf, len, &es );
+
+	GString *log = g_string_new ( NULL );
+	g_string_append_printf ( log, "PMT 0x%04x v%d -> v%d:", mon->pmt_pid, mon->pmt_ver, ver );
+
+	uint8_t i = 0;
+	for ( i = 0; i < mon->es.n; i++ ) if ( !svc_pids_has ( &es, mon->es.pid[i] ) && mon->es.pid[i] != mon->pmt_pid ) svc_mon_remove ( mon, mon->es.pid[i], log );
+	for ( i = 0; i < es.n; i++ ) svc_mon_add ( mon, es.pid[i], log );
+
+	// the first PMT only completes the channel file set
+	if ( mon->pmt_ver >= 0 ) svc_mon_log ( mon, log ); else g_message ( "%s:: sid %u: %s ", __func__, mon->sid, log->str );
+
+	g_string_free ( log, TRUE );
+
+	mon->es = es;
+	mon->pmt_ver = ver;
+
+	svc_section_filter ( mon->pmt_fd, mon->pmt_pid, 0x02, mon->sid, ver );
+}
+
+/*
+* Follows the service for the whole zap: the PMT pid from the PAT, then PCR and all streams from the PMT.
+* A new PAT / PMT version updates the service filter with DMX_ADD_PID / DMX_REMOVE_PID, the recorder keeps reading.
+*/
+static gpointer svc_mon_thread ( SvcMon *mon )
+{
+	uint8_t *buf = g_malloc ( SVC_SECT_SIZE );
+
+	svc_section_filter ( mon->pat_fd, SVC_PID_PAT, 0x00, -1, -1 );
+
+	while ( !g_atomic_int_get ( &mon->stop ) )
+	{
+		struct pollfd pfd[2] =
+		{
+			{ .fd = dvb_dev_get_fd ( mon->pat_fd ), .events = POLLIN | POLLPRI },
+			{ .fd = dvb_dev_get_fd ( mon->pmt_fd ), .events = POLLIN | POLLPRI }
+		};
+
+		if ( poll ( pfd, ( mon->pmt_pid ) ? 2 : 1, 100 ) <= 0 ) continue;
+
+		if ( pfd[0].revents )
+		{
+			ssize_t len = read ( pfd[0].fd, buf, SVC_SECT_SIZE );
+
+			if ( len >= 12 && buf[0] == 0x00 ) svc_mon_pat ( mon, buf, len );
+		}
+
+		if ( mon->pmt_pid && pfd[1].revents )
+		{
+			ssize_t len = read ( pfd[1].fd, buf, SVC_SECT_SIZE );
+
+			if ( len >= 16 && buf[0] == 0x02 ) svc_mon_pmt ( mon, buf, len );
+		}
+	}
+
+	free ( buf );
+
+	return NULL;
+}
+
+/* fd - the service filter of svc_filter_open, sp - pids already on it, changes - receives the PAT / PMT change log */
+SvcMon * svc_mon_start ( struct dvb_device *dvb, const char *demux_dev, struct dvb_open_descriptor *fd, uint16_t sid, const SvcPids *sp, GAsyncQueue *changes )
+{
+	if ( !fd || !sid ) return NULL;
+
+	SvcMon *mon = g_new0 ( SvcMon, 1 );
+
+	// all handles are opened here, on the caller's thread
+	mon->pat_fd = dvb_dev_open ( dvb, demux_dev, O_RDWR | O_NONBLOCK );
+	mon->pmt_fd = dvb_dev_open ( dvb, demux_dev, O_RDWR | O_NONBLOCK );
+
+	if ( !mon->pat_fd || !mon->pmt_fd )
+	{
+		g_warning ( "%s:: failed opening %s", __func__, demux_dev );
+
+		if ( mon->pat_fd ) dvb_dev_close ( mon->pat_fd );
+		if ( mon->pmt_fd ) dvb_dev_close ( mon->pmt_fd );
+
+		free ( mon );
+		return NULL;
+	}
+
+	mon->fd = fd;
+	mon->sid = sid;
+	mon->pids = *sp;
+	mon->pat_ver = -1;
+	mon->pmt_ver = -1;
+	mon->changes = changes;
+	mon->thread = g_thread_new ( "svc-monitor", (GThreadFunc)svc_mon_thread, mon );
+
+	return mon;
+}
+
+/* Before the service filter is closed */
+void svc_mon_stop ( SvcMon *mon )
+{
+	if ( !mon ) return;
+
+	g_atomic_int_set ( &mon->stop, 1 );
+	g_thread_join ( mon->thread );
+
+	dvb_dev_close ( mon->pat_fd );
+	dvb_dev_close ( mon->pmt_fd );
+
+	free ( mon );
+}
@@ -0,0 +1,40 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-dev.h>
+#include <libdvbv5/dvb-file.h>
+
+#include <glib.h>
+
+#define SVC_PIDS_MAX 64
+
+#define SVC_PID_PAT 0x0000
+#define SVC_PID_EIT 0x0012
+
+typedef struct _SvcPids SvcPids;
+
+struct _SvcPids
+{
+	uint16_t pid[SVC_PIDS_MAX];
+	uint8_t n;
+};
+
+typedef struct _SvcMon SvcMon;
+
+gboolean svc_pids_add ( SvcPids *, uint16_t );
+
+void svc_pids_from_entry ( struct dvb_entry *, gboolean, SvcPids * );
+
+struct dvb_open_descriptor * svc_filter_open ( struct dvb_device *, const char *, const SvcPids *, uint8_t, uint32_t );
+
+SvcMon * svc_mon_start ( struct dvb_device *, const char *, struct dvb_open_descriptor *, uint16_t, const SvcPids *, GAsyncQueue * );
+
+void svc_mon_stop ( SvcMon * );
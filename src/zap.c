@@ -9,22 +9,18 @@
 
 #include "zap.h"
 #include "file.h"
+#include "chdb.h"
+#include "chbin.h"
+#include "chmodel.h"
+#include "player.h"
 
 #include <linux/dvb/dmx.h>
 
 #include <libdvbv5/dvb-file.h>
 
-enum cols_n
-{
-	COL_NUM,
-	COL_REC,
-	COL_CHL,
-	COL_SIZE,
-	COL_VPID,
-	COL_APID,
-	COL_FILE,
-	NUM_COLS
-};
+#include <malloc.h>
+
+#define ZAP_BENCH_ENV "DVB5_ZAP_BENCH" // set: each load is measured against the former GtkListStore fill too
 
 typedef struct _OutDemux OutDemux;
 
@@ -54,30 +50,87 @@ struct _Zap
 	GtkButton *button_play;
 	GtkComboBoxText *combo_dmx;
 	GtkCheckButton *checkbutton;
+	GtkCheckButton *check_pretune;
+	GtkCheckButton *check_eit;
 
 	DwrRecMonitor *dm;
+	Player *player;
+	DvrTee *tee; // the dvr reader for the recording and the players
 
 	char *channel;
+	char *channel_prev; // zap history for pre-tune
 	ulong rec_signal_id;
+
+	GCancellable *load_cancel; // channel file still loading
+
+	GtkSearchEntry *entry_search;
+	ChModel *model_all; // the whole file; the view may show a search result of it
 };
 
 G_DEFINE_TYPE ( Zap, zap, GTK_TYPE_BOX )
 
-static void zap_treeview_append ( const char *channel, uint16_t apid, uint16_t vpid, Zap *zap )
+typedef struct _ZapLoad ZapLoad;
+
+struct _ZapLoad
+{
+	Zap *zap;
+	char *file;
+	GCancellable *cancel;
+
+	gboolean bench;
+	gint64 t_table, t_parse; // µs: chdb + table; dvb_read_file_format alone, -1 - binary file
+};
+
+/* Likely next zaps: the rows below and above, then the previous channel */
+static void zap_pretune ( GtkTreePath *path, Zap *zap )
 {
+	if ( !gtk_toggle_button_get_active ( GTK_TOGGLE_BUTTON ( zap->check_pretune ) ) ) return;
+
 	GtkTreeIter iter;
 	GtkTreeModel *model = gtk_tree_view_get_model ( zap->treeview );
 
-	int ind = gtk_tree_model_iter_n_children ( model, NULL );
-	if ( ind >= UINT16_MAX ) return;
+	int ind = gtk_tree_path_get_indices ( path )[0], n = gtk_tree_model_iter_n_children ( model, NULL );
+
+	char *channels[4] = { NULL };
+	uint8_t c = 0;
+
+	if ( n > 1 && gtk_tree_model_iter_nth_child ( model, &iter, NULL, ( ind + 1 ) % n ) ) gtk_tree_model_get ( model, &iter, COL_CHL, &channels[c++], -1 );
+	if ( n > 2 && gtk_tree_model_iter_nth_child ( model, &iter, NULL, ( ind + n - 1 ) % n ) ) gtk_tree_model_get ( model, &iter, COL_CHL, &channels[c++], -1 );
+
+	if ( zap->channel_prev ) channels[c++] = g_strdup ( zap->channel_prev );
 
-	gtk_list_store_append ( GTK_LIST_STORE ( model ), &iter );
-	gtk_list_store_set    ( GTK_LIST_STORE ( model ), &iter,
-				COL_NUM, ind + 1,
-				COL_CHL, channel,
-				COL_VPID, vpid,
-				COL_APID, apid,
-				-1 );
+	g_signal_emit_by_name ( zap, "zap-pretune", gtk_entry_get_text ( zap->entry_file ), channels );
+
+	for ( c = 0; c < 3; c++ ) free ( channels[c] );
+}
+
+static void zap_signal_toggled_pretune ( GtkCheckButton *button, Zap *zap )
+{
+	if ( gtk_toggle_button_get_active ( GTK_TOGGLE_BUTTON ( button ) ) ) return;
+
+	g_signal_emit_by_name ( zap, "zap-pretune", gtk_entry_get_text ( zap->entry_file ), NULL );
+}
+
+static void zap_handler_set_adapter ( Zap *zap, uint8_t adapter, uint8_t demux )
+{
+	// the recording and the players follow a hand-off to another adapter
+	const char *res = ( zap->tee ) ? dvr_tee_set_adapter ( zap->tee, adapter, demux ) : NULL;
+
+	if ( res ) g_warning ( "%s:: %s ", __func__, res );
+
+	// so does a command with its own dvr device
+	const char *cmd = gtk_entry_get_text ( zap->entry_play );
+
+	GRegex *regex = g_regex_new ( "/dev/dvb/adapter[0-9]+/dvr[0-9]+", 0, 0, NULL );
+
+	char dvr[64];
+	sprintf ( dvr, "/dev/dvb/adapter%u/dvr%u", adapter, demux );
+
+	g_autofree char *cmd_new = g_regex_replace_literal ( regex, cmd, -1, 0, dvr, 0, NULL );
+
+	if ( cmd_new ) gtk_entry_set_text ( zap->entry_play, cmd_new );
+
+	g_regex_unref ( regex );
 }
 
 static void zap_signal_trw_act ( GtkTreeView *tree_view, GtkTreePath *path, G_GNUC_UNUSED GtkTreeViewColumn *column, Zap *zap )
@@ -88,14 +141,11 @@ static void zap_signal_trw_act ( GtkTreeView *tree_view, GtkTreePath *path, G_GN
 
 	const char *file = gtk_entry_get_text ( zap->entry_file );
 
-	gboolean fe_lock = FALSE;
-	g_signal_emit_by_name ( zap, "zap-get-felock", &fe_lock );
-
-	if ( fe_lock )
+	if ( !zap->dm->stop_rec )
 	{
-		g_message ( "%s:: Zap channel = %s ", __func__, zap->channel );
+		GtkWindow *window = GTK_WINDOW ( gtk_widget_get_toplevel ( GTK_WIDGET ( tree_view ) ) );
 
-		g_signal_emit_by_name ( zap, "zap-set-data", descr_num, zap->channel, file );
+		dvb5_message_dialog ( zap->channel, "Record?", GTK_MESSAGE_WARNING, window );
 
 		return;
 	}
@@ -105,7 +155,10 @@ static void zap_signal_trw_act ( GtkTreeView *tree_view, GtkTreePath *path, G_GN
 
 	if ( !gtk_tree_model_get_iter ( model, &iter, path ) ) return;
 
-	if ( zap->channel ) { free ( zap->channel ); zap->channel = NULL; }
+	if ( zap->channel_prev ) free ( zap->channel_prev );
+	zap->channel_prev = zap->channel;
+	zap->channel = NULL;
+
 	gtk_tree_model_get ( model, &iter, COL_CHL, &zap->channel, -1 );
 
 	const char *file_rec = gtk_entry_get_text ( zap->entry_rec );
@@ -118,7 +171,11 @@ static void zap_signal_trw_act ( GtkTreeView *tree_view, GtkTreePath *path, G_GN
 
 	gtk_entry_set_text ( zap->entry_rec, file_new );
 
-	g_signal_emit_by_name ( zap, "zap-set-data", descr_num, zap->channel, file );
+	gboolean eit = gtk_toggle_button_get_active ( GTK_TOGGLE_BUTTON ( zap->check_eit ) );
+
+	g_signal_emit_by_name ( zap, "zap-set-data", descr_num, eit, zap->channel, file );
+
+	zap_pretune ( path, zap );
 }
 
 static GtkScrolledWindow * zap_create_treeview_scroll ( Zap *zap )
@@ -127,9 +184,10 @@ static GtkScrolledWindow * zap_create_treeview_scroll ( Zap *zap )
 	gtk_scrolled_window_set_policy ( scroll, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
 	gtk_widget_set_visible ( GTK_WIDGET ( scroll ), TRUE );
 
-	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING );
+	zap->model_all = chmodel_new ( NULL );
 
-	zap->treeview = (GtkTreeView *)gtk_tree_view_new_with_model ( GTK_TREE_MODEL ( store ) );
+	zap->treeview = (GtkTreeView *)gtk_tree_view_new_with_model ( GTK_TREE_MODEL ( zap->model_all ) );
+	gtk_tree_view_set_fixed_height_mode ( zap->treeview, TRUE ); // rows are measured only when shown
 	gtk_drag_dest_set ( GTK_WIDGET ( zap->treeview ), GTK_DEST_DEFAULT_ALL, NULL, 0, GDK_ACTION_COPY );
 	gtk_drag_dest_add_uri_targets  ( GTK_WIDGET ( zap->treeview ) );
 	gtk_widget_set_visible ( GTK_WIDGET ( zap->treeview ), TRUE );
@@ -156,12 +214,15 @@ static GtkScrolledWindow * zap_create_treeview_scroll ( Zap *zap )
 			renderer = gtk_cell_renderer_text_new ();
 
 		column = gtk_tree_view_column_new_with_attributes ( column_n[c].name, renderer, column_n[c].type, column_n[c].num, NULL );
+		gtk_tree_view_column_set_sizing ( column, GTK_TREE_VIEW_COLUMN_FIXED );
+		gtk_tree_view_column_set_resizable ( column, TRUE );
+		gtk_tree_view_column_set_fixed_width ( column, ( c == COL_CHL ) ? 300 : 80 );
+		gtk_tree_view_column_set_expand ( column, ( c == COL_CHL ) );
 		if ( c == COL_REC || c == COL_SIZE || c == COL_VPID || c == COL_APID || c == COL_FILE ) gtk_tree_view_column_set_visible ( column, FALSE );
 		gtk_tree_view_append_column ( zap->treeview, column );
 	}
 
 	gtk_container_add ( GTK_CONTAINER ( scroll ), GTK_WIDGET ( zap->treeview ) );
-	g_object_unref ( G_OBJECT (store) );
 
 	return scroll;
 }
@@ -174,33 +235,202 @@ static void zap_combo_dmx_add ( uint8_t n_elm, Zap *zap )
 	gtk_combo_box_set_active ( GTK_COMBO_BOX ( zap->combo_dmx ), 2 );
 }
 
-static gboolean zap_signal_parse_dvb_file ( const char *file, Zap *zap )
+/* Filters the view by the search text, the empty text shows the whole file */
+static void zap_search_apply ( Zap *zap )
 {
-	if ( file == NULL ) return FALSE;
-	if ( !g_file_test ( file, G_FILE_TEST_EXISTS ) ) return FALSE;
+	const char *text = gtk_entry_get_text ( GTK_ENTRY ( zap->entry_search ) );
+
+	if ( !text[0] ) { gtk_tree_view_set_model ( zap->treeview, GTK_TREE_MODEL ( zap->model_all ) ); return; }
+
+	ChTable *table = chmodel_table ( zap->model_all );
+
+	uint32_t *rows = NULL;
+	uint32_t n = chindex_search ( table->index, text, &rows );
+
+	ChModel *model = chmodel_new_filter ( table, rows, n );
+
+	gtk_tree_view_set_model ( zap->treeview, GTK_TREE_MODEL ( model ) );
+
+	g_object_unref ( model );
+}
+
+static void zap_search_changed ( G_GNUC_UNUSED GtkSearchEntry *entry, Zap *zap )
+{
+	zap_search_apply ( zap );
+}
+
+/* Enter: zap the first match */
+static void zap_search_activate ( G_GNUC_UNUSED GtkSearchEntry *entry, Zap *zap )
+{
+	GtkTreeModel *model = gtk_tree_view_get_model ( zap->treeview );
+
+	if ( gtk_tree_model_iter_n_children ( model, NULL ) == 0 ) return;
 
-	struct dvb_file *dvb_file;
-	struct dvb_entry *entry;
+	GtkTreePath *path = gtk_tree_path_new_first ();
 
-	dvb_file = dvb_read_file_format ( file, 0, FILE_DVBV5 );
+	gtk_tree_view_set_cursor ( zap->treeview, path, NULL, FALSE );
+	gtk_tree_view_row_activated ( zap->treeview, path, gtk_tree_view_get_column ( zap->treeview, COL_CHL ) );
 
-	if ( !dvb_file )
+	gtk_tree_path_free ( path );
+}
+
+/* Takes the model */
+static void zap_set_model ( Zap *zap, ChModel *model )
+{
+	if ( zap->model_all ) g_object_unref ( zap->model_all );
+
+	zap->model_all = model;
+
+	zap_search_apply ( zap );
+}
+
+static void zap_load_free ( ZapLoad *load )
+{
+	g_object_unref ( load->cancel );
+	g_object_unref ( load->zap );
+
+	free ( load->file );
+	free ( load );
+}
+
+/* Heap in use, main arena: the main thread's allocations */
+static size_t zap_bench_heap ( void )
+{
+#if defined ( __GLIBC__ ) && __GLIBC_PREREQ ( 2, 33 )
+	struct mallinfo2 mi = mallinfo2 ();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	struct mallinfo mi = mallinfo ();
+
+	return (size_t)mi.uordblks + (size_t)mi.hblkhd;
+#endif
+}
+
+/* The former list: file parsed in the main thread, then a 7-column GtkListStore filled row by row */
+static void zap_bench_store ( const ChTable *table, const ZapLoad *load )
+{
+	size_t heap = zap_bench_heap ();
+	gint64 t = g_get_monotonic_time ();
+
+	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING );
+
+	GtkTreeIter iter;
+
+	uint32_t i = 0; for ( i = 0; i < table->count; i++ )
 	{
-		g_critical ( "%s:: Read file format ( only DVBV5 ) failed.", __func__ );
-		return FALSE;
+		gtk_list_store_append ( store, &iter );
+		gtk_list_store_set    ( store, &iter, COL_NUM, i + 1, COL_CHL, chtable_name ( table, i ), COL_VPID, table->vpid[i], COL_APID, table->apid[i], -1 );
 	}
 
-	gtk_list_store_clear ( GTK_LIST_STORE ( gtk_tree_view_get_model ( zap->treeview ) ) );
+	gint64 t_fill = g_get_monotonic_time () - t;
+	size_t store_size = zap_bench_heap () - heap;
+
+	g_object_unref ( store );
+
+	g_message ( "%s:: %u rows | GtkListStore: parse %.1f ms, fill %.1f ms, %zu KiB ( %zu B / row ) | ChTable: parse + build %.1f ms, %zu KiB ( %zu B / row ) + index %zu KiB ",
+		__func__, table->count, (double)load->t_parse / 1000, (double)t_fill / 1000, store_size / 1024, store_size / MAX ( table->count, 1 ),
+		(double)load->t_table / 1000, table->size / 1024, table->size / MAX ( table->count, 1 ), chindex_size ( table->index ) / 1024 );
+}
+
+/* Main thread: the finished table replaces the model in one step */
+static void zap_load_done ( Zap *zap, GAsyncResult *res, ZapLoad *load )
+{
+	GError *error = NULL;
+
+	ChTable *table = g_task_propagate_pointer ( G_TASK ( res ), &error );
 
-	for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
+	if ( !table )
 	{
-		if ( entry->channel  ) zap_treeview_append ( entry->channel,  ( entry->audio_pid ) ? entry->audio_pid[0] : 0, ( entry->video_pid ) ? entry->video_pid[0] : 0, zap );
-		if ( entry->vchannel ) zap_treeview_append ( entry->vchannel, ( entry->audio_pid ) ? entry->audio_pid[0] : 0, ( entry->video_pid ) ? entry->video_pid[0] : 0, zap );
+		if ( !g_error_matches ( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) ) g_critical ( "%s:: %s", __func__, error->message );
+
+		g_error_free ( error );
+		zap_load_free ( load );
+
+		return;
 	}
 
-	dvb_file_free ( dvb_file );
+	if ( load->bench ) zap_bench_store ( table, load );
+
+	zap_set_model ( zap, chmodel_new ( table ) );
+	gtk_entry_set_text ( zap->entry_file, load->file );
+
+	chtable_unref ( table );
+
+	if ( zap->load_cancel == load->cancel ) g_clear_object ( &zap->load_cancel );
+
+	zap_load_free ( load );
+}
+
+/* Worker: parsing, indexing ( chdb ) and the list table */
+static void zap_load_thread ( GTask *task, G_GNUC_UNUSED gpointer source, ZapLoad *load, G_GNUC_UNUSED GCancellable *cancel )
+{
+	const char *file = load->file;
+
+	gint64 t = g_get_monotonic_time ();
+
+	ChDb *db = chdb_open ( file, FILE_DVBV5, SYS_UNDEFINED );
+
+	if ( !db ) { g_task_return_new_error ( task, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Read file format ( DVBV5 | " CHBIN_EXT " ) failed." ); return; }
 
-	gtk_entry_set_text ( zap->entry_file, file );
+	ChTable *table = chdb_table ( db );
+
+	chdb_unref ( db );
+
+	load->t_table = g_get_monotonic_time () - t;
+
+	g_message ( "%s:: %u rows, table %zu KiB, index %zu KiB, %.1f ms ", __func__, table->count,
+		table->size / 1024, chindex_size ( table->index ) / 1024, (double)load->t_table / 1000 );
+
+	// the former load: libdvbv5's parser, then the list store in zap_bench_store
+	if ( load->bench )
+	{
+		load->t_parse = -1000;
+
+		if ( !chbin_is_bin ( file ) )
+		{
+			t = g_get_monotonic_time ();
+
+			struct dvb_file *dvb_file = dvb_read_file_format ( file, 0, FILE_DVBV5 );
+
+			load->t_parse = g_get_monotonic_time () - t;
+
+			if ( dvb_file ) dvb_file_free ( dvb_file );
+		}
+	}
+
+	g_task_return_pointer ( task, table, (GDestroyNotify)chtable_unref );
+}
+
+static void zap_load_cancel ( Zap *zap )
+{
+	if ( !zap->load_cancel ) return;
+
+	g_cancellable_cancel ( zap->load_cancel );
+	g_clear_object ( &zap->load_cancel );
+}
+
+static gboolean zap_signal_parse_dvb_file ( const char *file, Zap *zap )
+{
+	if ( file == NULL ) return FALSE;
+	if ( !g_file_test ( file, G_FILE_TEST_EXISTS ) ) return FALSE;
+
+	// a newer file replaces one still loading
+	zap_load_cancel ( zap );
+	zap->load_cancel = g_cancellable_new ();
+
+	ZapLoad *load = g_new0 ( ZapLoad, 1 );
+
+	load->zap    = g_object_ref ( zap );
+	load->file   = g_strdup ( file );
+	load->cancel = g_object_ref ( zap->load_cancel );
+	load->bench  = ( g_getenv ( ZAP_BENCH_ENV ) != NULL );
+
+	// load outlives the worker: freed in zap_load_done
+	GTask *task = g_task_new ( zap, load->cancel, (GAsyncReadyCallback)zap_load_done, load );
+	g_task_set_task_data ( task, load, NULL );
+	g_task_run_in_thread ( task, (GTaskThreadFunc)zap_load_thread );
+	g_object_unref ( task );
 
 	return TRUE;
 }
@@ -233,8 +463,94 @@ static void zap_signal_drag_in ( G_GNUC_UNUSED GtkTreeView *tree_view, GdkDragCo
 
 static void zap_clicked_clear ( G_GNUC_UNUSED GtkButton *button, Zap *zap )
 {
+	zap_load_cancel ( zap );
+
 	gtk_entry_set_text ( zap->entry_file, "" );
-	gtk_list_store_clear ( GTK_LIST_STORE ( gtk_tree_view_get_model ( zap->treeview ) ) );
+
+	// a new empty model: no row-deleted per row
+	zap_set_model ( zap, chmodel_new ( NULL ) );
+}
+
+static enum dvb_file_formats zap_format_by_ext ( const char *file )
+{
+	if ( g_str_has_suffix ( file, ".vdr"     ) ) return FILE_VDR;
+	if ( g_str_has_suffix ( file, ".channel" ) ) return FILE_CHANNEL;
+	if ( g_str_has_suffix ( file, ".zap"     ) ) return FILE_ZAP;
+
+	return FILE_DVBV5;
+}
+
+/* A ZAP file does not name its delivery system; SYS_UNDEFINED - cancelled */
+static uint32_t zap_ask_delsys ( GtkWindow *window )
+{
+	struct DelSys { const char *name; uint32_t delsys; } delsys_n[] =
+	{
+		{ "DVB-T / T2", SYS_DVBT },
+		{ "DVB-C",      SYS_DVBC_ANNEX_A },
+		{ "DVB-S / S2", SYS_DVBS },
+		{ "ATSC",       SYS_ATSC }
+	};
+
+	GtkWidget *dialog = gtk_message_dialog_new ( window, GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_OK_CANCEL, "ZAP: delivery system?" );
+
+	GtkComboBoxText *combo = (GtkComboBoxText *)gtk_combo_box_text_new ();
+
+	uint8_t c = 0; for ( c = 0; c < G_N_ELEMENTS ( delsys_n ); c++ ) gtk_combo_box_text_append_text ( combo, delsys_n[c].name );
+
+	gtk_combo_box_set_active ( GTK_COMBO_BOX ( combo ), 0 );
+	gtk_widget_set_visible ( GTK_WIDGET ( combo ), TRUE );
+
+	GtkBox *area = GTK_BOX ( gtk_message_dialog_get_message_area ( GTK_MESSAGE_DIALOG ( dialog ) ) );
+	gtk_box_pack_start ( area, GTK_WIDGET ( combo ), FALSE, FALSE, 0 );
+
+	uint32_t delsys = SYS_UNDEFINED;
+
+	if ( gtk_dialog_run ( GTK_DIALOG ( dialog ) ) == GTK_RESPONSE_OK ) delsys = delsys_n[gtk_combo_box_get_active ( GTK_COMBO_BOX ( combo ) )].delsys;
+
+	gtk_widget_destroy ( dialog );
+
+	return delsys;
+}
+
+static void zap_clicked_convert ( GtkButton *button, Zap *zap )
+{
+	GtkWindow *window = GTK_WINDOW ( gtk_widget_get_toplevel ( GTK_WIDGET ( button ) ) );
+
+	const char *file = gtk_entry_get_text ( zap->entry_file );
+
+	if ( !g_file_test ( file, G_FILE_TEST_EXISTS ) ) { dvb5_message_dialog ( file, "File?", GTK_MESSAGE_WARNING, window ); return; }
+
+	gboolean src_bin = chbin_is_bin ( file );
+
+	// libdvbv5 writes VDR, but does not read it
+	if ( !src_bin && zap_format_by_ext ( file ) == FILE_VDR ) { dvb5_message_dialog ( file, "VDR: export only.", GTK_MESSAGE_WARNING, window ); return; }
+
+	uint32_t delsys = SYS_UNDEFINED;
+
+	if ( !src_bin && zap_format_by_ext ( file ) == FILE_ZAP && ( delsys = zap_ask_delsys ( window ) ) == SYS_UNDEFINED ) return;
+
+	g_autofree char *base = g_path_get_basename ( file );
+	g_autofree char *name = g_strconcat ( base, ( src_bin ) ? ".conf" : CHBIN_EXT, NULL );
+	g_autofree char *dir  = g_path_get_dirname ( file );
+
+	g_autofree char *out = file_save ( dir, name, window );
+
+	if ( !out ) return;
+
+	gboolean ret = FALSE, out_bin = g_str_has_suffix ( out, CHBIN_EXT );
+
+	if ( src_bin == out_bin )
+	{
+		dvb5_message_dialog ( out, ( src_bin ) ? "DVBV5 | *.vdr | *.channel | *.zap ?" : "*" CHBIN_EXT " ?", GTK_MESSAGE_WARNING, window );
+		return;
+	}
+
+	if ( out_bin )
+		ret = chbin_import ( file, zap_format_by_ext ( file ), delsys, out );
+	else
+		ret = chbin_export ( file, out, zap_format_by_ext ( out ) );
+
+	if ( !ret ) dvb5_message_dialog ( out, "Convert failed.", GTK_MESSAGE_ERROR, window );
 }
 
 static void zap_signal_record_file ( GtkEntry *entry, GtkEntryIconPosition icon_pos, G_GNUC_UNUSED GdkEventButton *event, G_GNUC_UNUSED Zap *zap )
@@ -262,6 +578,28 @@ static void zap_set_active_toggled_block ( ulong signal_id, gboolean active, Gtk
 	g_signal_handler_unblock ( toggle, signal_id );
 }
 
+static const char * zap_tee ( Zap *zap )
+{
+	if ( zap->tee ) return NULL;
+
+	uint8_t adapter = 0, demux = 0;
+	g_signal_emit_by_name ( zap, "zap-get-adapter", &adapter );
+	g_signal_emit_by_name ( zap, "zap-get-demux",   &demux   );
+
+	zap->tee = dvr_tee_new ( adapter, demux );
+
+	return ( zap->tee ) ? NULL : "Cannot open dvr device";
+}
+
+/* The dvr device is released once nothing reads from it */
+static void zap_tee_release ( Zap *zap )
+{
+	if ( !zap->tee || player_count ( zap->player ) || !zap->dm->stop_rec ) return;
+
+	dvr_tee_free ( zap->tee );
+	zap->tee = NULL;
+}
+
 static void zap_signal_toggled_record ( GtkCheckButton *button, Zap *zap )
 {
 	gboolean fe_lock = FALSE;
@@ -278,9 +616,6 @@ static void zap_signal_toggled_record ( GtkCheckButton *button, Zap *zap )
 		return;
 	}
 
-	uint8_t adapter = 0;
-	g_signal_emit_by_name ( zap, "zap-get-adapter", &adapter );
-
 	const char *res = NULL;
 	const char *file_rec = gtk_entry_get_text ( zap->entry_rec );
 
@@ -289,15 +624,23 @@ static void zap_signal_toggled_record ( GtkCheckButton *button, Zap *zap )
 	if ( !active )
 	{
 		zap->dm->stop_rec = 1; zap->dm->total_rec = 0;
+
+		if ( zap->tee ) dvr_tee_record_stop ( zap->tee );
+		zap_tee_release ( zap );
 	}
 	else 
 	{
 		zap->dm->stop_rec = 0; zap->dm->total_rec = 0;
-		res = dvr_rec_create ( adapter, file_rec, zap->dm );
+
+		res = zap_tee ( zap );
+		if ( !res ) res = dvr_tee_record ( zap->tee, file_rec, zap->dm );
 	}
 
 	if ( res )
 	{
+		zap->dm->stop_rec = 1;
+		zap_tee_release ( zap );
+
 		zap_set_active_toggled_block ( zap->rec_signal_id, FALSE, zap->checkbutton );
 
 		dvb5_message_dialog ( "", res, GTK_MESSAGE_WARNING, window );
@@ -344,64 +687,61 @@ static GtkBox * zap_set_record_file ( const char *file, Zap *zap )
 	return v_box;
 }
 
-static void zap_signal_clicked_play ( GtkButton *button, Zap *zap )
+static void zap_player_exited ( G_GNUC_UNUSED GPid pid, Zap *zap )
 {
-	GtkWindow *window = ( button ) ? GTK_WINDOW ( gtk_widget_get_toplevel ( GTK_WIDGET ( button ) ) ) : NULL;
+	if ( player_count ( zap->player ) ) return;
 
-	if ( button )
-	{
-		gboolean fe_lock = FALSE;
-		g_signal_emit_by_name ( zap, "zap-get-felock", &fe_lock );
+	gtk_button_set_label ( zap->button_play, "Play" );
 
-		if ( !fe_lock || !zap->channel )
-		{
-			dvb5_message_dialog ( "", "Zap?", GTK_MESSAGE_WARNING, window );
+	zap_tee_release ( zap );
+}
 
-			return;
-		}
-	}
+/* Play starts a session, Stop ends them all; Ctrl + Play - one more session */
+static void zap_signal_clicked_play ( GtkButton *button, Zap *zap )
+{
+	GtkWindow *window = GTK_WINDOW ( gtk_widget_get_toplevel ( GTK_WIDGET ( button ) ) );
+
+	GdkModifierType state = 0;
+	gboolean more = ( gtk_get_current_event_state ( &state ) && ( state & GDK_CONTROL_MASK ) );
 
-	int pid = 0, SIZE = 1024;
-	const char *file = gtk_entry_get_text ( zap->entry_play );
+	if ( player_count ( zap->player ) && !more ) { player_stop ( zap->player, 0 ); return; }
 
-	char line[SIZE];
-	FILE *fp = popen ( "ps -T -f -o pid:1,args", "r" );
+	gboolean fe_lock = FALSE;
+	g_signal_emit_by_name ( zap, "zap-get-felock", &fe_lock );
 
-	while ( !feof (fp) )
+	if ( !fe_lock || !zap->channel )
 	{
-		if ( fgets ( line, SIZE, fp ) )
-		{
-			fgets ( line, SIZE, fp );
+		dvb5_message_dialog ( "", "Zap?", GTK_MESSAGE_WARNING, window );
 
-			if ( g_strrstr ( line, file ) ) pid = (int)strtoul ( line, NULL, 10 );
-		}
+		return;
 	}
 
-	pclose ( fp );
+	const char *cmd = gtk_entry_get_text ( zap->entry_play );
 
-	if ( !button && !pid ) return;
+	// a command with its own dvr device reads it itself; else the stream comes on stdin
+	gboolean own = ( g_strstr_len ( cmd, -1, "/dev/dvb/" ) != NULL );
 
-	if ( !pid )
-	{
-		GError *error = NULL;
-		GAppInfo *app = g_app_info_create_from_commandline ( file, NULL, G_APP_INFO_CREATE_NONE, &error );
+	const char *res = ( own ) ? NULL : zap_tee ( zap );
 
-		g_app_info_launch ( app, NULL, NULL, &error );
+	if ( res ) { dvb5_message_dialog ( "", res, GTK_MESSAGE_ERROR, window ); return; }
 
-		if ( error )
-		{
-			dvb5_message_dialog ( "", error->message, GTK_MESSAGE_ERROR, window );
+	int fd = -1;
+	GError *error = NULL;
 
-			g_error_free ( error );
-		}
-		else
-			{ gtk_button_set_label ( button, "Stop" ); }
+	if ( !player_start ( zap->player, cmd, ( own ) ? NULL : &fd, &error ) )
+	{
+		dvb5_message_dialog ( "", error->message, GTK_MESSAGE_ERROR, window );
 
-		g_object_unref ( app );
+		g_error_free ( error );
+
+		zap_tee_release ( zap );
 	}
 	else
-		{ if ( button ) gtk_button_set_label ( button, "Play" ); kill ( pid, SIGINT ); }
+	{
+		if ( fd != -1 ) dvr_tee_play ( zap->tee, fd );
 
+		gtk_button_set_label ( button, "Stop" );
+	}
 }
 
 static GtkBox * zap_set_play_file ( Zap *zap )
@@ -414,11 +754,12 @@ static GtkBox * zap_set_play_file ( Zap *zap )
 	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
 
 	zap->entry_play = (GtkEntry *)gtk_entry_new ();
-	gtk_entry_set_text ( zap->entry_play, "mplayer -nocache /dev/dvb/adapter0/dvr0" );
+	gtk_entry_set_text ( zap->entry_play, "mplayer -nocache -" );
 	g_object_set ( zap->entry_play, "editable", TRUE, NULL );
 
 	zap->button_play = (GtkButton *)gtk_button_new_with_label ( " Play " );
 	gtk_widget_set_size_request ( GTK_WIDGET ( zap->button_play ) , 100, -1 );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( zap->button_play ), "Ctrl + Play: one more player" );
 	g_signal_connect ( zap->button_play, "clicked", G_CALLBACK ( zap_signal_clicked_play ), zap );
 
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( zap->button_play ), FALSE, FALSE, 0 );
@@ -440,9 +781,13 @@ static void zap_handler_stop ( Zap *zap )
 	zap->dm->stop_rec = 1;
 	zap->dm->total_rec = 0;
 
-	zap_signal_clicked_play ( NULL, zap );
+	player_stop ( zap->player, 0 );
+
+	dvr_tee_free ( zap->tee );
+	zap->tee = NULL;
 
 	if ( zap->channel ) { free ( zap->channel ); zap->channel = NULL; }
+	if ( zap->channel_prev ) { free ( zap->channel_prev ); zap->channel_prev = NULL; }
 }
 
 static void zap_init ( Zap *zap )
@@ -451,6 +796,8 @@ static void zap_init ( Zap *zap )
 	zap->dm->stop_rec  = 1;
 	zap->dm->total_rec = 0;
 
+	zap->player = player_new ( (PlayerExit)zap_player_exited, zap );
+
 	GtkBox *box = GTK_BOX ( zap );
 	gtk_orientable_set_orientation ( GTK_ORIENTABLE ( box ), GTK_ORIENTATION_VERTICAL );
 	gtk_box_set_spacing ( box, 10 );
@@ -461,8 +808,17 @@ static void zap_init ( Zap *zap )
 	gtk_widget_set_margin_start  ( GTK_WIDGET ( box ), 10 );
 	gtk_widget_set_margin_end    ( GTK_WIDGET ( box ), 10 );
 
+	zap->entry_search = (GtkSearchEntry *)gtk_search_entry_new ();
+	gtk_entry_set_placeholder_text ( GTK_ENTRY ( zap->entry_search ), "Channel, service id or frequency" );
+	gtk_widget_set_visible ( GTK_WIDGET ( zap->entry_search ), TRUE );
+	gtk_box_pack_start ( box, GTK_WIDGET ( zap->entry_search ), FALSE, FALSE, 0 );
+
 	gtk_box_pack_start ( box, GTK_WIDGET ( zap_create_treeview_scroll ( zap ) ), TRUE, TRUE, 0 );
 
+	// "changed", not the delayed "search-changed": the index answers within a keystroke
+	g_signal_connect ( zap->entry_search, "changed",  G_CALLBACK ( zap_search_changed  ), zap );
+	g_signal_connect ( zap->entry_search, "activate", G_CALLBACK ( zap_search_activate ), zap );
+
 	g_signal_connect ( zap->treeview, "drag-data-received", G_CALLBACK ( zap_signal_drag_in ), zap );
 	g_signal_connect ( zap->treeview, "row-activated",      G_CALLBACK ( zap_signal_trw_act ), zap );
 
@@ -473,6 +829,11 @@ static void zap_init ( Zap *zap )
 	GtkButton *button_clear = (GtkButton *)gtk_button_new_from_icon_name ( "edit-clear", GTK_ICON_SIZE_MENU );
 	gtk_widget_set_visible ( GTK_WIDGET ( button_clear ), TRUE );
 
+	GtkButton *button_conv = (GtkButton *)gtk_button_new_from_icon_name ( "document-save-as", GTK_ICON_SIZE_MENU );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( button_conv ), "DVBV5 | *.channel | *.zap -> *" CHBIN_EXT " ( binary )\n*" CHBIN_EXT " -> DVBV5 | *.vdr | *.channel | *.zap" );
+	gtk_widget_set_visible ( GTK_WIDGET ( button_conv ), TRUE );
+	g_signal_connect ( button_conv, "clicked", G_CALLBACK ( zap_clicked_convert ), zap );
+
 	zap->entry_file = (GtkEntry *)gtk_entry_new ();
 	gtk_entry_set_text ( zap->entry_file, "dvb_channel.conf" );
 	g_object_set ( zap->entry_file, "editable", FALSE, NULL );
@@ -483,9 +844,18 @@ static void zap_init ( Zap *zap )
 
 	const char *icon = "info";
 	gtk_entry_set_icon_from_icon_name ( zap->entry_file, GTK_ENTRY_ICON_PRIMARY, icon );
-	gtk_entry_set_icon_tooltip_text ( GTK_ENTRY ( zap->entry_file ), GTK_ENTRY_ICON_PRIMARY, "Format only DVBV5" );
+	gtk_entry_set_icon_tooltip_text ( GTK_ENTRY ( zap->entry_file ), GTK_ENTRY_ICON_PRIMARY, "Format DVBV5 or *" CHBIN_EXT );
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( zap->entry_file ), TRUE, TRUE, 0 );
 
+	zap->check_pretune = (GtkCheckButton *)gtk_check_button_new_with_label ( "Pre-tune" );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( zap->check_pretune ), "Keep the neighbouring channels tuned on idle adapters" );
+	g_signal_connect ( zap->check_pretune, "toggled", G_CALLBACK ( zap_signal_toggled_pretune ), zap );
+	gtk_widget_set_visible ( GTK_WIDGET ( zap->check_pretune ), TRUE );
+
+	zap->check_eit = (GtkCheckButton *)gtk_check_button_new_with_label ( "EIT" );
+	gtk_widget_set_tooltip_text ( GTK_WIDGET ( zap->check_eit ), "DMX_OUT_TS_TAP | DMX_OUT_TSDEMUX_TAP: + EIT ( pid 0x12 )" );
+	gtk_widget_set_visible ( GTK_WIDGET ( zap->check_eit ), TRUE );
+
 	zap->combo_dmx = (GtkComboBoxText *) gtk_combo_box_text_new ();
 	zap_combo_dmx_add ( G_N_ELEMENTS ( out_demux_n ), zap );
 	gtk_box_pack_start ( h_box, GTK_WIDGET ( zap->combo_dmx ), TRUE, TRUE, 0 );
@@ -494,6 +864,9 @@ static void zap_init ( Zap *zap )
 	gtk_widget_set_visible ( GTK_WIDGET ( zap->combo_dmx  ), TRUE );
 
 	gtk_box_pack_end   ( h_box, GTK_WIDGET ( button_clear ), FALSE, FALSE, 0 );
+	gtk_box_pack_end   ( h_box, GTK_WIDGET ( zap->check_pretune ), FALSE, FALSE, 0 );
+	gtk_box_pack_end   ( h_box, GTK_WIDGET ( zap->check_eit ), FALSE, FALSE, 0 );
+	gtk_box_pack_end   ( h_box, GTK_WIDGET ( button_conv  ), FALSE, FALSE, 0 );
 
 	char file_rec[PATH_MAX];
 	sprintf ( file_rec, "%s/%s.ts", g_get_home_dir (), "Record" );
@@ -507,8 +880,13 @@ static void zap_init ( Zap *zap )
 	gtk_box_pack_start ( box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
 
 	zap->channel = NULL;
+	zap->channel_prev = NULL;
+	zap->load_cancel  = NULL;
+
+	g_signal_connect ( zap, "destroy", G_CALLBACK ( zap_load_cancel ), NULL );
 
 	g_signal_connect ( zap, "zap-stop",     G_CALLBACK ( zap_handler_stop ), NULL );
+	g_signal_connect ( zap, "zap-set-adapter", G_CALLBACK ( zap_handler_set_adapter ), NULL );
 	g_signal_connect ( zap, "zap-get-size", G_CALLBACK ( zap_handler_get_size ), NULL );
 }
 
@@ -516,8 +894,12 @@ static void zap_finalize ( GObject *object )
 {
 	Zap *zap = ZAP_BOX ( object );
 
+	dvr_tee_free ( zap->tee );
+	player_free ( zap->player );
 	free ( zap->dm );
+	if ( zap->model_all ) g_object_unref ( zap->model_all );
 	if ( zap->channel ) free ( zap->channel );
+	if ( zap->channel_prev ) free ( zap->channel_prev );
 
 	G_OBJECT_CLASS (zap_parent_class)->finalize (object);
 }
@@ -541,8 +923,14 @@ static void zap_class_init ( ZapClass *class )
 	g_signal_new ( "zap-stop", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
 		0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
 
+	g_signal_new ( "zap-pretune", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_STRV );
+
+	g_signal_new ( "zap-set-adapter", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_UINT );
+
 	g_signal_new ( "zap-set-data", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST,
-		0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING );
+		0, NULL, NULL, NULL, G_TYPE_NONE, 4, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING );
 }
 
 Zap * zap_new (void)
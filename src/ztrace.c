@@ -0,0 +1,294 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "ztrace.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dvb/dmx.h>
+
+#define ZTRACE_TS_SIZE 188
+#define ZTRACE_TIMEOUT ( 5 * G_USEC_PER_SEC )
+
+struct _ZtCapture
+{
+	struct dvb_open_descriptor *fd;
+	ZapTrace *trace;
+	GThread *thread;
+
+	gint stop, finished;
+};
+
+void ztrace_begin ( ZapTrace *tr, const char *channel, gint64 now )
+{
+	memset ( tr, 0, sizeof ( ZapTrace ) );
+
+	tr->start = now;
+	tr->wall  = g_get_real_time ();
+
+	if ( channel ) g_strlcpy ( tr->channel, channel, sizeof ( tr->channel ) );
+}
+
+/* The first time only; 0 stays reserved for "not reached" */
+void ztrace_mark ( ZapTrace *tr, enum ztrace_mark m, gint64 now )
+{
+	if ( tr->mark[m] ) return;
+
+	tr->mark[m] = MAX ( 1, now - tr->start );
+}
+
+/* PAT -> PMT pid of sid, PMT of sid, first video packet, first random_access_indicator on the video pid */
+gboolean ztrace_ts_packet ( ZapTrace *tr, const uint8_t *pkt, gint64 now )
+{
+	if ( pkt[0] != 0x47 ) return FALSE;
+
+	uint16_t pid = (uint16_t)( ( ( pkt[1] & 0x1f ) << 8 ) | pkt[2] );
+	uint8_t pusi = pkt[1] & 0x40, afc = ( pkt[3] >> 4 ) & 0x03;
+
+	const uint8_t *pl = pkt + 4, *end = pkt + ZTRACE_TS_SIZE;
+
+	if ( afc & 0x02 )
+	{
+		if ( tr->vpid && pid == tr->vpid && pkt[4] && ( pkt[5] & 0x40 ) ) ztrace_mark ( tr, ZT_IFRAME, now );
+
+		pl += 1 + pkt[4];
+	}
+
+	if ( tr->vpid && pid == tr->vpid ) { ztrace_mark ( tr, ZT_VIDEO, now ); return TRUE; }
+
+	if ( !( afc & 0x01 ) || !pusi || pl >= end ) return FALSE;
+
+	// section start: pointer_field, then table_id and section_length
+	const uint8_t *s = pl + 1 + pl[0];
+
+	if ( s + 8 > end ) return FALSE;
+
+	uint16_t slen = (uint16_t)( ( ( s[1] & 0x0f ) << 8 ) | s[2] );
+
+	if ( slen < 9 ) return FALSE;
+
+	const uint8_t *s_end = MIN ( s + 3 + slen - 4, end ); // without CRC; a PAT over one packet is scanned partially
+
+	if ( pid == 0 && s[0] == 0x00 && !tr->mark[ZT_PAT] )
+	{
+		const uint8_t *p = s + 8; for ( p = s + 8; p + 4 <= s_end; p += 4 )
+		{
+			uint16_t prog = (uint16_t)( ( p[0] << 8 ) | p[1] );
+
+			if ( prog && prog == tr->sid ) tr->pmt_pid = (uint16_t)( ( ( p[2] & 0x1f ) << 8 ) | p[3] );
+		}
+
+		ztrace_mark ( tr, ZT_PAT, now );
+
+		return TRUE;
+	}
+
+	if ( tr->pmt_pid && pid == tr->pmt_pid && s[0] == 0x02 && ( ( s[3] << 8 ) | s[4] ) == tr->sid )
+	{
+		ztrace_mark ( tr, ZT_PMT, now );
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+gboolean ztrace_stream_done ( const ZapTrace *tr )
+{
+	if ( !tr->mark[ZT_PAT] ) return FALSE;
+	if ( tr->sid  && !tr->mark[ZT_PMT] ) return FALSE;
+	if ( tr->vpid && ( !tr->mark[ZT_VIDEO] || !tr->mark[ZT_IFRAME] ) ) return FALSE;
+
+	return TRUE;
+}
+
+char * ztrace_to_str ( const ZapTrace *tr )
+{
+	const char *names[ZT_ALL] = { "Parse", "Tune", "Lock", "PAT", "PMT", "Video", "I-frame" };
+
+	GString *str = g_string_new ( NULL );
+
+	uint8_t m = 0; for ( m = 0; m < ZT_ALL; m++ )
+	{
+		if ( m == ZT_SET_PARMS && !tr->retune ) continue;
+
+		if ( tr->mark[m] )
+			g_string_append_printf ( str, "%s%s %" G_GINT64_FORMAT, ( str->len ) ? " | " : "", names[m], tr->mark[m] / 1000 );
+		else
+			g_string_append_printf ( str, "%s%s -", ( str->len ) ? " | " : "", names[m] );
+	}
+
+	g_string_append ( str, " ms" );
+
+	return g_string_free ( str, FALSE );
+}
+
+/* One CSV row per zap, times in ms, empty when the milestone was not reached */
+gboolean ztrace_log_append ( const char *file, const ZapTrace *tr )
+{
+	gboolean header = !g_file_test ( file, G_FILE_TEST_EXISTS );
+
+	FILE *fp = fopen ( file, "a" );
+
+	if ( !fp ) { g_warning ( "%s:: %s: %m ", __func__, file ); return FALSE; }
+
+	if ( header ) fprintf ( fp, "time,channel,frequency,sid,retune,parse,set_parms,lock,pat,pmt,video,iframe\n" );
+
+	g_autoptr ( GDateTime ) date = g_date_time_new_from_unix_local ( tr->wall / G_USEC_PER_SEC );
+	g_autofree char *date_str = g_date_time_format ( date, "%F %T" );
+	g_autofree char *channel = g_strdelimit ( g_strdup ( tr->channel ), ",\"", ' ' );
+
+	fprintf ( fp, "%s,%s,%u,%u,%u", date_str, channel, tr->freq, tr->sid, tr->retune );
+
+	uint8_t m = 0; for ( m = 0; m < ZT_ALL; m++ )
+	{
+		if ( tr->mark[m] ) fprintf ( fp, ",%.1f", (double)tr->mark[m] / 1000 ); else fprintf ( fp, "," );
+	}
+
+	fprintf ( fp, "\n" );
+
+	return ( fclose ( fp ) == 0 );
+}
+
+/*
+* Frontend stand-in for the zap benchmark: a recorded TS is fed through the same milestone
+* detector, its clock is the byte position at the given mux bitrate ( bit/s ).
+*/
+gboolean ztrace_replay ( const char *file, uint16_t sid, uint16_t vpid, uint32_t bitrate, ZapTrace *tr )
+{
+	FILE *fp = fopen ( file, "rb" );
+
+	if ( !fp ) { g_warning ( "%s:: %s: %m ", __func__, file ); return FALSE; }
+
+	g_autofree char *name = g_path_get_basename ( file );
+
+	ztrace_begin ( tr, name, 0 );
+
+	tr->sid  = sid;
+	tr->vpid = vpid;
+
+	uint8_t buf[ZTRACE_TS_SIZE * 256];
+	uint64_t pos = 0;
+	size_t len = 0, rest = 0;
+
+	while ( !ztrace_stream_done ( tr ) && ( len = fread ( buf + rest, 1, sizeof ( buf ) - rest, fp ) ) > 0 )
+	{
+		len += rest;
+
+		size_t i = 0;
+
+		while ( i + ZTRACE_TS_SIZE <= len )
+		{
+			if ( buf[i] != 0x47 ) { i++; continue; }
+
+			gint64 now = (gint64)( ( pos + i ) * 8 * G_USEC_PER_SEC / ( ( bitrate ) ? bitrate : 1 ) );
+
+			ztrace_ts_packet ( tr, buf + i, now );
+
+			i += ZTRACE_TS_SIZE;
+		}
+
+		rest = len - i;
+		memmove ( buf, buf + i, rest );
+		pos += i;
+	}
+
+	fclose ( fp );
+
+	return TRUE;
+}
+
+static gpointer ztrace_capture_thread ( ZtCapture *cap )
+{
+	int fd = dvb_dev_get_fd ( cap->fd );
+	gint64 deadline = cap->trace->start + ZTRACE_TIMEOUT;
+	uint16_t pmt_pid = 0;
+
+	uint8_t buf[ZTRACE_TS_SIZE * 64];
+
+	while ( !g_atomic_int_get ( &cap->stop ) && g_get_monotonic_time () < deadline )
+	{
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		if ( poll ( &pfd, 1, 50 ) <= 0 ) continue;
+
+		ssize_t len = read ( fd, buf, sizeof ( buf ) );
+
+		if ( len <= 0 ) continue; // EOVERFLOW: the next read resumes
+
+		gint64 now = g_get_monotonic_time ();
+
+		ssize_t i = 0; for ( i = 0; i + ZTRACE_TS_SIZE <= len; i += ZTRACE_TS_SIZE ) ztrace_ts_packet ( cap->trace, buf + i, now );
+
+		// the PMT pid is known only after the PAT
+		if ( !pmt_pid && cap->trace->pmt_pid )
+		{
+			pmt_pid = cap->trace->pmt_pid;
+
+			if ( ioctl ( fd, DMX_ADD_PID, &pmt_pid ) < 0 ) g_warning ( "%s:: DMX_ADD_PID 0x%04x: %m ", __func__, pmt_pid );
+		}
+
+		if ( ztrace_stream_done ( cap->trace ) ) break;
+	}
+
+	g_atomic_int_set ( &cap->finished, 1 );
+
+	return NULL;
+}
+
+/*
+* Stream milestones of the zap in trace: one TS tap filter on the PAT and the video pid ( + PMT once found ),
+* read by its own thread for up to ZTRACE_TIMEOUT. The frontend milestones are left to the caller.
+*/
+ZtCapture * ztrace_capture_start ( struct dvb_device *dvb, const char *demux_dev, ZapTrace *tr )
+{
+	struct dvb_open_descriptor *fd = dvb_dev_open ( dvb, demux_dev, O_RDWR | O_NONBLOCK );
+
+	if ( !fd ) { g_warning ( "%s:: failed opening %s", __func__, demux_dev ); return NULL; }
+
+	if ( dvb_dev_dmx_set_pesfilter ( fd, 0, DMX_PES_OTHER, DMX_OUT_TSDEMUX_TAP, ZTRACE_TS_SIZE * 1024 ) < 0 )
+	{
+		g_warning ( "%s:: set pes filter failed.", __func__ );
+		dvb_dev_close ( fd );
+		return NULL;
+	}
+
+	uint16_t vpid = tr->vpid;
+
+	if ( vpid && ioctl ( dvb_dev_get_fd ( fd ), DMX_ADD_PID, &vpid ) < 0 ) g_warning ( "%s:: DMX_ADD_PID 0x%04x: %m ", __func__, vpid );
+
+	ZtCapture *cap = g_new0 ( ZtCapture, 1 );
+
+	cap->fd = fd;
+	cap->trace = tr;
+	cap->thread = g_thread_new ( "zap-trace", (GThreadFunc)ztrace_capture_thread, cap );
+
+	return cap;
+}
+
+gboolean ztrace_capture_finished ( ZtCapture *cap )
+{
+	return ( g_atomic_int_get ( &cap->finished ) == 1 );
+}
+
+/* Joins the thread: the trace is complete after this */
+void ztrace_capture_stop ( ZtCapture *cap )
+{
+	if ( !cap ) return;
+
+	g_atomic_int_set ( &cap->stop, 1 );
+	g_thread_join ( cap->thread );
+
+	dvb_dev_close ( cap->fd );
+	free ( cap );
+}
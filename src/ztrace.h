@@ -0,0 +1,65 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-dev.h>
+
+#include <glib.h>
+
+#define ZTRACE_HIST 100
+
+enum ztrace_mark
+{
+	ZT_PARSE,
+	ZT_SET_PARMS,
+	ZT_LOCK,
+	ZT_PAT,
+	ZT_PMT,
+	ZT_VIDEO,
+	ZT_IFRAME,
+	ZT_ALL
+};
+
+typedef struct _ZapTrace ZapTrace;
+
+struct _ZapTrace
+{
+	gint64 start; // monotonic µs at dvb_zap entry
+	gint64 wall;  // real time µs, for the log
+	gint64 mark[ZT_ALL]; // µs since start, 0 not reached
+
+	uint32_t freq;
+	uint16_t sid, vpid, pmt_pid;
+	gboolean retune;
+
+	char channel[64];
+};
+
+typedef struct _ZtCapture ZtCapture;
+
+void ztrace_begin ( ZapTrace *, const char *, gint64 );
+
+void ztrace_mark ( ZapTrace *, enum ztrace_mark, gint64 );
+
+gboolean ztrace_ts_packet ( ZapTrace *, const uint8_t *, gint64 );
+
+gboolean ztrace_stream_done ( const ZapTrace * );
+
+char * ztrace_to_str ( const ZapTrace * );
+
+gboolean ztrace_log_append ( const char *, const ZapTrace * );
+
+gboolean ztrace_replay ( const char *, uint16_t, uint16_t, uint32_t, ZapTrace * );
+
+ZtCapture * ztrace_capture_start ( struct dvb_device *, const char *, ZapTrace * );
+
+gboolean ztrace_capture_finished ( ZtCapture * );
+
+void ztrace_capture_stop ( ZtCapture * );
@@ -0,0 +1,269 @@
+/*
+* Copyright 2021 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "sched.h"
+
+#include <string.h>
+
+/* The scheduler on a fake clock and fake tuners: no timerfd, every tick is driven from here */
+
+typedef struct _Fake Fake;
+
+struct _Fake
+{
+	int64_t now;
+	uint32_t starts, stops, plans;
+	uint8_t adapter; // of the last start
+	gboolean fail;   // the next start fails
+};
+
+static int64_t fake_now ( gpointer data )
+{
+	Fake *f = data;
+
+	return f->now;
+}
+
+static gboolean fake_start ( gpointer data, const SchedTuner *t, G_GNUC_UNUSED const SchedRec *rec )
+{
+	Fake *f = data;
+
+	if ( f->fail ) return FALSE;
+
+	f->starts++;
+	f->adapter = t->adapter;
+
+	return TRUE;
+}
+
+static void fake_stop ( gpointer data, G_GNUC_UNUSED const SchedTuner *t, G_GNUC_UNUSED const SchedRec *rec )
+{
+	Fake *f = data;
+
+	f->stops++;
+}
+
+static void fake_plan ( gpointer data, G_GNUC_UNUSED uint32_t conflicts )
+{
+	Fake *f = data;
+
+	f->plans++;
+}
+
+static const SchedOps fake_ops = { fake_now, fake_start, fake_stop, fake_plan };
+
+static Sched * fake_sched ( Fake *f, uint8_t n_tuners )
+{
+	SchedTuner tuners[4];
+	memset ( tuners, 0, sizeof ( tuners ) );
+
+	uint8_t t = 0; for ( t = 0; t < n_tuners; t++ ) tuners[t].adapter = t;
+
+	memset ( f, 0, sizeof ( Fake ) );
+	f->now = 1000;
+
+	return sched_new ( &fake_ops, f, tuners, n_tuners, FALSE );
+}
+
+static uint32_t fake_add ( Sched *s, uint32_t freq, int64_t start, int64_t stop )
+{
+	SchedRec rec;
+	memset ( &rec, 0, sizeof ( SchedRec ) );
+
+	rec.channel = "Channel";
+	rec.file = "dvb_channel.conf";
+	rec.out = "out.ts";
+	rec.tp.freq = freq;
+	rec.start = start;
+	rec.stop = stop;
+	rec.pre = SCHED_PRE;
+	rec.post = SCHED_POST;
+
+	return sched_add ( s, &rec );
+}
+
+static const SchedRec * fake_rec ( Sched *s, uint32_t id )
+{
+	uint32_t i = 0, n = 0;
+	const SchedRec *list = sched_list ( s, &n );
+
+	for ( i = 0; i < n; i++ ) if ( list[i].id == id ) return &list[i];
+
+	return NULL;
+}
+
+static void fake_tick ( Sched *s, Fake *f, int64_t now )
+{
+	f->now = now;
+	sched_tick ( s );
+}
+
+static void test_padding ( void )
+{
+	Fake f;
+	Sched *s = fake_sched ( &f, 1 );
+
+	uint32_t id = fake_add ( s, 100, 2000, 3000 );
+
+	g_assert_cmpuint ( id, !=, 0 );
+	g_assert_cmpint ( sched_next ( s ), ==, 2000 - SCHED_PRE );
+
+	fake_tick ( s, &f, 2000 - SCHED_PRE - 1 );
+	g_assert_cmpuint ( f.starts, ==, 0 );
+
+	fake_tick ( s, &f, 2000 - SCHED_PRE );
+	g_assert_cmpuint ( f.starts, ==, 1 );
+	g_assert_cmpuint ( fake_rec ( s, id )->state, ==, SCHED_RUN );
+	g_assert_cmpint ( sched_next ( s ), ==, 3000 + SCHED_POST );
+
+	fake_tick ( s, &f, 3000 + SCHED_POST - 1 );
+	g_assert_cmpuint ( f.stops, ==, 0 );
+
+	fake_tick ( s, &f, 3000 + SCHED_POST );
+	g_assert_cmpuint ( f.stops, ==, 1 );
+	g_assert_cmpuint ( fake_rec ( s, id )->state, ==, SCHED_DONE );
+
+	// finished entries are listed for SCHED_KEEP
+	fake_tick ( s, &f, 3000 + SCHED_POST + SCHED_KEEP + 1 );
+	g_assert_null ( fake_rec ( s, id ) );
+
+	sched_free ( s );
+}
+
+static void test_epg_follow ( void )
+{
+	Fake f;
+	Sched *s = fake_sched ( &f, 1 );
+
+	EpgStore *store = epg_store_open ( NULL );
+	sched_set_epg ( s, store );
+
+	EpgService svc = { 1, 2, 3 };
+	EpgEvent ev = { 2000, 600, 0, 0, 7, 0, 0x4e };
+
+	epg_store_add ( store, &svc, &ev, "Event", "" );
+
+	SchedRec rec;
+	memset ( &rec, 0, sizeof ( SchedRec ) );
+
+	rec.channel = "Channel";
+	rec.file = "dvb_channel.conf";
+	rec.out = "out.ts";
+	rec.tp.freq = 100;
+	rec.start = 2000;
+	rec.stop = 2600;
+	rec.pre = SCHED_PRE;
+	rec.post = SCHED_POST;
+	rec.svc = svc;
+	rec.event_id = 7;
+
+	uint32_t id = sched_add ( s, &rec );
+
+	// the broadcaster moves the event by 10 min and makes it longer
+	ev.start = 2600;
+	ev.duration = 900;
+	epg_store_add ( store, &svc, &ev, "Event", "" );
+
+	fake_tick ( s, &f, 2000 - SCHED_PRE );
+	g_assert_cmpuint ( f.starts, ==, 0 );
+	g_assert_cmpint ( fake_rec ( s, id )->start, ==, 2600 );
+	g_assert_cmpint ( fake_rec ( s, id )->stop, ==, 3500 );
+
+	fake_tick ( s, &f, 2600 - SCHED_PRE );
+	g_assert_cmpuint ( f.starts, ==, 1 );
+
+	// a running event only changes its end
+	ev.duration = 1200;
+	epg_store_add ( store, &svc, &ev, "Event", "" );
+
+	fake_tick ( s, &f, 3500 + SCHED_POST );
+	g_assert_cmpuint ( f.stops, ==, 0 );
+	g_assert_cmpint ( fake_rec ( s, id )->stop, ==, 3800 );
+
+	fake_tick ( s, &f, 3800 + SCHED_POST );
+	g_assert_cmpuint ( f.stops, ==, 1 );
+
+	sched_free ( s );
+	epg_store_free ( store );
+}
+
+static void test_conflicts ( void )
+{
+	Fake f;
+	Sched *s = fake_sched ( &f, 1 );
+
+	uint32_t a = fake_add ( s, 100, 2000, 3000 );
+	uint32_t b = fake_add ( s, 100, 2500, 3500 ); // same transponder: shares the tuner
+	g_assert_cmpuint ( sched_conflicts ( s ), ==, 0 );
+	g_assert_cmpint ( fake_rec ( s, b )->tuner, ==, 0 );
+
+	uint32_t c = fake_add ( s, 200, 2800, 3200 ); // another one over the same time
+	g_assert_cmpuint ( sched_conflicts ( s ), ==, 1 );
+	g_assert_cmpint ( fake_rec ( s, c )->tuner, ==, -1 );
+	g_assert_cmpuint ( f.plans, >, 0 );
+
+	fake_tick ( s, &f, 2800 - SCHED_PRE );
+	g_assert_cmpuint ( fake_rec ( s, a )->state, ==, SCHED_RUN );
+	g_assert_cmpuint ( fake_rec ( s, b )->state, ==, SCHED_RUN );
+	g_assert_cmpuint ( fake_rec ( s, c )->state, ==, SCHED_FAIL );
+
+	// a missed start stays failed when its rival goes
+	g_assert_true ( sched_remove ( s, a ) );
+	g_assert_cmpuint ( f.stops, ==, 1 );
+	g_assert_cmpuint ( fake_rec ( s, c )->state, ==, SCHED_FAIL );
+
+	sched_free ( s );
+	g_assert_cmpuint ( f.stops, ==, 2 ); // b was still running
+}
+
+static void test_busy ( void )
+{
+	Fake f;
+	Sched *s = fake_sched ( &f, 2 );
+
+	sched_set_busy ( s, 0, TRUE ); // zap or scan on adapter0
+
+	uint32_t a = fake_add ( s, 100, 2000, 3000 );
+	g_assert_cmpint ( fake_rec ( s, a )->tuner, ==, 1 );
+
+	sched_set_busy ( s, 1, TRUE );
+	g_assert_cmpint ( fake_rec ( s, a )->tuner, ==, -1 );
+	g_assert_cmpuint ( sched_conflicts ( s ), ==, 1 );
+
+	sched_set_busy ( s, 0, FALSE );
+	g_assert_cmpint ( fake_rec ( s, a )->tuner, ==, 0 );
+	g_assert_cmpuint ( sched_conflicts ( s ), ==, 0 );
+
+	fake_tick ( s, &f, 2000 - SCHED_PRE );
+	g_assert_cmpuint ( f.starts, ==, 1 );
+	g_assert_cmpuint ( f.adapter, ==, 0 );
+
+	// a failed start is not retried
+	f.fail = TRUE;
+	uint32_t b = fake_add ( s, 100, 5000, 6000 );
+	fake_tick ( s, &f, 5000 - SCHED_PRE );
+	g_assert_cmpuint ( fake_rec ( s, b )->state, ==, SCHED_FAIL );
+
+	sched_free ( s );
+}
+
+int main ( int argc, char *argv[] )
+{
+	g_test_init ( &argc, &argv, NULL );
+
+	// conflicts and missed starts are g_warning: expected here
+	g_log_set_always_fatal ( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+
+	g_test_add_func ( "/sched/padding",    test_padding    );
+	g_test_add_func ( "/sched/epg-follow", test_epg_follow );
+	g_test_add_func ( "/sched/conflicts",  test_conflicts  );
+	g_test_add_func ( "/sched/busy",       test_busy       );
+
+	return g_test_run ();
+}